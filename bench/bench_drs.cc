@@ -0,0 +1,120 @@
+/**
+ * @file bench_drs.cc
+ * @brief Benchmarks of the DRS4 readout against the mock DRS board (see
+ * mock/DRS.h): the per-event waveform accessors, the batched collection, and
+ * the background acquisition loop.
+ */
+#include "drs.hpp"
+
+#include <benchmark/benchmark.h>
+
+static DRSContainer&
+MockDRS()
+{
+  static const bool init = ( DRSContainer::instance().Init(), true );
+  (void)init;
+  return DRSContainer::instance();
+}
+
+
+static void
+BM_DRSWaveformSum( benchmark::State& state )
+{
+  DRSContainer& drs = MockDRS();
+  drs.SetTimeWeighted( state.range( 0 ) );
+  for( auto _ : state ){
+    drs.StartCollect();
+    benchmark::DoNotOptimize( drs.WaveformSum( 0, 200, 600, 0, 150 ) );
+  }
+  drs.SetTimeWeighted( false );
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_DRSWaveformSum )->ArgName( "timeweighted" )->Arg( 0 )->Arg( 1 );
+
+
+static void
+BM_DRSWaveformStr( benchmark::State& state )
+{
+  DRSContainer& drs = MockDRS();
+  for( auto _ : state ){
+    drs.StartCollect();
+    benchmark::DoNotOptimize( drs.WaveformStr( 0 ) );
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_DRSWaveformStr );
+
+
+static void
+BM_DRSCollectSums( benchmark::State& state )
+{
+  DRSContainer&  drs = MockDRS();
+  const unsigned n   = state.range( 0 );
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( drs.CollectSums( n, 0, 200, 600, 0, 150 ) );
+  }
+  state.SetItemsProcessed( state.iterations() * n );
+}
+BENCHMARK( BM_DRSCollectSums )->Arg( 100 )->Arg( 1000 );
+
+
+/**
+ * Sums drained from the background acquisition loop in batches of 256 events,
+ * with the mock board triggering as fast as the loop can re-arm it, such that
+ * this measures the throughput of the acquisition loop and of the ring buffer
+ * drain.
+ */
+static void
+BM_DRSPopSums( benchmark::State& state )
+{
+  DRSContainer& drs = MockDRS();
+  drs.StartAcquisition( 1024 );
+  size_t events = 0;
+  for( auto _ : state ){
+    while( drs.BufferedEvents() < 256 ){
+      std::this_thread::yield();
+    }
+    events += drs.PopSums( 0, 200, 600, 0, 150 ).size();
+  }
+  drs.StopAcquisition();
+  state.SetItemsProcessed( events );
+  state.counters["dropped"] = drs.DroppedEvents();
+}
+BENCHMARK( BM_DRSPopSums )->UseRealTime();
+
+
+/**
+ * Merged events of all channels of several mock boards drained from the
+ * per-board acquisition threads in batches of 256 events, measuring the cost
+ * of the lock step acquisition cycle and of the event merging. With masked
+ * set, all channels of the last board are disabled, such that the board stores
+ * no events and must be skipped when the buffered events are counted.
+ */
+static void
+BM_DRSPopEvents( benchmark::State& state )
+{
+  DRSContainer&  drs    = MockDRS();
+  const unsigned nboard = state.range( 0 );
+  DRS::nboards() = nboard;
+  drs.Init();
+  if( state.range( 1 ) ){
+    drs.SetChannelMask( drs.ChannelMask() & ~( 0xfu << ( 4 * ( nboard-1 ) ) ) );
+  }
+  drs.StartAcquisition( 1024 );
+  size_t events = 0;
+  for( auto _ : state ){
+    while( drs.BufferedEvents() < 256 ){
+      std::this_thread::yield();
+    }
+    events += drs.PopEvents().nevents;
+  }
+  drs.StopAcquisition();
+  state.SetItemsProcessed( events );
+  state.counters["dropped"]   = drs.DroppedEvents();
+  state.counters["unmatched"] = drs.UnmatchedEvents();
+  DRS::nboards() = 1;
+  drs.Init();
+}
+BENCHMARK( BM_DRSPopEvents )->ArgNames( {"boards", "masked"} )
+->Args( {1, 0} )->Args( {2, 0} )->Args( {4, 0} )->Args( {2, 1} )
+->UseRealTime();
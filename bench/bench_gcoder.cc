@@ -0,0 +1,108 @@
+/**
+ * @file bench_gcoder.cc
+ * @brief Benchmarks of the gcode command round trip against a fake printer on
+ * a pseudo-terminal (see mock/fakeprinter.hpp): single blocking commands,
+ * pipelined command submissions through the IO thread, and pipelined scans.
+ */
+#include "fakeprinter.hpp"
+#include "gcoder.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+static GCoder&
+MockGCoder()
+{
+  static std::unique_ptr<FakePrinter> printer;
+  if( printer == nullptr ){
+    printer.reset( new FakePrinter() );
+    GCoder::instance().Init( printer->Path() );
+  }
+  return GCoder::instance();
+}
+
+
+static void
+BM_RunGcodeRoundTrip( benchmark::State& state )
+{
+  GCoder& gcoder = MockGCoder();
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( gcoder.RunGcode( "M114\n" ) );
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_RunGcodeRoundTrip )->UseRealTime();
+
+
+/**
+ * Submitting a batch of motion commands and waiting for all acknowledgements,
+ * with the number of commands in flight limited by SetMaxInFlight.
+ */
+static void
+BM_SubmitGcodePipelined( benchmark::State& state )
+{
+  static constexpr unsigned n = 100;
+  GCoder&                   gcoder = MockGCoder();
+  gcoder.SetMaxInFlight( state.range( 0 ) );
+  for( auto _ : state ){
+    for( unsigned i = 0; i < n; ++i ){
+      gcoder.SubmitGcode( "G0 X" + std::to_string( i % 10 ) + "\n" );
+    }
+    gcoder.WaitQueue();
+  }
+  gcoder.SetMaxInFlight( 4 );
+  state.SetItemsProcessed( state.iterations() * n );
+}
+BENCHMARK( BM_SubmitGcodePipelined )->ArgName( "inflight" )->Arg( 1 )->Arg( 4 )
+->UseRealTime();
+
+
+/**
+ * Scan over 20 points (at the same position, so the predicted motion time does
+ * not dominate) with a synthetic readout (2 ms acquisition and 1 ms
+ * reduction per point) and a 2 ms writer, with the number of points in flight
+ * set by the pipeline depth. A depth of 1 runs all stages in sequence, deeper
+ * pipelines overlap the reduction and writing with the next motion.
+ */
+static void
+BM_RunScanPipelined( benchmark::State& state )
+{
+  static constexpr unsigned n = 20;
+  GCoder&                   gcoder = MockGCoder();
+  std::vector<float>        x, y, z;
+  for( unsigned i = 0; i < n; ++i ){
+    x.push_back( 10 );
+    y.push_back( 10 );
+    z.push_back( 5 );
+  }
+  const std::vector<float> path = GCoder::PrepareScan( x, y, z );
+
+  ScanReadout readout;
+  readout.nvalues = 2;
+  readout.SetStages( []( std::vector<double>& raw ){
+    std::this_thread::sleep_for( std::chrono::milliseconds( 2 ) );
+    raw.assign( 100, 1.0 );
+  }, []( const std::vector<double>& raw, double* out ){
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    ScanReadout::Summarize( raw, true, out );
+  } );
+  const GCoder::ScanWriter write = []( const size_t, const double* ){
+                                     std::this_thread::sleep_for(
+                                       std::chrono::milliseconds( 2 ) );
+                                   };
+
+  gcoder.RunScan( path, readout, 0, nullptr, false );// Moving to the position
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( gcoder.RunScan( path, readout, 0, nullptr, false,
+                                              write, state.range( 0 ) ) );
+  }
+  state.SetItemsProcessed( state.iterations() * n );
+  for( const auto& t : gcoder.ScanTiming() ){
+    state.counters[t.name+"_ms"] = 1e3 * t.run.Mean();
+  }
+}
+BENCHMARK( BM_RunScanPipelined )->ArgName( "depth" )->Arg( 1 )->Arg( 2 )
+->Arg( 4 )->UseRealTime()->Unit( benchmark::kMillisecond );
@@ -0,0 +1,108 @@
+/**
+ * @file bench_gpio.cc
+ * @brief Benchmarks of the GPIO trigger pulse timing and of the ADC readout
+ * containers, with the GPIO registers substituted by a memory mapped file.
+ */
+#include "gpio.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * File based GPIO: the trigger pin writes go to a memory mapped temporary file
+ * of the size of the GPIO register block instead of /dev/gpiomem, and the line
+ * request handle is the file itself, such that all pulse generation code
+ * paths run without the GPIO character device.
+ */
+template<>
+struct DeviceMock<GPIO>
+{
+  static void
+  Attach( GPIO& gpio )
+  {
+    char      path[] = "/tmp/gpiomemXXXXXX";
+    const int fd     = mkstemp( path );
+    if( fd < 0 || ftruncate( fd, 4096 ) != 0 ){
+      throw std::runtime_error( "Failed to create mock GPIO register file" );
+    }
+    unlink( path );
+    void* reg = mmap( nullptr, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( reg == MAP_FAILED ){
+      throw std::runtime_error( "Failed to map mock GPIO register file" );
+    }
+    gpio.gpio_lines = fd;
+    gpio.gpio_reg   = static_cast<volatile uint32_t*>( reg );
+  }
+};
+
+
+static GPIO&
+MockGPIO()
+{
+  static const bool init = ( DeviceMock<GPIO>::Attach( GPIO::instance() ), true );
+  (void)init;
+  return GPIO::instance();
+}
+
+
+/**
+ * Timing of a two pulse sequence (one full period plus the pulse width) for
+ * a given wait time in microseconds. The jitter is the RMS deviation of the
+ * sequence duration from its mean, the lag is the mean excess over the
+ * nominal duration.
+ */
+static void
+BM_PulseJitter( benchmark::State& state )
+{
+  GPIO&               gpio    = MockGPIO();
+  const unsigned      wait    = state.range( 0 );
+  const double        nominal = ( 1+wait )+1;
+  std::vector<double> times;
+  times.reserve( 1 << 16 );
+  for( auto _ : state ){
+    const auto start = std::chrono::steady_clock::now();
+    gpio.Pulse( 2, wait );
+    const auto stop = std::chrono::steady_clock::now();
+    const double us = std::chrono::duration<double, std::micro>( stop-start ).count();
+    state.SetIterationTime( us * 1e-6 );
+    if( times.size() < times.capacity() ){
+      times.push_back( us );
+    }
+  }
+
+  double mean = 0, var = 0, maxdev = 0;
+  for( const double t : times ){ mean += t; }
+  mean /= std::max( (size_t)1, times.size() );
+  for( const double t : times ){
+    var   += ( t-mean ) * ( t-mean );
+    maxdev = std::max( maxdev, std::fabs( t-mean ) );
+  }
+  var /= std::max( (size_t)1, times.size() );
+  state.counters["lag_us"]    = mean-nominal;
+  state.counters["jitter_us"] = std::sqrt( var );
+  state.counters["maxdev_us"] = maxdev;
+}
+BENCHMARK( BM_PulseJitter )->ArgName( "wait" )->Arg( 10 )->Arg( 100 )->Arg( 1000 )
+->UseManualTime();
+
+
+static void
+BM_ADCSnapshot( benchmark::State& state )
+{
+  GPIO& gpio = MockGPIO();
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( gpio.ReadADCSnapshot() );
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_ADCSnapshot );
+
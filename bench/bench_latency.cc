@@ -0,0 +1,36 @@
+/**
+ * @file bench_latency.cc
+ * @brief Benchmarks of the latency instrumentation overhead: a scoped timer
+ * with recording enabled and disabled at run time, and the bare histogram
+ * record.
+ */
+#include "latency.hpp"
+
+#include <benchmark/benchmark.h>
+
+static void
+BM_LatencyScope( benchmark::State& state )
+{
+  LatencySetEnabled( state.range( 0 ) );
+  for( auto _ : state ){
+    LATENCY_SCOPE( "bench.scope" );
+    benchmark::ClobberMemory();
+  }
+  LatencySetEnabled( true );
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_LatencyScope )->ArgName( "enabled" )->Arg( 0 )->Arg( 1 );
+
+
+static void
+BM_LatencyRecord( benchmark::State& state )
+{
+  const unsigned id = LatencyId( "bench.record" );
+  uint64_t       ns = 0;
+  for( auto _ : state ){
+    LatencyRecord( id, ns );
+    ns = ( ns+997 ) & 0xfffff;
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_LatencyRecord );
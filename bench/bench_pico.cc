@@ -0,0 +1,124 @@
+/**
+ * @file bench_pico.cc
+ * @brief Benchmarks of the picoscope rapid block readout against the mock
+ * ps5000 driver (see mock/ps5000_mock.cc): the block flush and the per-capture
+ * and whole-block reductions.
+ */
+#include "pico.hpp"
+
+#include <benchmark/benchmark.h>
+
+static PicoUnit&
+MockPico( const unsigned ncaps )
+{
+  static const bool init = ( PicoUnit::instance().Init(), true );
+  (void)init;
+  PicoUnit& pico = PicoUnit::instance();
+  pico.SetBlockNums( ncaps, 200, 50 );
+  return pico;
+}
+
+
+static void
+BM_PicoRapidBlockFlush( benchmark::State& state )
+{
+  PicoUnit& pico = MockPico( state.range( 0 ) );
+  for( auto _ : state ){
+    pico.StartRapidBlock();
+    pico.WaitTillReady();
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed( state.iterations() * state.range( 0 ) );
+  state.SetBytesProcessed( state.iterations() * state.range( 0 ) * 2
+                           * ( pico.presamples+pico.postsamples )
+                           * sizeof( int16_t ) );
+}
+BENCHMARK( BM_PicoRapidBlockFlush )->ArgName( "ncaps" )->Arg( 1000 )->Arg( 5000 );
+
+
+static void
+BM_PicoWaveformSum( benchmark::State& state )
+{
+  PicoUnit& pico = MockPico( 1000 );
+  pico.StartRapidBlock();
+  pico.WaitTillReady();
+  unsigned cap = 0;
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( pico.WaveformSum( 0, cap, 50, 150, 0, 40 ) );
+    cap = ( cap+1 ) % pico.ncaptures;
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_PicoWaveformSum );
+
+
+static void
+BM_PicoWaveformString( benchmark::State& state )
+{
+  PicoUnit& pico = MockPico( 1000 );
+  pico.StartRapidBlock();
+  pico.WaitTillReady();
+  unsigned cap = 0;
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( pico.WaveformString( 0, cap ) );
+    cap = ( cap+1 ) % pico.ncaptures;
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_PicoWaveformString );
+
+
+static void
+BM_PicoBlockSums( benchmark::State& state )
+{
+  PicoUnit& pico = MockPico( 5000 );
+  pico.StartRapidBlock();
+  pico.WaitTillReady();
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( pico.BlockSums( 0, 50, 150, 0, 40,
+                                              state.range( 0 ) ) );
+  }
+  state.SetItemsProcessed( state.iterations() * pico.ncaptures );
+}
+BENCHMARK( BM_PicoBlockSums )->ArgName( "nthreads" )->Arg( 1 )->Arg( 4 )
+->UseRealTime();
+
+
+static void
+BM_PicoBlockHistogram( benchmark::State& state )
+{
+  PicoUnit& pico = MockPico( 5000 );
+  pico.StartRapidBlock();
+  pico.WaitTillReady();
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( pico.BlockHistogram( 0, 50, 150, 0, 40,
+                                                   -1000, 10000, 256,
+                                                   state.range( 0 ) ) );
+  }
+  state.SetItemsProcessed( state.iterations() * pico.ncaptures );
+}
+BENCHMARK( BM_PicoBlockHistogram )->ArgName( "nthreads" )->Arg( 1 )->Arg( 4 )
+->UseRealTime();
+
+
+/**
+ * Blocks drained from the pipelined acquisition loop, with the mock driver
+ * triggering as soon as a block is armed.
+ */
+static void
+BM_PicoPopBlockSums( benchmark::State& state )
+{
+  PicoUnit& pico = MockPico( 1000 );
+  pico.StartAcquisition( 4 );
+  size_t captures = 0;
+  for( auto _ : state ){
+    while( pico.BufferedBlocks() == 0 ){
+      std::this_thread::yield();
+    }
+    captures += pico.PopBlockSums( 0, 50, 150, 0, 40, 1 ).size();
+  }
+  pico.StopAcquisition();
+  state.SetItemsProcessed( captures );
+  state.counters["dropped"] = pico.DroppedBlocks();
+}
+BENCHMARK( BM_PicoPopBlockSums )->UseRealTime();
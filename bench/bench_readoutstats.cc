@@ -0,0 +1,57 @@
+/**
+ * @file bench_readoutstats.cc
+ * @brief Benchmarks of the streaming readout accumulators: filling blocks of
+ * waveform sums with and without the fixed photoelectron binning, and merging
+ * the per-block accumulators.
+ */
+#include "readoutstats.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+/** @brief Low light like spectrum of 1000 sums, with a 100 unit gain. */
+static std::vector<float>
+MockSums()
+{
+  std::mt19937                     rng( 42 );
+  std::poisson_distribution<int>   npe( 1.5 );
+  std::normal_distribution<double> noise( 0, 10 );
+  std::vector<float>               ans( 1000 );
+  for( auto& x : ans ){
+    x = 100 * npe( rng )+noise( rng );
+  }
+  return ans;
+}
+
+
+static void
+BM_ReadoutStatsFill( benchmark::State& state )
+{
+  const std::vector<float> sums = MockSums();
+  ReadoutStats             stats;
+  if( state.range( 0 ) ){
+    stats.SetBinning( Histogram::Photoelectron( 0, 100, 20, 5 ) );
+  }
+  for( auto _ : state ){
+    stats.Fill( sums.data(), sums.size() );
+  }
+  benchmark::DoNotOptimize( stats.Stats().Mean() );
+  state.SetItemsProcessed( state.iterations() * sums.size() );
+}
+BENCHMARK( BM_ReadoutStatsFill )->ArgName( "pebinning" )->Arg( 0 )->Arg( 1 );
+
+
+static void
+BM_ReadoutStatsMerge( benchmark::State& state )
+{
+  const std::vector<float> sums = MockSums();
+  ReadoutStats             block, total;
+  block.Fill( sums.data(), sums.size() );
+  for( auto _ : state ){
+    total.Merge( block );
+  }
+  benchmark::DoNotOptimize( total.Stats().Count() );
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_ReadoutStatsMerge );
@@ -0,0 +1,87 @@
+/**
+ * @file bench_visual.cc
+ * @brief Benchmarks of the visual processing per frame on synthetic camera
+ * frames: the full detector finding with and without tracking, and the display
+ * rendering and encoding used by the GUI.
+ */
+#include "visual.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <opencv2/imgcodecs.hpp>
+
+/**
+ * Synthetic 1280x1024 camera frame mimicking the visual calibration mockup
+ * board (see cfg/viscalib_mock.json): a grid of dark square photosensors on a
+ * bright, noisy board, with slightly blurred edges.
+ */
+static const cv::Mat&
+MockFrame()
+{
+  static cv::Mat frame;
+  if( frame.empty() ){
+    frame = cv::Mat( 1024, 1280, CV_8UC3, cv::Scalar( 190, 200, 200 ) );
+    cv::Mat noise( frame.size(), CV_8UC3 );
+    cv::randn( noise, cv::Scalar::all( 0 ), cv::Scalar::all( 8 ) );
+    frame += noise;
+    for( int i = 0; i < 4; ++i ){
+      for( int j = 0; j < 6; ++j ){
+        cv::rectangle( frame, cv::Rect( 100+j * 190, 80+i * 240, 120, 120 ),
+                       cv::Scalar( 20, 20, 25 ), cv::FILLED );
+      }
+    }
+    cv::GaussianBlur( frame, frame, cv::Size( 5, 5 ), 0 );
+  }
+  return frame;
+}
+
+
+static void
+BM_FindDetector( benchmark::State& state )
+{
+  Visual                           vis;
+  const cv::Mat&                   frame = MockFrame();
+  cv::Rect                         tracked;
+  std::vector<Visual::ContourList> contours;
+  std::vector<cv::Rect>            rois;
+  double                           found = 0;
+  vis.tracking = state.range( 0 );
+  for( auto _ : state ){
+    const auto res = vis.FindDetector( frame, tracked, contours, rois );
+    found += res.area > 0;
+  }
+  state.SetItemsProcessed( state.iterations() );
+  state.counters["found"] = found / state.iterations();
+}
+BENCHMARK( BM_FindDetector )->ArgName( "tracking" )->Arg( 0 )->Arg( 1 );
+
+
+static void
+BM_RenderDisplay( benchmark::State& state )
+{
+  Visual                           vis;
+  const cv::Mat&                   frame = MockFrame();
+  cv::Rect                         tracked;
+  std::vector<Visual::ContourList> contours;
+  std::vector<cv::Rect>            rois;
+  const auto res = vis.FindDetector( frame, tracked, contours, rois );
+  for( auto _ : state ){
+    benchmark::DoNotOptimize( vis.MakeDisplay( frame, contours, res ) );
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_RenderDisplay );
+
+
+static void
+BM_EncodeJpeg( benchmark::State& state )
+{
+  const cv::Mat&     frame = MockFrame();
+  std::vector<uchar> buf;
+  for( auto _ : state ){
+    cv::imencode( ".jpg", frame, buf );
+    benchmark::DoNotOptimize( buf.data() );
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_EncodeJpeg );
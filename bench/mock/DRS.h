@@ -0,0 +1,132 @@
+#ifndef MOCK_DRS_H
+#define MOCK_DRS_H
+
+/**
+ * @brief Mock of the DRS4 evaluation board library, implementing only the
+ * subset of the DRS/DRSBoard interface used by DRSContainer.
+ *
+ * The mock board is always triggered as soon as the domino wave is started,
+ * and returns synthetic waveforms of a negative pulse on top of a noisy
+ * pedestal, matching the layout of the real board readout: 1024 samples per
+ * channel, with the DRS channel index being twice the input channel index.
+ * The waveforms are copied from a set of precomputed templates with different
+ * pulse amplitudes, such that the transfer cost does not include the waveform
+ * generation, and the reductions cannot be optimized away. The number of
+ * mock boards attached is set by DRS::nboards() before the DRS instance is
+ * created.
+ */
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+class DRSCallback
+{
+public:
+  virtual void Progress( int ) = 0;
+  virtual ~DRSCallback(){}
+};
+
+class DRSBoard
+{
+public:
+  DRSBoard() : frequency( 2.0 ), triggercell( 0 ), event( 0 )
+  {
+    uint32_t seed = 1;
+    for( unsigned k = 0; k < ntemplates; ++k ){
+      const double amp = 50.0+5.0 * k;
+      for( unsigned i = 0; i < 1024; ++i ){
+        const double t = ( (double)i-200.0 ) / 10.0;
+        seed = seed * 1103515245+12345;
+        const double noise = ( (int)( seed >> 16 & 0x7fff ) / 32768.0-0.5 ) * 2;
+        templates[k][i] = noise-( t > 0 ? amp * t * std::exp( 1-t ) : 0.0 );
+      }
+    }
+  }
+
+  int Init(){ return 0; }
+  int GetDRSType(){ return 4; }
+  int GetBoardSerialNumber(){ return 0; }
+  int GetFirmwareVersion(){ return 0; }
+  int GetChannelDepth(){ return 1024; }
+
+  int SetFrequency( double f, bool ){ frequency = f; return 1; }
+  int ReadFrequency( unsigned char, double* f ){ *f = frequency; return 1; }
+  int SetInputRange( double ){ return 1; }
+  int SetRefclk( bool ){ return 1; }
+  int CalibrateTiming( DRSCallback* ){ return 1; }
+  int CalibrateVolt( DRSCallback* ){ return 1; }
+  int EnableTrigger( int, int ){ return 1; }
+  int SetTriggerSource( int ){ return 1; }
+  int SetTriggerLevel( double ){ return 1; }
+  int SetTriggerPolarity( bool ){ return 1; }
+  int SetTriggerDelayNs( int ){ return 1; }
+
+  // Every armed event is triggered immediately.
+  int StartDomino(){ ++event; triggercell = ( event * 379 ) % 1024; return 1; }
+  int SoftTrigger(){ return 1; }
+  int IsBusy(){ return 0; }
+  int TransferWaves( int, int ){ return 1; }
+  int GetTriggerCell( unsigned int ){ return triggercell; }
+
+  int
+  GetWave( unsigned int, unsigned char channel, float* waveform,
+           bool = true, int = -1, int = -1, bool = false, float = 0,
+           bool = true )
+  {
+    const auto& wave = templates[( event * 31+channel ) % ntemplates];
+    memcpy( waveform, wave, sizeof( wave ) );
+    return 0;
+  }
+
+  int
+  GetTime( unsigned int, int, int tc, float* time, bool = true,
+           bool = true )
+  {
+    for( unsigned i = 0; i < 1024; ++i ){
+      const unsigned cell = ( i+tc ) % 1024;
+      time[i] = i / frequency+0.01 * std::sin( cell );
+    }
+    return 1;
+  }
+
+private:
+  static constexpr unsigned ntemplates = 64;
+  double                    frequency;
+  int                       triggercell;
+  uint64_t                  event;
+  float                     templates[ntemplates][1024];
+};
+
+class DRS
+{
+public:
+  static int&
+  nboards()
+  {
+    static int n = 1;
+    return n;
+  }
+
+  DRS()
+  {
+    for( int i = 0; i < nboards(); ++i ){
+      boards.emplace_back( new DRSBoard() );
+    }
+  }
+
+  int       GetNumberOfBoards(){ return boards.size(); }
+  DRSBoard* GetBoard( int i ){ return boards[i].get(); }
+  bool
+  GetError( char* str, int size )
+  {
+    if( size > 0 ){ str[0] = '\0'; }
+    return false;
+  }
+
+private:
+  std::vector<std::unique_ptr<DRSBoard> > boards;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef FAKEPRINTER_HPP
+#define FAKEPRINTER_HPP
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * @brief Fake 3D printer on a pseudo-terminal, used in place of the USB serial
+ * device of the gantry.
+ *
+ * The slave side of the pseudo-terminal (see Path) is passed to GCoder::Init.
+ * The printer thread keeps track of the coordinates of the G0/G1/G28 commands
+ * (motion is instantaneous), reports the coordinates for M114 in the Marlin
+ * format, and acknowledges every command line with "ok". The optional latency
+ * (in microseconds) is added before each acknowledgement to emulate the
+ * firmware's command processing time.
+ */
+class FakePrinter
+{
+public:
+  explicit FakePrinter( const unsigned latency = 0 ) :
+    master( posix_openpt( O_RDWR | O_NOCTTY ) ),
+    latency( latency ),
+    run( true ),
+    x( 0 ), y( 0 ), z( 0 )
+  {
+    if( master < 0 || grantpt( master ) || unlockpt( master ) ){
+      throw std::runtime_error( "Failed to open pseudo-terminal" );
+    }
+    path   = ptsname( master );
+    thread = std::thread( [this]{ Loop(); } );
+  }
+
+  ~FakePrinter()
+  {
+    run = false;
+    thread.join();
+    close( master );
+  }
+
+  const std::string&
+  Path() const { return path; }
+
+private:
+  int               master;
+  unsigned          latency;
+  std::atomic<bool> run;
+  std::thread       thread;
+  std::string       path;
+  float             x, y, z;
+
+  void
+  Loop()
+  {
+    std::string line;
+    char        buf[1024];
+    pollfd      pfd = { master, POLLIN, 0 };
+    while( run ){
+      if( poll( &pfd, 1, 10 ) <= 0 || !( pfd.revents & POLLIN ) ){
+        continue;
+      }
+      const ssize_t n = read( master, buf, sizeof( buf ) );
+      for( ssize_t i = 0; i < n; ++i ){
+        if( buf[i] != '\n' ){
+          line += buf[i];
+          continue;
+        }
+        Reply( line );
+        line.clear();
+      }
+    }
+  }
+
+  void
+  Reply( const std::string& cmd )
+  {
+    char msg[256];
+    if( cmd.compare( 0, 2, "G0" ) == 0 || cmd.compare( 0, 2, "G1" ) == 0 ){
+      ParseAxis( cmd, 'X', x );
+      ParseAxis( cmd, 'Y', y );
+      ParseAxis( cmd, 'Z', z );
+      snprintf( msg, sizeof( msg ), "ok\n" );
+    } else if( cmd.compare( 0, 3, "G28" ) == 0 ){
+      x = y = z = 0;
+      snprintf( msg, sizeof( msg ), "ok\n" );
+    } else if( cmd.compare( 0, 4, "M114" ) == 0 ){
+      snprintf( msg, sizeof( msg ),
+                "X:%.2f Y:%.2f Z:%.2f E:0.00 Count X:%.2f Y:%.2f Z:%.2f\nok\n",
+                x, y, z, x, y, z );
+    } else {
+      snprintf( msg, sizeof( msg ), "ok\n" );
+    }
+    if( latency ){
+      usleep( latency );
+    }
+    const std::string reply( msg );
+    if( write( master, reply.c_str(), reply.size() ) < 0 ){
+      perror( "FakePrinter" );
+    }
+  }
+
+  static void
+  ParseAxis( const std::string& cmd, const char axis, float& val )
+  {
+    const size_t pos = cmd.find( axis );
+    if( pos != std::string::npos ){
+      val = atof( cmd.c_str()+pos+1 );
+    }
+  }
+};
+
+#endif
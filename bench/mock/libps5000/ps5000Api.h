@@ -0,0 +1,112 @@
+#ifndef MOCK_PS5000API_H
+#define MOCK_PS5000API_H
+
+/**
+ * @brief Mock of the picoscope ps5000 driver API, declaring only the subset of
+ * the API used by PicoUnit. The implementation is in ps5000_mock.cc.
+ */
+#include <cstdint>
+
+typedef uint32_t PICO_STATUS;
+typedef uint32_t PICO_INFO;
+
+#define PICO_OK               0x00000000UL
+#define PICO_INVALID_HANDLE   0x0000000CUL
+#define PICO_INVALID_TIMEBASE 0x0000000EUL
+#define PS5000_MAX_VALUE      32512
+
+typedef enum enPS5000Channel
+{
+  PS5000_CHANNEL_A,
+  PS5000_CHANNEL_B,
+  PS5000_CHANNEL_C,
+  PS5000_CHANNEL_D,
+  PS5000_EXTERNAL,
+  PS5000_MAX_CHANNELS = PS5000_EXTERNAL,
+  PS5000_TRIGGER_AUX,
+  PS5000_MAX_TRIGGER_SOURCES
+} PS5000_CHANNEL;
+
+typedef enum enPS5000Range
+{
+  PS5000_10MV,
+  PS5000_20MV,
+  PS5000_50MV,
+  PS5000_100MV,
+  PS5000_200MV,
+  PS5000_500MV,
+  PS5000_1V,
+  PS5000_2V,
+  PS5000_5V,
+  PS5000_10V,
+  PS5000_20V,
+  PS5000_50V,
+  PS5000_MAX_RANGES
+} PS5000_RANGE;
+
+typedef enum enThresholdDirection
+{
+  ABOVE,
+  BELOW,
+  RISING,
+  FALLING,
+  RISING_OR_FALLING
+} THRESHOLD_DIRECTION;
+
+typedef void (* ps5000BlockReady)( int16_t, PICO_STATUS, void* );
+
+extern "C" {
+PICO_STATUS ps5000OpenUnit( int16_t* handle );
+PICO_STATUS ps5000CloseUnit( int16_t handle );
+PICO_STATUS ps5000GetUnitInfo( int16_t   handle,
+                               int8_t*   string,
+                               int16_t   stringLength,
+                               int16_t*  requiredSize,
+                               PICO_INFO info );
+PICO_STATUS ps5000SetChannel( int16_t        handle,
+                              PS5000_CHANNEL channel,
+                              int16_t        enabled,
+                              int16_t        dc,
+                              PS5000_RANGE   range );
+PICO_STATUS ps5000SetSimpleTrigger( int16_t             handle,
+                                    int16_t             enable,
+                                    PS5000_CHANNEL      source,
+                                    int16_t             threshold,
+                                    THRESHOLD_DIRECTION direction,
+                                    uint32_t            delay,
+                                    int16_t             autoTrigger_ms );
+PICO_STATUS ps5000GetTimebase( int16_t  handle,
+                               uint32_t timebase,
+                               int32_t  noSamples,
+                               int32_t* timeIntervalNanoseconds,
+                               int16_t  oversample,
+                               int32_t* maxSamples,
+                               uint16_t segmentIndex );
+PICO_STATUS ps5000MemorySegments( int16_t  handle,
+                                  uint16_t nSegments,
+                                  int32_t* nMaxSamples );
+PICO_STATUS ps5000SetNoOfCaptures( int16_t handle, uint16_t nCaptures );
+PICO_STATUS ps5000RunBlock( int16_t          handle,
+                            int32_t          noOfPreTriggerSamples,
+                            int32_t          noOfPostTriggerSamples,
+                            uint32_t         timebase,
+                            int16_t          oversample,
+                            int32_t*         timeIndisposedMs,
+                            uint16_t         segmentIndex,
+                            ps5000BlockReady lpReady,
+                            void*            pParameter );
+PICO_STATUS ps5000IsReady( int16_t handle, int16_t* ready );
+PICO_STATUS ps5000SetDataBufferBulk( int16_t        handle,
+                                     PS5000_CHANNEL channel,
+                                     int16_t*       buffer,
+                                     int32_t        bufferLth,
+                                     uint16_t       waveform );
+PICO_STATUS ps5000GetValuesBulk( int16_t   handle,
+                                 uint32_t* noOfSamples,
+                                 uint16_t  fromSegmentIndex,
+                                 uint16_t  toSegmentIndex,
+                                 int16_t*  overflow );
+PICO_STATUS ps5000Stop( int16_t handle );
+}
+
+#endif
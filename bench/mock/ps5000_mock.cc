@@ -0,0 +1,214 @@
+/**
+ * @file ps5000_mock.cc
+ * @brief Mock implementation of the ps5000 driver API.
+ *
+ * A single mock device is available. Every rapid block is triggered as soon as
+ * it is armed, and the bulk transfer copies synthetic captures (a negative
+ * pulse on top of a noisy pedestal, in raw ADC units) into the buffers
+ * registered with ps5000SetDataBufferBulk, such that the flush cost includes a
+ * memory transfer comparable to the real driver. The captures are drawn from a
+ * small set of precomputed templates with different pulse amplitudes.
+ */
+#include <libps5000/ps5000Api.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+
+static constexpr int16_t  mock_handle    = 1;
+static constexpr unsigned mock_templates = 64;
+
+static bool    mock_open      = false;
+static int32_t mock_samples   = 0;
+static int64_t mock_block     = 0;
+static std::map<std::pair<int, unsigned>, std::pair<int16_t*, int32_t> >
+  mock_buffers;
+static std::vector<std::vector<int16_t> > mock_waveforms;
+
+
+static void
+mock_make_templates( const int32_t length )
+{
+  if( (int32_t)mock_waveforms.size() == (int32_t)mock_templates
+      && (int32_t)mock_waveforms[0].size() == length ){
+    return;
+  }
+  mock_waveforms.assign( mock_templates, std::vector<int16_t>( length ) );
+  uint32_t seed = 1;
+  for( unsigned k = 0; k < mock_templates; ++k ){
+    const double amp = 2000.0+150.0 * k;
+    for( int32_t i = 0; i < length; ++i ){
+      const double t = ( i-length / 4.0 ) / 4.0;
+      seed = seed * 1103515245+12345;
+      const double noise = ( (int)( seed >> 16 & 0x7fff ) / 32768.0-0.5 ) * 200;
+      mock_waveforms[k][i] = noise-( t > 0 ? amp * t * std::exp( 1-t ) : 0.0 );
+    }
+  }
+}
+
+
+static PICO_STATUS
+mock_check( const int16_t handle )
+{
+  return mock_open && handle == mock_handle ? PICO_OK : PICO_INVALID_HANDLE;
+}
+
+
+extern "C" {
+
+PICO_STATUS
+ps5000OpenUnit( int16_t* handle )
+{
+  mock_open = true;
+  *handle   = mock_handle;
+  return PICO_OK;
+}
+
+
+PICO_STATUS
+ps5000CloseUnit( int16_t handle )
+{
+  const PICO_STATUS status = mock_check( handle );
+  mock_open = false;
+  mock_buffers.clear();
+  return status;
+}
+
+
+PICO_STATUS
+ps5000GetUnitInfo( int16_t   handle,
+                   int8_t*   string,
+                   int16_t   stringLength,
+                   int16_t*  requiredSize,
+                   PICO_INFO info )
+{
+  static const char* const mock_info = "0";
+  const size_t             len       = strlen( mock_info )+1;
+  if( stringLength > 0 ){
+    strncpy( (char*)string, mock_info, stringLength );
+    string[stringLength-1] = '\0';
+  }
+  *requiredSize = len;
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000SetChannel( int16_t handle, PS5000_CHANNEL, int16_t, int16_t,
+                  PS5000_RANGE )
+{
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000SetSimpleTrigger( int16_t handle, int16_t, PS5000_CHANNEL, int16_t,
+                        THRESHOLD_DIRECTION, uint32_t, int16_t )
+{
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000GetTimebase( int16_t  handle,
+                   uint32_t timebase,
+                   int32_t,
+                   int32_t* timeIntervalNanoseconds,
+                   int16_t,
+                   int32_t* maxSamples,
+                   uint16_t )
+{
+  // Timebases 0 and 1 are not available with two channels enabled.
+  if( timebase < 2 ){ return PICO_INVALID_TIMEBASE; }
+  *timeIntervalNanoseconds = 1 << ( timebase-1 );
+  *maxSamples              = 1 << 20;
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000MemorySegments( int16_t handle, uint16_t nSegments, int32_t* nMaxSamples )
+{
+  *nMaxSamples = ( 1 << 27 ) / ( nSegments > 0 ? nSegments : 1 );
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000SetNoOfCaptures( int16_t handle, uint16_t )
+{
+  mock_buffers.clear();
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000RunBlock( int16_t handle,
+                int32_t noOfPreTriggerSamples,
+                int32_t noOfPostTriggerSamples,
+                uint32_t, int16_t, int32_t*, uint16_t, ps5000BlockReady,
+                void* )
+{
+  mock_samples = noOfPreTriggerSamples+noOfPostTriggerSamples;
+  ++mock_block;
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000IsReady( int16_t handle, int16_t* ready )
+{
+  *ready = 1;
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000SetDataBufferBulk( int16_t        handle,
+                         PS5000_CHANNEL channel,
+                         int16_t*       buffer,
+                         int32_t        bufferLth,
+                         uint16_t       waveform )
+{
+  mock_buffers[std::make_pair( (int)channel, (unsigned)waveform )]
+    = std::make_pair( buffer, bufferLth );
+  return mock_check( handle );
+}
+
+
+PICO_STATUS
+ps5000GetValuesBulk( int16_t   handle,
+                     uint32_t* noOfSamples,
+                     uint16_t  fromSegmentIndex,
+                     uint16_t  toSegmentIndex,
+                     int16_t*  overflow )
+{
+  if( mock_check( handle ) != PICO_OK ){ return PICO_INVALID_HANDLE; }
+  const int32_t length = std::min( (int32_t)*noOfSamples, mock_samples );
+  mock_make_templates( length );
+  for( const auto& buf : mock_buffers ){
+    const unsigned seg = buf.first.second;
+    if( seg < fromSegmentIndex || seg > toSegmentIndex ){ continue; }
+    const auto& wave = mock_waveforms[( mock_block * 31+seg * 7+buf.first.first )
+                                      % mock_templates];
+    memcpy( buf.second.first, wave.data(),
+            std::min( length, buf.second.second ) * sizeof( int16_t ) );
+  }
+  for( unsigned seg = fromSegmentIndex; seg <= toSegmentIndex; ++seg ){
+    overflow[seg-fromSegmentIndex] = 0;
+  }
+  *noOfSamples = length;
+  return PICO_OK;
+}
+
+
+PICO_STATUS
+ps5000Stop( int16_t handle )
+{
+  return mock_check( handle );
+}
+
+}
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Running all hardware-free benchmarks, storing the results as JSON files in
+# results/bench/<commit>/ such that the numbers of different commits can be
+# compared (for example with the compare.py tool shipped with google
+# benchmark). Additional arguments are passed to all benchmark binaries.
+
+cd "$(dirname "$0")/.."
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo "unknown")
+if ! git diff --quiet HEAD 2>/dev/null; then
+  COMMIT="${COMMIT}-dirty"
+fi
+OUTDIR="results/bench/${COMMIT}"
+mkdir -p "${OUTDIR}"
+
+STATUS=0
+for BENCH in bin/bench_*.exe; do
+  [ -x "${BENCH}" ] || continue
+  NAME=$(basename "${BENCH}" .exe)
+  echo "Running ${NAME}..."
+  "${BENCH}" --benchmark_out="${OUTDIR}/${NAME}.json" \
+             --benchmark_out_format=json "$@" || STATUS=1
+done
+
+echo "Results stored in ${OUTDIR}"
+exit ${STATUS}
@@ -10,8 +10,12 @@ of GUI display elements.
 
 On the C++ side, all `printf` or `std::cout` statements should be replaced by
 the various `printx` method provided in the logger.hpp file, with the
-appropriate logging levels. We will use the facilities provided in the
-`pybind11` to expose the python logging module to the C++ functions.
+appropriate logging levels. The C++ messages are passed through a lock-free
+queue to a single drain thread, which forwards them in batches to the python
+loggers `SiPMCalibCMD.<device>`, so the C++ logging calls never block and do
+not require the python GIL. Messages below the lowest effective level of the
+`SiPMCalibCMD` loggers are discarded on the C++ side, so setting the logger
+levels on the python side also cuts the cost of C++ debug logging.
 
 On the python side, various functions and classes will be provided for the
 processing and formatting of the logging strings, as well as some niceties for
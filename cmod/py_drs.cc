@@ -1,35 +1,277 @@
+#include "devicecall.hpp"
 #include "drs.hpp"
+#include "scancapsule.hpp"
+#include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <limits>
 
 PYBIND11_MODULE( drs, m )
 {
+  // Registering the readout accumulator type used by the *_stats methods
+  pybind11::module::import( "cmod.stats" );
+
   pybind11::class_<DRSContainer>( m, "DRS" )
 
   // Special singleton syntax, do *NOT* define the __init__ method
   SINGLETON_PYBIND(DRSContainer)
-  .def( "init",              &DRSContainer::Init )
-  .def( "timeslice",         &DRSContainer::GetTimeArray )
-  .def( "startcollect",      &DRSContainer::StartCollect )
-  .def( "forcestop",         &DRSContainer::ForceStop )
+
+  // Device calls release the GIL and lock the device (see devicecall.hpp)
+  .def( "init",              DeviceCall( &DRSContainer::Init ) )
+  .def( "timeslice",         DeviceCall( &DRSContainer::GetTimeArray ) )
+  .def( "startcollect",      DeviceCall( &DRSContainer::StartCollect ) )
+
+  // Not locking the device, as this is used to release a readout that is
+  // waiting for a trigger in another thread (the board access itself is
+  // protected by the DRS library mutex).
+  .def( "forcestop",         &DRSContainer::ForceStop,
+        pybind11::call_guard<pybind11::gil_scoped_release>() )
 
   // Trigger related stuff
-  .def( "set_trigger",       &DRSContainer::SetTrigger )
-  .def( "trigger_channel",   &DRSContainer::TriggerChannel )
-  .def( "trigger_direction", &DRSContainer::TriggerDirection )
-  .def( "trigger_level",     &DRSContainer::TriggerLevel )
-  .def( "trigger_delay",     &DRSContainer::TriggerDelay )
+  .def( "set_trigger",       DeviceCall( &DRSContainer::SetTrigger ) )
+  .def( "trigger_channel",   DeviceCall( &DRSContainer::TriggerChannel ) )
+  .def( "trigger_direction", DeviceCall( &DRSContainer::TriggerDirection ) )
+  .def( "trigger_level",     DeviceCall( &DRSContainer::TriggerLevel ) )
+  .def( "trigger_delay",     DeviceCall( &DRSContainer::TriggerDelay ) )
 
   // Collection related stuff
-  .def( "set_samples",       &DRSContainer::SetSamples )
-  .def( "samples",           &DRSContainer::GetSamples )
-  .def( "set_rate",          &DRSContainer::SetRate )
-  .def( "rate",              &DRSContainer::GetRate )
-
-  .def( "is_available",      &DRSContainer::IsAvailable )
-  .def( "is_ready",          &DRSContainer::IsReady )
-  .def( "waveformstr",       &DRSContainer::WaveformStr )
-  .def( "waveformsum",       &DRSContainer::WaveformSum )
-  .def( "dumpbuffer",        &DRSContainer::DumpBuffer )
-  .def( "run_calibrations",  &DRSContainer::RunCalib   )
+  .def( "set_samples",       DeviceCall( &DRSContainer::SetSamples ) )
+  .def( "samples",           DeviceCall( &DRSContainer::GetSamples ) )
+  .def( "set_rate",          DeviceCall( &DRSContainer::SetRate ) )
+  .def( "rate",              DeviceCall( &DRSContainer::GetRate ) )
+  .def( "set_channel_mask",  DeviceCall( &DRSContainer::SetChannelMask ) )
+  .def( "channel_mask",      DeviceCall( &DRSContainer::ChannelMask ) )
+  .def( "num_boards",        DeviceCall( &DRSContainer::NumBoards ) )
+  .def( "num_channels",      DeviceCall( &DRSContainer::NumChannels ) )
+  .def( "set_daisy_chain",   DeviceCall( &DRSContainer::SetDaisyChain ) )
+  .def( "daisy_chain",       DeviceCall( &DRSContainer::DaisyChain ) )
+  .def( "event_id",          DeviceCall( &DRSContainer::EventID ) )
+  .def( "cell_widths",       DeviceCall( &DRSContainer::GetCellWidths ) )
+  .def( "set_time_weighted", DeviceCall( &DRSContainer::SetTimeWeighted ) )
+  .def_property_readonly( "time_weighted", &DRSContainer::TimeWeighted )
+
+  .def( "is_available",      DeviceCall( &DRSContainer::IsAvailable ) )
+  .def( "is_ready",          DeviceCall( &DRSContainer::IsReady ) )
+  .def( "waveformstr",       DeviceCall( &DRSContainer::WaveformStr ) )
+  .def( "waveformsum",       DeviceCall( &DRSContainer::WaveformSum ) )
+  .def( "dumpbuffer",        DeviceCall( &DRSContainer::DumpBuffer ) )
+  .def( "open_wavefile",     DeviceCall( &DRSContainer::OpenWaveFile ) )
+  .def( "close_wavefile",    DeviceCall( &DRSContainer::CloseWaveFile ) )
+  .def( "write_waveform",    DeviceCall( &DRSContainer::WriteWaveform ) )
+  .def( "pop_to_wavefile",   DeviceCall( &DRSContainer::PopToWaveFile ),
+        pybind11::arg( "maxevents" ) = std::numeric_limits<unsigned>::max() )
+  .def( "run_calibrations",  DeviceCall( &DRSContainer::RunCalib ) )
+
+  // Readout routine for the C++ scan executor (see gcoder.run_scan): the mean
+  // and standard error of n waveform sums. The trigger must be a ScanTrigger
+  // capsule (see gpio.scan_trigger), or None for an external trigger.
+  .def( "scan_readout", []( DRSContainer&           drs,
+                            const unsigned          n,
+                            const unsigned          channel,
+                            const unsigned          intstart,
+                            const unsigned          intstop,
+                            const unsigned          pedstart,
+                            const unsigned          pedstop,
+                            const pybind11::object& trigger ){
+    const ScanTrigger* t = GetScanCapsule<ScanTrigger>( trigger );
+    if( t == nullptr && !trigger.is_none() ){
+      throw std::runtime_error( "Trigger must be a ScanTrigger capsule" );
+    }
+    const std::function<void()> fire = t ? t->fire : nullptr;
+
+    ScanReadout* r = new ScanReadout();
+    r->nvalues = 2;
+    r->SetStages( [&drs, n, channel, intstart, intstop, pedstart, pedstop,
+                   fire]( std::vector<double>& raw ){
+      const auto lock = DeviceLock( drs );
+      raw = drs.CollectSums( n, channel,
+                             intstart, intstop,
+                             pedstart, pedstop,
+                             fire );
+    }, []( const std::vector<double>& raw, double* out ){
+      ScanReadout::Summarize( raw, true, out );
+    } );
+    return MakeScanCapsule( r );
+  },
+        pybind11::arg( "n" ),
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "trigger" ) = pybind11::none() )
+
+  // Batched acquisition, the GIL is released while the events are collected
+  // and the results are handed over to a numpy array without copying.
+  .def( "collect_sums", []( DRSContainer&                drs,
+                            const unsigned               n,
+                            const unsigned               channel,
+                            const unsigned               intstart,
+                            const unsigned               intstop,
+                            const unsigned               pedstart,
+                            const unsigned               pedstop,
+                            const std::function<void()>& trigger ){
+    std::vector<double>* sums;
+    {
+      pybind11::gil_scoped_release release;
+      const auto                   lock = DeviceLock( drs );
+      sums = new std::vector<double>( drs.CollectSums( n, channel,
+                                                       intstart, intstop,
+                                                       pedstart, pedstop,
+                                                       trigger ) );
+    }
+    pybind11::capsule owner( sums, []( void* p ){
+      delete reinterpret_cast<std::vector<double>*>( p );
+    } );
+    return pybind11::array_t<double>( sums->size(), sums->data(), owner );
+  },
+        pybind11::arg( "n" ),
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "trigger" ) = pybind11::none() )
+
+  // Same as collect_sums, but filling the sums into a stats.ReadoutStats
+  // accumulator instead of returning them.
+  .def( "collect_stats", DeviceCall( &DRSContainer::CollectStats ),
+        pybind11::arg( "stats" ),
+        pybind11::arg( "n" ),
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "trigger" ) = pybind11::none() )
+
+  // Background acquisition loop
+  .def( "start_acquisition", DeviceCall( &DRSContainer::StartAcquisition ),
+        pybind11::arg( "capacity" ) = 256 )
+  .def( "stop_acquisition",  DeviceCall( &DRSContainer::StopAcquisition ) )
+  .def( "is_acquiring",      DeviceCall( &DRSContainer::IsAcquiring ) )
+  .def( "buffered_events",   DeviceCall( &DRSContainer::BufferedEvents ) )
+  .def( "dropped_events",    DeviceCall( &DRSContainer::DroppedEvents ) )
+  .def( "unmatched_events",  DeviceCall( &DRSContainer::UnmatchedEvents ) )
+  .def( "pop_sums", []( DRSContainer&  drs,
+                        const unsigned channel,
+                        const unsigned intstart,
+                        const unsigned intstop,
+                        const unsigned pedstart,
+                        const unsigned pedstop,
+                        const unsigned maxevents ){
+    std::vector<double>* sums;
+    {
+      pybind11::gil_scoped_release release;
+      const auto                   lock = DeviceLock( drs );
+      sums = new std::vector<double>( drs.PopSums( channel,
+                                                   intstart, intstop,
+                                                   pedstart, pedstop,
+                                                   maxevents ) );
+    }
+    pybind11::capsule owner( sums, []( void* p ){
+      delete reinterpret_cast<std::vector<double>*>( p );
+    } );
+    return pybind11::array_t<double>( sums->size(), sums->data(), owner );
+  },
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "maxevents" ) = std::numeric_limits<unsigned>::max() )
+  .def( "pop_stats",         DeviceCall( &DRSContainer::PopStats ),
+        pybind11::arg( "stats" ),
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "maxevents" ) = std::numeric_limits<unsigned>::max() )
+  .def( "pop_waveforms", []( DRSContainer&  drs,
+                             const unsigned channel,
+                             const unsigned maxevents ){
+    std::vector<float>* wave;
+    size_t              length;
+    {
+      pybind11::gil_scoped_release release;
+      const auto                   lock = DeviceLock( drs );
+      wave   = new std::vector<float>( drs.PopWaveforms( channel, maxevents ) );
+      length = drs.GetSamples();
+    }
+    pybind11::capsule owner( wave, []( void* p ){
+      delete reinterpret_cast<std::vector<float>*>( p );
+    } );
+    // No samples per waveform (board not configured): empty (0, 0) array
+    const size_t nevents = length ? wave->size() / length : 0;
+    return pybind11::array_t<float>( { nevents, length },
+                                     wave->data(),
+                                     owner );
+  },
+        pybind11::arg( "channel" ),
+        pybind11::arg( "maxevents" ) = std::numeric_limits<unsigned>::max() )
+
+  // Merged events of all enabled channels of all boards, returned as a
+  // dictionary of numpy arrays viewing the event block without copying:
+  // trigger [event], triggercell [board, event], waveform [channel, event,
+  // sample], with channels listing the global channel index of each row.
+  .def( "pop_events", []( DRSContainer& drs, const unsigned maxevents ){
+    DRSContainer::EventBlock* block;
+    size_t                    nboards;
+    {
+      pybind11::gil_scoped_release release;
+      const auto                   lock = DeviceLock( drs );
+      block   = new DRSContainer::EventBlock( drs.PopEvents( maxevents ) );
+      nboards = drs.NumBoards();
+    }
+    pybind11::capsule owner( block, []( void* p ){
+      delete reinterpret_cast<DRSContainer::EventBlock*>( p );
+    } );
+    const size_t   n = block->nevents;
+    pybind11::dict ans;
+    ans["channels"] = block->channels;
+    ans["trigger"]  = pybind11::array_t<uint64_t>( n, block->trigger.data(),
+                                                   owner );
+    ans["triggercell"] = pybind11::array_t<int>( { nboards, n },
+                                                 block->triggercell.data(),
+                                                 owner );
+    ans["waveform"] = pybind11::array_t<float>( { block->channels.size(), n,
+                                                  (size_t)block->samples },
+                                                block->waveform.data(),
+                                                owner );
+    return ans;
+  },
+        pybind11::arg( "maxevents" ) = std::numeric_limits<unsigned>::max() )
+  .def( "pop_event_sums", []( DRSContainer&  drs,
+                              const unsigned intstart,
+                              const unsigned intstop,
+                              const unsigned pedstart,
+                              const unsigned pedstop,
+                              const unsigned maxevents ){
+    std::vector<double>* sums;
+    size_t               nrows;
+    {
+      pybind11::gil_scoped_release release;
+      const auto                   lock = DeviceLock( drs );
+      sums = new std::vector<double>( drs.PopEventSums( intstart, intstop,
+                                                        pedstart, pedstop,
+                                                        maxevents ) );
+      nrows = __builtin_popcount( drs.ChannelMask() );
+    }
+    pybind11::capsule owner( sums, []( void* p ){
+      delete reinterpret_cast<std::vector<double>*>( p );
+    } );
+    return pybind11::array_t<double>( { nrows,
+                                        nrows ? sums->size() / nrows : 0 },
+                                      sums->data(),
+                                      owner );
+  },
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "maxevents" ) = std::numeric_limits<unsigned>::max() )
   ;
 }
@@ -1,24 +1,248 @@
+#include "devicecall.hpp"
 #include "gcoder.hpp"
+#include "scancapsule.hpp"
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+/**
+ * @brief Running a scan from python. The readout can either be a ScanReadout
+ * capsule provided by one of the readout modules, in which case the whole scan
+ * runs without the GIL, or an arbitrary python callable returning nvalues
+ * values, in which case the GIL is only acquired for the readout call. The
+ * optional write callable is called as write(index, row) for each completed
+ * point, with the row being a copy of the [x, y, z, values...] table row, while
+ * the scan continues to the next points (see GCoder::RunScan).
+ */
+static pybind11::array_t<double>
+RunScan( GCoder&                   gcoder,
+         const std::vector<float>& x,
+         const std::vector<float>& y,
+         const std::vector<float>& z,
+         const pybind11::object&   readout,
+         const double              settle,
+         const pybind11::object&   interrupt,
+         const bool                stepperoff,
+         const unsigned            nvalues,
+         const pybind11::object&   write,
+         const unsigned            depth )
+{
+  const std::vector<float> path = GCoder::PrepareScan( x, y, z );
+
+  ScanReadout        pyreadout;
+  const ScanReadout* r = GetScanCapsule<ScanReadout>( readout );
+  if( r == nullptr ){
+    r                 = &pyreadout;
+    pyreadout.nvalues = nvalues;
+    pyreadout.read    = [&readout, nvalues]( double* out ){
+      pybind11::gil_scoped_acquire gil;
+      const auto values = readout().cast<std::vector<double> >();
+      if( values.size() != nvalues ){
+        throw std::runtime_error( "Scan readout returned wrong number of values" );
+      }
+      std::copy( values.begin(), values.end(), out );
+    };
+  }
+
+  std::function<void()> checkinterrupt;
+  if( !interrupt.is_none() ){
+    checkinterrupt = [&interrupt](){
+      pybind11::gil_scoped_acquire gil;
+      interrupt();
+    };
+  }
+
+  GCoder::ScanWriter writer;
+  const size_t       ncols = 3+r->nvalues;
+  if( !write.is_none() ){
+    writer = [&write, ncols]( const size_t i, const double* row ){
+      pybind11::gil_scoped_acquire gil;
+      write( i, pybind11::array_t<double>( ncols, row ) );
+    };
+  }
+
+  std::unique_ptr<std::vector<double> > table;
+  {
+    pybind11::gil_scoped_release release;
+    const auto                   lock = DeviceLock( gcoder );
+    table.reset( new std::vector<double>( gcoder.RunScan( path,
+                                                          *r,
+                                                          settle,
+                                                          checkinterrupt,
+                                                          stepperoff,
+                                                          writer,
+                                                          depth ) ) );
+  }
+  const size_t npoints = table->size() / ncols;
+  double*      data    = table->data();
+  pybind11::capsule owner( table.release(), []( void* p ){
+    delete reinterpret_cast<std::vector<double>*>( p );
+  } );
+  return pybind11::array_t<double>( { npoints, ncols }, data, owner );
+}
+
+/**
+ * @brief Shared copy of a python callable that can be released from any thread.
+ * The last reference may be dropped by the gcode IO thread, or by a thread not
+ * holding the GIL, so the python object is released on a separate thread that
+ * acquires the GIL, without blocking the releasing thread.
+ */
+static std::shared_ptr<pybind11::function>
+SharedCallback( const pybind11::function& callback )
+{
+  return std::shared_ptr<pybind11::function>(
+    new pybind11::function( callback ),
+    []( pybind11::function* f ){
+      std::thread( [f](){
+        pybind11::gil_scoped_acquire gil;
+        delete f;
+      } ).detach();
+    } );
+}
 
 PYBIND11_MODULE( gcoder, m )
 {
+  // Handle to the acknowledgement of a command submitted to the queue
+  typedef std::shared_future<std::string> GCodeFuture;
+  pybind11::class_<GCodeFuture>( m, "GCodeFuture" )
+  .def( "done", []( const GCodeFuture& f ){
+    return f.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready;
+  } )
+  .def( "result", []( const GCodeFuture& f ){
+    {
+      pybind11::gil_scoped_release release;
+      f.wait();
+    }
+    return f.get();
+  } )
+  ;
+
   pybind11::class_<GCoder>( m, "GCoder" )
 
   // Explicitly hiding the constructor instance, using just the instance method
   // for getting access to the singleton class.
   SINGLETON_PYBIND( GCoder )
-  .def( "init",            &GCoder::Init          )
+
+  // Device calls release the GIL and lock the device (see devicecall.hpp).
+  // The command queue is thread safe on its own, so the queue methods do not
+  // lock the device.
+  .def( "init",            DeviceCall( &GCoder::Init ) )
 
   // Hiding functions from python
-  .def( "run_gcode",       &GCoder::RunGcode       )
-  .def( "getsettings",     &GCoder::GetSettings    )
-  .def( "set_speed_limit", &GCoder::SetSpeedLimit  )
-  .def( "moveto",          &GCoder::MoveTo         )
-  .def( "enablestepper",   &GCoder::EnableStepper  )
-  .def( "disablestepper",  &GCoder::DisableStepper )
-  .def( "in_motion",       &GCoder::InMotion       )
-  .def( "sendhome",        &GCoder::SendHome       )
+  .def( "run_gcode",       DeviceCall( &GCoder::RunGcode ) )
+  .def( "submit_gcode", []( const GCoder& g, const std::string& gcode,
+                            const unsigned waitack ){
+    return g.SubmitGcode( gcode, waitack );
+  },
+        pybind11::call_guard<pybind11::gil_scoped_release>(),
+        pybind11::arg( "gcode" ),
+        pybind11::arg( "waitack" ) = 10000 )
+  .def( "wait_queue",      &GCoder::WaitQueue,
+        pybind11::call_guard<pybind11::gil_scoped_release>() )
+  .def( "pending_commands", &GCoder::PendingCommands )
+  .def( "set_max_inflight", DeviceCall( &GCoder::SetMaxInFlight ) )
+  .def( "getsettings",     DeviceCall( &GCoder::GetSettings ) )
+  .def( "set_speed_limit", DeviceCall( &GCoder::SetSpeedLimit ) )
+  .def( "set_accel_limit", DeviceCall( &GCoder::SetAccelLimit ) )
+  .def( "move_time",       DeviceCall( &GCoder::MoveTime ) )
+  .def( "predicted_arrival", DeviceCall( &GCoder::PredictedArrival ) )
+  .def( "path_time", []( const GCoder&             g,
+                         const std::vector<float>& x,
+                         const std::vector<float>& y,
+                         const std::vector<float>& z ){
+    const std::vector<float>     path = GCoder::PrepareScan( x, y, z );
+    pybind11::gil_scoped_release release;
+    const auto                   lock = DeviceLock( g );
+    return g.PathTime( path );
+  } )
+  .def( "optimize_path", []( const GCoder&             g,
+                             const std::vector<float>& x,
+                             const std::vector<float>& y,
+                             const std::vector<float>& z,
+                             const std::string&        method ){
+    const std::vector<float>     path = GCoder::PrepareScan( x, y, z );
+    pybind11::gil_scoped_release release;
+    const auto                   lock = DeviceLock( g );
+    return g.OptimizePath( path, method );
+  },
+        pybind11::arg( "x" ),
+        pybind11::arg( "y" ),
+        pybind11::arg( "z" ),
+        pybind11::arg( "method" ) = "auto" )
+  .def( "moveto",          DeviceCall( &GCoder::MoveTo ) )
+  .def( "enablestepper",   DeviceCall( &GCoder::EnableStepper ) )
+  .def( "disablestepper",  DeviceCall( &GCoder::DisableStepper ) )
+  .def( "in_motion",       DeviceCall( &GCoder::InMotion ) )
+  .def( "wait_motion_done", DeviceCall( &GCoder::WaitMotionDone ),
+        pybind11::arg( "timeout" ) )
+
+  // The python callback is dispatched on a separate thread, such that the IO
+  // thread never waits for the GIL, which can be held by the main thread while
+  // waiting for a gcode acknowledgement. The python object is held by the hook,
+  // and is released with the GIL (see SharedCallback) whether or not the hook is
+  // ever called.
+  .def( "notify_motion_done", []( GCoder&                   g,
+                                  const pybind11::function& callback,
+                                  const double              timeout ){
+    const auto                   cb = SharedCallback( callback );
+    pybind11::gil_scoped_release release;
+    const auto                   lock = DeviceLock( g );
+    return g.NotifyMotionDone( [cb](){
+      std::thread( [cb](){
+        pybind11::gil_scoped_acquire gil;
+        try {
+          ( *cb )();
+        } catch( pybind11::error_already_set& e ){
+          e.restore();
+          PyErr_Print();
+        }
+      } ).detach();
+    }, timeout );
+  },
+        pybind11::arg( "callback" ),
+        pybind11::arg( "timeout" ) = 600 )
+  .def( "sendhome",        DeviceCall( &GCoder::SendHome ) )
+  .def( "run_scan",        &RunScan,
+        pybind11::arg( "x" ),
+        pybind11::arg( "y" ),
+        pybind11::arg( "z" ),
+        pybind11::arg( "readout" ),
+        pybind11::arg( "settle" )     = 0.0,
+        pybind11::arg( "interrupt" )  = pybind11::none(),
+        pybind11::arg( "stepperoff" ) = true,
+        pybind11::arg( "nvalues" )    = 2,
+        pybind11::arg( "write" )      = pybind11::none(),
+        pybind11::arg( "depth" )      = 2 )
+
+  // Timing of the stages of the latest scan as a list of dictionaries, in
+  // seconds, with the run time statistics of the stage and the total time the
+  // stage worker waited for the stage dependencies.
+  .def( "scan_timing", []( const GCoder& g ){
+    std::vector<ScanScheduler::StageTiming> timing;
+    {
+      pybind11::gil_scoped_release release;
+      const auto                   lock = DeviceLock( g );
+      timing = g.ScanTiming();
+    }
+    pybind11::list ans;
+    for( const auto& t : timing ){
+      pybind11::dict entry;
+      entry["stage"]  = t.name;
+      entry["worker"] = t.worker;
+      entry["count"]  = t.run.Count();
+      entry["total"]  = t.run.Mean() * t.run.Count();
+      entry["mean"]   = t.run.Mean();
+      entry["min"]    = t.run.Min();
+      entry["max"]    = t.run.Max();
+      entry["wait"]   = t.wait;
+      ans.append( entry );
+    }
+    return ans;
+  } )
   .def_readwrite( "dev_path", &GCoder::dev_path )
   .def_readwrite( "opx",      &GCoder::opx )
   .def_readwrite( "opy",      &GCoder::opy )
@@ -26,8 +250,15 @@ PYBIND11_MODULE( gcoder, m )
   .def_readwrite( "cx",      &GCoder::cx )
   .def_readwrite( "cy",      &GCoder::cy )
   .def_readwrite( "cz",      &GCoder::cz )
+  .def_readonly( "vx",       &GCoder::vx )
+  .def_readonly( "vy",       &GCoder::vy )
+  .def_readonly( "vz",       &GCoder::vz )
+  .def_readonly( "ax",       &GCoder::ax )
+  .def_readonly( "ay",       &GCoder::ay )
+  .def_readonly( "az",       &GCoder::az )
 
   // Static methods
+  .def_static( "prepare_scan", &GCoder::PrepareScan )
   .def_static( "max_x", &GCoder::max_x )
   .def_static( "max_y", &GCoder::max_y )
   .def_static( "max_z", &GCoder::max_z )
@@ -1,25 +1,123 @@
+#include "devicecall.hpp"
 #include "gpio.hpp"
+#include "scancapsule.hpp"
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
+#include <chrono>
+#include <random>
+#include <thread>
+
 PYBIND11_MODULE( gpio, m )
 {
   pybind11::class_<GPIO>( m, "GPIO"  )
   SINGLETON_PYBIND(GPIO)
-  .def( "init",        &GPIO::Init                )
-  .def( "pulse",       &GPIO::Pulse               )
-  .def( "light_on",    &GPIO::LightsOn            )
-  .def( "light_off",   &GPIO::LightsOff           )
-  .def( "pwm",         &GPIO::SetPWM              )
-  .def( "pwm_duty",    &GPIO::GetPWM              )
+
+  // Device calls release the GIL and lock the device (see devicecall.hpp). The
+  // pulse train status and the ADC readouts are published through atomic or
+  // lock-free containers, so these do not lock the device.
+  .def( "init",        DeviceCall( &GPIO::Init ) )
+  .def( "pulse",       DeviceCall( &GPIO::Pulse ) )
+  .def( "pulse_train_start", DeviceCall( &GPIO::StartPulseTrain ),
+        pybind11::arg( "frequency" ),
+        pybind11::arg( "n" )     = 0,
+        pybind11::arg( "width" ) = 1e-6 )
+  .def( "pulse_train_stop",    DeviceCall( &GPIO::StopPulseTrain ) )
+  .def( "pulse_train_running", &GPIO::PulseTrainRunning )
+  .def( "pulse_train_count",   &GPIO::PulseTrainCount   )
+  .def( "light_on",    DeviceCall( &GPIO::LightsOn ) )
+  .def( "light_off",   DeviceCall( &GPIO::LightsOff ) )
+  .def( "pwm",         DeviceCall( &GPIO::SetPWM ) )
+  .def( "pwm_duty",    DeviceCall( &GPIO::GetPWM ) )
   .def( "adc_read",    &GPIO::ReadADC             )
-  .def( "adc_range",   &GPIO::SetADCRange         )
-  .def( "adc_rate",    &GPIO::SetADCRate          )
-  .def( "adc_setref",  &GPIO::SetReferenceVoltage )
-  .def( "rtd_read",    &GPIO::ReadRTDTemp         )
-  .def( "ntc_read",    &GPIO::ReadNTCTemp         )
-  .def( "gpio_status", &GPIO::StatusGPIO          )
-  .def( "adc_status",  &GPIO::StatusADC           )
-  .def( "pwm_status",  &GPIO::StatusPWM           )
+  .def( "adc_range",   DeviceCall( &GPIO::SetADCRange ) )
+  .def( "adc_rate",    DeviceCall( &GPIO::SetADCRate ) )
+  .def( "adc_setref",  DeviceCall( &GPIO::SetReferenceVoltage ) )
+  .def( "adc_snapshot", []( const GPIO& gpio ){
+    const GPIO::ADCSnapshot snap = gpio.ReadADCSnapshot();
+    pybind11::dict          ans;
+    pybind11::list          values, time, range, rate;
+    for( unsigned i = 0; i < 4; ++i ){
+      values.append( snap.values[i] );
+      time.append( snap.time[i] );
+      range.append( snap.range[i] );
+      rate.append( snap.rate[i] );
+    }
+    ans["values"] = values;
+    ans["time"]   = time;
+    ans["range"]  = range;
+    ans["rate"]   = rate;
+    return ans;
+  } )
+  .def( "adc_oversample", DeviceCall( &GPIO::SetADCOversample ) )
+  .def( "adc_average",    &GPIO::ReadADCAverage,
+        pybind11::call_guard<pybind11::gil_scoped_release>(),
+        pybind11::arg( "channel" ),
+        pybind11::arg( "n" ) )
+  .def( "adc_sample_count", &GPIO::ADCSampleCount )
+
+  // History of the latest n samples as a (n, 2) array of [time, mV], with the
+  // time being the system time in seconds (comparable with time.time()).
+  .def( "adc_history", []( const GPIO& gpio, const unsigned channel,
+                           const unsigned n ){
+    const std::vector<SampleHistory::Sample> samples
+      = gpio.ADCHistory( channel, n );
+    pybind11::array_t<double> ans( { samples.size(), (size_t)2 } );
+    auto                      a = ans.mutable_unchecked<2>();
+    for( size_t i = 0; i < samples.size(); ++i ){
+      a( i, 0 ) = samples[i].time;
+      a( i, 1 ) = samples[i].value;
+    }
+    return ans;
+  },
+        pybind11::arg( "channel" ),
+        pybind11::arg( "n" ) = 16384 )
+  .def( "rtd_read",    DeviceCall( &GPIO::ReadRTDTemp ) )
+  .def( "ntc_read",    DeviceCall( &GPIO::ReadNTCTemp ) )
+  .def( "gpio_status", DeviceCall( &GPIO::StatusGPIO ) )
+  .def( "adc_status",  DeviceCall( &GPIO::StatusADC ) )
+  .def( "pwm_status",  DeviceCall( &GPIO::StatusPWM ) )
+  .def( "gpiomem_status", DeviceCall( &GPIO::StatusGPIOMem ) )
+
+  // Routines for the C++ scan executor (see gcoder.run_scan). The trigger
+  // fires n pulses, and can only be created if the trigger pin is available
+  // (pass None as the trigger of the scope readouts for an external trigger).
+  // Errors while firing are raised, stopping the scan. The ADC readout returns
+  // the mean and standard deviation of n samples with the same random spacing
+  // as the python readout.
+  .def( "scan_trigger", []( const GPIO& gpio, const unsigned n,
+                            const unsigned wait ){
+    if( !gpio.StatusGPIO() ){
+      throw std::runtime_error( "GPIO for trigger pin is not initialized" );
+    }
+    ScanTrigger* t = new ScanTrigger();
+    t->fire = [&gpio, n, wait](){
+      const auto lock = DeviceLock( gpio );
+      gpio.Pulse( n, wait );
+    };
+    return MakeScanCapsule( t );
+  },
+        pybind11::arg( "n" )    = 10,
+        pybind11::arg( "wait" ) = 100 )
+  .def( "adc_scan_readout", []( const GPIO& gpio, const unsigned channel,
+                                const unsigned n ){
+    ScanReadout* r = new ScanReadout();
+    r->nvalues = 2;
+    r->SetStages( [&gpio, channel, n]( std::vector<double>& values ){
+      std::mt19937                     rng( std::random_device{} () );
+      std::uniform_real_distribution<> sleep( 0, 1.0 / 200 );
+      values.resize( n );
+      for( unsigned i = 0; i < n; ++i ){
+        values[i] = gpio.ReadADC( channel );
+        std::this_thread::sleep_for( std::chrono::duration<double>( sleep( rng ) ) );
+      }
+    }, []( const std::vector<double>& values, double* out ){
+      ScanReadout::Summarize( values, false, out );
+    } );
+    return MakeScanCapsule( r );
+  },
+        pybind11::arg( "channel" ),
+        pybind11::arg( "n" ) )
 
   // Static variables
   .def_readonly_static( "ADS_RANGE_6V",    &GPIO::ADS_RANGE_6V )
@@ -0,0 +1,52 @@
+#include "latency.hpp"
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+PYBIND11_MODULE( latency, m )
+{
+  m.doc() = "Latency histograms of the instrumented device sections. "
+            "All durations are in nanoseconds.";
+
+  // Snapshot as a dictionary of {section: {count, mean, ..., buckets}}, with
+  // buckets being the list of [lower edge, count] of the non-empty buckets.
+  m.def( "snapshot", [](){
+    std::vector<LatencySummary> snap;
+    {
+      pybind11::gil_scoped_release release;
+      snap = LatencySnapshot();
+    }
+    pybind11::dict ans;
+    for( const auto& s : snap ){
+      pybind11::dict entry;
+      entry["count"]   = s.count;
+      entry["mean"]    = s.mean;
+      entry["min"]     = s.min;
+      entry["max"]     = s.max;
+      entry["p50"]     = s.p50;
+      entry["p90"]     = s.p90;
+      entry["p99"]     = s.p99;
+      entry["p999"]    = s.p999;
+      entry["buckets"] = s.buckets;
+      ans[pybind11::str( s.name )] = entry;
+    }
+    return ans;
+  } );
+  m.def( "prometheus", &LatencyPrometheus,
+         pybind11::call_guard<pybind11::gil_scoped_release>() );
+  m.def( "reset", &LatencyReset,
+         pybind11::call_guard<pybind11::gil_scoped_release>() );
+  m.def( "enabled",     &LatencyEnabled );
+  m.def( "set_enabled", &LatencySetEnabled );
+
+  // Recording durations measured on the python side (ex: the python overhead
+  // around device calls), with the section registered on the first call.
+  m.def( "record", []( const std::string& name, const uint64_t ns ){
+    LatencyRecord( LatencyId( name.c_str() ), ns );
+  }, pybind11::arg( "name" ), pybind11::arg( "ns" ) );
+
+#ifdef SIPM_LATENCY
+  m.attr( "compiled" ) = true;
+#else
+  m.attr( "compiled" ) = false;
+#endif
+}
@@ -1,29 +1,243 @@
+#include "devicecall.hpp"
 #include "pico.hpp"
+#include "scancapsule.hpp"
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <thread>
+
+/**
+ * @brief Read-only numpy view of the full rapid-block buffer, with shape
+ * (channel, capture, sample). No data is copied, and the array holds a
+ * reference to the buffer arena rather than to the device: changing the block
+ * settings with setblocknums swaps in a new arena, and existing views keep
+ * showing the last blocks of the old layout.
+ */
+static pybind11::array_t<int16_t>
+BlockArray( const PicoUnit& pico )
+{
+  typedef std::shared_ptr<const std::vector<int16_t> > Arena;
+  const size_t length = pico.presamples+pico.postsamples;
+  Arena*       arena  = new Arena( pico.BlockArena() );
+  pybind11::capsule owner( arena, []( void* p ){
+    delete reinterpret_cast<Arena*>( p );
+  } );
+  pybind11::array_t<int16_t> ans(
+    { (size_t)2, (size_t)pico.ncaptures, length },
+    { pico.ncaptures * length * sizeof( int16_t ),
+      length * sizeof( int16_t ),
+      sizeof( int16_t ) },
+    ( *arena )->data(),
+    owner );
+  ans.attr( "flags" ).attr( "writeable" ) = false;
+  return ans;
+}
+
+/**
+ * @brief Handing the results of a whole-block reduction over to numpy without
+ * copying. The GIL is released and the device is locked while the block is
+ * being reduced.
+ */
+template<typename T, typename F>
+static pybind11::array_t<T>
+ReleasedArray( const PicoUnit& pico, F&& f )
+{
+  std::vector<T>* ans;
+  {
+    pybind11::gil_scoped_release release;
+    const auto                   lock = DeviceLock( pico );
+    ans = new std::vector<T>( f() );
+  }
+  pybind11::capsule owner( ans, []( void* p ){
+    delete reinterpret_cast<std::vector<T>*>( p );
+  } );
+  return pybind11::array_t<T>( ans->size(), ans->data(), owner );
+}
+
 PYBIND11_MODULE( pico, m )
 {
+  // Registering the readout accumulator type used by the *_stats methods
+  pybind11::module::import( "cmod.stats" );
+
   pybind11::class_<PicoUnit>( m, "PicoUnit" )
   SINGLETON_PYBIND( PicoUnit )
-  .def( "init",             &PicoUnit::Init            )
-  .def( "settrigger",       &PicoUnit::SetTrigger      )
-  .def( "rangemin",         &PicoUnit::VoltageRangeMin )
-  .def( "rangemax",         &PicoUnit::VoltageRangeMax )
-  .def( "setrange",         &PicoUnit::SetVoltageRange )
-  .def( "setblocknums",     &PicoUnit::SetBlockNums    )
-  .def( "startrapidblocks", &PicoUnit::StartRapidBlock )
-  .def( "isready",          &PicoUnit::IsReady         )
-  .def( "waitready",        &PicoUnit::WaitTillReady   )
-  .def( "buffer",           &PicoUnit::GetBuffer       )
-  .def( "flushbuffer",      &PicoUnit::FlushToBuffer   )
-  .def( "dumpbuffer",       &PicoUnit::DumpBuffer      )
-  .def( "dumpinfo",         &PicoUnit::DumpInfo        )
-  .def( "adc2mv",           &PicoUnit::adc2mv          )
-  .def( "waveformstr",      &PicoUnit::WaveformString  )
-  .def( "waveformsum",      &PicoUnit::WaveformSum     )
-  .def( "waveformmax",      &PicoUnit::WaveformAbsMax  )
-  .def( "rangeA",           &PicoUnit::rangeA          )
-  .def( "rangeB",           &PicoUnit::rangeB          )
+
+  // Device calls release the GIL and lock the device (see devicecall.hpp)
+  .def( "init",             DeviceCall( &PicoUnit::Init ) )
+  .def( "settrigger",       DeviceCall( &PicoUnit::SetTrigger ) )
+  .def( "rangemin",         DeviceCall( &PicoUnit::VoltageRangeMin ) )
+  .def( "rangemax",         DeviceCall( &PicoUnit::VoltageRangeMax ) )
+  .def( "setrange",         DeviceCall( &PicoUnit::SetVoltageRange ) )
+  .def( "setblocknums",     DeviceCall( &PicoUnit::SetBlockNums ) )
+  .def( "startrapidblocks", DeviceCall( &PicoUnit::StartRapidBlock ) )
+  .def( "isready",          DeviceCall( &PicoUnit::IsReady ) )
+  .def( "waitready",        DeviceCall( &PicoUnit::WaitTillReady ) )
+  .def( "buffer",           DeviceCall( &PicoUnit::GetBuffer ) )
+  .def( "block_array",      &BlockArray                )
+  .def( "flushbuffer",      DeviceCall( &PicoUnit::FlushToBuffer ) )
+  .def( "dumpbuffer",       DeviceCall( &PicoUnit::DumpBuffer ) )
+  .def( "dumpinfo",         DeviceCall( &PicoUnit::DumpInfo ) )
+  .def( "adc2mv",           DeviceCall( &PicoUnit::adc2mv ) )
+  .def( "waveformstr",      DeviceCall( &PicoUnit::WaveformString ) )
+  .def( "waveformsum",      DeviceCall( &PicoUnit::WaveformSum ) )
+  .def( "waveformmax",      DeviceCall( &PicoUnit::WaveformAbsMax ) )
+  .def( "block_sums", []( const PicoUnit& pico,
+                          const int16_t   channel,
+                          const unsigned  intstart,
+                          const unsigned  intstop,
+                          const unsigned  pedstart,
+                          const unsigned  pedstop,
+                          const unsigned  nthreads ){
+    return ReleasedArray<float>( pico, [&](){
+      return pico.BlockSums( channel, intstart, intstop, pedstart, pedstop,
+                             nthreads );
+    } );
+  },
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "nthreads" ) = 1 )
+  .def( "block_histogram", []( const PicoUnit& pico,
+                               const int16_t   channel,
+                               const unsigned  intstart,
+                               const unsigned  intstop,
+                               const unsigned  pedstart,
+                               const unsigned  pedstop,
+                               const float     binmin,
+                               const float     binmax,
+                               const unsigned  nbins,
+                               const unsigned  nthreads ){
+    return ReleasedArray<unsigned>( pico, [&](){
+      return pico.BlockHistogram( channel, intstart, intstop, pedstart, pedstop,
+                                  binmin, binmax, nbins, nthreads );
+    } );
+  },
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "binmin" ),
+        pybind11::arg( "binmax" ),
+        pybind11::arg( "nbins" ),
+        pybind11::arg( "nthreads" ) = 1 )
+  .def( "block_stats",      DeviceCall( &PicoUnit::BlockStats ),
+        pybind11::arg( "stats" ),
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "nthreads" ) = 1 )
+
+  // Pipelined background acquisition
+  .def( "start_acquisition", DeviceCall( &PicoUnit::StartAcquisition ),
+        pybind11::arg( "capacity" ) = 4 )
+  .def( "stop_acquisition",  DeviceCall( &PicoUnit::StopAcquisition ) )
+  .def( "is_acquiring",      DeviceCall( &PicoUnit::IsAcquiring ) )
+  .def( "buffered_blocks",   DeviceCall( &PicoUnit::BufferedBlocks ) )
+  .def( "dropped_blocks",    DeviceCall( &PicoUnit::DroppedBlocks ) )
+  .def( "pop_block",         DeviceCall( &PicoUnit::PopBlock ) )
+  .def( "pop_block_sums", []( PicoUnit&      pico,
+                              const int16_t  channel,
+                              const unsigned intstart,
+                              const unsigned intstop,
+                              const unsigned pedstart,
+                              const unsigned pedstop,
+                              const unsigned maxblocks,
+                              const unsigned nthreads ){
+    return ReleasedArray<float>( pico, [&](){
+      return pico.PopBlockSums( channel, intstart, intstop, pedstart, pedstop,
+                                maxblocks, nthreads );
+    } );
+  },
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "maxblocks" ) = std::numeric_limits<unsigned>::max(),
+        pybind11::arg( "nthreads" )  = 1 )
+  .def( "pop_block_stats",  DeviceCall( &PicoUnit::PopBlockStats ),
+        pybind11::arg( "stats" ),
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "maxblocks" ) = std::numeric_limits<unsigned>::max(),
+        pybind11::arg( "nthreads" )  = 1 )
+
+  // Readout routine for the C++ scan executor (see gcoder.run_scan): the mean
+  // and standard error of the waveform sums of at least n captures, collected
+  // in rapid blocks of 1000 captures. The trigger must be a ScanTrigger capsule
+  // (see gpio.scan_trigger), or None for an external trigger. An error is
+  // raised (stopping the scan) if a block is not completed within timeout
+  // seconds, for example if the external trigger is missing.
+  .def( "scan_readout", []( PicoUnit&               pico,
+                            const unsigned          n,
+                            const int16_t           channel,
+                            const unsigned          intstart,
+                            const unsigned          intstop,
+                            const unsigned          pedstart,
+                            const unsigned          pedstop,
+                            const pybind11::object& trigger,
+                            const double            timeout ){
+    const ScanTrigger* t = GetScanCapsule<ScanTrigger>( trigger );
+    if( t == nullptr && !trigger.is_none() ){
+      throw std::runtime_error( "Trigger must be a ScanTrigger capsule" );
+    }
+    const std::function<void()> fire = t ? t->fire : nullptr;
+
+    ScanReadout* r = new ScanReadout();
+    r->nvalues = 2;
+    r->SetStages( [&pico, n, channel, intstart, intstop, pedstart, pedstop,
+                   fire, timeout]( std::vector<double>& raw ){
+      const auto lock = DeviceLock( pico );
+      while( raw.size() < n ){
+        pico.SetBlockNums( 1000, pico.postsamples, pico.presamples );
+        pico.StartRapidBlock();
+        const auto start = std::chrono::steady_clock::now();
+        while( !pico.IsReady() ){
+          if( std::chrono::steady_clock::now()-start
+              > std::chrono::duration<double>( timeout ) ){
+            throw std::runtime_error( "Rapid block not completed in time" );
+          }
+          if( fire ){
+            fire();
+          } else {
+            std::this_thread::sleep_for( std::chrono::microseconds( 5 ) );
+          }
+        }
+        const std::vector<float> block = pico.BlockSums( channel,
+                                                         intstart, intstop,
+                                                         pedstart, pedstop );
+        raw.insert( raw.end(), block.begin(), block.end() );
+      }
+    }, []( const std::vector<double>& raw, double* out ){
+      ScanReadout::Summarize( raw, true, out );
+    } );
+    return MakeScanCapsule( r );
+  },
+        pybind11::arg( "n" ),
+        pybind11::arg( "channel" ),
+        pybind11::arg( "intstart" ),
+        pybind11::arg( "intstop" ),
+        pybind11::arg( "pedstart" ),
+        pybind11::arg( "pedstop" ),
+        pybind11::arg( "trigger" ) = pybind11::none(),
+        pybind11::arg( "timeout" ) = 10.0 )
+
+  .def( "open_wavefile",    DeviceCall( &PicoUnit::OpenWaveFile ) )
+  .def( "close_wavefile",   DeviceCall( &PicoUnit::CloseWaveFile ) )
+  .def( "write_block",      DeviceCall( &PicoUnit::WriteBlock ) )
+  .def( "rangeA",           DeviceCall( &PicoUnit::rangeA ) )
+  .def( "rangeB",           DeviceCall( &PicoUnit::rangeB ) )
 
   // Defining data members as readonly:
   .def_readonly( "device",           &PicoUnit::device           )
@@ -0,0 +1,89 @@
+#include "readoutstats.hpp"
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+/**
+ * @brief Histogram counts with the bin edges in the numpy.histogram
+ * convention: (counts, edges), with len(edges) == len(counts)+1.
+ */
+static pybind11::tuple
+HistogramTuple( const std::vector<uint64_t>& counts,
+                const double                 min,
+                const double                 max )
+{
+  pybind11::array_t<uint64_t> c( counts.size(), counts.data() );
+  pybind11::array_t<double>   e( counts.size()+1 );
+  auto                        edges = e.mutable_unchecked<1>();
+  for( size_t i = 0; i <= counts.size(); ++i ){
+    edges( i ) = min+( max-min ) * i / counts.size();
+  }
+  return pybind11::make_tuple( c, e );
+}
+
+PYBIND11_MODULE( stats, m )
+{
+  m.doc() = "Streaming accumulators for the per-event readout values, filled "
+            "directly by the DRS4 and picoscope readout methods.";
+
+  pybind11::class_<ReadoutStats>( m, "ReadoutStats" )
+  .def( pybind11::init<unsigned, double>(),
+        pybind11::arg( "nbins" )     = 1024,
+        pybind11::arg( "basewidth" ) = 1e-3 )
+  .def( "copy", []( const ReadoutStats& s ){ return ReadoutStats( s ); } )
+
+  // Filling from a scalar or any array-like of values
+  .def( "fill", []( ReadoutStats& s,
+                    const pybind11::array_t<double,
+                                            pybind11::array::c_style |
+                                            pybind11::array::forcecast>& x ){
+    s.Fill( x.data(), x.size() );
+  } )
+  .def( "merge", &ReadoutStats::Merge )
+  .def( "reset", &ReadoutStats::Reset )
+  .def( "set_binning", []( ReadoutStats& s, const double min,
+                           const double max, const unsigned nbins ){
+    s.SetBinning( Histogram( min, max, nbins ) );
+  },
+        pybind11::arg( "min" ),
+        pybind11::arg( "max" ),
+        pybind11::arg( "nbins" ) )
+  .def( "set_pe_binning", []( ReadoutStats& s, const double pedestal,
+                              const double gain, const unsigned maxpe,
+                              const unsigned binsperpe ){
+    s.SetBinning( Histogram::Photoelectron( pedestal, gain, maxpe,
+                                            binsperpe ) );
+  },
+        pybind11::arg( "pedestal" ),
+        pybind11::arg( "gain" ),
+        pybind11::arg( "maxpe" ),
+        pybind11::arg( "binsperpe" ) = 5 )
+
+  // Summary statistics
+  .def( "count",  []( const ReadoutStats& s ){ return s.Stats().Count(); } )
+  .def( "mean",   []( const ReadoutStats& s ){ return s.Stats().Mean(); } )
+  .def( "var",    []( const ReadoutStats& s ){ return s.Stats().Variance(); } )
+  .def( "std",    []( const ReadoutStats& s ){ return s.Stats().StdDev(); } )
+  .def( "stderr", []( const ReadoutStats& s ){ return s.Stats().StdError(); } )
+  .def( "min",    []( const ReadoutStats& s ){ return s.Stats().Min(); } )
+  .def( "max",    []( const ReadoutStats& s ){ return s.Stats().Max(); } )
+  .def( "__len__", []( const ReadoutStats& s ){ return s.Stats().Count(); } )
+
+  // Histograms as (counts, edges) tuples, the fixed binning histogram also
+  // returns the underflow and overflow counts.
+  .def( "histogram", []( const ReadoutStats& s ){
+    const AdaptiveHistogram& h = s.Adaptive();
+    return HistogramTuple( h.Counts(), h.Min(), h.Max() );
+  } )
+  .def( "fixed_histogram", []( const ReadoutStats& s ){
+    const Histogram& h = s.Fixed();
+    if( h.Bins() == 0 ){
+      throw std::runtime_error( "Fixed binning not set (see set_binning)" );
+    }
+    pybind11::tuple ans = HistogramTuple( h.Counts(), h.Min(), h.Max() );
+    return pybind11::make_tuple( pybind11::object( ans[0] ),
+                                 pybind11::object( ans[1] ),
+                                 h.Underflow(),
+                                 h.Overflow() );
+  } )
+  ;
+}
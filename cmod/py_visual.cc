@@ -2,28 +2,66 @@
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
+/**
+ * Exporting the image to a read-only numpy array without copying: the array
+ * holds a reference to the underlying cv::Mat data (the cv::Mat header is
+ * kept by the array's base capsule). Published images are never modified, as
+ * the grabber thread only reuses image memory once all references have been
+ * released (see Visual::RunGrabLoop).
+ */
+static pybind11::array_t<uchar>
+image_to_array( const cv::Mat& img )
+{
+  auto* owner = new cv::Mat( img );
+  auto  arr   = pybind11::array_t<uchar>(
+    { img.rows, img.cols, img.channels() },
+    { img.step[0], img.step[1], img.elemSize1() },
+    img.data,
+    pybind11::capsule( owner, []( void* p ){
+    delete reinterpret_cast<cv::Mat*>( p );
+  } ) );
+  arr.attr( "setflags" )( pybind11::arg( "write" ) = false );
+  return arr;
+}
+
+
 PYBIND11_MODULE( visual, m )
 {
   pybind11::class_<Visual>( m, "Visual" )
   .def( pybind11::init<>() )
   .def( pybind11::init<const std::string&>() )
-  .def( "init_dev",      &Visual::init_dev     )
+  .def( "init_dev",      &Visual::init_dev,
+        pybind11::call_guard<pybind11::gil_scoped_release>() )
   .def( "frame_width",    &Visual::FrameWidth   )
   .def( "frame_height",   &Visual::FrameHeight  )
   .def( "get_latest",    &Visual::GetVisResult )
-  .def( "save_image",     &Visual::SaveImage    )
+  .def( "get_latest_after", &Visual::GetVisResultAfter,
+        pybind11::arg( "time" ), pybind11::arg( "timeout" ) = 5.0,
+        pybind11::call_guard<pybind11::gil_scoped_release>() )
+  .def( "save_image",     &Visual::SaveImage,
+        pybind11::call_guard<pybind11::gil_scoped_release>() )
   .def( "get_image_bytes", []( Visual& vis ){
-    // Inline conversion to python bytes
-    const auto cbytes = vis.GetImageBytes();
-    std::string sbytes( cbytes.begin(), cbytes.end() );
-    return pybind11::bytes( sbytes );
+    Visual::ImageBytes bytes;
+    {
+      pybind11::gil_scoped_release release;
+      bytes = vis.GetImageBytes();
+    }
+    auto* owner = new Visual::ImageBytes( bytes );
+    auto  arr   = pybind11::array_t<uchar>(
+      { bytes->size() }, { sizeof( uchar ) }, bytes->data(),
+      pybind11::capsule( owner, []( void* p ){
+      delete reinterpret_cast<Visual::ImageBytes*>( p );
+    } ) );
+    arr.attr( "setflags" )( pybind11::arg( "write" ) = false );
+    return pybind11::memoryview( arr );
   } )
   .def( "get_image", []( Visual& vis, const bool raw ){
-    // Inline conversion of cv::Mat to numpy arrays
-    cv::Mat img = vis.GetImage( raw );
-    return pybind11::array_t<unsigned char>(
-      {img.rows, img.cols, 3},
-      img.data );
+    cv::Mat img;
+    {
+      pybind11::gil_scoped_release release;
+      img = vis.GetImage( raw );
+    }
+    return image_to_array( img );
   } )
   .def_readonly(  "dev_path",     &Visual::dev_path     )
   .def_readwrite( "threshold",    &Visual::threshold    )
@@ -32,6 +70,9 @@ PYBIND11_MODULE( visual, m )
   .def_readwrite( "size_cutoff",  &Visual::size_cutoff  )
   .def_readwrite( "ratio_cutoff", &Visual::ratio_cutoff )
   .def_readwrite( "poly_range",   &Visual::poly_range   )
+  .def_readwrite( "tracking",       &Visual::tracking       )
+  .def_readwrite( "roi_margin",     &Visual::roi_margin     )
+  .def_readwrite( "pyramid_levels", &Visual::pyramid_levels )
   ;
 
   // Required for coordinate calculation
@@ -51,5 +92,7 @@ PYBIND11_MODULE( visual, m )
   .def_readwrite( "poly_y2",   &Visual::VisResult::poly_y2      )
   .def_readwrite( "poly_y3",   &Visual::VisResult::poly_y3      )
   .def_readwrite( "poly_y4",   &Visual::VisResult::poly_y4      )
+  .def_readonly(  "seq",       &Visual::VisResult::frame_seq    )
+  .def_readonly(  "time",      &Visual::VisResult::frame_time   )
   ;
 }
@@ -0,0 +1,70 @@
+"""
+
+  wavefile.py
+
+  Reader for the binary waveform files written by the DRS4 and picoscope
+  interfaces (see the src/wavefile.hpp header for the full format definition).
+  The file is memory mapped, so that the analysis does not need to parse or load
+  the full file into memory.
+
+"""
+import numpy as np
+import os
+
+## Numpy description of the fixed 64 byte file header.
+HEADER_DTYPE = np.dtype([
+    ('magic', 'S8'),
+    ('version', '<u4'),
+    ('channel', '<u4'),
+    ('nsamples', '<u4'),
+    ('reserved', '<u4'),
+    ('timeinterval', '<f8'),
+    ('adcscale', '<f8'),
+    ('padding', 'V24'),
+])
+
+MAGIC = b'SIPMWAVE'
+
+
+class WaveFile(object):
+  """
+  Memory-mapped view of a binary waveform file. The `adc` attribute is a
+  read-only array of shape [nframes, nsamples] containing the raw 16 bit ADC
+  values, the header information is available as attributes:
+  - `timeinterval`: Spacing between samples in ns
+  - `adcscale`: The conversion factor from ADC value to mV.
+  - `channel`: The readout channel the waveforms were collected from.
+  """
+  def __init__(self, filename):
+    header = np.fromfile(filename, dtype=HEADER_DTYPE, count=1)
+    if len(header) != 1 or header['magic'][0] != MAGIC:
+      raise ValueError(f'File [{filename}] is not a binary waveform file')
+    self.filename = filename
+    self.version = int(header['version'][0])
+    self.channel = int(header['channel'][0])
+    self.nsamples = int(header['nsamples'][0])
+    self.timeinterval = float(header['timeinterval'][0])
+    self.adcscale = float(header['adcscale'][0])
+
+    # Dropping any trailing partial frame (if the file is still being written)
+    datasize = os.path.getsize(filename) - HEADER_DTYPE.itemsize
+    nframes = datasize // (2 * self.nsamples) if self.nsamples else 0
+    if nframes == 0:
+      self.adc = np.zeros((0, self.nsamples), dtype='<i2')
+    else:
+      self.adc = np.memmap(filename,
+                           dtype='<i2',
+                           mode='r',
+                           offset=HEADER_DTYPE.itemsize,
+                           shape=(nframes, self.nsamples))
+
+  def __len__(self):
+    return self.adc.shape[0]
+
+  def mv(self, frames=slice(None)):
+    """Waveforms of the selected frames converted to mV."""
+    return self.adc[frames] * self.adcscale
+
+  def time(self):
+    """Time of each sample in a frame in ns."""
+    return np.arange(self.nsamples) * self.timeinterval
@@ -65,6 +65,7 @@ import cmod.board as board
 import cmod.gpio as gpio
 import cmod.visual as visual
 import cmod.fmt as fmt
+import cmod.stats as readoutstats
 import cmod.TBController as tbc
 import numpy as np
 import cmd
@@ -728,9 +729,10 @@ class controlcmd(object):
       # Try to move the gantry. Even if it fails there will be fail safes
       # in other classes
       self.gcoder.moveto(x, y, z)
-      while self.gcoder.in_motion(x, y, z):
+      # Blocking in C++ until the motion completion is acknowledged, waking up
+      # every 0.1 seconds to allow for interruption.
+      while not self.gcoder.wait_motion_done(0.1):
         self.check_handle()  # Allowing for interuption
-        time.sleep(0.01)  ## Updating position in 0.01 second increments
     except Exception as e:
       # Setting internal coordinates to the designated position anyway.
       self.gcoder.opx = x
@@ -741,6 +743,18 @@ class controlcmd(object):
       self.gcoder.cz = z
       pass
 
+  def settle_time(self, wait):
+    """
+    @brief Remaining time for the gantry to settle after a motion command.
+
+    @details The settling time is counted from the predicted arrival time of
+    the latest motion (see the `predicted_arrival` method of the gcoder),
+    rather than from when the motion completion was confirmed, so the time spent
+    on the confirmation is not waited for twice. The remaining time is never
+    longer than the requested settling time.
+    """
+    return min(wait, max(0, self.gcoder.predicted_arrival() + wait))
+
   def prompt_input(self, message, allowed=None) -> str:
     """Thin wrapper for prompt input of the main controlterm method"""
     return self.cmd.prompt_input(self.classname, message, allowed)
@@ -921,7 +935,7 @@ class rootfilecmd(controlcmd):
     specificdata = {**{title: [] for title in self.specific_dict}}
     self.saveddata = {"standard": standarddata, "specific": specificdata}
 
-  def fillroot(self, data, datatypes=None, time=0.0, det_id=-100):
+  def fillroot(self, data, datatypes=None, time=0.0, det_id=-100, gantry=None):
     """
     @brief Fill the root file with the given data, will create a root file on the first call
 
@@ -934,6 +948,10 @@ class rootfilecmd(controlcmd):
     will multiple values per call of fill root must set datatypes and must make sure they are inputting a list.
     Ex: self.fillroot({"testdata":[1,2,3]},datatypes = {"testdata":"var * int64")
 
+    The gantry coordinates default to the current gantry target, and should be
+    given explicitly for the results of a scan (see run_scan), as the gantry may
+    already be moving to the next point.
+
     """
     ##fill data into the root file
     if not hasattr(self, "rootfile"):
@@ -942,9 +960,11 @@ class rootfilecmd(controlcmd):
     if data != "dump":
       self.saveddata["standard"]["time"].append(time)
       self.saveddata["standard"]["det_id"].append(det_id)
-      self.saveddata["standard"]["gantry_x"].append(self.gcoder.opx)
-      self.saveddata["standard"]["gantry_y"].append(self.gcoder.opy)
-      self.saveddata["standard"]["gantry_z"].append(self.gcoder.opz)
+      if gantry is None:
+        gantry = (self.gcoder.opx, self.gcoder.opy, self.gcoder.opz)
+      self.saveddata["standard"]["gantry_x"].append(gantry[0])
+      self.saveddata["standard"]["gantry_y"].append(gantry[1])
+      self.saveddata["standard"]["gantry_z"].append(gantry[2])
       self.saveddata["standard"]["led_bv"].append(self.gpio.adc_read(2))
       self.saveddata["standard"]["led_temp"].append(self.gpio.ntc_read(0))
       self.saveddata["standard"]["sipm_temp"].append(self.gpio.rtd_read(1))
@@ -1396,8 +1416,13 @@ class hscancmd(singlexycmd):
     xmesh, ymesh = np.meshgrid(np.linspace(xmin, xmax, numx),
                                np.linspace(ymin, ymax, numy))
 
-    args.x = xmesh.reshape(1, np.prod(xmesh.shape))[0]
-    args.y = ymesh.reshape(1, np.prod(ymesh.shape))[0]
+    x = xmesh.reshape(1, np.prod(xmesh.shape))[0]
+    y = ymesh.reshape(1, np.prod(ymesh.shape))[0]
+
+    # Reordering the grid points to minimize the gantry travel time.
+    order = self.gcoder.optimize_path(x, y, np.full(len(x), args.scanz))
+    args.x = x[order]
+    args.y = y[order]
     return args
 
 
@@ -1631,7 +1656,34 @@ class readoutcmd(controlcmd):
     @details Abstracting the readout method for child classes. The `average`
     flag will be used to indicate whether the list return value should be the
     list of readout values of length (args.samples) or be a 2-tuple indicating
-    the avearge and (reduced) standard deviation of the raw list.
+    the avearge and (reduced) standard deviation of the raw list. The averaged
+    readout is accumulated with readout_stats, so the readout values are never
+    stored.
+    """
+    if average:
+      return self._summarize(args, self.readout_stats(args))
+    else:
+      return self._run_readout(args, None)
+
+  def readout_stats(self, args, stats=None):
+    """
+    @brief Performing a readout routine, accumulating the readout values into a
+    cmod.stats.ReadoutStats object.
+
+    @details The scope-like readouts fill the accumulator directly from the C++
+    reduction of each event, so the memory usage does not grow with
+    args.samples. The accumulator holds the summary statistics as well as the
+    histogram of the readout values. If an existing accumulator is passed in,
+    the new readout values are added to it.
+    """
+    if stats is None:
+      stats = readoutstats.ReadoutStats()
+    return self._run_readout(args, stats)
+
+  def _run_readout(self, args, stats):
+    """
+    Common readout routine, returning the list of readout values if stats is
+    None, otherwise returning the filled stats object.
 
     For pausing the system we will be splitting the wait into 0.1 second
     interval to allow for the system to detect interuption signals to halt the
@@ -1642,34 +1694,112 @@ class readoutcmd(controlcmd):
       self.check_handle()
       time.sleep(0.1)
 
-    readout_list = []
     try:  # Stopping the stepper motors for cleaner readout
       self.gcoder.disablestepper(False, False, True)
     except:  # In case the gcode interface is not available, do nothing
       pass
 
+    result = self._read_device(args, stats)
+
+    try:  # Re-enable the stepper motors
+      self.gcoder.enablestepper(True, True, True)
+    except:  # In the case that the gcode interface isn't availabe, do nothing.
+      pass
+
+    return result
+
+  def _read_device(self, args, stats):
+    """
+    Readout of the device selected by the readout mode, with the same return
+    convention as _run_readout.
+    """
     if args.mode == readoutcmd.Mode.MODE_PICO:
-      readout_list = self.read_pico(args)
+      readout_list = self.read_pico(args, stats)
     elif args.mode == readoutcmd.Mode.MODE_ADC:
       readout_list = self.read_adc(args)
     elif args.mode == readoutcmd.Mode.MODE_DRS:
-      readout_list = self.read_drs(args)
+      readout_list = self.read_drs(args, stats)
     else:
       readout_list = self.read_model(args)
 
-    try:  # Re-enable the stepper motors
-      self.gcoder.enablestepper(True, True, True)
-    except:  # In the case that the gcode interface isn't availabe, do nothing.
-      pass
+    if stats is None:
+      return readout_list
+    elif readout_list is not stats:  # Readouts without C++ accumulation
+      stats.fill(readout_list)
+    return stats
 
-    if average:
-      if self._is_counting(args):
-        return np.mean(readout_list), np.std(readout_list) / np.sqrt(
-            args.samples)
-      else:
-        return np.mean(readout_list), np.std(readout_list)
+  def _summarize(self, args, stats):
+    """
+    Averaged readout value and uncertainty of the filled stats object.
+    """
+    if self._is_counting(args):
+      return stats.mean(), stats.stderr()
     else:
-      return readout_list
+      return stats.mean(), stats.std()
+
+  def scan_readout(self, args):
+    """
+    @brief Readout routine for the C++ scan executor (see run_scan).
+
+    @details For the hardware readout modes, this is the readout capsule of the
+    readout device, such that the readout at each scan point runs in C++ without
+    returning to python. The scope-like readouts are fired by the GPIO trigger
+    if it is available, and wait for an external trigger otherwise. Returns None
+    for the model readouts, which depend on the python gantry coordinates, so
+    these should use a python loop with move_gantry instead.
+    """
+    trigger = self.gpio.scan_trigger() if self.gpio.gpio_status() else None
+    if args.mode == readoutcmd.Mode.MODE_PICO:
+      return self.pico.scan_readout(args.samples, args.channel, args.intstart,
+                                    args.intstop, args.pedstart, args.pedstop,
+                                    trigger)
+    elif args.mode == readoutcmd.Mode.MODE_ADC:
+      return self.gpio.adc_scan_readout(args.channel, args.samples)
+    elif args.mode == readoutcmd.Mode.MODE_DRS:
+      return self.drs.scan_readout(args.samples, args.channel, args.intstart,
+                                   args.intstop, args.pedstart, args.pedstop,
+                                   trigger)
+    else:
+      return None
+
+  def scan_read(self, args):
+    """
+    @brief Python readout routine for the C++ scan executor (see run_scan).
+
+    @details Same as the averaged readout, except that the pause and the stepper
+    motor handling are left to the scan executor. This is called by the scan
+    executor while the gantry is locked, so the gantry must not be accessed.
+    """
+    return self._summarize(args,
+                           self._read_device(args, readoutstats.ReadoutStats()))
+
+  def run_scan(self, args, x, y, z, readout, fill=None):
+    """
+    @brief Running a scan over the listed gantry coordinates with the C++ scan
+    executor (see gcoder.run_scan).
+
+    @details The readout is either a capsule given by scan_readout, or a python
+    callable returning the readout value and uncertainty (see scan_read). The
+    gantry waits for args.pause seconds at each point before the readout. The
+    fill function is called as fill(row) in point order while the gantry moves
+    on to the next points, with the row being the confirmed gantry coordinates
+    followed by the readout value and uncertainty, and the progress bar is
+    updated for each point. Returns the table of all rows. The scan can be
+    interrupted by the termination signal.
+    """
+    def write(index, row):
+      if fill is not None:
+        fill(row)
+      self.pbar.update(1)
+
+    self.start_pbar(total=len(x))
+    return self.gcoder.run_scan(x,
+                                y,
+                                z,
+                                readout,
+                                settle=args.pause,
+                                interrupt=self.check_handle,
+                                write=write)
 
   def read_adc(self, args):
     """
@@ -1686,45 +1816,53 @@ class readoutcmd(controlcmd):
       time.sleep(1 / 200 * np.random.random())
     return val
 
-  def read_pico(self, args):
+  def read_pico(self, args, stats=None):
     """
     @brief Implementation for reading out the Picoscope
 
     @details Averaged readout of the picoscope. Here we always set the blocksize
     to be 1000 captures. This function will continuously fire the trigger system
-    until a single rapidblock has been completed.
+    until a single rapidblock has been completed. If a stats accumulator is
+    given, the block sums are filled into the accumulator instead of being
+    returned as a list.
     """
     Nblock = 1000
     val = []
-    while len(val) < args.samples:
+    nread = 0
+    while nread < args.samples:
       self.pico.setblocknums(Nblock, self.pico.postsamples, self.pico.presamples)
       self.pico.startrapidblocks()
       while not self.pico.isready():
         self._fire_trigger()
       self.pico.flushbuffer()
-      val.extend(
-          self.pico.waveformsum(args.channel, x, args.intstart, args.intstop,
-                                args.pedstart, args.pedstop)
-          for x in range(Nblock))
-    return val
+      if stats is None:
+        val.extend(
+            self.pico.block_sums(args.channel, args.intstart, args.intstop,
+                                 args.pedstart, args.pedstop))
+      else:
+        self.pico.block_stats(stats, args.channel, args.intstart, args.intstop,
+                              args.pedstart, args.pedstop)
+      nread += Nblock
+    return val if stats is None else stats
 
-  def read_drs(self, args):
+  def read_drs(self, args, stats=None):
     """
     @brief Implementation for reading out the DRS4
 
     @details As the DRS 4 will always effectively be in single shot mode, here we
-    will contiously fire the trigger until collections have been completed.
-    """
-    val = []
-    for _ in range(args.samples):
-      self.drs.startcollect()
-      while not self.drs.is_ready():
-        self._fire_trigger()
-      val.append(
-          self.drs.waveformsum(args.channel, args.intstart, args.intstop,
-                               args.pedstart, args.pedstop))
-
-    return val
+    will contiously fire the trigger until collections have been completed. The
+    event loop is handled by the C++ library in a single call, with the trigger
+    firing passed in as a callback. If a stats accumulator is given, the
+    waveform sums are filled into the accumulator instead of being returned.
+    """
+    if stats is None:
+      return self.drs.collect_sums(args.samples, args.channel, args.intstart,
+                                   args.intstop, args.pedstart, args.pedstop,
+                                   self._fire_trigger)
+    self.drs.collect_stats(stats, args.samples, args.channel, args.intstart,
+                           args.intstop, args.pedstart, args.pedstop,
+                           self._fire_trigger)
+    return stats
 
   def _fire_trigger(self, n=10, wait=100):
     """
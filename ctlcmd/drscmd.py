@@ -124,6 +124,12 @@ class drsrun(cmdbase.savefilecmd):
                              help="""
                              Store the sum of the waveform values instead of
                              waveforms itself""")
+    self.parser.add_argument('--binary',
+                             action='store_true',
+                             help="""
+                             Store the waveforms in the binary waveform format
+                             (see cmod/wavefile.py) in the save file path with an
+                             additional .bin suffix.""")
     self.parser.add_argument('--waittrigger',
                              type=int,
                              default=0,
@@ -164,6 +170,10 @@ class drsrun(cmdbase.savefilecmd):
           time=1.0 / self.drs.rate(), bits=4, adcval=0.1))
       self.savefile.flush()
 
+    binary = args.binary and not args.sum
+    if binary:
+      self.drs.open_wavefile(self.savefile.name + '.bin', args.channel)
+
     for _ in self.start_pbar(range(args.numevents)):
       self.drs.startcollect()
       tstart = time.time()
@@ -180,7 +190,9 @@ class drsrun(cmdbase.savefilecmd):
           self.drs.forcestop()
           time.sleep(0.001)
 
-      if not args.sum:
+      if binary:
+        self.drs.write_waveform()
+      elif not args.sum:
         line = self.drs.waveformstr(args.channel)
         self.savefile.write("{line}\n".format(line=line))
       else:
@@ -188,5 +200,8 @@ class drsrun(cmdbase.savefilecmd):
                                     args.pedstart, args.pedstop)
         self.savefile.write("{line}\n".format(line=line))
 
+    if binary:
+      self.drs.close_wavefile()
+
     if args.dumpbuffer:
       self.drs.dumpbuffer(args.channel)
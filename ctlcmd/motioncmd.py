@@ -211,7 +211,9 @@ class halign(cmdbase.readoutcmd, cmdbase.hscancmd, cmdbase.rootfilecmd):
     - Given the list of parsed coordinates in the arguments, we loop over the
       coordinates and take a luminosity measurement at each of the coordinate.
       Results are aggregated into a and array, and a measurement result is
-      listed for each measurement performed in the output save file.
+      listed for each measurement performed in the output save file. For the
+      hardware readouts, the loop runs in the C++ scan executor (see
+      cmdbase.readoutcmd.run_scan).
     - The results is fitted to the inverse square model, the initial fit
       results is estimated with the center coordinates taken to be the
       estimated luminosity center.
@@ -221,20 +223,25 @@ class halign(cmdbase.readoutcmd, cmdbase.hscancmd, cmdbase.rootfilecmd):
     self.gpio.pwm(0, args.power, 1e5)
     lumi = []
     unc = []
-    total = len(args.x)
 
-    n = 0
-    test1 = []
-    test2 = []
-    ## Running over mesh.
-    for xval, yval in self.start_pbar(zip(args.x, args.y)):
-      self.check_handle()
-      self.move_gantry(xval, yval, args.scanz)
-      lumival, uncval = self.readout(args, average=True)
-      self.fillroot({"lumival": lumival, "uncval": uncval}, det_id=args.detid)
+    def fill(lumival, uncval, gantry=None):
+      self.fillroot({"lumival": lumival, "uncval": uncval},
+                    det_id=args.detid,
+                    gantry=gantry)
       self.pbar_data(Lumi=f'{lumival:.2f}+-{uncval:.2f}')
       lumi.append(abs(lumival))
       unc.append(uncval)
+
+    ## Running over mesh.
+    readout = self.scan_readout(args)
+    if readout is not None:
+      self.run_scan(args, args.x, args.y, [args.scanz] * len(args.x), readout,
+                    lambda row: fill(row[3], row[4], row[:3]))
+    else:
+      for xval, yval in self.start_pbar(zip(args.x, args.y)):
+        self.check_handle()
+        self.move_gantry(xval, yval, args.scanz)
+        fill(*self.readout(args, average=True))
     # Performing fit
     p0 = (
         max(lumi) * ((args.scanz + 2)**2),  #
@@ -334,40 +341,65 @@ class zscan(cmdbase.singlexycmd, cmdbase.zscancmd, cmdbase.readoutcmd,
     arguments, we move the gantry over to the cooridnates, set the PWM
     settings, and take a measurement. The measurement is then saved to the
     standard data format. As there are no fitting done here, the command simply
-    exists once all data collection is complete.
+    exists once all data collection is complete. For the hardware readouts, the
+    loop runs in the C++ scan executor (see cmdbase.readoutcmd.run_scan), with
+    the readout returning to python if the PWM setting changes between points or
+    the picoscope range needs to be adjusted.
     """
-    lumi = []
-    unc = []
     # Ordering is important! Grouping z values together as the bottle neck is in
     # motion speed
-    for z, power in self.start_pbar(
-        [(z, p) for z in args.zlist for p in args.power]):
-      self.check_handle()
-      self.move_gantry(args.x, args.y, z)
-      self.gpio.pwm(0, power, 1e5)  # Maximum PWM frequency
-
-      lumival = 0
-      uncval = 0
-      while 1:
-        lumival, uncval = self.readout(args, average=True)
-        if args.mode == cmdbase.readoutcmd.Mode.MODE_PICO:
-          wmax = self.pico.waveformmax(args.channel)
-          current_range = self.pico.rangeA() if args.channel == 0 \
-                          else self.pico.rangeB()
-          if wmax < 100 and current_range > self.pico.rangemin():
-            self.pico.setrange(args.channel, current_range - 1)
-          elif wmax > 200 and current_range < self.pico.rangemax():
-            self.pico.setrange(args.channel, current_range + 1)
-          else:
-            break
-        else:
-          break
-
-      lumi.append(lumival)
-      unc.append(uncval)
-      self.fillroot({"lumival": lumival, "uncval": uncval}, det_id=args.detid)
+    points = [(z, p) for z in args.zlist for p in args.power]
+
+    def fill(lumival, uncval, gantry=None):
+      self.fillroot({"lumival": lumival, "uncval": uncval},
+                    det_id=args.detid,
+                    gantry=gantry)
       self.pbar_data(Lumi=f'{lumival:.2f}+-{uncval:.2f}')
 
+    readout = self.scan_readout(args)
+    if readout is None:  # Model readouts follow the python gantry coordinates
+      for z, power in self.start_pbar(points):
+        self.check_handle()
+        self.move_gantry(args.x, args.y, z)
+        self.gpio.pwm(0, power, 1e5)  # Maximum PWM frequency
+        fill(*self.readout(args, average=True))
+      return
+
+    if args.mode == cmdbase.readoutcmd.Mode.MODE_PICO or len(args.power) > 1:
+      powers = iter([p for _, p in points])
+
+      def readout():
+        self.gpio.pwm(0, next(powers), 1e5)  # Maximum PWM frequency
+        while True:
+          lumival, uncval = self.scan_read(args)
+          if not self.adjust_range(args):
+            return [lumival, uncval]
+    else:
+      self.gpio.pwm(0, args.power[0], 1e5)  # Maximum PWM frequency
+
+    self.run_scan(args, [args.x] * len(points), [args.y] * len(points),
+                  [z for z, _ in points], readout,
+                  lambda row: fill(row[3], row[4], row[:3]))
+
+  def adjust_range(self, args):
+    """
+    Adjusting the picoscope range to the last readout waveforms, returning
+    whether the range was changed (that is, whether the readout should be
+    repeated).
+    """
+    if args.mode != cmdbase.readoutcmd.Mode.MODE_PICO:
+      return False
+    wmax = self.pico.waveformmax(args.channel)
+    current_range = self.pico.rangeA() if args.channel == 0 \
+                    else self.pico.rangeB()
+    if wmax < 100 and current_range > self.pico.rangemin():
+      self.pico.setrange(args.channel, current_range - 1)
+      return True
+    elif wmax > 200 and current_range < self.pico.rangemax():
+      self.pico.setrange(args.channel, current_range + 1)
+      return True
+    return False
+
 
 class lowlightcollect(cmdbase.singlexycmd, cmdbase.readoutcmd,
                       cmdbase.rootfilecmd):
@@ -1,4 +1,5 @@
 import ctlcmd.cmdbase as cmdbase
+import time
 
 
 class picoset(cmdbase.controlcmd):
@@ -125,6 +126,12 @@ class picorunblock(cmdbase.savefilecmd):
                              help="""
                              Store the sum of the waveform values instead of
                              waveforms itself""")
+    self.parser.add_argument('--binary',
+                             action='store_true',
+                             help="""
+                             Store the waveforms in the binary waveform format
+                             (see cmod/wavefile.py) in the save file path with an
+                             additional .bin suffix.""")
 
   def run(self, args):
     ## First line in file contains convertion information
@@ -135,6 +142,9 @@ class picorunblock(cmdbase.savefilecmd):
           adc=self.pico.adc2mv(args.channel, 256)))
       self.savefile.flush()
 
+    if args.binary:
+      self.pico.open_wavefile(self.savefile.name + '.bin', args.channel)
+
     for i in range(args.numblocks):
       self.update('Collecting block...[{0:5d}/{1:d}]'.format(
           i,
@@ -142,18 +152,29 @@ class picorunblock(cmdbase.savefilecmd):
       ))
       self.pico.startrapidblocks()
 
-      while not self.pico.isready():
-        self.check_handle()
-        if self.gpio.gpio_status():
-          self.gpio.pulse(int(self.pico.ncaptures / 10), 100)
+      # Keeping the trigger running in the background while the block fills.
+      if self.gpio.gpio_status():
+        self.gpio.pulse_train_start(1e4)
+      try:
+        while not self.pico.isready():
+          self.check_handle()
+          time.sleep(0.001)
+      finally:
+        self.gpio.pulse_train_stop()
 
       self.pico.flushbuffer()
 
-      lines = [
-          self.pico.waveformstr(args.channel, cap)
-          for cap in range(self.pico.ncaptures)
-      ]
-      self.savefile.write("\n".join(lines))
+      if args.binary:
+        self.pico.write_block()
+      else:
+        lines = [
+            self.pico.waveformstr(args.channel, cap)
+            for cap in range(self.pico.ncaptures)
+        ]
+        self.savefile.write("\n".join(lines))
+
+    if args.binary:
+      self.pico.close_wavefile()
 
     if args.dumpbuffer:
       self.pico.dumpbuffer()
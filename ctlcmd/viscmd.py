@@ -38,9 +38,23 @@ class visualmeta(cmdbase.controlcmd):
 
   def show_img(self, args, raw=False):
     if args.monitor:
-      cv2.imshow(self.WINDOWS_NAME, np.copy(self.visual.get_image(raw)))
+      cv2.imshow(self.WINDOWS_NAME, self.visual.get_image(raw))
       cv2.waitKey(1)
 
+  def get_settled_result(self, args, timeout=5.0):
+    """
+    @brief Getting the visual processing results of a frame captured after the
+    gantry has settled.
+
+    @details Rather than pausing for a fixed amount of time after the motion
+    and taking whatever result is available, this requests the result of a
+    frame whose capture time is after the settling time of the latest motion.
+    The settling time is counted from the predicted arrival time (see the
+    `settle_time` method).
+    """
+    return self.visual.get_latest_after(
+        time.time() + self.settle_time(args.vwait), timeout)
+
   def post_run(self):
     cv2.destroyAllWindows()
 
@@ -88,6 +102,23 @@ class visualset(cmdbase.controlcmd):
                              help="""
                              Relative tolerance for performing polygon
                              approximation algorithm (0, 1)""")
+    self.parser.add_argument('--track',
+                             type=str,
+                             choices=['on', 'off'],
+                             help="""
+                             Whether to restrict the search to a region around
+                             the detector found in the previous frame""")
+    self.parser.add_argument('--margin',
+                             type=float,
+                             help="""
+                             Size of the tracking region relative to the size of
+                             the previously found detector (>1)""")
+    self.parser.add_argument('--pyramid',
+                             type=int,
+                             help="""
+                             Number of times the image is down-sampled by 2 for
+                             the coarse search when the detector is not tracked
+                             (0 to search the full resolution image)""")
 
   def run(self, args):
     if args.threshold:
@@ -102,6 +133,12 @@ class visualset(cmdbase.controlcmd):
       self.visual.ratio_cutoff = args.ratio
     if args.poly:
       self.visual.poly_range = args.poly
+    if args.track:
+      self.visual.tracking = (args.track == 'on')
+    if args.margin:
+      self.visual.roi_margin = args.margin
+    if args.pyramid is not None:
+      self.visual.pyramid_levels = args.pyramid
 
 
 class visualhscan(cmdbase.hscancmd, visualmeta, cmdbase.rootfilecmd):
@@ -147,9 +184,8 @@ class visualhscan(cmdbase.hscancmd, visualmeta, cmdbase.rootfilecmd):
     for xval, yval in self.start_pbar(zip(args.x, args.y)):
       self.check_handle()
       self.move_gantry(xval, yval, args.scanz)
-      time.sleep(args.vwait)
 
-      center = self.visual.get_latest()
+      center = self.get_settled_result(args)
       self.show_img(args, False)
 
       if center.x > 0 and center.y > 0:
@@ -266,12 +302,13 @@ class visualcenterdet(cmdbase.singlexycmd, visualmeta):
     center = None
 
     for _ in range(16):
+      center = self.get_settled_result(args)
       for __ in range(8):
-        center = self.visual.get_latest()
         self.show_img(args, False)
         if center.x > 0:
           break
-        time.sleep(0.2)
+        ## Retrying on the next frame that is captured
+        center = self.visual.get_latest_after(time.time(), 5.0)
 
       ## Early exit if det is not found.
       if (center.x < 0 or center.y < 0):
@@ -290,9 +327,8 @@ class visualcenterdet(cmdbase.singlexycmd, visualmeta):
       if np.linalg.norm(motionxy) < 0.1: break
       self.move_gantry(self.gcoder.opx + motionxy[0],
                        self.gcoder.opy + motionxy[1], self.gcoder.opz)
-      time.sleep(args.vwait)  ## Waiting for the gantry to stop moving
 
-    center = self.visual.get_latest()
+    center = self.get_settled_result(args)
     self.printmsg(
       'Gantry position: x={0:.1f} y={1:.1f} | '\
       'Det FOV position: x={2:.1f} y={3:.1f}'.
@@ -366,9 +402,8 @@ class visualmaxsharp(cmdbase.singlexycmd, cmdbase.zscancmd, visualmeta):
     for z in args.zlist:
       self.check_handle()
       self.move_gantry(args.x, args.y, z)
-      time.sleep(args.vwait)
 
-      center = self.visual.get_latest()
+      center = self.get_settled_result(args)
       self.show_img(args, True)
       laplace.append(center.s2)
       # Information
@@ -475,9 +510,8 @@ class visualzscan(cmdbase.singlexycmd, cmdbase.zscancmd, visualmeta,
       # Checking termination signal
       self.check_handle()
       self.move_gantry(args.x, args.y, z)
-      time.sleep(args.wait)
 
-      center = self.visual.get_latest()
+      center = self.get_settled_result(args)
       self.show_img(args, True)
       laplace.append(center.sharpness)
       reco_x.append(center.x)
@@ -300,6 +300,7 @@ class GUISession(object):
         # ('/databyprocess/<process>/<detid>', 'databyprocess'),  #
         ('/visual', 'visual'),  #
         ('/logdump/<logtype>', 'logdump'),  #
+        ('/metrics/<fmt>', 'metrics'),  #
     ]:
       setattr(self, f'view_{vfunc}', getattr(views, vfunc)(self))
       self.app.add_url_rule(url,
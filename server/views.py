@@ -18,6 +18,7 @@ main session instance.
 from flask import render_template, Response, jsonify
 import cv2, io, time
 import numpy as np
+import cmod.latency as latency
 
 
 class ViewFunction(object):
@@ -306,6 +307,25 @@ class visual(ViewFunction):
                     mimetype='multipart/x-mixed-replace; boundary=frame')
 
 
+class metrics(ViewFunction):
+  """
+  Returning the latency histograms of the instrumented device sections (see
+  src/latency.hpp), either as a json file, or in the Prometheus text format if
+  the requested format is `prometheus`, such that the session can be scraped
+  by an external monitoring server.
+  """
+  def view(self, fmt):
+    if fmt == 'prometheus':
+      return Response(latency.prometheus(),
+                      mimetype='text/plain; version=0.0.4')
+    return jsonify({
+        'request_timestamp': time.time(),
+        'compiled': latency.compiled,
+        'enabled': latency.enabled(),
+        'sections': latency.snapshot()
+    })
+
+
 class logdump(ViewFunction):
   """
   Returning the monitoring stream as a single json file
@@ -0,0 +1,97 @@
+#ifndef DEVICECALL_HPP
+#define DEVICECALL_HPP
+
+#include "latency.hpp"
+
+#include <mutex>
+#include <pybind11/pybind11.h>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @brief Helper functions for binding the methods of the singleton devices
+ * (see singleton.hpp) to python. Only to be used by the python bindings.
+ *
+ * The wrapped method is called with the python GIL released, while holding the
+ * access mutex of the device. The GIL is always released before the mutex is
+ * acquired, so a thread waiting for the device never blocks other python
+ * threads (or other devices). The return value is copied while the mutex is
+ * held, and converted to python after the GIL is re-acquired. The time spent
+ * waiting for the access mutex is recorded in the `<DeviceName>.lock_wait`
+ * latency section, and the time spent in the method itself (excluding the
+ * python conversions) in the `<DeviceName>.call` section.
+ * @{
+ */
+template<typename C>
+inline unsigned
+DeviceLatencyId( const char* section )
+{
+  return LatencyId( ( std::string( C::DeviceName )+"."+section ).c_str() );
+}
+
+
+template<typename C>
+inline std::unique_lock<std::recursive_mutex>
+DeviceCallLock( const C& self )
+{
+#ifdef SIPM_LATENCY
+  static const unsigned id = DeviceLatencyId<C>( "lock_wait" );
+  const LatencyTimer    timer( id );
+#endif
+  return std::unique_lock<std::recursive_mutex>( self.access_mutex() );
+}
+
+
+#ifdef SIPM_LATENCY
+#define DEVICECALL_LATENCY( C )                                       \
+  static const unsigned _call_id = DeviceLatencyId<C>( "call" );      \
+  const LatencyTimer    _call_timer( _call_id )
+#else
+#define DEVICECALL_LATENCY( C )
+#endif
+
+
+template<typename C, typename R, typename ... Args>
+inline auto
+DeviceCall( R ( C::* f )( Args... ) )
+{
+  return [f]( C& self, Args... args ) -> typename std::decay<R>::type {
+           pybind11::gil_scoped_release release;
+           const auto                   lock = DeviceCallLock( self );
+           DEVICECALL_LATENCY( C );
+           return ( self.*f )( std::forward<Args>( args )... );
+         };
+}
+
+
+template<typename C, typename R, typename ... Args>
+inline auto
+DeviceCall( R ( C::* f )( Args... ) const )
+{
+  return [f]( const C& self, Args... args ) -> typename std::decay<R>::type {
+           pybind11::gil_scoped_release release;
+           const auto                   lock = DeviceCallLock( self );
+           DEVICECALL_LATENCY( C );
+           return ( self.*f )( std::forward<Args>( args )... );
+         };
+}
+
+
+/**
+ * @brief Locking the device for a block of code that is already running with
+ * the GIL released (ex: in custom binding functions, or in the scan routines
+ * passed as capsules).
+ */
+template<typename C>
+inline std::unique_lock<std::recursive_mutex>
+DeviceLock( const C& device )
+{
+  return std::unique_lock<std::recursive_mutex>( device.access_mutex() );
+}
+
+#undef DEVICECALL_LATENCY
+
+/** @} */
+
+#endif
@@ -22,13 +22,27 @@
  * [ref]: https://www.psi.ch/en/drs/software-download
  */
 #include "drs.hpp"
+#include "latency.hpp"
 #include "logger.hpp"
+#include "waveformkernel.hpp"
 
 #include <fmt/printf.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <stdexcept>
 #include <unistd.h>
 
+/**
+ * @brief Bit mask of the first n global channels.
+ */
+static inline unsigned
+ChannelBits( const unsigned n )
+{
+  return n >= 32 ? ~0u : ( 1u << n )-1;
+}
+
+
 /**
  * @brief Initializing the DRS4 container in single shot mode, and external
  * triggers.
@@ -37,6 +51,11 @@
  * is needed for out single-shot operation. We also include explicit settings
  * commented out to make sure future development doesn't open certain settings
  * that is already known to cause issues by accident.
+ *
+ * All attached boards (up to maxboards) are initialized with the same
+ * settings, with the channels of the additional boards being indexed after the
+ * channels of the first board (board b channel c has the global index
+ * b*4+c). The channels of the additional boards are enabled by default.
  */
 void
 DRSContainer::Init()
@@ -53,33 +72,52 @@ DRSContainer::Init()
   if( !drs->GetNumberOfBoards() ){
     throw device_exception( DeviceName, "No DRS boards found" );
   }
+  if( (unsigned)drs->GetNumberOfBoards() > maxboards ){
+    printwarn( DeviceName, fmt::sprintf( "Only using the first %u DRS boards",
+                                         maxboards ) );
+  }
+
+  boards.clear();
+  for( int i = 0; i < std::min( drs->GetNumberOfBoards(), (int)maxboards ); ++i ){
+    DRSBoard* b = drs->GetBoard( i );
+    b->Init();
+    sprintf( errmsg,
+             "Found DRS%d board on USB, serial #%04d, firmware revision %5d\n",
+             b->GetDRSType(),
+             b->GetBoardSerialNumber(),
+             b->GetFirmwareVersion() );
+    printdebug( DeviceName, errmsg );
+    boards.push_back( b );
+  }
+  board = boards.front();
 
-  // Only getting the first board for now.
-  board = drs->GetBoard( 0 );
-  board->Init();
-  sprintf( errmsg,
-           "Found DRS%d board on USB, serial #%04d, firmware revision %5d\n",
-           board->GetDRSType(),
-           board->GetBoardSerialNumber(),
-           board->GetFirmwareVersion() );
-  printdebug( DeviceName, errmsg );
+  // Per channel caches for all channels of all boards
+  const unsigned nglobal = nchannels * boards.size();
+  channelmask = ( channelmask & ChannelBits( nchannels ) )
+                | ( ChannelBits( nglobal ) & ~ChannelBits( nchannels ) );
+  triggercell.assign( boards.size(), 0 );
+  waveid.assign( nglobal, -1 );
+  wavecache.assign( nglobal, std::vector<float>( maxdepth, 0 ) );
+  cellwidth.assign( nglobal, std::vector<float>( ncells, 0.5 ) );
 
   // 2 microsecond sleep to allow for settings to settle down
   usleep( 2 );
 
   // Running the various common settings required for the SiPM calibration
-  // board->SetChannelConfig( 0, 8, 8 );// 1024 binning
-  board->SetFrequency( 2.0, true );// Running at target 2GHz sample rate.
-  // DO NOT ENABLE TRANSPARENT MODE!!!
-  // board->SetTranspMode( 1 );
-  // board->SetDominoMode( 0 );// Singe shot mode
-  // board->SetReadoutMode( 1 );// Read most recent
-
-  /* set input range to -0.5V ... +0.5V */
-  board->SetInputRange( 0 );
-
-  // DO NOT ENABLE INTERNAL CLOCK CALIBRATION!!
-  // board->EnableTcal( 1 );
+  for( DRSBoard* b : boards ){
+    // b->SetChannelConfig( 0, 8, 8 );// 1024 binning
+    b->SetFrequency( 2.0, true );// Running at target 2GHz sample rate.
+    // DO NOT ENABLE TRANSPARENT MODE!!!
+    // b->SetTranspMode( 1 );
+    // b->SetDominoMode( 0 );// Singe shot mode
+    // b->SetReadoutMode( 1 );// Read most recent
+
+    /* set input range to -0.5V ... +0.5V */
+    b->SetInputRange( 0 );
+
+    // DO NOT ENABLE INTERNAL CLOCK CALIBRATION!!
+    // b->EnableTcal( 1 );
+  }
   // By default setting to use the external trigger
   SetTrigger( 4,// Channel external trigger
               0.05,// Trigger on 0.05 voltage
@@ -87,6 +125,7 @@ DRSContainer::Init()
               0 );// 0 nanosecond delay by default.
   // Additional two microsecond sleep for configuration to get through.
   usleep( 2 );
+  CacheTiming();
 
   printdebug( DeviceName, "Completed setting DRS Container" );
 }
@@ -96,16 +135,98 @@ DRSContainer::Init()
  * @brief Waiting for the DRS4 to be ready for data transfer.
  *
  * This function will suspend the thread indefinitely until the DRS4 is ready
- * for data transfer operation. After the suspension, the data will always be
- * flushed to the main buffer (as this main program is only ever intended to be
- * done with the DRS4 running in single-shot mode).
+ * for data transfer operation. After the suspension, the data of the enabled
+ * channels will be flushed to the main buffer (as this main program is only
+ * ever intended to be done with the DRS4 running in single-shot mode).
+ *
+ * The transfer is only performed once per event: the transfer is tagged with
+ * the event counter, and is skipped if the current event has already been
+ * transferred, so that multiple accessors for the same event only pay for the
+ * USB transfer once. The trigger wait and the USB transfer are recorded in the
+ * `drs.trigger_wait` and `drs.transfer` latency sections. With multiple boards,
+ * this waits for all boards to be triggered, and only the boards with enabled
+ * channels are transferred.
  */
 void
 DRSContainer::WaitReady()
 {
   CheckAvailable();
-  while( board->IsBusy() ){usleep( 2 );
-  } board->TransferWaves( 0, 8 );// Flush all waveforms into buffer.
+  CheckIdle();
+  if( !( channelmask & ChannelBits( NumChannels() ) ) ){
+    throw device_exception( DeviceName, "No DRS channels enabled for readout" );
+  }
+  {
+    LATENCY_SCOPE( "drs.trigger_wait" );
+    while( !IsReady() ){
+      usleep( 2 );
+    }
+  }
+  if( transferid == eventid ){ return; }
+
+  LATENCY_SCOPE( "drs.transfer" );
+  for( unsigned b = 0; b < boards.size(); ++b ){
+    unsigned first, last;
+    if( TransferRange( b, first, last ) ){
+      boards[b]->TransferWaves( first, last );
+    }
+    triggercell[b] = boards[b]->GetTriggerCell( 0 );
+  }
+  transferid = eventid;
+}
+
+
+/**
+ * @brief Getting the range of chip channels of a board to transfer for the
+ * enabled channels, returns false if no channels of the board are enabled.
+ *
+ * Notice that chip channel index 0-1 both correspond to the physical channel
+ * 1 input, so only the chip channel range covering the enabled physical
+ * channels are transferred.
+ */
+bool
+DRSContainer::TransferRange( const unsigned b,
+                             unsigned&      first,
+                             unsigned&      last ) const
+{
+  first = nchannels;
+  last  = 0;
+  for( unsigned i = 0; i < nchannels; ++i ){
+    if( channelmask & ( 1u << ( b * nchannels+i ) ) ){
+      first = std::min( first, i );
+      last  = std::max( last, i );
+    }
+  }
+  if( first > last ){ return false; }
+  first = 2 * first;
+  last  = 2 * last+1;
+  return true;
+}
+
+
+/**
+ * @brief Getting the cached waveform of the current event for a given channel.
+ *
+ * The waveform is decoded from the transferred buffer at most once per event,
+ * subsequent calls for the same event and channel return the same cached
+ * buffer. The returned pointer is valid until the next event is decoded.
+ */
+const float*
+DRSContainer::GetWaveCache( const unsigned channel )
+{
+  CheckChannel( channel );
+  WaitReady();
+  if( waveid[channel] != eventid ){
+    LATENCY_SCOPE( "drs.decode" );
+    const int status = boards[channel / nchannels]->GetWave(
+      0,
+      ( channel % nchannels ) * 2,
+      wavecache[channel].data() );
+    if( status ){
+      throw device_exception( DeviceName, "Error running DRSBoard::GetWave" );
+    }
+    waveid[channel] = eventid;
+  }
+  return wavecache[channel].data();
 }
 
 
@@ -117,16 +238,64 @@ DRSContainer::WaitReady()
  * can be reused between calibration runs. However, it is found that the timing
  * variation from a regular interval deducted from the sample frequency is small
  * enough that this function is only included for the sake of debugging and
- * display. The timing returned is in units of nanoseconds.
+ * display. The timing returned is in units of nanoseconds. The array is
+ * constructed from cached cell widths (see CacheTiming) rotated to the trigger
+ * cell of the current event, so no additional board queries are made.
  */
 std::vector<float>
 DRSContainer::GetTimeArray( const unsigned channel )
 {
-  static const unsigned len = 2048;
-  float                 time_array[len];
+  const unsigned            index  = channel % NumChannels();
+  const std::vector<float>& width  = cellwidth[index];
+  const unsigned            length = board->GetChannelDepth();
+  std::vector<float>        time_array( length, 0 );
   WaitReady();
-  board->GetTime( 0, 2 * channel, board->GetTriggerCell( 0 ), time_array );
-  return std::vector<float>( time_array, time_array+len );
+  const int tcell = triggercell[index / nchannels];
+  for( unsigned i = 1; i < length; ++i ){
+    time_array[i] = time_array[i-1]+width[( i-1+tcell ) % ncells];
+  }
+  return time_array;
+}
+
+
+/**
+ * @brief Getting the cached time width (in nanoseconds) of each of the domino
+ * cells of a channel, indexed by the cell number rather than the sample number.
+ */
+std::vector<float>
+DRSContainer::GetCellWidths( const unsigned channel ) const
+{
+  return cellwidth[channel % NumChannels()];
+}
+
+
+/**
+ * @brief Caching the sampling rate and the per-cell time widths.
+ *
+ * This should be called whenever the sampling frequency or the timing
+ * calibration changes. The DRS API only provides the timing as an integrated
+ * time array starting from some cell, here we extract the width of each cell
+ * from the un-rotated array, with the width of the last cell (which wraps
+ * around to the first cell) extracted from an array starting on cell 1. The
+ * cell widths are cached for each board, with the sampling rate of the first
+ * board being used for all boards.
+ */
+void
+DRSContainer::CacheTiming()
+{
+  float time_array[maxdepth];
+  board->ReadFrequency( 0, &rate );
+  for( unsigned b = 0; b < boards.size(); ++b ){
+    for( unsigned ch = 0; ch < nchannels; ++ch ){
+      std::vector<float>& width = cellwidth[b * nchannels+ch];
+      boards[b]->GetTime( 0, 2 * ch, 0, time_array, true, false );
+      for( unsigned i = 0; i+1 < ncells; ++i ){
+        width[i] = time_array[i+1]-time_array[i];
+      }
+      boards[b]->GetTime( 0, 2 * ch, 1, time_array, true, true );
+      width[ncells-1] = time_array[ncells-1]-time_array[ncells-2];
+    }
+  }
 }
 
 
@@ -144,17 +313,8 @@ DRSContainer::GetTimeArray( const unsigned channel )
 std::vector<float>
 DRSContainer::GetWaveform( const unsigned channel )
 {
-  static const unsigned len = 2048;
-  float                 waveform[len];
-  WaitReady();
-
-  // Notice that channel index 0-1 both correspond to the the physical
-  // channel 1 input, and so on.
-  int status = board->GetWave( 0, channel * 2, waveform );
-  if( status ){
-    throw device_exception( DeviceName, "Error running DRSBoard::GetWave" );
-  }
-  return std::vector<float>( waveform, waveform+len );
+  const float* waveform = GetWaveCache( channel );
+  return std::vector<float>( waveform, waveform+maxdepth );
 }
 
 
@@ -169,7 +329,7 @@ DRSContainer::GetWaveform( const unsigned channel )
 std::string
 DRSContainer::WaveformStr( const unsigned channel )
 {
-  const auto     waveform = GetWaveform( channel );
+  const float*   waveform = GetWaveCache( channel );
   const unsigned length   =
     std::min((unsigned)board->GetChannelDepth(), samples );
   std::string ans( 4 * length, '\0' );
@@ -196,8 +356,10 @@ DRSContainer::WaveformStr( const unsigned channel )
  * The integration window and pedestal window is specified by sample indices,
  * so you will need to calculate the required window from the timing
  * information. The return will be single double for the waveform area in units
- * of mV x ns. Notice that timing information will *NOT* be used, as we simply
- * assuming perfect temporal spacing between the sampled values.
+ * of mV x ns. By default timing information will *NOT* be used, as we simply
+ * assuming perfect temporal spacing between the sampled values. If the time
+ * weighted flag is set (SetTimeWeighted), each sample is instead weighted by
+ * the cached width of the domino cell it was sampled on.
  *
  * In case you do not want to to perform pedestal subtraction, the starting the
  * stopping indices to the same value.
@@ -209,34 +371,747 @@ DRSContainer::WaveformSum( const unsigned channel,
                            const unsigned _pedstart,
                            const unsigned _pedstop )
 {
-  const auto     waveform = GetWaveform( channel );
-  const unsigned maxlen   = board->GetChannelDepth();
-  double         pedvalue = 0;
+  const float* waveform = GetWaveCache( channel );
+  return Integrate( waveform,
+                    triggercell[channel / nchannels],
+                    channel,
+                    _intstart,
+                    _intstop,
+                    _pedstart,
+                    _pedstop );
+}
+
+
+/**
+ * @brief Integration of a waveform over the integration window, with pedestal
+ * subtraction, with the trigger cell of the waveform required for the time
+ * weighted integration. See WaveformSum for the details.
+ */
+double
+DRSContainer::Integrate( const float*   waveform,
+                         const int      tcell,
+                         const unsigned channel,
+                         const unsigned _intstart,
+                         const unsigned _intstop,
+                         const unsigned _pedstart,
+                         const unsigned _pedstop ) const
+{
+  const unsigned       maxlen = board->GetChannelDepth();
+  const WaveformWindow window = { _intstart, _intstop, _pedstart, _pedstop };
+  if( timeweighted ){
+    const unsigned intstart = std::min( maxlen, _intstart );
+    const unsigned intstop  = std::max( intstart, std::min( maxlen, _intstop ) );
+    const double   pedvalue = _pedstart == _pedstop ? 0.0 :
+                              WaveformKernelPedestal( waveform,
+                                                      _pedstart,
+                                                      std::min( maxlen, _pedstop ) );
+    const double ans = WaveformKernelWeightedSum( waveform,
+                                                  cellwidth[channel].data(),
+                                                  ncells,
+                                                  tcell,
+                                                  pedvalue,
+                                                  intstart,
+                                                  intstop );
+    return -ans;// Negative to correct pulse direction
+  }
+  const WaveformReduction<float> red = WaveformKernelReduce( waveform,
+                                                             maxlen,
+                                                             window );
+  return -red.integral / rate;// Negative to correct pulse direction
+}
+
+
+/**
+ * @brief Running N single-shot acquisitions and returning the waveform sums of
+ * a given channel for each of the events.
+ *
+ * This is the batched equivalent of calling StartCollect, polling IsReady and
+ * calling WaveformSum N times from python, such that the arm/trigger/transfer/
+ * integrate cycle never leaves C++. The integration and pedestal windows are
+ * interpreted the same way as in the WaveformSum method.
+ *
+ * The optional trigger callback is invoked repeatedly while the board is
+ * waiting for a trigger (typically used to fire the GPIO trigger pulses). If no
+ * callback is given, the function will simply wait for an external trigger, as
+ * with the WaitReady method, the user is responsible for making sure the
+ * trigger is provided.
+ */
+std::vector<double>
+DRSContainer::CollectSums( const unsigned               n,
+                           const unsigned               channel,
+                           const unsigned               intstart,
+                           const unsigned               intstop,
+                           const unsigned               pedstart,
+                           const unsigned               pedstop,
+                           const std::function<void()>& trigger )
+{
+  CheckAvailable();
+  std::vector<double> ans;
+  ans.reserve( n );
+  for( unsigned i = 0; i < n; ++i ){
+    CollectNext( trigger );
+    ans.push_back( WaveformSum( channel, intstart, intstop, pedstart, pedstop ) );
+  }
+  return ans;
+}
+
+
+/**
+ * @brief Collecting n events like CollectSums, but filling the waveform sums
+ * into a readout accumulator instead of returning them, such that the memory
+ * used does not grow with the number of events.
+ */
+void
+DRSContainer::CollectStats( ReadoutStats&                stats,
+                            const unsigned               n,
+                            const unsigned               channel,
+                            const unsigned               intstart,
+                            const unsigned               intstop,
+                            const unsigned               pedstart,
+                            const unsigned               pedstop,
+                            const std::function<void()>& trigger )
+{
+  CheckAvailable();
+  for( unsigned i = 0; i < n; ++i ){
+    CollectNext( trigger );
+    stats.Fill( WaveformSum( channel, intstart, intstop, pedstart, pedstop ) );
+  }
+}
+
+
+/**
+ * @brief Starting a single-shot collection and waiting for it to finish,
+ * firing the trigger (or sleeping, for external triggers) while waiting.
+ */
+void
+DRSContainer::CollectNext( const std::function<void()>& trigger )
+{
+  StartCollect();
+  while( !IsReady() ){
+    if( trigger ){
+      trigger();
+    } else {
+      usleep( 2 );
+    }
+  }
+}
+
+
+/**
+ * @brief Starting the background acquisition threads.
+ *
+ * The acquisition threads (one per board) continuously run single-shot
+ * collections, with the boards being re-armed as soon as the waveforms of an
+ * event have been transferred to the host, such that the DRS4 collects the next
+ * event while the previous event is being decoded and processed. Finished
+ * events of the enabled channels are stored in a per-board ring buffer holding
+ * up to `capacity` events, which can be drained in batches using the PopSums,
+ * PopWaveforms and PopEvents methods. If the ring buffer of a board is full,
+ * new events of the board are dropped (see DroppedEvents).
+ *
+ * The trigger is not handled by the acquisition threads, the user is
+ * responsible for providing the triggers while the loop is running. While the
+ * loop is running, all other methods that would access the boards will raise
+ * an exception.
+ */
+void
+DRSContainer::StartAcquisition( const unsigned capacity )
+{
+  CheckAvailable();
+  CheckIdle();
+  if( !( channelmask & ChannelBits( NumChannels() ) ) ){
+    throw device_exception( DeviceName, "No DRS channels enabled for readout" );
+  }
 
-  // Getting the pedestal value if required
-  if( _pedstart != _pedstop ){
-    const unsigned pedstart = std::max( unsigned(0), _pedstart );
-    const unsigned pedstop  = std::min( maxlen, _pedstop );
-    for( unsigned i = pedstart; i < pedstop; ++i ){
-      pedvalue += waveform[i];
+  // Threads of a loop stopped by an error are still joinable
+  StopAcquisition();
+  acq.clear();
+  for( unsigned b = 0; b < boards.size(); ++b ){
+    acq.emplace_back( new BoardAcquisition() );
+    acq.back()->events.Reset( capacity,
+                              DRSEvent { 0, 0, std::vector<float>(
+                                           nchannels * maxdepth, 0 ) } );
+    acq.back()->dropped = 0;
+  }
+  unmatched = 0;
+  acqcycle  = 0;
+  acqarmed  = 0;
+  acqdone   = 0;
+  acqfirst  = 0;
+  runacq    = true;
+  for( unsigned b = 0; b < boards.size(); ++b ){
+    acq[b]->thread = std::thread( [this, b]{
+      this->RunAcquisitionLoop( b, std::ref( runacq ) );
+    } );
+  }
+}
+
+
+/**
+ * @brief Stopping the background acquisition threads. Events already in the
+ * ring buffers can still be drained after the loop has stopped.
+ */
+void
+DRSContainer::StopAcquisition()
+{
+  runacq = false;
+  { std::lock_guard<std::mutex> lock( acqmutex ); }
+  acqcv.notify_all();
+  for( auto& a : acq ){
+    if( a->thread.joinable() ){
+      a->thread.join();
     }
-    pedvalue /= (double)( pedstop-pedstart );
   }
+}
+
+
+/**
+ * @brief The main loop for the background acquisition thread of a board.
+ *
+ * The DRS4 boards do not number their events, so the threads of all boards run
+ * in lock step: each board is armed once per acquisition cycle, and the cycle
+ * only ends once all boards are done, such that the cycle number is the
+ * trigger number shared by all boards. If a board is still waiting for the
+ * trigger `maxskew` after another board was triggered in the same cycle, it is
+ * considered to have missed the trigger and is stopped with a software
+ * trigger, and no event is stored for the board in this cycle. The partial
+ * events are discarded when the events are merged (see AlignEvents).
+ *
+ * For daisy-chained boards (see SetDaisyChain), the first board is only armed
+ * after all other boards of the chain, such that every trigger of the first
+ * board reaches the full chain. With parallel boards, triggers arriving while
+ * the boards are being re-armed may only be seen by some of the boards, and
+ * the trigger interval should be longer than `maxskew`, such that a missed
+ * trigger cannot be mistaken for the trigger of the next cycle.
+ *
+ * Errors raised in the loop are stored and stop the loop, rather than being
+ * logged from the acquisition thread, such that the error reaches the user as
+ * an exception: the stored error is raised when the user attempts to drain the
+ * buffer.
+ */
+void
+DRSContainer::RunAcquisitionLoop( const unsigned b, std::atomic<bool>& run )
+{
+  typedef std::chrono::steady_clock clock;
+  static constexpr int64_t maxskew = 200000;// ns
+  auto now = [](){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock::now().time_since_epoch() ).count();
+  };
+
+  DRSBoard*         dev   = boards[b];
+  BoardAcquisition& state = *acq[b];
+  const unsigned    n     = boards.size();
+
+  // Arming the board, with the first board of a daisy chain being armed last.
+  auto arm = [&](){
+    if( daisychain && n > 1 && b == 0 ){
+      std::unique_lock<std::mutex> lock( acqmutex );
+      acqcv.wait( lock, [&]{ return acqarmed+1 == n || !run; } );
+    }
+    dev->StartDomino();
+    if( daisychain && b != 0 ){
+      { std::lock_guard<std::mutex> lock( acqmutex ); ++acqarmed; }
+      acqcv.notify_all();
+    }
+  };
+
+  try {
+    unsigned   first, last;
+    const bool transfer = TransferRange( b, first, last );
+    uint64_t   cycle    = 0;
+    arm();
+    while( run == true ){
+      // Waiting for the trigger.
+      bool missed = false;
+      while( dev->IsBusy() && run == true ){
+        const int64_t t0 = acqfirst;
+        if( t0 != 0 && now()-t0 > maxskew ){
+          dev->SoftTrigger();
+          while( dev->IsBusy() ){ usleep( 2 ); }
+          missed = true;
+          break;
+        }
+        usleep( 2 );
+      }
+      if( run == false ){ break; }
+
+      int tcell = 0;
+      if( !missed ){
+        int64_t expected = 0;
+        acqfirst.compare_exchange_strong( expected, now() );
+        LATENCY_SCOPE( "drs.acq.transfer" );
+        if( transfer ){
+          dev->TransferWaves( first, last );
+        }
+        tcell = dev->GetTriggerCell( 0 );
+      }
+
+      // Waiting for all boards to complete the cycle.
+      {
+        std::unique_lock<std::mutex> lock( acqmutex );
+        if( ++acqdone == n ){
+          acqdone  = 0;
+          acqarmed = 0;
+          acqfirst = 0;
+          ++acqcycle;
+          ++eventid;
+          lock.unlock();
+          acqcv.notify_all();
+        } else {
+          acqcv.wait( lock, [&]{ return acqcycle != cycle || !run; } );
+        }
+      }
+      if( run == false ){ break; }
+
+      // Re-arming the board immediately, the transferred data remains in the
+      // host buffer until the next transfer.
+      arm();
+
+      if( !missed && transfer ){
+        DRSEvent* event = state.events.BeginWrite();
+        if( event == nullptr ){
+          ++state.dropped;
+        } else {
+          LATENCY_SCOPE( "drs.acq.decode" );
+          event->id          = cycle;
+          event->triggercell = tcell;
+          for( unsigned ch = 0; ch < nchannels; ++ch ){
+            if( channelmask & ( 1u << ( b * nchannels+ch ) ) ){
+              dev->GetWave( 0,
+                            ch * 2,
+                            event->waveform.data()+ch * maxdepth,
+                            true,
+                            tcell );
+            }
+          }
+          state.events.EndWrite();
+        }
+      }
+      ++cycle;
+    }
+  } catch( std::exception& e ){
+    state.error = e.what();
+    run         = false;
+    { std::lock_guard<std::mutex> lock( acqmutex ); }
+    acqcv.notify_all();
+  }
+}
+
+
+/**
+ * @brief Whether the background acquisition loop is running.
+ */
+bool
+DRSContainer::IsAcquiring() const
+{
+  return runacq;
+}
+
+
+/**
+ * @brief Number of events buffered by all boards waiting to be drained. Notice
+ * that this is an upper bound of the number of merged events, as partial
+ * events are discarded when the events are merged. Boards without enabled
+ * channels do not store events, and are skipped like in AlignEvents.
+ */
+unsigned
+DRSContainer::BufferedEvents() const
+{
+  size_t ans = 0;
+  bool   any = false;
+  for( unsigned b = 0; b < acq.size(); ++b ){
+    unsigned first, last;
+    if( !TransferRange( b, first, last ) ){ continue; }
+    const size_t n = acq[b]->events.Size();
+    ans = any ? std::min( ans, n ) : n;
+    any = true;
+  }
+  return ans;
+}
+
 
-  // Running the additional parsing.
-  const unsigned intstart  = std::max( unsigned(0), _intstart );
-  const unsigned intstop   = std::min( maxlen, _intstop );
-  double         ans       = 0;
-  const double   timeslice = 1.0 / GetRate();
-  for( unsigned i = intstart; i < intstop; ++i ){
-    ans += waveform[i];
+/**
+ * @brief Number of board events dropped since the acquisition loop started due
+ * to the ring buffer of the board being full.
+ */
+uint64_t
+DRSContainer::DroppedEvents() const
+{
+  uint64_t ans = 0;
+  for( const auto& a : acq ){
+    ans += a->dropped;
   }
-  ans -= pedvalue * ( intstop-intstart );
-  ans *= -timeslice;// Negative to correct pulse direction
   return ans;
 }
 
 
+/**
+ * @brief Number of board events discarded when merging the events, because
+ * the event of the same trigger was missed or dropped by another board.
+ */
+uint64_t
+DRSContainer::UnmatchedEvents() const
+{
+  return unmatched;
+}
+
+
+/**
+ * @brief Aligning the oldest buffered events of all boards by trigger number,
+ * discarding the events whose trigger is missing on some of the boards.
+ *
+ * Returns true with the events of the same trigger stored in heads (which
+ * must be released with ReleaseEvents), or false if any of the boards has no
+ * buffered events. Boards without enabled channels do not store events, and
+ * are not used for the alignment.
+ */
+bool
+DRSContainer::AlignEvents( const DRSEvent** heads )
+{
+  while( true ){
+    uint64_t target = 0;
+    bool     any    = false;
+    for( unsigned b = 0; b < acq.size(); ++b ){
+      unsigned first, last;
+      heads[b] = nullptr;
+      if( !TransferRange( b, first, last ) ){ continue; }
+      heads[b] = acq[b]->events.BeginRead();
+      if( heads[b] == nullptr ){ return false; }
+      target = std::max( target, heads[b]->id );
+      any    = true;
+    }
+    if( !any ){ return false; }
+
+    bool aligned = true;
+    for( unsigned b = 0; b < acq.size(); ++b ){
+      if( heads[b] != nullptr && heads[b]->id < target ){
+        acq[b]->events.EndRead();
+        ++unmatched;
+        aligned = false;
+      }
+    }
+    if( aligned ){ return true; }
+  }
+}
+
+
+/**
+ * @brief Releasing the events returned by AlignEvents.
+ */
+void
+DRSContainer::ReleaseEvents()
+{
+  for( unsigned b = 0; b < acq.size(); ++b ){
+    unsigned first, last;
+    if( TransferRange( b, first, last ) ){
+      acq[b]->events.EndRead();
+    }
+  }
+}
+
+
+/**
+ * @brief Raising the error stored by the acquisition threads, if the loop was
+ * stopped by an error.
+ */
+void
+DRSContainer::CheckAcqError() const
+{
+  if( runacq ){ return; }
+  for( const auto& a : acq ){
+    if( !a->error.empty() ){
+      throw device_exception( DeviceName, a->error );
+    }
+  }
+}
+
+
+/**
+ * @brief Draining up to maxevents merged events from the acquisition ring
+ * buffers, returning the waveform sums of a channel. See WaveformSum for the
+ * integration and pedestal window definition.
+ */
+std::vector<double>
+DRSContainer::PopSums( const unsigned channel,
+                       const unsigned intstart,
+                       const unsigned intstop,
+                       const unsigned pedstart,
+                       const unsigned pedstop,
+                       const unsigned maxevents )
+{
+  CheckChannel( channel );
+  const unsigned               b      = channel / nchannels;
+  const unsigned               offset = ( channel % nchannels ) * maxdepth;
+  std::vector<const DRSEvent*> heads( acq.size() );
+  std::vector<double>          ans;
+  ans.reserve( std::min( maxevents, BufferedEvents() ) );
+  while( ans.size() < maxevents && AlignEvents( heads.data() ) ){
+    ans.push_back( Integrate( heads[b]->waveform.data()+offset,
+                              heads[b]->triggercell,
+                              channel,
+                              intstart,
+                              intstop,
+                              pedstart,
+                              pedstop ) );
+    ReleaseEvents();
+  }
+  if( ans.empty() ){ CheckAcqError(); }
+  return ans;
+}
+
+
+/**
+ * @brief Draining up to maxevents merged events from the acquisition ring
+ * buffers into a readout accumulator, returning the number of events drained.
+ */
+unsigned
+DRSContainer::PopStats( ReadoutStats&  stats,
+                        const unsigned channel,
+                        const unsigned intstart,
+                        const unsigned intstop,
+                        const unsigned pedstart,
+                        const unsigned pedstop,
+                        const unsigned maxevents )
+{
+  CheckChannel( channel );
+  const unsigned               b      = channel / nchannels;
+  const unsigned               offset = ( channel % nchannels ) * maxdepth;
+  std::vector<const DRSEvent*> heads( acq.size() );
+  unsigned                     n = 0;
+  for( ; n < maxevents && AlignEvents( heads.data() ); ++n ){
+    stats.Fill( Integrate( heads[b]->waveform.data()+offset,
+                           heads[b]->triggercell,
+                           channel,
+                           intstart,
+                           intstop,
+                           pedstart,
+                           pedstop ) );
+    ReleaseEvents();
+  }
+  if( n == 0 ){ CheckAcqError(); }
+  return n;
+}
+
+
+/**
+ * @brief Draining up to maxevents merged events from the acquisition ring
+ * buffers, returning the waveforms of a channel as a flat array of
+ * [event][GetSamples()] values in units of mV.
+ */
+std::vector<float>
+DRSContainer::PopWaveforms( const unsigned channel, const unsigned maxevents )
+{
+  CheckChannel( channel );
+  const unsigned               length = GetSamples();
+  const unsigned               b      = channel / nchannels;
+  const unsigned               offset = ( channel % nchannels ) * maxdepth;
+  std::vector<const DRSEvent*> heads( acq.size() );
+  std::vector<float>           ans;
+  ans.reserve( std::min( maxevents, BufferedEvents() ) * length );
+  for( unsigned n = 0; n < maxevents && AlignEvents( heads.data() ); ++n ){
+    const float* waveform = heads[b]->waveform.data()+offset;
+    ans.insert( ans.end(), waveform, waveform+length );
+    ReleaseEvents();
+  }
+  if( ans.empty() ){ CheckAcqError(); }
+  return ans;
+}
+
+
+/**
+ * @brief Removing the unused preallocated columns of a [row][capacity][length]
+ * array once only n columns have been filled.
+ */
+template<typename T>
+static void
+CompactRows( std::vector<T>& x,
+             const size_t    rows,
+             const size_t    capacity,
+             const size_t    n,
+             const size_t    length )
+{
+  for( size_t r = 1; r < rows && n < capacity; ++r ){
+    std::copy( x.begin()+r * capacity * length,
+               x.begin()+( r * capacity+n ) * length,
+               x.begin()+r * n * length );
+  }
+  x.resize( rows * n * length );
+}
+
+
+/**
+ * @brief Draining up to maxevents merged events from the acquisition ring
+ * buffers, with the waveforms of all enabled channels of all boards.
+ *
+ * The events are returned in a structure-of-arrays layout: the trigger number
+ * of each event, the trigger cells as a [board][event] array, and the
+ * waveforms (in units of mV) as a [channel][event][GetSamples()] array, with
+ * the channels rows being the enabled channels in the order of the global
+ * channel index (also listed in the `channels` field). Only one copy of the
+ * waveform is made per event.
+ */
+DRSContainer::EventBlock
+DRSContainer::PopEvents( const unsigned maxevents )
+{
+  EventBlock ans;
+  ans.samples = GetSamples();
+  for( unsigned ch = 0; ch < NumChannels(); ++ch ){
+    if( channelmask & ( 1u << ch ) ){ ans.channels.push_back( ch ); }
+  }
+
+  const unsigned nboards  = acq.size();
+  const unsigned nrows    = ans.channels.size();
+  const unsigned capacity = std::min( maxevents, BufferedEvents() );
+  ans.trigger.reserve( capacity );
+  ans.triggercell.resize( (size_t)nboards * capacity, 0 );
+  ans.waveform.resize( (size_t)nrows * capacity * ans.samples );
+
+  std::vector<const DRSEvent*> heads( nboards );
+  unsigned                     n = 0;
+  for( ; n < capacity && AlignEvents( heads.data() ); ++n ){
+    for( unsigned b = 0; b < nboards; ++b ){
+      if( heads[b] == nullptr ){ continue; }
+      ans.triggercell[(size_t)b * capacity+n] = heads[b]->triggercell;
+      if( ans.trigger.size() == n ){ ans.trigger.push_back( heads[b]->id ); }
+    }
+    for( unsigned r = 0; r < nrows; ++r ){
+      const unsigned ch  = ans.channels[r];
+      const float*   src = heads[ch / nchannels]->waveform.data()
+                           +( ch % nchannels ) * maxdepth;
+      std::copy( src, src+ans.samples,
+                 ans.waveform.begin()+( (size_t)r * capacity+n ) * ans.samples );
+    }
+    ReleaseEvents();
+  }
+  CompactRows( ans.triggercell, nboards, capacity, n, 1 );
+  CompactRows( ans.waveform,    nrows,   capacity, n, ans.samples );
+  ans.nevents = n;
+  if( n == 0 ){ CheckAcqError(); }
+  return ans;
+}
+
+
+/**
+ * @brief Draining up to maxevents merged events from the acquisition ring
+ * buffers, returning the waveform sums of all enabled channels of all boards
+ * as a [channel][event] array, with the channel rows in the same order as
+ * PopEvents. See WaveformSum for the integration and pedestal window
+ * definition.
+ */
+std::vector<double>
+DRSContainer::PopEventSums( const unsigned intstart,
+                            const unsigned intstop,
+                            const unsigned pedstart,
+                            const unsigned pedstop,
+                            const unsigned maxevents )
+{
+  std::vector<unsigned> channels;
+  for( unsigned ch = 0; ch < NumChannels(); ++ch ){
+    if( channelmask & ( 1u << ch ) ){ channels.push_back( ch ); }
+  }
+
+  const unsigned               nrows    = channels.size();
+  const unsigned               capacity = std::min( maxevents, BufferedEvents() );
+  std::vector<double>          ans( (size_t)nrows * capacity );
+  std::vector<const DRSEvent*> heads( acq.size() );
+  unsigned                     n = 0;
+  for( ; n < capacity && AlignEvents( heads.data() ); ++n ){
+    for( unsigned r = 0; r < nrows; ++r ){
+      const unsigned  ch    = channels[r];
+      const DRSEvent* event = heads[ch / nchannels];
+      ans[(size_t)r * capacity+n] = Integrate(
+        event->waveform.data()+( ch % nchannels ) * maxdepth,
+        event->triggercell,
+        ch,
+        intstart,
+        intstop,
+        pedstart,
+        pedstop );
+    }
+    ReleaseEvents();
+  }
+  CompactRows( ans, nrows, capacity, n, 1 );
+  if( n == 0 ){ CheckAcqError(); }
+  return ans;
+}
+
+
+/**
+ * @brief Opening a binary waveform file for storing the waveforms of a given
+ * channel.
+ *
+ * The waveform values are stored in the same 16 bit with 0.1mV per bit
+ * convention as the WaveformStr method, with the number of samples per frame
+ * fixed to the current GetSamples value. See the @ref wavefile group for the
+ * file format. If the file already exists, new frames are appended.
+ */
+void
+DRSContainer::OpenWaveFile( const std::string& path, const unsigned channel )
+{
+  CheckAvailable();
+  CheckChannel( channel );
+  wavefile.Open( path, channel, GetSamples(), 1.0 / rate, 0.1 );
+  wavechannel = channel;
+}
+
+
+/**
+ * @brief Flushing and closing the binary waveform file.
+ */
+void
+DRSContainer::CloseWaveFile()
+{
+  wavefile.Close();
+}
+
+
+/**
+ * @brief Writing the waveform of the current event to the binary waveform
+ * file.
+ *
+ * The conversion is performed directly into the file output buffer, so no
+ * intermediate containers are created per event.
+ */
+void
+DRSContainer::WriteWaveform()
+{
+  const float* waveform = GetWaveCache( wavechannel );
+  int16_t*     frame    = wavefile.NextFrame();
+  for( unsigned i = 0; i < wavefile.Samples(); ++i ){
+    frame[i] = waveform[i] / 0.1;
+  }
+  wavefile.CommitFrame();
+}
+
+
+/**
+ * @brief Draining up to maxevents merged events from the acquisition ring
+ * buffers directly into the binary waveform file. Returns the number of events
+ * written.
+ */
+unsigned
+DRSContainer::PopToWaveFile( const unsigned maxevents )
+{
+  CheckChannel( wavechannel );
+  const unsigned               b      = wavechannel / nchannels;
+  const unsigned               offset = ( wavechannel % nchannels ) * maxdepth;
+  std::vector<const DRSEvent*> heads( acq.size() );
+  unsigned                     n = 0;
+  for( ; n < maxevents && AlignEvents( heads.data() ); ++n ){
+    const float* waveform = heads[b]->waveform.data()+offset;
+    int16_t*     frame    = wavefile.NextFrame();
+    for( unsigned i = 0; i < wavefile.Samples(); ++i ){
+      frame[i] = waveform[i] / 0.1;
+    }
+    wavefile.CommitFrame();
+    ReleaseEvents();
+  }
+  if( n == 0 ){ CheckAcqError(); }
+  return n;
+}
+
+
 /**
  * @brief Printing the latest buffer collection results on the screen for
  * debugging.
@@ -249,7 +1124,7 @@ DRSContainer::WaveformSum( const unsigned channel,
 void
 DRSContainer::DumpBuffer( const unsigned channel )
 {
-  const auto     waveform     = GetWaveform( channel );
+  const float*   waveform     = GetWaveCache( channel );
   const auto     time_array   = GetTimeArray( channel );
   const unsigned length       = GetSamples();
   std::string    output_table = "";
@@ -268,6 +1143,10 @@ DRSContainer::DumpBuffer( const unsigned channel )
  * For the channel, use 4 to set to external trigger. The level and direction
  * will only be used if the trigger channel is set to one of the readout
  * channels. Delay will always be in units of nanoseconds.
+ *
+ * With multiple boards, the settings are applied to all boards, except for
+ * daisy-chained boards (see SetDaisyChain), where the boards after the first
+ * board are triggered by the external trigger input.
  */
 void
 DRSContainer::SetTrigger( const unsigned channel,
@@ -276,19 +1155,27 @@ DRSContainer::SetTrigger( const unsigned channel,
                           const double   delay )
 {
   CheckAvailable();
-  board->EnableTrigger( 1, 0 );// Using hardware trigger
-  board->SetTriggerSource( 1 << channel );
   triggerchannel = channel;
+  for( unsigned b = 0; b < boards.size(); ++b ){
+    boards[b]->EnableTrigger( 1, 0 );// Using hardware trigger
+    if( daisychain && b > 0 ){
+      boards[b]->SetTriggerSource( 1 << 4 );
+    } else {
+      boards[b]->SetTriggerSource( 1 << channel );
 
-  // Certain trigger settings are only used for internal triggers.
+      // Certain trigger settings are only used for internal triggers.
+      if( channel < 4 ){
+        boards[b]->SetTriggerLevel( level );
+        boards[b]->SetTriggerPolarity( direction );
+      }
+    }
+    boards[b]->SetTriggerDelayNs( delay );
+  }
   if( channel < 4 ){
-    board->SetTriggerLevel( level );
-    triggerlevel = level;
-    board->SetTriggerPolarity( direction );
+    triggerlevel     = level;
     triggerdirection = direction;
   }
   triggerdelay = delay;
-  board->SetTriggerDelayNs( delay );
 
   // Sleeping to allow settings to settle.
   usleep( 500 );
@@ -345,22 +1232,133 @@ void
 DRSContainer::SetRate( const double x )
 {
   CheckAvailable();
-  board->SetFrequency( x, true );
+  CheckIdle();
+  for( DRSBoard* b : boards ){
+    b->SetFrequency( x, true );
+  }
+  CacheTiming();
 }
 
 
 /**
  * @brief Getting the true sampling rate
  *
+ * The value is cached whenever the rate is changed, so this does not query
+ * the board.
+ *
  * @return double
  */
 double
 DRSContainer::GetRate()
 {
   CheckAvailable();
-  double ans;
-  board->ReadFrequency( 0, &ans );
-  return ans;
+  return rate;
+}
+
+
+/**
+ * @brief Setting whether the waveform summation uses the per-cell time widths
+ * as integration weights instead of a uniform time slice.
+ */
+void
+DRSContainer::SetTimeWeighted( const bool x )
+{
+  timeweighted = x;
+}
+
+
+/**
+ * @brief Getting whether the waveform summation uses per-cell time widths.
+ */
+bool
+DRSContainer::TimeWeighted() const
+{
+  return timeweighted;
+}
+
+
+/**
+ * @brief Setting which of the input channels are transferred for each event
+ * as a bit mask (bit 0 for the first input channel), with bit b*4+c for the
+ * input channel c of board b.
+ */
+void
+DRSContainer::SetChannelMask( const unsigned x )
+{
+  CheckIdle();
+  channelmask = x & ChannelBits( NumChannels() );
+  transferid  = eventid-1;// Forcing the next access to re-transfer.
+}
+
+
+/**
+ * @brief Getting the bit mask of channels transferred for each event.
+ */
+unsigned
+DRSContainer::ChannelMask() const
+{
+  return channelmask;
+}
+
+
+/**
+ * @brief Number of DRS boards in use.
+ */
+unsigned
+DRSContainer::NumBoards() const
+{
+  return boards.size();
+}
+
+
+/**
+ * @brief Number of input channels over all boards in use, which is the range
+ * of the global channel index.
+ */
+unsigned
+DRSContainer::NumChannels() const
+{
+  return wavecache.size();
+}
+
+
+/**
+ * @brief Setting whether the boards are daisy-chained, with the trigger output
+ * of each board connected to the trigger input of the next board.
+ *
+ * For daisy-chained boards, only the first board uses the trigger settings
+ * (see SetTrigger), and the acquisition loop always arms the first board last
+ * (see RunAcquisitionLoop). Otherwise, the boards are assumed to be triggered
+ * in parallel by the same trigger signal.
+ */
+void
+DRSContainer::SetDaisyChain( const bool x )
+{
+  CheckIdle();
+  daisychain = x;
+  if( IsAvailable() ){
+    SetTrigger( triggerchannel, triggerlevel, triggerdirection, triggerdelay );
+  }
+}
+
+
+/**
+ * @brief Getting whether the boards are daisy-chained.
+ */
+bool
+DRSContainer::DaisyChain() const
+{
+  return daisychain;
+}
+
+
+/**
+ * @brief Getting the event counter, incremented for each collection request.
+ */
+uint64_t
+DRSContainer::EventID() const
+{
+  return eventid;
 }
 
 
@@ -391,7 +1389,23 @@ void
 DRSContainer::StartCollect()
 {
   CheckAvailable();
-  board->StartDomino();
+  CheckIdle();
+  ++eventid;
+  ArmBoards();
+}
+
+
+/**
+ * @brief Arming all boards for a single-shot collection, with the first board
+ * armed last, such that daisy-chained boards are ready when the first board is
+ * triggered.
+ */
+void
+DRSContainer::ArmBoards()
+{
+  for( auto it = boards.rbegin(); it != boards.rend(); ++it ){
+    ( *it )->StartDomino();
+  }
 }
 
 
@@ -402,7 +1416,9 @@ void
 DRSContainer::ForceStop()
 {
   CheckAvailable();
-  board->SoftTrigger();
+  for( DRSBoard* b : boards ){
+    b->SoftTrigger();
+  }
 }
 
 
@@ -419,6 +1435,35 @@ DRSContainer::CheckAvailable() const
 }
 
 
+/**
+ * @brief Checking that a channel is enabled for readout. Throw exception if
+ * not.
+ */
+void
+DRSContainer::CheckChannel( const unsigned channel ) const
+{
+  if( channel >= NumChannels() || !( channelmask & ( 1u << channel ) ) ){
+    throw device_exception( DeviceName,
+                            fmt::sprintf( "DRS channel [%u] is not enabled",
+                                          channel ) );
+  }
+}
+
+
+/**
+ * @brief Checking that the background acquisition loop is not running. Throw
+ * exception if it is, as the board is owned by the acquisition thread.
+ */
+void
+DRSContainer::CheckIdle() const
+{
+  if( runacq ){
+    throw device_exception( DeviceName,
+                            "DRS4 board is in use by the acquisition loop" );
+  }
+}
+
+
 /**
  * @brief True/False flag for whether the DRS4 is available for operation.
  */
@@ -430,12 +1475,15 @@ DRSContainer::IsAvailable() const
 
 
 /**
- * @brief Simple check for whether data collection has finished.
+ * @brief Simple check for whether data collection has finished on all boards.
  */
 bool
 DRSContainer::IsReady()
 {
-  return !board->IsBusy();
+  for( DRSBoard* b : boards ){
+    if( b->IsBusy() ){ return false; }
+  }
+  return true;
 }
 
 
@@ -460,11 +1508,15 @@ public:
 
   // Running the time calibration and voltage calibration each time the DRS is
   // initialized.
+  CheckIdle();
   DummyCallback _d;
-  board->SetFrequency( 2.0, true );
-  board->CalibrateTiming( &_d );
-  board->SetRefclk( 0 );
-  board->CalibrateVolt( &_d );
+  for( DRSBoard* b : boards ){
+    b->SetFrequency( 2.0, true );
+    b->CalibrateTiming( &_d );
+    b->SetRefclk( 0 );
+    b->CalibrateVolt( &_d );
+  }
+  CacheTiming();
 
   // After running, we will need to reset the board trigger configurations
   // By default setting to use the external trigger
@@ -477,9 +1529,32 @@ public:
 
 IMPLEMENT_SINGLETON( DRSContainer );
 
-DRSContainer::DRSContainer() : board( nullptr ){}
+DRSContainer::DRSContainer() : board( nullptr ),
+  daisychain                      ( false ),
+  samples                         ( 1024 ),
+  channelmask                     ( ( 1 << nchannels )-1 ),
+  eventid                         ( 0 ),
+  transferid                      ( -1 ),
+  triggercell                     ( 1, 0 ),
+  waveid                          ( nchannels, -1 ),
+  wavecache                       ( nchannels,
+                                    std::vector<float>( maxdepth, 0 ) ),
+  rate                            ( 2.0 ),
+  timeweighted                    ( false ),
+  cellwidth                       ( nchannels,
+                                    std::vector<float>( ncells, 0.5 ) ),
+  runacq                          ( false ),
+  unmatched                       ( 0 ),
+  acqcycle                        ( 0 ),
+  acqarmed                        ( 0 ),
+  acqdone                         ( 0 ),
+  acqfirst                        ( 0 ),
+  wavechannel                     ( 0 )
+{
+}
 
 DRSContainer::~DRSContainer()
 {
   printdebug( DeviceName, "Deallocating the DRS controller" );
+  StopAcquisition();
 }
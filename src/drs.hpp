@@ -2,10 +2,18 @@
 #define DRS_HPP
 
 #include "DRS.h"
+#include "readoutstats.hpp"
+#include "ringbuffer.hpp"
 #include "singleton.hpp"
+#include "wavefile.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 class DRSContainer
@@ -22,11 +30,15 @@ public:
                    const double   delay );
   void SetRate( const double frequency );
   void SetSamples( const unsigned );
+  void SetChannelMask( const unsigned );
+  void SetTimeWeighted( const bool );
+  void SetDaisyChain( const bool );
 
   // Direct interfaces
   void               WaitReady();
   std::vector<float> GetWaveform( const unsigned channel );
   std::vector<float> GetTimeArray( const unsigned channel );
+  std::vector<float> GetCellWidths( const unsigned channel ) const;
 
   // High level interfaces
   std::string WaveformStr( const unsigned channel );
@@ -35,6 +47,69 @@ public:
                            const unsigned intstop  = -1,
                            const unsigned pedstart = -1,
                            const unsigned pedstop  = -1 );
+  std::vector<double> CollectSums( const unsigned                n,
+                                   const unsigned                channel,
+                                   const unsigned                intstart = -1,
+                                   const unsigned                intstop  = -1,
+                                   const unsigned                pedstart = -1,
+                                   const unsigned                pedstop  = -1,
+                                   const std::function<void()>& trigger  =
+                                     nullptr );
+  void CollectStats( ReadoutStats&                stats,
+                     const unsigned               n,
+                     const unsigned               channel,
+                     const unsigned               intstart = -1,
+                     const unsigned               intstop  = -1,
+                     const unsigned               pedstart = -1,
+                     const unsigned               pedstop  = -1,
+                     const std::function<void()>& trigger  = nullptr );
+
+  // Background acquisition loop
+  void                StartAcquisition( const unsigned capacity = 256 );
+  void                StopAcquisition();
+  bool                IsAcquiring() const;
+  unsigned            BufferedEvents() const;
+  uint64_t            DroppedEvents() const;
+  std::vector<double> PopSums( const unsigned channel,
+                               const unsigned intstart,
+                               const unsigned intstop,
+                               const unsigned pedstart,
+                               const unsigned pedstop,
+                               const unsigned maxevents = -1 );
+  std::vector<float> PopWaveforms( const unsigned channel,
+                                   const unsigned maxevents = -1 );
+  unsigned PopStats( ReadoutStats&  stats,
+                     const unsigned channel,
+                     const unsigned intstart,
+                     const unsigned intstop,
+                     const unsigned pedstart,
+                     const unsigned pedstop,
+                     const unsigned maxevents = -1 );
+
+  // Merged events of all enabled channels of all boards, in a
+  // structure-of-arrays layout (see PopEvents).
+  struct EventBlock
+  {
+    unsigned              nevents;
+    unsigned              samples;
+    std::vector<unsigned> channels;// Global index of each channel row
+    std::vector<uint64_t> trigger;// [event]
+    std::vector<int>      triggercell;// [board][event]
+    std::vector<float>    waveform;// [channel][event][sample]
+  };
+  EventBlock          PopEvents( const unsigned maxevents = -1 );
+  std::vector<double> PopEventSums( const unsigned intstart,
+                                    const unsigned intstop,
+                                    const unsigned pedstart,
+                                    const unsigned pedstop,
+                                    const unsigned maxevents = -1 );
+  uint64_t UnmatchedEvents() const;
+
+  // Binary waveform file output
+  void     OpenWaveFile( const std::string& path, const unsigned channel );
+  void     CloseWaveFile();
+  void     WriteWaveform();
+  unsigned PopToWaveFile( const unsigned maxevents = -1 );
 
   // Debugging methods
   void     DumpBuffer( const unsigned channel );
@@ -46,14 +121,24 @@ public:
   double   TriggerLevel();
   double   GetRate();
   unsigned GetSamples();
+  unsigned ChannelMask() const;
+  unsigned NumBoards() const;
+  unsigned NumChannels() const;
+  bool     DaisyChain() const;
+  uint64_t EventID() const;
+  bool     TimeWeighted() const;
   bool     IsAvailable() const;
   bool     IsReady();
   void     CheckAvailable() const;
 
 private:
-  // Variables for handling the various handles.
-  std::unique_ptr<DRS> drs;
-  DRSBoard*            board;
+  // Variables for handling the various handles. The first board is the
+  // primary board, which also serves as the master board for daisy-chained
+  // triggers.
+  std::unique_ptr<DRS>    drs;
+  DRSBoard*               board;
+  std::vector<DRSBoard*>  boards;
+  bool                    daisychain;
 
   // Time samples
   double   triggerlevel;
@@ -61,6 +146,83 @@ private:
   int      triggerdirection;
   double   triggerdelay;
   unsigned samples;
+
+  // Per-event cache of the transferred waveforms. The event counter is
+  // incremented every time a new collection is requested, the cached
+  // waveforms are only valid if their ID matches the current event counter.
+  // Channels are indexed globally over all boards, with nchannels channels per
+  // board, such that the channel mask can hold up to maxboards boards.
+  static constexpr unsigned       nchannels = 4;
+  static constexpr unsigned       maxboards = 8;
+  static constexpr unsigned       maxdepth  = 2048;
+  unsigned                        channelmask;
+  std::atomic<uint64_t>           eventid;
+  uint64_t                        transferid;
+  std::vector<int>                triggercell;
+  std::vector<uint64_t>           waveid;
+  std::vector<std::vector<float> > wavecache;
+
+  // Cached timing information, only updated when the sampling rate or the
+  // timing calibration changes.
+  static constexpr unsigned        ncells = 1024;
+  double                           rate;
+  bool                             timeweighted;
+  std::vector<std::vector<float> > cellwidth;
+
+  const float* GetWaveCache( const unsigned channel );
+  void         CacheTiming();
+  void         CheckIdle() const;
+  void         CheckChannel( const unsigned ) const;
+  bool         TransferRange( const unsigned board,
+                              unsigned&      first,
+                              unsigned&      last ) const;
+  void         ArmBoards();
+  void         CollectNext( const std::function<void()>& trigger );
+  double       Integrate( const float*    waveform,
+                          const int      tcell,
+                          const unsigned channel,
+                          const unsigned intstart,
+                          const unsigned intstop,
+                          const unsigned pedstart,
+                          const unsigned pedstop ) const;
+
+  // Events collected by the acquisition threads, with one thread and one ring
+  // buffer per board. The waveforms of all channels of a board are stored in a
+  // single flat array of [channel][maxdepth], and the event ID is the trigger
+  // number shared by all boards (see RunAcquisitionLoop).
+  struct DRSEvent
+  {
+    uint64_t           id;
+    int                triggercell;
+    std::vector<float> waveform;
+  };
+  struct BoardAcquisition
+  {
+    RingBuffer<DRSEvent>  events;
+    std::thread           thread;
+    std::atomic<uint64_t> dropped;
+    std::string           error;
+  };
+  std::vector<std::unique_ptr<BoardAcquisition> > acq;
+  std::atomic<bool>                               runacq;
+  uint64_t                                        unmatched;
+
+  // Arming cycle shared by the acquisition threads.
+  std::mutex              acqmutex;
+  std::condition_variable acqcv;
+  uint64_t                acqcycle;
+  unsigned                acqarmed;
+  unsigned                acqdone;
+  std::atomic<int64_t>    acqfirst;
+
+  void RunAcquisitionLoop( const unsigned board, std::atomic<bool>& );
+  bool AlignEvents( const DRSEvent** heads );
+  void ReleaseEvents();
+  void CheckAcqError() const;
+
+  // Binary output file
+  WaveFileWriter wavefile;
+  unsigned       wavechannel;
   DECLARE_SINGLETON( DRSContainer );
 };
 
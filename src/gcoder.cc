@@ -26,17 +26,22 @@
  * [marlin]: https://marlinfw.org/meta/gcode/
  */
 #include "gcoder.hpp"
+#include "latency.hpp"
 #include "logger.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
 
 // Stuff required for tty input and output
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/file.h>
 #include <termios.h>
@@ -86,6 +91,7 @@ GCoder::Init( const std::string& dev )
   struct termios tty;
   char           errormessage[2048];
 
+  StopIOThread();
   dev_path   = dev;
   printer_IO = open( dev.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_ASYNC );
 
@@ -138,16 +144,17 @@ GCoder::Init( const std::string& dev )
     throw device_exception( DeviceName, errormessage );
   }
 
+  StartIOThread();
+
   printmsg( DeviceName, "Waking up printer...." );
   std::this_thread::sleep_for( std::chrono::seconds( 5 ) );
   SendHome( true, true, true );
-  std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
 
   // Setting speed to be as fast as possible
   SetSpeedLimit( 1000, 1000, 1000 );
 
   // Setting acceleration to 3x the factory default:
-  RunGcode( "M201 X1000 Y1000 Z300\n", 0, 1e5 );
+  SetAccelLimit( 1000, 1000, 300 );
 
   return;
 }
@@ -162,94 +169,356 @@ GCoder::Init( const std::string& dev )
  * return value. Notice that the function will check the return string for the
  * acknowledgement string ("ok" at the start of a line) to know that the
  * command has been executed by the printer. If this acknowledgement string is
- * not received after a wait period, then the command is tried again up to 10
- * times.
+ * not received after a wait period (in units of microseconds), then the
+ * command is tried again up to 10 times.
  *
  * Notice that exactly when the acknowledgement string is reported will depend
  * on the gcode command in question, and so later functions of abstracting
  * gcode commands should be responsible for choosing an appropriate timeout
  * duration to reduce multiple function calls.
+ *
+ * The command is passed to the IO thread command queue (see SubmitGcode), and
+ * this function simply blocks until the command has been acknowledged. The
+ * full round trip is recorded in the `gcoder.run` latency section.
  */
 std::string
 GCoder::RunGcode( const std::string& gcode,
                   const unsigned     attempt,
                   const unsigned     waitack ) const
 {
-  using namespace std::chrono;
+  LATENCY_SCOPE( "gcoder.run" );
+  char       msg[1024];
+  const bool debug = log_enabled( 6 );// Skipping the formatting if not logged
+
+  // Pretty output
+  if( debug ){
+    std::string pstring = gcode;
+    pstring[pstring.length()-1] = '\0';// Getting rid of trailing new line
 
-  // static variables
-  static const unsigned maxtry     = 10;
-  static const unsigned buffersize = 65536;
+    sprintf( msg,
+             "[%s] to USBTERM[%d] (attempt %u)...",
+             pstring.c_str(),
+             printer_IO,
+             attempt );
+    printdebug( DeviceName, msg );
+  }
 
-  // Readout data
-  char        buffer[buffersize];
-  char        msg[1024];
-  int         readlen;
-  std::string ackstr = "";
-  bool        awk    = false;
+  const std::string ackstr = SubmitGcode( gcode, waitack, nullptr, attempt ).get();
 
-  // Pretty output
-  std::string pstring = gcode;
-  pstring[pstring.length()-1] = '\0';// Getting rid of trailing new line
+  if( debug ){
+    strcat( msg, "... Done!" );
+    printdebug( DeviceName, msg );
+  }
+  return ackstr;
+}
 
-  sprintf( msg,
-           "[%s] to USBTERM[%d] (attempt %u)...",
-           pstring.c_str(),
-           printer_IO,
-           attempt );
 
-  if( printer_IO < 0 ){
+/**
+ * @brief Adding a gcode command to the command queue without waiting for the
+ * acknowledgement.
+ *
+ * The IO thread sends queued commands to the printer as soon as there are
+ * fewer than the maximum number of in-flight commands (see SetMaxInFlight),
+ * such that the printer firmware planner buffer can be kept filled. The
+ * acknowledgements are matched to the in-flight commands in the order the
+ * commands were sent. The returned future holds the return string of the
+ * printer, or the exception if the command was not acknowledged after 10
+ * attempts. The optional callback is invoked on the IO thread with the return
+ * string as soon as the acknowledgement is received, and so should not block.
+ */
+std::shared_future<std::string>
+GCoder::SubmitGcode( const std::string& gcode,
+                     const unsigned     waitack,
+                     const AckCallback& callback,
+                     const unsigned     attempt ) const
+{
+  if( printer_IO < 0 || !io_run ){
     throw device_exception( DeviceName, "Printer is not available for commands" );
   }
 
-  if( attempt >= maxtry ){
+  std::unique_ptr<GCodeCommand> cmd( new GCodeCommand() );
+  cmd->gcode    = gcode;
+  cmd->waitack  = waitack;
+  cmd->attempt  = attempt;
+  cmd->callback = callback;
+  std::shared_future<std::string> ans = cmd->ack.get_future().share();
+  {
+    std::lock_guard<std::mutex> lock( queue_mutex );
+    pending.push_back( std::move( cmd ) );
+  }
+
+  // Waking the IO thread from poll.
+  const char c = 0;
+  write( wake_pipe[1], &c, 1 );
+  return ans;
+}
+
+
+/**
+ * @brief Blocking until all submitted commands have been acknowledged (or have
+ * failed).
+ */
+void
+GCoder::WaitQueue() const
+{
+  std::unique_lock<std::mutex> lock( queue_mutex );
+  queue_cv.wait( lock, [this]{
+    return ( pending.empty() && inflight.empty() ) || !io_run;
+  } );
+}
+
+
+/**
+ * @brief Number of commands waiting to be sent or acknowledged.
+ */
+unsigned
+GCoder::PendingCommands() const
+{
+  std::lock_guard<std::mutex> lock( queue_mutex );
+  return pending.size()+inflight.size();
+}
+
+
+/**
+ * @brief Setting the maximum number of commands sent to the printer before the
+ * acknowledgement of the earliest command is received. Marlin firmware buffers
+ * 4 commands by default (BUFSIZE), setting this to 1 is equivalent to the fully
+ * synchronous transmission.
+ */
+void
+GCoder::SetMaxInFlight( const unsigned n )
+{
+  maxinflight = std::max( 1u, n );
+  const char c = 0;
+  write( wake_pipe[1], &c, 1 );
+}
+
+
+/**
+ * @brief Starting the IO thread handling the transmission of the command queue.
+ */
+void
+GCoder::StartIOThread()
+{
+  if( pipe( wake_pipe ) != 0 ){
+    throw device_exception( DeviceName, "Failed to create IO thread pipe" );
+  }
+  fcntl( wake_pipe[0], F_SETFL, O_NONBLOCK );
+  fcntl( wake_pipe[1], F_SETFL, O_NONBLOCK );
+  io_run    = true;
+  io_thread = std::thread( [this]{ this->RunIOLoop(); } );
+}
+
+
+/**
+ * @brief Stopping the IO thread, commands that have not been acknowledged are
+ * failed.
+ */
+void
+GCoder::StopIOThread()
+{
+  if( !io_thread.joinable() ){ return; }
+  io_run = false;
+  const char c = 0;
+  write( wake_pipe[1], &c, 1 );
+  io_thread.join();
+  close( wake_pipe[0] );
+  close( wake_pipe[1] );
+  wake_pipe[0] = wake_pipe[1] = -1;
+}
+
+
+/**
+ * @brief Main loop of the IO thread.
+ *
+ * Rather than polling the device at fixed intervals, the thread blocks in
+ * poll() until either the printer has returned data, a new command is
+ * submitted, or the acknowledgement for the earliest in-flight command has
+ * timed out. The return data is split into lines which are collected into the
+ * response of the earliest in-flight command until the acknowledgement line is
+ * found. Data returned while no command is in flight (such as the automatic
+ * reports of the printer) is discarded. A command that times out is only
+ * re-sent if no later command is in flight (see the timeout check below).
+ */
+void
+GCoder::RunIOLoop()
+{
+  using namespace std::chrono;
+  static const unsigned maxtry = 10;
+
+  char        buffer[4096];
+  std::string linebuffer;
+  std::string response;
+
+  while( io_run ){
+    GCodeCommand* front = nullptr;
+    {
+      std::lock_guard<std::mutex> lock( queue_mutex );
+      while( !pending.empty() && inflight.size() < maxinflight ){
+        inflight.push_back( std::move( pending.front() ) );
+        pending.pop_front();
+        SendCommand( *inflight.back() );
+      }
+      if( !inflight.empty() ){
+        front = inflight.front().get();
+      }
+    }
+
+    // Only the IO thread modifies the in-flight queue, so the front command
+    // remains valid outside the lock.
+    int timeout = -1;
+    if( front ){
+      const auto deadline = front->sent+microseconds( front->waitack );
+      const auto remain   = duration_cast<milliseconds>(
+        deadline-steady_clock::now() ).count();
+      timeout = std::max( (long)0, (long)remain+1 );
+    }
+
+    struct pollfd fds[2] = {
+      { printer_IO,   POLLIN, 0 },
+      { wake_pipe[0], POLLIN, 0 }
+    };
+    poll( fds, 2, timeout );
+
+    if( fds[1].revents & POLLIN ){
+      while( read( wake_pipe[0], buffer, sizeof( buffer ) ) > 0 ){}
+    }
+    if( fds[0].revents & ( POLLERR | POLLHUP | POLLNVAL ) ){
+      break;// Device disconnected, failing all remaining commands
+    }
+    if( fds[0].revents & POLLIN ){
+      const int readlen = read( printer_IO, buffer, sizeof( buffer ) );
+      if( readlen > 0 ){
+        linebuffer.append( buffer, readlen );
+      }
+      size_t pos;
+      while( ( pos = linebuffer.find( '\n' ) ) != std::string::npos ){
+        HandleLine( linebuffer.substr( 0, pos+1 ), response );
+        linebuffer.erase( 0, pos+1 );
+      }
+    }
+
+    // Checking the timeout of the earliest in-flight command.
+    std::lock_guard<std::mutex> lock( queue_mutex );
+    if( inflight.empty() || inflight.front().get() != front ){ continue; }
+    if( steady_clock::now() < front->sent+microseconds( front->waitack ) ){
+      continue;
+    }
+    if( ++front->attempt < maxtry ){
+      // Acknowledgements are matched to the commands in the order they were
+      // sent, so the command is only re-sent if nothing was sent after it.
+      // Otherwise a resend would repeat the command after the later ones, and
+      // the extra acknowledgement would be credited to a later command.
+      if( inflight.size() == 1 ){
+        response.clear();
+        SendCommand( *front );
+      } else {
+        front->sent = steady_clock::now();
+      }
+      continue;
+    }
+    std::string pstring = front->gcode;
+    if( !pstring.empty() && pstring.back() == '\n' ){ pstring.pop_back(); }
+    char msg[1024];
     sprintf( msg,
              R"(ACK string for command [%s] was not received after [%d] attempts!
              The message could be dropped or there is something wrong with the
              printer!)",
              pstring.c_str(),
              maxtry );
-    throw device_exception( DeviceName, msg );
+    front->ack.set_exception(
+      std::make_exception_ptr( device_exception( DeviceName, msg ) ) );
+    inflight.pop_front();
+    response.clear();
+    queue_cv.notify_all();
   }
 
-  // Sending output
-  printdebug( DeviceName, msg );
-  write( printer_IO, gcode.c_str(), gcode.length() );
-  tcdrain( printer_IO );
-
-  high_resolution_clock::time_point t1 = high_resolution_clock::now();
-  high_resolution_clock::time_point t2 = high_resolution_clock::now();
+  io_run = false;
+  FailCommands( "Printer IO thread stopped before command was acknowledged" );
+}
 
-  // Checking the output for the acknowledge/completion return
-  do {
-    readlen = read( printer_IO, buffer, sizeof( buffer )-1 );
 
-    if( readlen > 0 ){
-      buffer[readlen] = 1;
-      ackstr          = std::string( buffer, buffer+readlen );
-      if( check_ack( gcode, ackstr ) ){
-        awk = true;
-      }
+/**
+ * @brief Writing a command to the printer, should only be called by the IO
+ * thread with the queue lock held. The write (including the serial drain) is
+ * recorded in the `gcoder.write` latency section.
+ */
+void
+GCoder::SendCommand( GCodeCommand& cmd )
+{
+  LATENCY_SCOPE( "gcoder.write" );
+  size_t written = 0;
+  while( written < cmd.gcode.length() ){
+    const ssize_t n = write( printer_IO,
+                             cmd.gcode.c_str()+written,
+                             cmd.gcode.length()-written );
+    if( n > 0 ){
+      written += n;
+    } else if( n < 0 && errno != EAGAIN ){
+      break;// Failed write will be retried on the acknowledgement timeout
+    } else {
+      struct pollfd fd = { printer_IO, POLLOUT, 0 };
+      poll( &fd, 1, 10 );
     }
-    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
-    t2 = high_resolution_clock::now();
-  } while( !awk && duration_cast<microseconds>( t2-t1 ).count() < waitack );
+  }
+  tcdrain( printer_IO );
+  cmd.sent = std::chrono::steady_clock::now();
+}
 
-  // Checking output
-  if( awk ){
-    strcat( msg, "... Done!" );
-    printdebug( DeviceName, msg );
 
-    // Flushing the printer buffer after executing the command.
-    while( readlen > 0 ){
-      readlen = read( printer_IO, buffer, sizeof( buffer )-1 );
-      std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+/**
+ * @brief Handling a single line returned by the printer, completing the
+ * earliest in-flight command once the acknowledgement line is found. The time
+ * between the command being sent and acknowledged is recorded in the
+ * `gcoder.ack` latency section (this includes the motion time of the M400
+ * commands).
+ */
+void
+GCoder::HandleLine( const std::string& line, std::string& response )
+{
+  std::unique_ptr<GCodeCommand> done;
+  {
+    std::lock_guard<std::mutex> lock( queue_mutex );
+    if( inflight.empty() ){
+      response.clear();
+      return;
+    }
+    response += line;
+    if( line.compare( 0, 2, "ok" ) != 0 ){ return; }
+    if( !check_ack( inflight.front()->gcode, response ) ){
+      response.clear();// Ack of an automatic report, not of the command
+      return;
     }
+    done = std::move( inflight.front() );
+    inflight.pop_front();
+  }
+  LATENCY_RECORD( "gcoder.ack",
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now()-done->sent ).count() );
+  done->ack.set_value( response );
+  if( done->callback ){
+    done->callback( response );
+  }
+  response.clear();
+  queue_cv.notify_all();
+}
 
-    return ackstr;
-  } else {
-    return RunGcode( gcode, attempt+1, waitack );
+
+/**
+ * @brief Failing all commands remaining in the queue.
+ */
+void
+GCoder::FailCommands( const std::string& msg )
+{
+  std::lock_guard<std::mutex> lock( queue_mutex );
+  for( auto* queue : { &inflight, &pending } ){
+    for( auto& cmd : *queue ){
+      cmd->ack.set_exception(
+        std::make_exception_ptr( device_exception( DeviceName, msg ) ) );
+    }
+    queue->clear();
   }
+  queue_cv.notify_all();
 }
 
 
@@ -319,6 +588,7 @@ GCoder::SendHome( bool x, bool y, bool z )
   // Adding end of line character.
   strcat( cmd, "\n" );
 
+  motiondone = std::shared_future<std::string>();
   RunGcode( cmd, 0, 4e9 );
 }
 
@@ -425,6 +695,31 @@ GCoder::SetSpeedLimit( float x, float y, float z )
 }
 
 
+/**
+ * @brief Setting the maximum acceleration of each axis (in units of mm/s^2)
+ * with the M201 command. The values are also stored for the motion time
+ * estimation (see MoveTime).
+ */
+void
+GCoder::SetAccelLimit( float x, float y, float z )
+{
+  static const char gcode_fmt[] = "M201 X%.0f Y%.0f Z%.0f\n";
+  char              gcode[128];
+
+  // NAN detection.
+  if( x != x ){ x = ax; }
+  if( y != y ){ y = ay; }
+  if( z != z ){ z = az; }
+
+  sprintf( gcode, gcode_fmt, x, y, z );
+  RunGcode( gcode, 0, 1e5 );
+
+  ax = x;
+  ay = y;
+  az = z;
+}
+
+
 /**
  * @brief Sending the command for linear motion.
  *
@@ -440,6 +735,17 @@ GCoder::SetSpeedLimit( float x, float y, float z )
  */
 void
 GCoder::MoveToRaw( float x, float y, float z )
+{
+  SubmitMove( x, y, z ).get();
+}
+
+
+/**
+ * @brief Updating the target position and submitting the G0 command to the
+ * command queue without waiting for the acknowledgement.
+ */
+std::shared_future<std::string>
+GCoder::SubmitMove( float x, float y, float z )
 {
   static const char move_fmt[] = "G0 X%.1f Y%.1f Z%.1f\n";
 
@@ -463,9 +769,11 @@ GCoder::MoveToRaw( float x, float y, float z )
 
   // Running the code
   sprintf( gcode, move_fmt, opx, opy, opz );
-  RunGcode( gcode, 0, 1000 );
+  motiondone = std::shared_future<std::string>();
 
-  return;
+  // Marlin holds back the acknowledgement while the planner buffer is full, so
+  // queued motion commands wait for as long as the motion may take.
+  return SubmitGcode( gcode, 4e9 );
 }
 
 
@@ -492,29 +800,14 @@ GCoder::MoveToRaw( float x, float y, float z )
 bool
 GCoder::InMotion( float x, float y, float z )
 {
-  std::string checkmsg;
-  float       a, b, c, temp;// feed position of extruder.
-  int         check;
   try {
-    checkmsg = RunGcode( "M114\n" );
-    check    = sscanf(
-      checkmsg.c_str(),
-      "X:%f Y:%f Z:%f E:%f Count X:%f Y:%f Z:%f",
-      &a,
-      &b,
-      &c,
-      &temp,
-      &cx,
-      &cy,
-      &cz );
+    if( !ParsePosition( RunGcode( "M114\n" ) ) ){
+      return true;
+    }
   } catch( std::exception& e ){
     return true;
   }
 
-  if( check != 7 ){
-    return true;
-  }
-
   // Supposedly the check matching cooridnate
   const double tx = ModifyTargetCoordinate( x, max_x() );
   const double ty = ModifyTargetCoordinate( y, max_y() );
@@ -528,6 +821,109 @@ GCoder::InMotion( float x, float y, float z )
 }
 
 
+/**
+ * @brief Waiting for the motion to the current target coordinates to be
+ * completed, for at most timeout seconds.
+ *
+ * Rather than repeatedly querying the position, a single M400 command (wait
+ * for the planner buffer to be empty) is submitted after the latest motion
+ * command, the acknowledgement of which is only returned by the printer once
+ * all motion has finished. Repeated calls reuse the same M400 command, so the
+ * function can be called with a short timeout in a loop that also checks for
+ * user interruption, without additional communication with the printer. Once
+ * the acknowledgement is received, the position is confirmed with a single M114
+ * query. Returns true once the gantry is confirmed to be at the target
+ * position, false if the motion is still ongoing after the timeout, and raises
+ * an exception if the confirmed position does not match the target.
+ *
+ * This function does not use the logging facilities, so it can be called
+ * without holding the python GIL.
+ */
+bool
+GCoder::WaitMotionDone( const double timeout )
+{
+  if( !motiondone.valid() ){
+    motiondone = SubmitGcode( "M400\n", 4e9 );
+  }
+  if( motiondone.wait_for( std::chrono::duration<double>( timeout ) )
+      != std::future_status::ready ){
+    return false;
+  }
+  motiondone.get();// Raising exception if the M400 command failed.
+
+  // Once all motion is done the position will not change anymore, so a single
+  // confirmation is enough, and a mismatch is an error rather than a reason to
+  // query again.
+  const std::string pos = SubmitGcode( "M114\n" ).get();
+  if( !ParsePosition( pos ) || !AtTarget() ){
+    char msg[1024];
+    snprintf( msg, sizeof( msg ),
+              "Gantry position [%.1f,%.1f,%.1f] does not match target "
+              "[%.1f,%.1f,%.1f] after motion completed",
+              cx, cy, cz, opx, opy, opz );
+    throw device_exception( DeviceName, msg );
+  }
+  return true;
+}
+
+
+/**
+ * @brief Non-blocking notification of motion completion.
+ *
+ * Submits an M400 command, and the hook will be called as soon as the printer
+ * acknowledges that all motion has finished. The hook is invoked on the IO
+ * thread and should therefore return quickly, without waiting on any other
+ * GCoder command. This is intended for arming the readout system
+ * immediately once the gantry stops.
+ */
+std::shared_future<std::string>
+GCoder::NotifyMotionDone( const std::function<void()>& hook,
+                          const double                 timeout )
+{
+  return SubmitGcode( "M400\n",
+                      timeout * 1e6,
+                      [hook]( const std::string& ){ hook(); } );
+}
+
+
+/**
+ * @brief Parsing the return string of the M114 command to update the current
+ * coordinates. Returns false if the string is not in the expected format.
+ */
+bool
+GCoder::ParsePosition( const std::string& msg )
+{
+  float        a, b, c, temp;// feed position of extruder.
+  float        x, y, z;
+  const size_t start = msg.find( "X:" );
+  if( start == std::string::npos ){ return false; }
+  const int check = sscanf( msg.c_str()+start,
+                            "X:%f Y:%f Z:%f E:%f Count X:%f Y:%f Z:%f",
+                            &a,
+                            &b,
+                            &c,
+                            &temp,
+                            &x,
+                            &y,
+                            &z );
+  if( check != 7 ){ return false; }
+  cx = x;
+  cy = y;
+  cz = z;
+  return true;
+}
+
+
+/**
+ * @brief Whether the current coordinates match the target coordinates.
+ */
+bool
+GCoder::AtTarget() const
+{
+  return MatchCoord( opx, cx ) && MatchCoord( opy, cy ) && MatchCoord( opz, cz );
+}
+
+
 /**
  * @brief Simple abstraction of the motion command to ensure motion safety.
  *
@@ -537,30 +933,470 @@ GCoder::InMotion( float x, float y, float z )
  */
 void
 GCoder::MoveTo( float x, float y, float z )
+{
+  for( auto& ack : SubmitSafeMove( x, y, z ) ){
+    ack.get();
+  }
+}
+
+
+/**
+ * @brief Submitting all segments of a safe motion (see MoveTo) at once, such
+ * that the segments are in the printer planner buffer at the same time.
+ */
+std::vector<std::shared_future<std::string> >
+GCoder::SubmitSafeMove( float x, float y, float z )
+{
+  const float start[3]  = { opx, opy, opz };
+  const float target[3] = { x, y, z };
+  float       waypoints[3][3];
+  const auto  now = std::chrono::steady_clock::now();
+
+  // Motion starts once the previous motion has been completed.
+  arrival = std::max( now, arrival )
+            +std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>( MoveTime( opx, opy, opz, x, y, z ) ) );
+
+  std::vector<std::shared_future<std::string> > acks;
+  const unsigned n = SafeMoveWaypoints( start, target, waypoints );
+  for( unsigned i = 0; i < n; ++i ){
+    acks.push_back( SubmitMove( waypoints[i][0], waypoints[i][1],
+                                waypoints[i][2] ) );
+  }
+  return acks;
+}
+
+
+/**
+ * @brief Waypoints of a safe motion (see MoveTo) from a start to a target
+ * position, returning the number of waypoints. NAN target coordinates are
+ * kept at the coordinates of the previous waypoint, matching the behavior of
+ * the G0 command.
+ */
+unsigned
+GCoder::SafeMoveWaypoints( const float start[3],
+                           const float target[3],
+                           float       waypoints[3][3] )
 {
   static constexpr float min_z_safety = 3;
 
-  if( z < min_z_safety && opz < min_z_safety ){
-    MoveToRaw( opx, opy, min_z_safety );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
-    MoveToRaw( x, y, min_z_safety );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
-    MoveToRaw( x, y,  z );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
-  } else if( opz < min_z_safety ){
-    MoveToRaw( opx, opy, min_z_safety );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
-    MoveToRaw( x, y, z );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+  const float x  = target[0];
+  const float y  = target[1];
+  const float z  = target[2];
+  unsigned    n  = 0;
+  auto        add = [&]( float px, float py, float pz ){
+    const float* prev = n == 0 ? start : waypoints[n-1];
+    waypoints[n][0] = px == px ? px : prev[0];
+    waypoints[n][1] = py == py ? py : prev[1];
+    waypoints[n][2] = pz == pz ? pz : prev[2];
+    ++n;
+  };
+
+  if( z < min_z_safety && start[2] < min_z_safety ){
+    add( start[0], start[1], min_z_safety );
+    add( x, y, min_z_safety );
+    add( x, y, z );
+  } else if( start[2] < min_z_safety ){
+    add( start[0], start[1], min_z_safety );
+    add( x, y, z );
   } else if( z < min_z_safety ){
-    MoveToRaw( x, y, min_z_safety );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
-    MoveToRaw( x, y, z );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    add( x, y, min_z_safety );
+    add( x, y, z );
   } else {
-    MoveToRaw( x, y, z );
-    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    add( x, y, z );
+  }
+  return n;
+}
+
+
+/**
+ * @brief Estimated time (in seconds) for a safe motion (see MoveTo) from the
+ * start coordinates to the target coordinates.
+ *
+ * Each linear segment is modeled with a trapezoidal velocity profile starting
+ * and ending at rest, the cruise speed and acceleration along the segment
+ * being the largest values that do not exceed the per-axis limits set by
+ * SetSpeedLimit and SetAccelLimit. As the safe motion segments meet at right
+ * angles, the firmware junction speed between segments is small, and is
+ * neglected here.
+ */
+double
+GCoder::MoveTime( float x0, float y0, float z0,
+                  float x, float y, float z ) const
+{
+  const float start[3]  = { x0, y0, z0 };
+  const float target[3] = { x, y, z };
+  float       waypoints[3][3];
+  const unsigned n    = SafeMoveWaypoints( start, target, waypoints );
+  double         ans  = 0;
+  const float*   prev = start;
+  for( unsigned i = 0; i < n; ++i ){
+    ans += SegmentTime( waypoints[i][0]-prev[0],
+                        waypoints[i][1]-prev[1],
+                        waypoints[i][2]-prev[2] );
+    prev = waypoints[i];
+  }
+  return ans;
+}
+
+
+/**
+ * @brief Time for a single linear segment with a trapezoidal velocity
+ * profile, or a triangular profile if the segment is too short to reach the
+ * cruise speed.
+ */
+double
+GCoder::SegmentTime( double dx, double dy, double dz ) const
+{
+  const double length = std::sqrt( dx * dx+dy * dy+dz * dz );
+  if( !( length > 0 ) ){ return 0; }
+
+  // The cruise speed is the G0 feed rate set by SetSpeedLimit.
+  const double d[3]    = { std::fabs( dx ), std::fabs( dy ), std::fabs( dz ) };
+  const double vmax[3] = { vx, vy, vz };
+  const double amax[3] = { ax, ay, az };
+  double       v       = std::max( std::max( vx, vy ), vz );
+  double       a       = std::numeric_limits<double>::infinity();
+  for( unsigned i = 0; i < 3; ++i ){
+    if( d[i] > 0 ){
+      v = std::min( v, vmax[i] * length / d[i] );
+      a = std::min( a, amax[i] * length / d[i] );
+    }
+  }
+
+  return length * a >= v * v ?
+         length / v+v / a :
+         2 * std::sqrt( length / a );
+}
+
+
+/**
+ * @brief Estimated time to traverse a list of [point][x,y,z] coordinates
+ * starting from the current target position, excluding any time spent at
+ * each point.
+ */
+double
+GCoder::PathTime( const std::vector<float>& path ) const
+{
+  double ans = 0;
+  float  x   = opx, y = opy, z = opz;
+  for( size_t i = 0; i+2 < path.size(); i += 3 ){
+    ans += MoveTime( x, y, z, path[i], path[i+1], path[i+2] );
+    x    = path[i];
+    y    = path[i+1];
+    z    = path[i+2];
   }
+  return ans;
+}
+
+
+/**
+ * @brief Time (in seconds) until the predicted arrival of the latest motion
+ * command, negative if the gantry should have already arrived.
+ */
+double
+GCoder::PredictedArrival() const
+{
+  return std::chrono::duration<double>(
+    arrival-std::chrono::steady_clock::now() ).count();
+}
+
+
+/**
+ * @brief Reordering a list of [point][x,y,z] coordinates to minimize the
+ * total estimated travel time starting from the current target position.
+ * Returns the indices of the points in the new order.
+ *
+ * Available methods are:
+ * - "serpentine": points are grouped into rows of the same y coordinate, with
+ *   the direction of travel alternating between rows. The starting corner is
+ *   the one closest to the current position.
+ * - "nearest": nearest-neighbor ordering using the estimated motion time
+ *   (MoveTime) as the distance, refined by 2-opt segment reversals until no
+ *   further improvement is found.
+ * - "auto": serpentine if the points form a complete rectangular grid, nearest
+ *   otherwise.
+ */
+std::vector<unsigned>
+GCoder::OptimizePath( const std::vector<float>& path,
+                      const std::string&        method ) const
+{
+  const unsigned        n = path.size() / 3;
+  std::vector<unsigned> order( n );
+  for( unsigned i = 0; i < n; ++i ){
+    order[i] = i;
+  }
+  if( n < 2 ){ return order; }
+
+  auto px = [&path]( unsigned i ){ return path[3 * i+0]; };
+  auto py = [&path]( unsigned i ){ return path[3 * i+1]; };
+  auto pz = [&path]( unsigned i ){ return path[3 * i+2]; };
+
+  // Grouping points by rows of matching y coordinates
+  std::sort( order.begin(), order.end(), [&]( unsigned i, unsigned j ){
+    return MatchCoord( py( i ), py( j ) ) ?
+           px( i ) < px( j ) :
+           py( i ) < py( j );
+  } );
+  std::vector<unsigned> rowstart( 1, 0 );
+  for( unsigned i = 1; i < n; ++i ){
+    if( !MatchCoord( py( order[i] ), py( order[i-1] ) ) ){
+      rowstart.push_back( i );
+    }
+  }
+  rowstart.push_back( n );
+  const unsigned nrows = rowstart.size()-1;
+
+  std::string m = method;
+  if( m == "auto" ){
+    const unsigned ncols = rowstart[1];
+    bool           grid  = nrows > 1 && ncols > 1 && ncols * nrows == n;
+    for( unsigned r = 0; grid && r < nrows; ++r ){
+      for( unsigned c = 0; grid && c < ncols; ++c ){
+        grid = MatchCoord( px( order[r * ncols+c] ), px( order[c] ) )
+               && MatchCoord( pz( order[r * ncols+c] ), pz( order[0] ) );
+      }
+    }
+    m = grid ? "serpentine" : "nearest";
+  }
+
+  if( m == "serpentine" ){
+    // Choosing the starting corner closest to the current position.
+    const bool revrow = std::fabs( py( order[0] )-opy )
+                        > std::fabs( py( order[n-1] )-opy );
+    const bool revcol = std::fabs( px( order[0] )-opx )
+                        > std::fabs( px( order[rowstart[1]-1] )-opx );
+    std::vector<unsigned> ans;
+    ans.reserve( n );
+    for( unsigned k = 0; k < nrows; ++k ){
+      const unsigned r = revrow ? nrows-1-k : k;
+      auto           b = order.begin()+rowstart[r];
+      auto           e = order.begin()+rowstart[r+1];
+      if( ( k % 2 == 1 ) != revcol ){
+        ans.insert( ans.end(), std::reverse_iterator<decltype( e )>( e ),
+                    std::reverse_iterator<decltype( b )>( b ) );
+      } else {
+        ans.insert( ans.end(), b, e );
+      }
+    }
+    return ans;
+  } else if( m != "nearest" ){
+    throw device_exception( DeviceName, "Unknown path ordering method ["+m+"]" );
+  }
+
+  // Cost between positions in the tour, position 0 is the current position.
+  // The motion time is symmetric, so the tour can be reversed freely.
+  std::vector<unsigned> tour( n+1 );
+  auto                  cost = [&]( unsigned i, unsigned j ){
+    const unsigned a = tour[i], b = tour[j];
+    return MoveTime( i == 0 ? opx : px( a-1 ),
+                     i == 0 ? opy : py( a-1 ),
+                     i == 0 ? opz : pz( a-1 ),
+                     px( b-1 ), py( b-1 ), pz( b-1 ) );
+  };
+
+  // Nearest neighbor construction, tour entries are point indices offset by 1.
+  std::vector<bool> used( n, false );
+  tour[0] = 0;
+  for( unsigned k = 1; k <= n; ++k ){
+    double   best  = std::numeric_limits<double>::infinity();
+    unsigned bestj = 0;
+    for( unsigned j = 0; j < n; ++j ){
+      if( used[j] ){ continue; }
+      tour[k] = j+1;
+      const double c = cost( k-1, k );
+      if( c < best ){
+        best  = c;
+        bestj = j;
+      }
+    }
+    tour[k]      = bestj+1;
+    used[bestj] = true;
+  }
+
+  // 2-opt refinement on the open tour: reversing the segment [i, j] replaces
+  // the edges (i-1, i) and (j, j+1) with (i-1, j) and (i, j+1).
+  static constexpr unsigned max_passes = 100;
+  static constexpr double   epsilon    = 1e-9;
+  bool                      improved   = true;
+  for( unsigned pass = 0; improved && pass < max_passes; ++pass ){
+    improved = false;
+    for( unsigned i = 1; i < n; ++i ){
+      for( unsigned j = i+1; j <= n; ++j ){
+        const double before = cost( i-1, i )+( j < n ? cost( j, j+1 ) : 0 );
+        const double after  = cost( i-1, j )+( j < n ? cost( i, j+1 ) : 0 );
+        if( after < before-epsilon ){
+          std::reverse( tour.begin()+i, tour.begin()+j+1 );
+          improved = true;
+        }
+      }
+    }
+  }
+
+  for( unsigned k = 0; k < n; ++k ){
+    order[k] = tour[k+1]-1;
+  }
+  return order;
+}
+
+
+/**
+ * @brief Preparing a list of scan coordinates for RunScan.
+ *
+ * All coordinates are passed through ModifyTargetCoordinate ahead of time,
+ * such that any modification of the target coordinates is reported before the
+ * scan starts, and the return is a flat list of [point][x,y,z] coordinates
+ * that are guaranteed to be physically safe targets.
+ */
+std::vector<float>
+GCoder::PrepareScan( const std::vector<float>& x,
+                     const std::vector<float>& y,
+                     const std::vector<float>& z )
+{
+  if( x.size() != y.size() || x.size() != z.size() ){
+    throw device_exception( DeviceName,
+                            "Scan coordinate lists have different lengths" );
+  }
+  std::vector<float> ans( 3 * x.size() );
+  for( size_t i = 0; i < x.size(); ++i ){
+    ans[3 * i+0] = ModifyTargetCoordinate( x[i], max_x() );
+    ans[3 * i+1] = ModifyTargetCoordinate( y[i], max_y() );
+    ans[3 * i+2] = ModifyTargetCoordinate( z[i], max_z() );
+  }
+  return ans;
+}
+
+
+/**
+ * @brief Executing a scan over a list of points prepared by PrepareScan
+ * without returning to python in between points.
+ *
+ * Each point is split into stages run by the ScanScheduler on three worker
+ * threads: the gantry (move, settle), the readout device (acquire) and the
+ * host (reduce, write). The motion to a point starts as soon as the
+ * acquisition of the previous point is done, such that the reduction and the
+ * writing of a point overlap with the motion to the next point. The motion
+ * completion is awaited with M400 (see WaitMotionDone), and the acquisition
+ * starts once the settling time (in seconds) has passed since the predicted
+ * arrival (see MoveTime), such that the time spent confirming the arrival over
+ * the serial interface counts towards the settling time. If stepperoff is set,
+ * the z stepper motor is disabled during the acquisition, similar to the python
+ * readout method.
+ *
+ * If the readout routine provides the acquire and reduce split (see
+ * ScanReadout), only the acquisition runs on the readout worker, otherwise the
+ * full read function does. The optional write function is called in point
+ * order with the point index and the completed row, and at most depth points
+ * are in flight, so a slow writer eventually holds back the motion. A depth of
+ * 1 runs the stages of different points strictly in sequence.
+ *
+ * The return is a preallocated table of [point][3+nvalues] with the confirmed
+ * gantry coordinates followed by the readout values. The interrupt function is
+ * called periodically by the calling thread while the scan runs, and is
+ * expected to throw to stop the scan. The timing of each stage is available
+ * from ScanTiming once the scan has ended.
+ *
+ * As the coordinates have already been checked, this function does not use the
+ * logging facilities, and can be called without holding the python GIL.
+ */
+std::vector<double>
+GCoder::RunScan( const std::vector<float>&    path,
+                 const ScanReadout&           readout,
+                 const double                 settle,
+                 const std::function<void()>& interrupt,
+                 const bool                   stepperoff,
+                 const ScanWriter&            write,
+                 const unsigned               depth )
+{
+  const size_t        npoints = path.size() / 3;
+  const unsigned      ncols   = 3+readout.nvalues;
+  const unsigned      nbuf    = std::max( 1u, depth );
+  const bool          split   = readout.acquire && readout.reduce;
+  std::vector<double> ans( npoints * ncols, std::nan( "" ) );
+
+  // Raw readout data of the points in flight
+  std::vector<std::vector<double> > raw( nbuf );
+
+  // Stage indices, fixed by the order of the AddStage calls below.
+  enum { MOVE, SETTLE, ACQUIRE, REDUCE, WRITE };
+  ScanScheduler scheduler;
+  scheduler.AddStage( "move", "gantry", [&]( const size_t i ){
+    if( stepperoff && i > 0 ){ SubmitGcode( "M17 Z\n", 1e5 ).get(); }
+    for( auto& ack : SubmitSafeMove( path[3 * i], path[3 * i+1], path[3 * i+2] ) ){
+      ack.get();
+    }
+  }, { { ACQUIRE, 1 }, { WRITE, nbuf } } );
+  scheduler.AddStage( "settle", "gantry", [&]( const size_t i ){
+    const auto settled = arrival
+                         +std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>( settle ) );
+    while( !WaitMotionDone( 0.1 ) ){
+      if( scheduler.Stopped() ){ return; }
+    }
+    std::this_thread::sleep_until( settled );
+
+    double* row = ans.data()+i * ncols;
+    row[0] = cx;
+    row[1] = cy;
+    row[2] = cz;
+    if( stepperoff ){ SubmitGcode( "M18 Z E\n", 1e5 ).get(); }
+  }, { { MOVE, 0 } } );
+  scheduler.AddStage( "acquire", "readout", [&]( const size_t i ){
+    std::vector<double>& buf = raw[i % nbuf];
+    if( split ){
+      buf.clear();
+      readout.acquire( buf );
+    } else {
+      buf.resize( readout.nvalues );
+      readout.read( buf.data() );
+    }
+  }, { { SETTLE, 0 } } );
+  scheduler.AddStage( "reduce", "host", [&]( const size_t i ){
+    const std::vector<double>& buf = raw[i % nbuf];
+    double*                    out = ans.data()+i * ncols+3;
+    if( split ){
+      readout.reduce( buf, out );
+    } else {
+      std::copy( buf.begin(), buf.end(), out );
+    }
+  }, { { ACQUIRE, 0 } } );
+  scheduler.AddStage( "write", "host", [&]( const size_t i ){
+    if( write ){ write( i, ans.data()+i * ncols ); }
+  }, { { REDUCE, 0 } } );
+
+  try {
+    scheduler.Run( npoints, interrupt );
+  } catch( ... ){
+    StoreScanTiming( scheduler );
+    throw;
+  }
+  StoreScanTiming( scheduler );
+  if( stepperoff && npoints > 0 ){ SubmitGcode( "M17 Z\n", 1e5 ).get(); }
+  return ans;
+}
+
+
+/**
+ * @brief Timing of each stage of the latest scan (see RunScan), followed by a
+ * "total" entry holding the wall time of the scan.
+ */
+const std::vector<ScanScheduler::StageTiming>&
+GCoder::ScanTiming() const
+{
+  return scantiming;
+}
+
+
+void
+GCoder::StoreScanTiming( const ScanScheduler& scheduler )
+{
+  scantiming = scheduler.Timing();
+  ScanScheduler::StageTiming total;
+  total.name   = "total";
+  total.worker = "";
+  total.wait   = 0;
+  total.run.Fill( scheduler.WallTime() );
+  scantiming.push_back( total );
 }
 
 
@@ -626,11 +1462,21 @@ GCoder::ModifyTargetCoordinate( const double original, const double max_value )
 
 
 GCoder::GCoder() :
-  printer_IO( -1 ),
-  opx       ( -1 ),
-  opy       ( -1 ),
-  opz       ( -1 )
-{}
+  printer_IO ( -1 ),
+  opx        ( -1 ),
+  opy        ( -1 ),
+  opz        ( -1 ),
+  vx         ( 200 ),
+  vy         ( 200 ),
+  vz         ( 30 ),
+  ax         ( 1000 ),
+  ay         ( 1000 ),
+  az         ( 300 ),
+  maxinflight( 4 ),
+  io_run     ( false )
+{
+  wake_pipe[0] = wake_pipe[1] = -1;
+}
 
 /**
  * @brief Destructing the GCoder::GCoder object
@@ -641,6 +1487,7 @@ GCoder::GCoder() :
 GCoder::~GCoder()
 {
   printdebug( DeviceName, "Deallocating the gantry controls" );
+  StopIOThread();
   if( printer_IO > 0 ){
     close( printer_IO );
   }
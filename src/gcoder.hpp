@@ -1,10 +1,21 @@
 #ifndef GCODER_HPP
 #define GCODER_HPP
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "scanreadout.hpp"
+#include "scanscheduler.hpp"
 #include "singleton.hpp"
 
 class GCoder
@@ -21,15 +32,33 @@ public:
                         const unsigned     attempt = 0,
                         const unsigned     waitack = 1e4 ) const;
 
+  // Asynchronous command queue
+  typedef std::function<void( const std::string& )> AckCallback;
+  std::shared_future<std::string> SubmitGcode( const std::string& gcode,
+                                               const unsigned     waitack = 1e4,
+                                               const AckCallback& callback = nullptr,
+                                               const unsigned     attempt = 0 )
+  const;
+  void     WaitQueue() const;
+  unsigned PendingCommands() const;
+  void     SetMaxInFlight( const unsigned n );
+
   // Motion command abstraction
   std::string GetSettings() const;
   void        SendHome( bool x, bool y, bool z );
   void        EnableStepper( bool x, bool y, bool z );
   void        DisableStepper( bool x, bool y, bool z );
   bool        InMotion( float x, float y, float z );
+  bool        WaitMotionDone( const double timeout );
+  std::shared_future<std::string> NotifyMotionDone(
+    const std::function<void()>& hook,
+    const double                 timeout = 600 );
   void        SetSpeedLimit( float x = std::nanf(""),
                              float y = std::nanf(""),
                              float z = std::nanf("") );
+  void        SetAccelLimit( float x = std::nanf(""),
+                             float y = std::nanf(""),
+                             float z = std::nanf("") );
 
   //
   void MoveTo( float x = std::nanf(""),
@@ -41,6 +70,29 @@ public:
                   float y = std::nanf(""),
                   float z = std::nanf(""));
 
+  // Motion time estimation and scan path ordering
+  double                MoveTime( float x0, float y0, float z0,
+                                  float x, float y, float z ) const;
+  double                PathTime( const std::vector<float>& path ) const;
+  double                PredictedArrival() const;
+  std::vector<unsigned> OptimizePath( const std::vector<float>& path,
+                                      const std::string&        method = "auto" )
+  const;
+
+  // Batch scan execution
+  static std::vector<float> PrepareScan( const std::vector<float>& x,
+                                         const std::vector<float>& y,
+                                         const std::vector<float>& z );
+  typedef std::function<void( const size_t, const double* )> ScanWriter;
+  std::vector<double> RunScan( const std::vector<float>&    path,
+                               const ScanReadout&           readout,
+                               const double                 settle = 0,
+                               const std::function<void()>& interrupt = nullptr,
+                               const bool                   stepperoff = true,
+                               const ScanWriter&            write = nullptr,
+                               const unsigned               depth = 2 );
+  const std::vector<ScanScheduler::StageTiming>& ScanTiming() const;
+
   // Floating point comparison.
   static bool   MatchCoord( double x, double y );
   static double ModifyTargetCoordinate( double orig, const double max );
@@ -50,7 +102,59 @@ public:
   float       opx, opy, opz; /** target position of the printer */
   float       cx, cy, cz; /** current position of the printer */
   float       vx, vy, vz; /** Speed of the gantry head. */
+  float       ax, ay, az; /** Acceleration of the gantry head. */
   std::string dev_path;
+
+private:
+  struct GCodeCommand
+  {
+    std::string                           gcode;
+    unsigned                              waitack;
+    unsigned                              attempt;
+    std::promise<std::string>             ack;
+    AckCallback                           callback;
+    std::chrono::steady_clock::time_point sent;
+  };
+
+  std::shared_future<std::string> SubmitMove( float x, float y, float z );
+  std::vector<std::shared_future<std::string> > SubmitSafeMove( float x,
+                                                                float y,
+                                                                float z );
+  static unsigned SafeMoveWaypoints( const float start[3],
+                                     const float target[3],
+                                     float       waypoints[3][3] );
+  double          SegmentTime( double dx, double dy, double dz ) const;
+  bool                            ParsePosition( const std::string& msg );
+  bool                            AtTarget() const;
+
+  // Completion acknowledgement of the latest motion command.
+  std::shared_future<std::string> motiondone;
+
+  // Predicted arrival time of the latest motion command.
+  std::chrono::steady_clock::time_point arrival;
+
+  // Stage timing of the latest scan.
+  std::vector<ScanScheduler::StageTiming> scantiming;
+  void StoreScanTiming( const ScanScheduler& );
+
+  // Command queue shared with the IO thread, commands are moved from the
+  // pending queue to the in-flight queue once they are sent to the printer.
+  mutable std::mutex                                 queue_mutex;
+  mutable std::condition_variable                    queue_cv;
+  mutable std::deque<std::unique_ptr<GCodeCommand> > pending;
+  std::deque<std::unique_ptr<GCodeCommand> >         inflight;
+  std::atomic<unsigned>                              maxinflight;
+  int                                                wake_pipe[2];
+  std::thread                                        io_thread;
+  std::atomic<bool>                                  io_run;
+
+  void StartIOThread();
+  void StopIOThread();
+  void RunIOLoop();
+  void SendCommand( GCodeCommand& cmd );
+  void HandleLine( const std::string& line, std::string& response );
+  void FailCommands( const std::string& msg );
+
   DECLARE_SINGLETON( GCoder );
 };
 
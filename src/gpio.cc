@@ -9,7 +9,8 @@
  * @brief Interface to the GPIO hardware interfaces.
  *
  * To reduce the number of external dependencies, we will be using the UNIX
- * `/sys` interface for direct access of the underlying system, which allows
+ * `/sys` and `/dev` kernel interfaces directly (rather than libraries such as
+ * libgpiod) for access of the underlying system, which allows
  * for fast (microsecond level) timing precision, while still given decent
  * levels of human-readable interface abstraction. This will mean that the
  * additional system permission will need to be setup manually, rather than
@@ -19,7 +20,12 @@
  *
  * Three sub-interfaces are implemented in this file:
  * - A direct GPIO interface for simple 1/0 outputs, such as for the trigger
- *   and sub-system switches.
+ *   and sub-system switches, using the GPIO character device
+ *   (`/dev/gpiochipN`) with all output lines held in a single line request,
+ *   such that the pins are available without polling for sysfs files to
+ *   appear, and any number of pins can be set in a single ioctl. For precise
+ *   trigger timing, the trigger pin is additionally driven through the memory
+ *   mapped GPIO registers (`/dev/gpiomem`) if available.
  * - The PWM system for the systems voltage control.
  * - The I2C interface used to handle a 16bit ADC converter for DC readout.
  *   This is mainly used to monitor the system sensors like temperature and
@@ -35,9 +41,11 @@
  * about hardware permission settings to be able to execute these routines.
  *
  * To ensure that the gantry control program is the only process on the system
- * that is using the control pins, all file descriptors will be locked on
- * opening. If anything fails to be locked uniquely to the control program
- * instance, then an exceptions is raised.
+ * that is using the control pins, the GPIO lines are reserved by the kernel
+ * line request, which fails if any of the lines is already requested, and all
+ * other file descriptors (PWM and I2C) will be locked on opening. If anything
+ * fails to be reserved or locked uniquely to the control program instance,
+ * then an exceptions is raised.
 
  *
  * Physical Pin locations:
@@ -45,25 +53,35 @@
  * - PWM Channel 1 is Physical PIN 35 (BWM pin 24/ALT5 mode in `gpio readall`)
  *
  * List of references:
- * - General purpose input/ouput manipulation using `/sysfs`: [here][gpiosys]
+ * - General purpose input/ouput using the character device: [here][gpiosys]
+ * - BCM2835 GPIO register layout: [here][gpioreg]
  * - PWM manipulation (command-line piping): [here][pwmsys]
  * - I2C interface ofr ADS1115 ADC [here][adcsys]
  *
  * [adcsys]: http://www.bristolwatch.com/rpi/ads1115.html [gpiosys]:
- * https://www.ics.com/blog/gpio-programming-using-sysfs-interface [pwmsys]:
+ * https://docs.kernel.org/userspace-api/gpio/chardev.html [pwmsys]:
  * https://jumpnowtek.com/rpi/Using-the-Raspberry-Pi-Hardware-PWM-timers.html
+ * [gpioreg]:
+ * https://datasheets.raspberrypi.com/bcm2835/bcm2835-peripherals.pdf
  *
  */
 #include "gpio.hpp"
+#include "latency.hpp"
 #include "logger.hpp"
 
 #include <cmath>
 #include <fcntl.h>
+#include <errno.h>
+#include <linux/gpio.h>
 #include <linux/i2c-dev.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/file.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -115,110 +133,220 @@ open_with_lock( const char* path, int mode )
  *******************************************************************************/
 
 /**
- * @brief Initialization a PIN for read or write.
+ * @brief Finding the GPIO character device of the main GPIO controller.
+ *
+ * The main controller is the first chip with a "pinctrl" label (the label
+ * differs between raspberry PI generations), falling back to
+ * /dev/gpiochip0 if no such chip is found.
+ */
+static std::string
+find_gpio_chip()
+{
+  for( unsigned i = 0; i < 16; ++i ){
+    const std::string path = fmt::sprintf( "/dev/gpiochip%u", i );
+    const int         fd   = open( path.c_str(), O_RDONLY );
+    if( fd == GPIO::OPEN_FAILED ){ break; }
+    struct gpiochip_info info;
+    memset( &info, 0, sizeof( info ) );
+    const int status = ioctl( fd, GPIO_GET_CHIPINFO_IOCTL, &info );
+    close( fd );
+    if( status != GPIO::IO_FAILED
+        && strncmp( info.label, "pinctrl", 7 ) == 0 ){
+      return path;
+    }
+  }
+  return "/dev/gpiochip0";
+}
+
+
+/**
+ * @brief Requesting the trigger, light and spare lines as outputs through the
+ * GPIO character device.
  *
  * Notice that the pin index is not the physical pin index, but rather the BCM
  * pin index. Find out the correspondence using wiringPI's `gpio readall`
- * command. The return value will be the successfully opened file descriptor.
+ * command. All lines are held in a single line request, so that multiple lines
+ * can be set with a single ioctl call (see GPIOSetLines), with all lines
+ * initialized to low. The kernel only allows a single line request per line,
+ * so this also ensures that the program is the only process on the system that
+ * is using the pins. The return value is the file descriptor of the line
+ * request.
  */
 int
-GPIO::InitGPIOPin( const int pin, const unsigned direction )
-{
-  static constexpr unsigned buffer_length = 35;
-  unsigned                  write_length;
-  char                      buffer[buffer_length];
-  int                       fd = open_with_lock( "/sys/class/gpio/export",
-                                                 O_WRONLY );
-  write_length = snprintf( buffer, buffer_length, "%u", pin );
-  write( fd, buffer, write_length );
-  close( fd );
-
-  // Small pause for system settings to settle
-  std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+GPIO::InitGPIOLines()
+{
+  const std::string chip = find_gpio_chip();
+  const int         fd   = open( chip.c_str(), O_RDWR );
+  if( fd == OPEN_FAILED ){
+    throw device_exception( DeviceName,
+                            fmt::sprintf( "Failed to open path [%s]", chip ) );
+  }
 
-  // Getting the direction path
-  std::string path = fmt::sprintf( "/sys/class/gpio/gpio%d/direction", pin );
+  struct gpio_v2_line_request req;
+  memset( &req, 0, sizeof( req ) );
+  req.offsets[trigger_line] = trigger_pin;
+  req.offsets[light_line]   = light_pin;
+  req.offsets[spare_line]   = spare_pin;
+  req.num_lines             = 3;
+  req.config.flags          = GPIO_V2_LINE_FLAG_OUTPUT;
+  strncpy( req.consumer, "sipmcalib", sizeof( req.consumer )-1 );
 
-  // Waiting for the /sysfs to generated the corresponding file
-  while( access( path.c_str(), F_OK ) == -1 ){
-    std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
-  }
-  fd =
-    ( direction == READ ) ? open_with_lock( path.c_str(),
-                                            O_WRONLY ) : open_with_lock(
-      path.c_str(),
-      O_WRONLY );
-  int status = write( fd,
-                      direction == READ ? "in" : "out",
-                      direction == READ ? 2    : 3 );
+  const int status = ioctl( fd, GPIO_V2_GET_LINE_IOCTL, &req );
+  close( fd );
   if( status == IO_FAILED ){
     throw device_exception( DeviceName,
                             fmt::sprintf(
-                              "Failed to set gpio [%d] direction!",
-                              pin ) );
+                              "Failed to request gpio lines from [%s]: %s",
+                              chip,
+                              strerror( errno ) ) );
   }
-  close( fd );
-
-  // Opening GPIO PIN
-  path = fmt::sprintf( "/sys/class/gpio/gpio%d/value", pin );
-  fd   =
-    ( direction == READ ) ? open_with_lock( path.c_str(),
-                                            O_RDONLY ) : open_with_lock(
-      path.c_str(),
-      O_WRONLY );
-  return fd;
+  return req.fd;
 }
 
 
 /**
- * @brief Reading from a GPIO initialized file descriptor
+ * @brief Setting the lines of the line request in a single ioctl call.
  *
- * The value would be either 1 or 0 (integer) depending of if the pin detects
- * high or low voltage values.
+ * The mask selects the lines to modify, and the bits the output value, with
+ * bit i corresponding the i-th line of the request (trigger_line, light_line
+ * and spare_line). Lines not in the mask are left unchanged. If anything goes
+ * wrong raise an exception.
  */
-int
-GPIO::GPIORead( const int fd )
+void
+GPIO::GPIOSetLines( const uint64_t mask, const uint64_t bits ) const
 {
-  char value_str[3];
-  if( read( fd, value_str, 3 ) == IO_FAILED ){
-    throw device_exception( DeviceName, "Failed to read gpio value!" );
+  struct gpio_v2_line_values values;
+  values.mask = mask;
+  values.bits = bits;
+  if( ioctl( gpio_lines, GPIO_V2_LINE_SET_VALUES_IOCTL, &values )
+      == IO_FAILED ){
+    throw device_exception( DeviceName, "Failed to write gpio value!" );
   }
-  return atoi( value_str );
 }
 
 
 /**
- * @brief Writing to a GPIO initialized file descriptor
- *
- * Writing either 1 or 0 (string) to the designated file descriptor. If
- * anything goes wrong raise an excpetion.
+ * @brief Setting a single line of the line request to high or low.
  */
 void
-GPIO::GPIOWrite( const int fd, const unsigned val )
+GPIO::GPIOWrite( const unsigned line, const unsigned val ) const
 {
-  if( write( fd, LOW == val ? "0" : "1", 1 ) == IO_FAILED ){
-    throw device_exception( DeviceName, "Failed to write gpio value!" );
+  if( gpio_lines < NORMAL_PTR ){
+    throw device_exception( DeviceName, "GPIO lines are not initialized" );
   }
+  GPIOSetLines( 1ull << line, val == LOW ? 0 : 1ull << line );
 }
 
 
 /**
- * @brief Closing the GPIO file descriptor.
+ * @brief Mapping the GPIO registers for direct trigger pin manipulation.
  *
- * This is important for restarting the program, otherwise the GPIO sysfs will
- * be occupied by the non-existant closed program.
+ * Setting the line values through the GPIO character device requires a system
+ * call per edge, which limits the timing precision of the trigger pulses.
+ * Writing to the GPSET0/GPCLR0 registers instead takes a single bus write. As
+ * the pin direction is already configured by the line request, only the
+ * set/clear registers are used. Failing to map the registers is not an error,
+ * the trigger will fall back to the character device interface.
  */
 void
-GPIO::CloseGPIO( const int pin )
-{
-  static constexpr unsigned buffer_length = 3;
-  unsigned                  write_length;
-  char                      buffer[buffer_length];
-  int                       fd = open_with_lock( "/sys/class/gpio/unexport",
-                                                 O_WRONLY );
-  write_length = snprintf( buffer, buffer_length, "%d", pin );
-  write( fd, buffer, write_length );
+GPIO::InitGPIOMem()
+{
+  static constexpr size_t block_size = 4096;
+
+  CloseGPIOMem();
+  const int fd = open( "/dev/gpiomem", O_RDWR | O_SYNC );
+  if( fd == OPEN_FAILED ){
+    printwarn( DeviceName, "Failed to open /dev/gpiomem, trigger pulse timing"
+               " will use the gpio character device" );
+    return;
+  }
+  void* reg = mmap( nullptr, block_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0 );
   close( fd );
+  if( reg == MAP_FAILED ){
+    printwarn( DeviceName, "Failed to map GPIO registers, trigger pulse timing"
+               " will use the gpio character device" );
+    return;
+  }
+  gpio_reg = static_cast<volatile uint32_t*>( reg );
+}
+
+
+void
+GPIO::CloseGPIOMem()
+{
+  if( gpio_reg != nullptr ){
+    munmap( const_cast<uint32_t*>( gpio_reg ), 4096 );
+    gpio_reg = nullptr;
+  }
+}
+
+
+/**
+ * @brief Setting the trigger pin output, using the GPIO registers if
+ * available.
+ */
+void
+GPIO::TriggerWrite( const unsigned val ) const
+{
+  // Word offsets of the GPSET0 and GPCLR0 registers.
+  static constexpr unsigned gpset0 = 0x1c / 4;
+  static constexpr unsigned gpclr0 = 0x28 / 4;
+  if( gpio_reg != nullptr ){
+    gpio_reg[val == LOW ? gpclr0 : gpset0] = 1u << trigger_pin;
+  } else {
+    GPIOWrite( trigger_line, val );
+  }
+}
+
+
+/**
+ * @brief Waiting until a time point with microsecond level precision.
+ *
+ * The thread sleeps until shortly before the target time, then busy waits for
+ * the remaining time, as the wake up latency of the sleep is typically much
+ * larger than the required timing precision.
+ */
+static void
+precise_wait_until( const std::chrono::steady_clock::time_point t )
+{
+  static constexpr auto spin_margin = std::chrono::microseconds( 200 );
+  if( t-std::chrono::steady_clock::now() > spin_margin ){
+    std::this_thread::sleep_until( t-spin_margin );
+  }
+  while( std::chrono::steady_clock::now() < t ){}
+}
+
+
+/**
+ * @brief Generating n pulses (indefinitely if n is 0) with edges scheduled
+ * on absolute time points, such that the timing error does not accumulate
+ * over the pulse train, stopping early once run is set to false. If the
+ * thread falls behind by more than a full period (for example by being
+ * preempted), the schedule is restarted from the current time rather than
+ * firing the missed pulses in a burst. Returns the number of pulses generated.
+ */
+uint64_t
+GPIO::RunPulses( const unsigned                            n,
+                 const std::chrono::steady_clock::duration period,
+                 const std::chrono::steady_clock::duration width,
+                 const std::atomic<bool>&                  run ) const
+{
+  uint64_t count = 0;
+  auto     next  = std::chrono::steady_clock::now();
+  while( run && ( n == 0 || count < n ) ){
+    precise_wait_until( next );
+    TriggerWrite( HI );
+    precise_wait_until( next+width );
+    TriggerWrite( LOW );
+    ++count;
+    next += period;
+    const auto now = std::chrono::steady_clock::now();
+    if( now > next+period ){
+      next = now;
+    }
+  }
+  return count;
 }
 
 
@@ -226,21 +354,107 @@ GPIO::CloseGPIO( const int pin )
  * @brief Generating N pulses with some time in between pulses.
  *
  * All pulses will have a high-time of 1 microsecond, and a w microsecond of
- * down time. The fastest pulse rate is about 100 microseconds.
+ * down time. The function returns after the last pulse. Cannot be used while
+ * a pulse train is running (see StartPulseTrain). The full pulse sequence is
+ * recorded in the `gpio.pulse` latency section.
  */
 void
 GPIO::Pulse( const unsigned n, const unsigned wait ) const
 {
-  if( gpio_trigger == OPEN_FAILED ){
+  if( gpio_lines < NORMAL_PTR ){
+    throw device_exception( DeviceName,
+                            "GPIO for trigger pin is not initialized" );
+  }
+  if( pulse_run ){
+    throw device_exception( DeviceName, "Trigger pulse train is running" );
+  }
+  if( n == 0 ){ return; }
+  LATENCY_SCOPE( "gpio.pulse" );
+  const std::atomic<bool> run( true );
+  RunPulses( n,
+             std::chrono::microseconds( 1+wait ),
+             std::chrono::microseconds( 1 ),
+             run );
+}
+
+
+/**
+ * @brief Starting a train of n trigger pulses (unlimited if n is 0) at the
+ * given frequency (in Hz), with the given high time (in seconds), in a
+ * separate thread.
+ *
+ * The function returns immediately, so the readout system can wait for the
+ * triggers while the pulse train is running. The pulse thread requests real
+ * time scheduling to reduce jitter, falling back to the default scheduling if
+ * the process does not have the permission.
+ */
+void
+GPIO::StartPulseTrain( const double   frequency,
+                       const unsigned n,
+                       const double   width )
+{
+  if( gpio_lines < NORMAL_PTR ){
     throw device_exception( DeviceName,
                             "GPIO for trigger pin is not initialized" );
   }
-  for( unsigned i = 0; i < n; ++i ){
-    GPIOWrite( gpio_trigger, HI );
-    std::this_thread::sleep_for( std::chrono::microseconds( 1 ) );
-    GPIOWrite( gpio_trigger, LOW );
-    std::this_thread::sleep_for( std::chrono::microseconds( wait ) );
+  if( !( frequency > 0 ) || !( width > 0 ) || width * frequency >= 1 ){
+    throw device_exception( DeviceName,
+                            fmt::sprintf( "Invalid pulse train frequency [%g Hz]"
+                                          " and width [%g s]",
+                                          frequency,
+                                          width ) );
   }
+  StopPulseTrain();
+
+  typedef std::chrono::steady_clock::duration duration;
+  const duration period = std::chrono::duration_cast<duration>(
+    std::chrono::duration<double>( 1.0 / frequency ) );
+  const duration high = std::chrono::duration_cast<duration>(
+    std::chrono::duration<double>( width ) );
+
+  pulse_count  = 0;
+  pulse_run    = true;
+  pulse_thread = std::thread( [this, n, period, high]{
+    try {
+      pulse_count = RunPulses( n, period, high, pulse_run );
+    } catch( std::exception& e ){}// Stopping if the trigger pin is not writable
+    pulse_run = false;
+  } );
+
+  sched_param param;
+  param.sched_priority = sched_get_priority_min( SCHED_FIFO );
+  pthread_setschedparam( pulse_thread.native_handle(), SCHED_FIFO, &param );
+}
+
+
+/**
+ * @brief Stopping the pulse train, returning once the trigger pin is low.
+ */
+void
+GPIO::StopPulseTrain()
+{
+  pulse_run = false;
+  if( pulse_thread.joinable() ){
+    pulse_thread.join();
+  }
+}
+
+
+bool
+GPIO::PulseTrainRunning() const
+{
+  return pulse_run;
+}
+
+
+/**
+ * @brief Number of pulses generated by the latest pulse train, only updated
+ * once the pulse train has stopped.
+ */
+uint64_t
+GPIO::PulseTrainCount() const
+{
+  return pulse_count;
 }
 
 
@@ -251,22 +465,22 @@ GPIO::Pulse( const unsigned n, const unsigned wait ) const
 void
 GPIO::LightsOn() const
 {
-  if( gpio_light == OPEN_FAILED ){
+  if( gpio_lines < NORMAL_PTR ){
     throw device_exception( DeviceName,
                             "GPIO for light pin is not initialized" );
   }
-  GPIOWrite( gpio_light, HI );
+  GPIOWrite( light_line, HI );
 }
 
 
 void
 GPIO::LightsOff() const
 {
-  if( gpio_light == OPEN_FAILED ){
+  if( gpio_lines < NORMAL_PTR ){
     throw device_exception( DeviceName,
                             "GPIO for light pin is not initialized" );
   }
-  GPIOWrite( gpio_light, LOW );
+  GPIOWrite( light_line, LOW );
 }
 
 
@@ -280,22 +494,22 @@ GPIO::LightsOff() const
 void
 GPIO::SpareOn() const
 {
-  if( gpio_spare == OPEN_FAILED ){
+  if( gpio_lines < NORMAL_PTR ){
     throw device_exception( DeviceName,
                             "GPIO for spare pin is not initialized" );
   }
-  GPIOWrite( gpio_spare, HI );
+  GPIOWrite( spare_line, HI );
 }
 
 
 void
 GPIO::SpareOff() const
 {
-  if( gpio_spare == OPEN_FAILED ){
+  if( gpio_lines < NORMAL_PTR ){
     throw device_exception( DeviceName,
                             "GPIO for spare pin is not initialized" );
   }
-  GPIOWrite( gpio_spare, LOW );
+  GPIOWrite( spare_line, LOW );
 }
 
 
@@ -432,9 +646,9 @@ GPIO::SetPWM( const unsigned c, const double dc, const double f )
                               c ) );
   } else if( pwm_enable[channel] == UNOPENED ){
     if( channel == 0 ){
-      i2c_flush_array[2] = duty_cycle * 5000.0;
+      adc_mock[2] = duty_cycle * 5000.0;
     } else if( channel == 1 ){
-      i2c_flush_array[3] = duty_cycle * 5000.0;
+      adc_mock[3] = duty_cycle * 5000.0;
     }
   } else {
     write( pwm_enable[channel], "0",        1          );
@@ -510,34 +724,74 @@ GPIO::InitI2C()
 /**
  * @{
  * @brief Modifying the ADC settings via the configuration constant variables.
+ *
+ * The settings are queued here and applied by the streaming loop before the
+ * next channel readout, as the loop writes the full configuration to the
+ * device on every channel switch. The calling thread therefore never accesses
+ * the I2C device, and the call never waits for an I2C transaction.
  */
 void
 GPIO::SetADCRange( const int range )
 {
-  if( adc_range  != range ){
-    adc_range = range;
-    PushADCSetting();
-  }
+  QueueADCSetting( ADC_SETTING_RANGE, range );
 }
 
 
 void
 GPIO::SetADCRate( const int rate )
 {
-  if( rate != adc_rate ){
-    adc_rate = rate;
-    PushADCSetting();
+  QueueADCSetting( ADC_SETTING_RATE, rate );
+}
+
+
+void
+GPIO::QueueADCSetting( const unsigned setting, const uint8_t value )
+{
+  std::lock_guard<std::mutex> lock( adc_setting_mutex );
+  adc_setting_queue.emplace_back( setting, value );
+}
+
+
+/**
+ * @details Applying the queued setting changes in order, only to be called by
+ * the streaming thread (or before the streaming thread is started).
+ */
+void
+GPIO::ApplyADCSettings()
+{
+  std::deque<std::pair<unsigned, uint8_t> > queue;
+  {
+    std::lock_guard<std::mutex> lock( adc_setting_mutex );
+    queue.swap( adc_setting_queue );
   }
+  for( const auto& setting : queue ){
+    if( setting.first == ADC_SETTING_RANGE ){
+      adc_range = setting.second;
+    } else if( setting.first == ADC_SETTING_RATE ){
+      adc_rate = setting.second;
+    }
+  }
+}
+
+
+/**
+ * @brief Number of conversions to average for each stored ADC sample.
+ */
+void
+GPIO::SetADCOversample( const unsigned n )
+{
+  adc_oversample = std::max( 1u, n );
 }
 
 
 /**
  * @details This is the routine that actually writes the configuration settings
- * to the I2D device. Notice we will always be using the continuous readout
+ * to the I2D device, then sets the device pointer back to the conversion
+ * register for reading. Notice we will always be using the continuous readout
  * operation mode.
  */
 void
-GPIO::PushADCSetting()
+GPIO::PushADCSetting( const unsigned adc_channel )
 {
   const uint8_t channel         = ( adc_channel & 0x3 ) | ( 0x1 << 2 );
   const uint8_t range           = ( adc_range & 0x7 );
@@ -555,11 +809,9 @@ GPIO::PushADCSetting()
     ( rate << 5  | 0b00011 )};
   uint8_t       read_buffer[2] = {0};
 
-  // Write and wait for OK signal.
   if( write( gpio_adc, write_buffer, 3 ) != 3 ){
     throw device_exception( DeviceName, "Error writing setting to i2C device" );
   }
-  std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
 
   // Resetting to read mode
   read_buffer[0] = 0;
@@ -576,61 +828,125 @@ GPIO::PushADCSetting()
  * @brief Reading out the I2C interface at the current channel as a 16bit
  * number.
  *
- * Conversion is handled by the flushing loop.
+ * Conversion is handled by the flushing loop. Each transaction is recorded in
+ * the `gpio.adc_read` latency section.
  */
 int16_t
 GPIO::ADCReadRaw()
 {
+  LATENCY_SCOPE( "gpio.adc_read" );
   uint8_t read_buffer[2] = {0};
   int16_t ans;
-  read( gpio_adc, read_buffer, 2 );
+  if( read( gpio_adc, read_buffer, 2 ) != 2 ){
+    throw device_exception( DeviceName, "Error reading from i2C device" );
+  }
   ans = read_buffer[0] << 8 | read_buffer[1];
   return ans;
 }
 
 
 /**
- * @brief The main loop for flushing the readout results into the buffer.
+ * @brief Time for a single conversion at the current data rate setting (in
+ * seconds), including a 10% margin for the tolerance of the internal
+ * oscillator of the ADS1115.
+ */
+double
+GPIO::ADCConversionTime() const
+{
+  static const double rates[8] = { 8, 16, 32, 64, 128, 250, 475, 860 };
+  return 1.1 / rates[adc_rate & 0x7];
+}
+
+
+/**
+ * @brief Conversion factor from ADC counts to mV at the current range
+ * setting.
+ */
+float
+GPIO::ADCVoltScale() const
+{
+  const uint8_t range = adc_range & 0x7;
+  return range ==
+         ADS_RANGE_6V  ? 6144.0 / 32678.0 : range ==
+         ADS_RANGE_4V  ? 4096.0 / 32678.0 : range ==
+         ADS_RANGE_2V  ? 2048.0 / 32678.0 : range ==
+         ADS_RANGE_1V  ? 1024.0 / 32678.0 : range ==
+         ADS_RANGE_p5V ? 512.0 / 32678.0  : 256.0
+         / 32678.0;
+}
+
+
+/**
+ * @brief The main loop for streaming the readout results into the buffer.
  *
  * Notice that the i2C readout will always be a single channel so the loop is
- * responsible for iterating the readout channel. The loop is continuously run
- * until the i2d_flush is set to false (when exiting the program or
+ * responsible for iterating the readout channel. The ADC is always running in
+ * continuous conversion mode, so rather than polling with fixed sleeps, the
+ * readout is scheduled from the conversion time of the configured data rate:
+ * after switching the channel multiplexer, the conversion in progress (which
+ * may have started with the previous channel) is skipped, then the configured
+ * number of consecutive conversions are read out and averaged. With the default
+ * settings, all four channels are refreshed every ~40 ms.
+ *
+ * Each averaged value is stored with its timestamp (system time in seconds) in
+ * the per-channel sample history, and published together with the settings
+ * used for the conversion as the latest snapshot (see ReadADCSnapshot). If the
+ * I2C interface is not available (for local testing), the current mock values
+ * are recorded into the history every 50 ms instead. The loop is continuously
+ * run until the i2d_flush is set to false (when exiting the program or
  * re-initializing the i2c interface.)
  */
 void
 GPIO::FlushLoop( std::atomic<bool>& i2d_flush )
 {
+  typedef std::chrono::steady_clock clock;
+  auto timestamp = [](){
+    return std::chrono::duration<double>(
+      std::chrono::system_clock::now().time_since_epoch() ).count();
+  };
+
   while( i2c_flush == true ){
     if( gpio_adc >= NORMAL_PTR ){
-      for( unsigned channel = 0; channel < 4; ++channel ){
-        adc_channel = channel;
+      for( unsigned channel = 0; channel < 4 && i2c_flush; ++channel ){
+        ApplyADCSettings();
         try {// This is incase the GPIO interface is open but not addressable
-          PushADCSetting();
-          const int16_t adc   = ADCReadRaw();
-          const uint8_t range = adc_range & 0x7;
-          const float   conv  = range ==
-                                ADS_RANGE_6V  ? 6144.0 / 32678.0 : range ==
-                                ADS_RANGE_4V  ? 4096.0 / 32678.0 : range ==
-                                ADS_RANGE_2V  ? 2048.0 / 32678.0 : range ==
-                                ADS_RANGE_1V  ? 1024.0 / 32678.0 : range ==
-                                ADS_RANGE_p5V ? 512.0 / 32678.0  : 256.0
-                                / 32678.0;
-          i2c_flush_array[channel] = adc * conv;
-          std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+          PushADCSetting( channel );
+          const auto conv = std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>( ADCConversionTime() ) );
+          const unsigned n    = std::max( 1u, adc_oversample.load() );
+          auto           next = clock::now()+2 * conv;
+          double         sum  = 0;
+          for( unsigned i = 0; i < n; ++i ){
+            std::this_thread::sleep_until( next );
+            sum  += ADCReadRaw();
+            next += conv;
+          }
+          const float  value = sum / n * ADCVoltScale();
+          const double t     = timestamp();
+          adc_latest.values[channel] = value;
+          adc_latest.time[channel]   = t;
+          adc_latest.range[channel]  = adc_range;
+          adc_latest.rate[channel]   = adc_rate;
+          adc_snapshot.Store( adc_latest );
+          adc_history[channel].Push( t, value );
         } catch( std::exception& e ){
-          i2c_flush_array[0] = i2c_flush_array[0];
-          i2c_flush_array[1] = i2c_flush_array[1];
-          i2c_flush_array[2] = i2c_flush_array[2];
-          i2c_flush_array[3] = i2c_flush_array[3];
+          // Keeping the previous values if the readout failed.
+          std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
         }
       }
     } else {
-      i2c_flush_array[0] = i2c_flush_array[0];
-      i2c_flush_array[1] = i2c_flush_array[1];
-      i2c_flush_array[2] = i2c_flush_array[2];
-      i2c_flush_array[3] = i2c_flush_array[3];
+      ApplyADCSettings();
+      const double t = timestamp();
+      for( unsigned channel = 0; channel < 4; ++channel ){
+        adc_latest.values[channel] = adc_mock[channel];
+        adc_latest.time[channel]   = t;
+        adc_latest.range[channel]  = adc_range;
+        adc_latest.rate[channel]   = adc_rate;
+        adc_history[channel].Push( t, adc_latest.values[channel] );
+      }
+      adc_snapshot.Store( adc_latest );
+      std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
     }
-    std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
   }
 }
 
@@ -668,7 +984,75 @@ GPIO::CloseI2CFlush()
 float
 GPIO::ReadADC( const unsigned channel ) const
 {
-  return i2c_flush_array[channel];
+  return adc_snapshot.Load().values[channel];
+}
+
+
+/**
+ * @brief Consistent snapshot of the latest readout of all channels.
+ *
+ * The snapshot is published by the streaming thread with a sequence lock, so
+ * this never blocks, and the values are never torn or mismatched with the
+ * range and rate settings, regardless of the polling rate.
+ */
+GPIO::ADCSnapshot
+GPIO::ReadADCSnapshot() const
+{
+  return adc_snapshot.Load();
+}
+
+
+/**
+ * @brief Average of the latest n stored samples of a given channel in mV,
+ * falling back to the latest value if no samples have been stored yet.
+ */
+float
+GPIO::ReadADCAverage( const unsigned channel, const unsigned n ) const
+{
+  CheckADCChannel( channel );
+  const std::vector<SampleHistory::Sample> samples
+    = adc_history[channel].Latest( n );
+  if( samples.empty() ){
+    return ReadADC( channel );
+  }
+  double sum = 0;
+  for( const auto& sample : samples ){
+    sum += sample.value;
+  }
+  return sum / samples.size();
+}
+
+
+/**
+ * @brief Total number of samples stored for a given channel.
+ */
+uint64_t
+GPIO::ADCSampleCount( const unsigned channel ) const
+{
+  CheckADCChannel( channel );
+  return adc_history[channel].Count();
+}
+
+
+/**
+ * @brief Copy of the latest (at most) n timestamped samples of a given
+ * channel, oldest sample first.
+ */
+std::vector<SampleHistory::Sample>
+GPIO::ADCHistory( const unsigned channel, const unsigned n ) const
+{
+  CheckADCChannel( channel );
+  return adc_history[channel].Latest( n );
+}
+
+
+void
+GPIO::CheckADCChannel( const unsigned channel ) const
+{
+  if( channel >= 4 ){
+    throw device_exception( DeviceName,
+                            fmt::sprintf( "Invalid ADC channel [%u]", channel ) );
+  }
 }
 
 
@@ -764,13 +1148,14 @@ GPIO::ReadRTDTemp( const unsigned channel ) const
  * will be activated.
  *
  */
-GPIO::GPIO() : gpio_trigger( UNOPENED ),
-  gpio_light               ( UNOPENED ),
-  gpio_spare               ( UNOPENED ),
+GPIO::GPIO() : gpio_lines( UNOPENED ),
+  gpio_reg                 ( nullptr ),
+  pulse_run                ( false ),
+  pulse_count              ( 0 ),
   gpio_adc                 ( UNOPENED ),
+  adc_oversample           ( 1 ),
   adc_range                ( ADS_RANGE_4V ),
   adc_rate                 ( ADS_RATE_250SPS ),
-  adc_channel              ( 0 ),
   i2c_flush                ( false )
 {
   pwm_enable[0] = UNOPENED;
@@ -780,10 +1165,14 @@ GPIO::GPIO() : gpio_trigger( UNOPENED ),
   pwm_duty[1]   = UNOPENED;
   pwm_period[1] = UNOPENED;
 
-  i2c_flush_array[0] = 2500.0;
-  i2c_flush_array[1] = 2500.0;
-  i2c_flush_array[2] = 2500.0;
-  i2c_flush_array[3] = 2500.0;
+  for( unsigned channel = 0; channel < 4; ++channel ){
+    adc_mock[channel]          = 2500.0;
+    adc_latest.values[channel] = 2500.0;
+    adc_latest.time[channel]   = 0;
+    adc_latest.range[channel]  = adc_range;
+    adc_latest.rate[channel]   = adc_rate;
+  }
+  adc_snapshot.Store( adc_latest );
 
   reference_voltage[0] = 5000.0;
   reference_voltage[1] = 5000.0;
@@ -792,6 +1181,10 @@ GPIO::GPIO() : gpio_trigger( UNOPENED ),
 
   pwm_duty_value[0] = 0.5;
   pwm_duty_value[1] = 0.5;
+
+  for( unsigned channel = 0; channel < 4; ++channel ){
+    adc_history[channel].Reset( 16384 );
+  }
 }
 
 
@@ -809,9 +1202,10 @@ void
 GPIO::Init()
 {
   try {
-    gpio_light   = InitGPIOPin(   light_pin, WRITE );
-    gpio_trigger = InitGPIOPin( trigger_pin, WRITE );
-    gpio_spare   = InitGPIOPin(   spare_pin, WRITE );
+    if( gpio_lines < NORMAL_PTR ){
+      gpio_lines = InitGPIOLines();
+    }
+    InitGPIOMem();
     InitPWM();
 
     if( gpio_adc != UNOPENED ){
@@ -819,7 +1213,8 @@ GPIO::Init()
     }
     gpio_adc = InitI2C();
     if( gpio_adc != OPEN_FAILED && gpio_adc != UNOPENED ){
-      PushADCSetting();
+      ApplyADCSettings();
+      PushADCSetting( 0 );
       InitI2CFlush();
     }
   } catch( std::runtime_error& e ){
@@ -839,18 +1234,16 @@ GPIO::Init()
  */
 GPIO::~GPIO()
 {
-  // Turning off LED light when the process has ended.
-  printdebug( DeviceName, "Closing GPIO pins for the light" );
-  if( gpio_light >= NORMAL_PTR ){
-    LightsOff();
-    close( gpio_light );
-    CloseGPIO( light_pin );
-  }
-
-  printdebug( DeviceName, "Closing GPIO pins for the trigger" );
-  if( gpio_trigger >= NORMAL_PTR ){
-    close( gpio_trigger );
-    CloseGPIO( trigger_pin );
+  // Turning off LED light and all other pins when the process has ended.
+  printdebug( DeviceName, "Closing GPIO pins for the light and trigger" );
+  StopPulseTrain();
+  CloseGPIOMem();
+  if( gpio_lines >= NORMAL_PTR ){
+    try {
+      GPIOSetLines( ( 1ull << trigger_line ) | ( 1ull << light_line )
+                    | ( 1ull << spare_line ), 0 );
+    } catch( std::exception& e ){}
+    close( gpio_lines );
   }
 
   printdebug( DeviceName, "Closing GPIo pins for the PWM" );
@@ -872,8 +1265,7 @@ GPIO::~GPIO()
 bool
 GPIO::StatusGPIO() const
 {
-  return gpio_trigger >= NORMAL_PTR && gpio_light >= NORMAL_PTR &&
-         gpio_spare   >= NORMAL_PTR;
+  return gpio_lines >= NORMAL_PTR;
 }
 
 
@@ -887,6 +1279,17 @@ GPIO::StatusADC() const
 }
 
 
+/**
+ * @brief Checking that the GPIO registers are mapped for precise trigger
+ * timing.
+ */
+bool
+GPIO::StatusGPIOMem() const
+{
+  return gpio_reg != nullptr;
+}
+
+
 /**
  * @brief Checking that the PWM interface is available.
  */
@@ -2,9 +2,17 @@
 #define GPIO_HPP
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <utility>
+#include <vector>
 
+#include "samplehistory.hpp"
+#include "seqlock.hpp"
 #include "singleton.hpp"
 
 class GPIO
@@ -14,6 +22,12 @@ public:
 
   // High level functions using GPIO interface
   void Pulse( const unsigned n, const unsigned wait ) const;
+  void StartPulseTrain( const double   frequency,
+                        const unsigned n     = 0,
+                        const double   width = 1e-6 );
+  void     StopPulseTrain();
+  bool     PulseTrainRunning() const;
+  uint64_t PulseTrainCount() const;
   void LightsOn() const;
   void LightsOff() const;
   void SpareOn() const;
@@ -27,19 +41,42 @@ public:
   // Only storing the duty cycle for external reference.
   float GetPWM( unsigned channel );
 
+  // Consistent snapshot of the latest ADC readout of all channels, with the
+  // range and rate settings used for the conversion of each value.
+  struct ADCSnapshot
+  {
+    float   values[4];// In units of mV
+    double  time[4];// System time in seconds
+    uint8_t range[4];
+    uint8_t rate[4];
+  };
+
   // High level functions for I2C ADC det interface
   void  SetADCRange( const int );
   void  SetADCRate( const int );
   float ReadADC( const unsigned channel ) const;
+  ADCSnapshot ReadADCSnapshot() const;
   float ReadNTCTemp( const unsigned channel ) const;
   float ReadRTDTemp( const unsigned channel ) const;
   void  SetReferenceVoltage( const unsigned channel, const float val );
 
+  // Streaming ADC history
+  void                               SetADCOversample( const unsigned n );
+  float                              ReadADCAverage( const unsigned channel,
+                                                     const unsigned n ) const;
+  uint64_t                           ADCSampleCount( const unsigned channel ) const;
+  std::vector<SampleHistory::Sample> ADCHistory( const unsigned channel,
+                                                 const unsigned n ) const;
+
   // On the raspberry PI, these pins correspond to the BCM pin from
   // wiringPi's `gpio readall` command. Falling back to
   static constexpr unsigned trigger_pin = 21;// PHYS PIN 40
   static constexpr unsigned light_pin   = 26; // PHYS PIN 37
   static constexpr unsigned spare_pin   = 20; // PHYS PIN 38
+  // Index of the pins in the GPIO line request
+  static constexpr unsigned trigger_line = 0;
+  static constexpr unsigned light_line   = 1;
+  static constexpr unsigned spare_line   = 2;
   // Helper
   static constexpr unsigned READ  = 0;
   static constexpr unsigned WRITE = 1;
@@ -72,26 +109,47 @@ public:
   bool                 StatusGPIO() const;
   bool                 StatusADC() const;
   bool                 StatusPWM() const;
+  bool                 StatusGPIOMem() const;
 
 private:
-  static int           InitGPIOPin( const int pin, const unsigned direction );
-  static void          CloseGPIO( const int pin );
-  static int           GPIORead( const int fd );
-  static void          GPIOWrite( const int fd, const unsigned val );
+  static int           InitGPIOLines();
+  void                 GPIOSetLines( const uint64_t mask,
+                                     const uint64_t bits ) const;
+  void                 GPIOWrite( const unsigned line, const unsigned val ) const;
+  void                 InitGPIOMem();
+  void                 CloseGPIOMem();
+  void                 TriggerWrite( const unsigned val ) const;
+  uint64_t             RunPulses( const unsigned                            n,
+                                  const std::chrono::steady_clock::duration period,
+                                  const std::chrono::steady_clock::duration width,
+                                  const std::atomic<bool>&                  run )
+  const;
   void                 InitPWM();
   void                 ClosePWM();
   static constexpr int ads_default_address = 0x48;
   static int           InitI2C();
-  void                 PushADCSetting();
+  void                 PushADCSetting( const unsigned channel );
+  void                 QueueADCSetting( const unsigned setting,
+                                        const uint8_t  value );
+  void                 ApplyADCSettings();
   int16_t              ADCReadRaw();
+  double               ADCConversionTime() const;
+  float                ADCVoltScale() const;
+  void                 CheckADCChannel( const unsigned channel ) const;
   void                 FlushLoop( std::atomic<bool>& );
   void                 InitI2CFlush();
   void                 CloseI2CFlush();
 
-  // File pointers triggers direct GPIO
-  int gpio_trigger;
-  int gpio_light;
-  int gpio_spare;
+  // File pointer to the GPIO line request of the trigger and switch pins
+  int gpio_lines;
+
+  // Memory mapped GPIO registers for precise trigger timing
+  volatile uint32_t* gpio_reg;
+
+  // Background pulse train generation
+  std::atomic<bool>     pulse_run;
+  std::atomic<uint64_t> pulse_count;
+  std::thread           pulse_thread;
 
   // File pointer to ADC
   int gpio_adc;
@@ -102,16 +160,26 @@ private:
   int pwm_period[2];
 
   // Storing present duty cycle settings .
-  float   pwm_duty_value[2];
-  uint8_t adc_range;
-  uint8_t adc_rate;
-  uint8_t adc_channel;
-  float   reference_voltage[4];
-
-  // I2C interface continuous streaming.
-  std::atomic<bool> i2c_flush;
-  std::thread       i2c_flush_thread;
-  float             i2c_flush_array[4];
+  float                 pwm_duty_value[2];
+  std::atomic<unsigned> adc_oversample;
+  float                 reference_voltage[4];
+
+  // I2C interface continuous streaming. Once the streaming thread is started,
+  // it is the only thread accessing the I2C device and the applied ADC
+  // settings, setting changes are queued and applied by the streaming thread
+  // between channel readouts.
+  static constexpr unsigned                       ADC_SETTING_RANGE = 0;
+  static constexpr unsigned                       ADC_SETTING_RATE  = 1;
+  uint8_t                                         adc_range;
+  uint8_t                                         adc_rate;
+  std::mutex                                      adc_setting_mutex;
+  std::deque<std::pair<unsigned, uint8_t> >       adc_setting_queue;
+  std::atomic<bool>                               i2c_flush;
+  std::thread                                     i2c_flush_thread;
+  ADCSnapshot                                     adc_latest;
+  SeqLock<ADCSnapshot>                            adc_snapshot;
+  std::atomic<float>                              adc_mock[4];
+  SampleHistory                                   adc_history[4];
 
 /// singleton stuff
   DECLARE_SINGLETON( GPIO )
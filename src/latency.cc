@@ -0,0 +1,457 @@
+#include "latency.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fmt/format.h>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+/**
+ * @brief Per-thread latency histograms.
+ *
+ * Each instrumented code section is identified by a name (typically
+ * `<device>.<section>`), and the durations are recorded into log-linear
+ * histograms in the style of HDR histograms, such that the relative bucket width
+ * is at most 6.25%. Recording can be switched off at run time (see
+ * LatencySetEnabled), and the histograms of all threads are only merged when a
+ * snapshot is requested (see LatencySnapshot). The registry is implemented in a
+ * separate shared library, such that the histograms are shared by all device
+ * modules. The scoped timers read the CPU cycle counter (see LatencyTicks)
+ * rather than the system clock, which costs tens of nanoseconds per reading.
+ *
+ * Each thread owns a shard of histograms (one per registered section, allocated
+ * on the first record of the section), and is the only writer of its shard: the
+ * counters are atomics only such that snapshots can read them while the thread
+ * is recording, so the increments are plain relaxed load/store pairs rather
+ * than read-modify-write operations. The registry keeps the list of live
+ * shards, and the shard of an exiting thread is merged into the retired
+ * histograms before it is removed from the registry.
+ *
+ * The cycle counter rate is read from the counter frequency register on ARM,
+ * and measured against the steady clock over a 2 ms interval on x86. The
+ * enabled flag and the counter rate are namespace-scope atomics rather than
+ * registry members, and the shard of the current thread is a plain thread
+ * local pointer (the handle releasing the shard is only touched on the first
+ * record of the thread), so the record path involves no static or thread local
+ * initialization guards.
+ *
+ * Bucket indices are log-linear: values below 16 ns have their own bucket,
+ * larger values are binned with 16 sub-buckets per power of 2. The registry is
+ * intentionally leaked, such that threads exiting after the static destructors
+ * have run can still merge their shards.
+ */
+namespace {
+
+static constexpr unsigned max_sections = 256;
+static constexpr unsigned sub_bits     = 4;
+static constexpr unsigned sub_count    = 1 << sub_bits;
+static constexpr unsigned max_exponent = 47; // ~39 hours
+static constexpr unsigned n_buckets    = ( max_exponent-sub_bits+2 ) * sub_count;
+
+inline unsigned
+BucketIndex( const uint64_t ns )
+{
+  if( ns < sub_count ){ return ns; }
+  const unsigned e = std::min( 63u - __builtin_clzll( ns ), max_exponent );
+  const unsigned s = std::min<uint64_t>( ns >> ( e-sub_bits ),
+                                         2 * sub_count-1 ) - sub_count;
+  return ( e-sub_bits+1 ) * sub_count+s;
+}
+
+
+inline double
+BucketLower( const unsigned index )
+{
+  if( index < sub_count ){ return index; }
+  const unsigned e = index / sub_count+sub_bits-1;
+  const unsigned s = index % sub_count;
+  return std::ldexp( sub_count+s, e-sub_bits );
+}
+
+
+inline double
+BucketWidth( const unsigned index )
+{
+  return index < sub_count ? 1.0 : std::ldexp( 1.0, index / sub_count-1 );
+}
+
+
+struct Histogram
+{
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> min;
+  std::atomic<uint64_t> max;
+  std::atomic<uint64_t> bins[n_buckets];
+
+  Histogram(){ Clear(); }
+
+  // Only called by the owning thread.
+  inline void
+  Record( const uint64_t ns )
+  {
+    auto& bin = bins[BucketIndex( ns )];
+    bin.store( bin.load( std::memory_order_relaxed )+1,
+               std::memory_order_relaxed );
+    count.store( count.load( std::memory_order_relaxed )+1,
+                 std::memory_order_relaxed );
+    sum.store( sum.load( std::memory_order_relaxed )+ns,
+               std::memory_order_relaxed );
+    if( ns < min.load( std::memory_order_relaxed ) ){
+      min.store( ns, std::memory_order_relaxed );
+    }
+    if( ns > max.load( std::memory_order_relaxed ) ){
+      max.store( ns, std::memory_order_relaxed );
+    }
+  }
+
+  void
+  Clear()
+  {
+    count.store( 0, std::memory_order_relaxed );
+    sum.store( 0, std::memory_order_relaxed );
+    min.store( std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed );
+    max.store( 0, std::memory_order_relaxed );
+    for( auto& bin : bins ){
+      bin.store( 0, std::memory_order_relaxed );
+    }
+  }
+
+  void
+  MergeInto( Histogram& target ) const
+  {
+    const auto ld = std::memory_order_relaxed;
+    target.count.store( target.count.load( ld )+count.load( ld ), ld );
+    target.sum.store( target.sum.load( ld )+sum.load( ld ), ld );
+    target.min.store( std::min( target.min.load( ld ), min.load( ld ) ), ld );
+    target.max.store( std::max( target.max.load( ld ), max.load( ld ) ), ld );
+    for( unsigned i = 0; i < n_buckets; ++i ){
+      target.bins[i].store( target.bins[i].load( ld )+bins[i].load( ld ), ld );
+    }
+  }
+};
+
+
+struct Shard
+{
+  std::atomic<Histogram*> hists[max_sections];
+
+  Shard()
+  {
+    for( auto& h : hists ){ h.store( nullptr, std::memory_order_relaxed ); }
+  }
+
+  ~Shard()
+  {
+    for( auto& h : hists ){ delete h.load( std::memory_order_relaxed ); }
+  }
+};
+
+
+struct Registry
+{
+  std::mutex                                 mutex;
+  std::map<std::string, unsigned>            ids;
+  std::vector<std::string>                   names;
+  std::set<Shard*>                           shards;
+  std::unique_ptr<Histogram>                 retired[max_sections];
+};
+
+
+Registry&
+registry()
+{
+  static Registry* reg = new Registry();
+  return *reg;
+}
+
+
+// Constant initialized, so reading these never goes through a static guard.
+std::atomic<bool>   enabled( true );
+std::atomic<double> ns_per_tick( 0 );// 0 until calibrated
+
+
+double
+CalibrateTicks()
+{
+#if defined( __aarch64__ )
+  uint64_t freq;
+  asm volatile ( "mrs %0, cntfrq_el0" : "=r" ( freq ) );
+  return 1e9 / freq;
+#elif defined( __x86_64__ ) || defined( __i386__ )
+  typedef std::chrono::steady_clock clock;
+  const auto     t0 = clock::now();
+  const uint64_t c0 = LatencyTicks();
+  while( clock::now()-t0 < std::chrono::milliseconds( 2 ) ){}
+  const auto     t1 = clock::now();
+  const uint64_t c1 = LatencyTicks();
+  return std::chrono::duration<double, std::nano>( t1-t0 ).count()
+         / ( c1-c0 );
+#else
+  return 1;
+#endif
+}
+
+
+// Calibrating once, concurrent first calls may calibrate more than once. This
+// is normally done when the first section is registered (see LatencyId), rather
+// than on the first record.
+double
+NsPerTickSlow()
+{
+  const double x = CalibrateTicks();
+  ns_per_tick.store( x, std::memory_order_relaxed );
+  return x;
+}
+
+
+inline double
+NsPerTick()
+{
+  const double x = ns_per_tick.load( std::memory_order_relaxed );
+  return x > 0 ? x : NsPerTickSlow();
+}
+
+
+thread_local Shard* shard_ptr = nullptr;// Constant initialized
+
+
+// Registering the shard of the current thread on first use, and merging it
+// into the retired histograms on thread exit.
+struct ShardHandle
+{
+  Shard* shard;
+
+  ShardHandle() : shard( new Shard() )
+  {
+    std::lock_guard<std::mutex> lock( registry().mutex );
+    registry().shards.insert( shard );
+  }
+
+  ~ShardHandle()
+  {
+    Registry&                   reg = registry();
+    std::lock_guard<std::mutex> lock( reg.mutex );
+    for( unsigned i = 0; i < max_sections; ++i ){
+      const Histogram* h = shard->hists[i].load( std::memory_order_relaxed );
+      if( h == nullptr ){ continue; }
+      if( !reg.retired[i] ){ reg.retired[i].reset( new Histogram() ); }
+      h->MergeInto( *reg.retired[i] );
+    }
+    reg.shards.erase( shard );
+    delete shard;
+    shard_ptr = nullptr;
+  }
+};
+
+
+Shard&
+LocalShardSlow()
+{
+  static thread_local ShardHandle handle;
+  shard_ptr = handle.shard;
+  return *shard_ptr;
+}
+
+
+inline Shard&
+LocalShard()
+{
+  Shard* shard = shard_ptr;
+  return shard ? *shard : LocalShardSlow();
+}
+
+
+inline void
+RecordNs( const unsigned id, const uint64_t ns )
+{
+  if( id >= max_sections ){ return; }
+  auto&      slot = LocalShard().hists[id];
+  Histogram* h    = slot.load( std::memory_order_relaxed );
+  if( h == nullptr ){
+    h = new Histogram();
+    slot.store( h, std::memory_order_release );
+  }
+  h->Record( ns );
+}
+
+
+double
+Quantile( const Histogram& h, const double q )
+{
+  const uint64_t total = h.count.load( std::memory_order_relaxed );
+  if( total == 0 ){ return 0; }
+  const uint64_t target = std::max<uint64_t>( 1, std::ceil( q * total ) );
+  uint64_t       seen   = 0;
+  for( unsigned i = 0; i < n_buckets; ++i ){
+    seen += h.bins[i].load( std::memory_order_relaxed );
+    if( seen >= target ){
+      // Middle of the bucket, clamped to the observed range.
+      const double v = i < sub_count ? i : BucketLower( i )+BucketWidth( i ) / 2;
+      return std::min( std::max( v, double(h.min.load()) ), double(h.max.load()) );
+    }
+  }
+  return h.max.load( std::memory_order_relaxed );
+}
+
+}
+
+
+/**
+ * @brief Getting the section index of a name, registering the section if it
+ * doesn't already exists. This locks the registry, so the index should be
+ * cached by the caller (this is done by the LATENCY_SCOPE and LATENCY_RECORD
+ * macros).
+ */
+unsigned
+LatencyId( const char* name )
+{
+  NsPerTick();
+  Registry&                   reg = registry();
+  std::lock_guard<std::mutex> lock( reg.mutex );
+  auto                        it = reg.ids.find( name );
+  if( it != reg.ids.end() ){ return it->second; }
+  if( reg.names.size() >= max_sections ){
+    // Overflowing sections all share the last index.
+    return max_sections-1;
+  }
+  const unsigned id = reg.names.size();
+  reg.names.emplace_back( name );
+  reg.ids[name] = id;
+  return id;
+}
+
+
+/**
+ * @brief Recording a duration in nanoseconds for a section in the histogram of
+ * the current thread. This never locks, except for the first record of the
+ * thread or of the section in the thread.
+ */
+void
+LatencyRecord( const unsigned id, const uint64_t ns )
+{
+  if( !LatencyEnabled() ){ return; }
+  RecordNs( id, ns );
+}
+
+
+/**
+ * @brief Recording a duration in cycle counter ticks (see LatencyTicks), as used
+ * by the scoped timers. The enabled flag was already checked when the timer
+ * started, so it is not checked again.
+ */
+void
+LatencyRecordTicks( const unsigned id, const uint64_t ticks )
+{
+  RecordNs( id, ticks * NsPerTick() );
+}
+
+
+bool
+LatencyEnabled()
+{
+  return enabled.load( std::memory_order_relaxed );
+}
+
+
+void
+LatencySetEnabled( const bool x )
+{
+  enabled.store( x, std::memory_order_relaxed );
+}
+
+
+/**
+ * @brief Clearing all histograms. Records made by other threads while the
+ * histograms are being cleared may be partially kept.
+ */
+void
+LatencyReset()
+{
+  Registry&                   reg = registry();
+  std::lock_guard<std::mutex> lock( reg.mutex );
+  for( Shard* shard : reg.shards ){
+    for( auto& h : shard->hists ){
+      Histogram* ptr = h.load( std::memory_order_acquire );
+      if( ptr ){ ptr->Clear(); }
+    }
+  }
+  for( auto& h : reg.retired ){
+    if( h ){ h->Clear(); }
+  }
+}
+
+
+/**
+ * @brief Merging the histograms of all threads, for all sections that have at
+ * least one record, ordered by section name.
+ */
+std::vector<LatencySummary>
+LatencySnapshot()
+{
+  Registry&                   reg = registry();
+  std::lock_guard<std::mutex> lock( reg.mutex );
+  std::vector<LatencySummary> ans;
+
+  for( const auto& entry : reg.ids ){
+    const unsigned id = entry.second;
+    Histogram      merged;
+    if( reg.retired[id] ){ reg.retired[id]->MergeInto( merged ); }
+    for( const Shard* shard : reg.shards ){
+      const Histogram* h = shard->hists[id].load( std::memory_order_acquire );
+      if( h ){ h->MergeInto( merged ); }
+    }
+    const uint64_t count = merged.count.load();
+    if( count == 0 ){ continue; }
+
+    LatencySummary summary;
+    summary.name  = entry.first;
+    summary.count = count;
+    summary.mean  = double(merged.sum.load()) / count;
+    summary.min   = merged.min.load();
+    summary.max   = merged.max.load();
+    summary.p50   = Quantile( merged, 0.5 );
+    summary.p90   = Quantile( merged, 0.9 );
+    summary.p99   = Quantile( merged, 0.99 );
+    summary.p999  = Quantile( merged, 0.999 );
+    for( unsigned i = 0; i < n_buckets; ++i ){
+      const uint64_t n = merged.bins[i].load();
+      if( n ){ summary.buckets.emplace_back( BucketLower( i ), n ); }
+    }
+    ans.push_back( std::move( summary ) );
+  }
+
+  return ans;
+}
+
+
+/**
+ * @brief Snapshot in the Prometheus text exposition format, with each section
+ * exported as a summary in seconds.
+ */
+std::string
+LatencyPrometheus()
+{
+  static const std::pair<const char*, double LatencySummary::*> quantiles[] = {
+    {"0.5", &LatencySummary::p50}, {"0.9", &LatencySummary::p90},
+    {"0.99", &LatencySummary::p99}, {"0.999", &LatencySummary::p999}};
+
+  std::string ans =
+    "# HELP sipm_latency_seconds Latency of instrumented device sections\n"
+    "# TYPE sipm_latency_seconds summary\n";
+  for( const auto& s : LatencySnapshot() ){
+    for( const auto& q : quantiles ){
+      ans += fmt::format( "sipm_latency_seconds{{section=\"{}\",quantile=\"{}\"}}"
+                          " {:.9g}\n", s.name, q.first, s.*q.second * 1e-9 );
+    }
+    ans += fmt::format( "sipm_latency_seconds_sum{{section=\"{}\"}} {:.9g}\n",
+                        s.name, s.mean * s.count * 1e-9 );
+    ans += fmt::format( "sipm_latency_seconds_count{{section=\"{}\"}} {}\n",
+                        s.name, s.count );
+  }
+  return ans;
+}
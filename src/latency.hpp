@@ -0,0 +1,117 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <x86intrin.h>
+#endif
+
+// Main documentation kept in the latency.cc file
+/**
+ * @defgroup latency Latency instrumentation
+ * @ingroup hardware
+ * @brief Low overhead latency histograms for the device hot paths.
+ *
+ * Sections are timed with the LATENCY_SCOPE macro (the remainder of the
+ * enclosing scope) or LATENCY_RECORD (a duration in nanoseconds measured
+ * elsewhere). Both compile to nothing unless `SIPM_LATENCY` is defined.
+ *
+ * @{
+ */
+
+/** @brief Merged statistics of a single instrumented section, in nanoseconds. */
+struct LatencySummary
+{
+  std::string name;
+  uint64_t    count;
+  double      mean;
+  double      min;
+  double      max;
+  double      p50;
+  double      p90;
+  double      p99;
+  double      p999;
+
+  // Non-empty buckets as [lower edge, count] pairs.
+  std::vector<std::pair<double, uint64_t> > buckets;
+};
+
+extern unsigned                    LatencyId( const char* name );
+extern void                        LatencyRecord( const unsigned id,
+                                                  const uint64_t ns );
+extern void                        LatencyRecordTicks( const unsigned id,
+                                                       const uint64_t ticks );
+extern bool                        LatencyEnabled();
+extern void                        LatencySetEnabled( const bool );
+extern void                        LatencyReset();
+extern std::vector<LatencySummary> LatencySnapshot();
+extern std::string                 LatencyPrometheus();
+
+/**
+ * @brief Reading the CPU cycle counter, falling back to the steady clock in
+ * nanoseconds for other architectures.
+ */
+inline uint64_t
+LatencyTicks()
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+  return __rdtsc();
+#elif defined( __aarch64__ )
+  uint64_t t;
+  asm volatile ( "mrs %0, cntvct_el0" : "=r" ( t ) );
+  return t;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+#endif
+}
+
+
+/**
+ * @brief Recording the time between construction and destruction into the
+ * histogram of a given section.
+ */
+class LatencyTimer
+{
+public:
+  explicit LatencyTimer( const unsigned id ) :
+    id( id ),
+    start( LatencyEnabled() ? LatencyTicks() : 0 ){}
+  ~LatencyTimer()
+  {
+    if( start != 0 ){
+      LatencyRecordTicks( id, LatencyTicks()-start );
+    }
+  }
+
+private:
+  const unsigned id;
+  const uint64_t start;
+};
+
+#define LATENCY_CONCAT_( a, b ) a ## b
+#define LATENCY_CONCAT( a, b )  LATENCY_CONCAT_( a, b )
+
+#ifdef SIPM_LATENCY
+#define LATENCY_SCOPE( name )                                                \
+  static const unsigned LATENCY_CONCAT( _latency_id_, __LINE__ ) =            \
+    LatencyId( name );                                                        \
+  const LatencyTimer LATENCY_CONCAT( _latency_timer_, __LINE__ )(             \
+    LATENCY_CONCAT( _latency_id_, __LINE__ ) )
+#define LATENCY_RECORD( name, ns )                                           \
+  do {                                                                        \
+    static const unsigned _latency_id = LatencyId( name );                    \
+    LatencyRecord( _latency_id, ns );                                         \
+  } while( 0 )
+#else
+#define LATENCY_SCOPE( name )
+#define LATENCY_RECORD( name, ns ) do {} while( 0 )
+#endif
+
+/** @} */
+
+#endif
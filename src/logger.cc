@@ -1,43 +1,375 @@
 #include "logger.hpp"
 #include "Python.h"
 
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <map>
+#include <mutex>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <stdexcept>
+#include <thread>
 
 #ifndef PYTHON_H
 #define PYTHON_H
 #endif
 
+/**
+ * @brief Asynchronous logging backend.
+ *
+ * The `printx` functions never call into python directly: the messages are
+ * pushed into a lock-free multiple-producer/single-consumer queue, and a
+ * single drain thread forwards the message to the python logging module in
+ * batches, taking the python GIL once per batch. This way the C++ logging
+ * calls never block on python (nor require the GIL), and can be safely used in
+ * background threads and hot loops.
+ *
+ * Messages are filtered in C++ before anything is copied: the drain thread
+ * periodically refreshes the lowest effective level of the `SiPMCalibCMD`
+ * loggers, and messages below that level are dropped at the call site. The
+ * C++ side of the filtering will therefore lag behind python's `setLevel`
+ * calls by at most the refresh interval. Python logger handles are cached per
+ * device by the drain thread. If the queue is full, new messages are dropped,
+ * and the number of dropped messages is reported once the queue is drained.
+ *
+ * The logging queue is flushed and the drain thread is stopped by a python
+ * `atexit` handler, messages logged after the python interpreter starts
+ * shutting down are discarded.
+ */
+namespace {
+
+struct LogNode
+{
+  std::atomic<LogNode*> next;
+  int                   level;
+  std::string           device;
+  std::string           message;
+};
+
+struct LogState
+{
+  // Intrusive MPSC queue: producers push at the head with an atomic exchange,
+  // the drain thread pops from the tail.
+  std::atomic<LogNode*> head;
+  LogNode*              tail;
+  LogNode               stub;
+
+  std::atomic<size_t>   pending;
+  std::atomic<size_t>   dropped;
+  std::atomic<int>      threshold;
+  std::atomic<bool>     running;
+  std::atomic<bool>     closed;
+  std::once_flag        start_flag;
+  std::thread           drain_thread;
+
+  // Only accessed by the drain thread (or the exit handler with the drain
+  // thread stopped), while holding the GIL.
+  PyObject*                        logging_lib;
+  std::map<std::string, PyObject*> handles;
+
+  LogState() : head( &stub ), tail( &stub ),
+    pending( 0 ), dropped( 0 ), threshold( 0 ),
+    running( false ), closed( false ), logging_lib( nullptr )
+  {
+    stub.next = nullptr;
+  }
+};
+
+static constexpr size_t max_pending = 1 << 16;
+static constexpr auto   poll_interval    = std::chrono::milliseconds( 10 );
+static constexpr auto   refresh_interval = std::chrono::milliseconds( 500 );
+static const char* const logger_prefix = "SiPMCalibCMD";
+static const char* const standalone_level_env = "SIPM_LOG_LEVEL";
+
+// Intentionally never deleted, as the device destructors can log during the
+// destruction of static objects in other libraries.
+static LogState& state = *( new LogState() );
+
+}
+
+
+static void
+queue_push( LogNode* node )
+{
+  node->next.store( nullptr, std::memory_order_relaxed );
+  LogNode* prev = state.head.exchange( node, std::memory_order_acq_rel );
+  prev->next.store( node, std::memory_order_release );
+}
+
+
+/**
+ * @brief Popping the oldest message in the queue, nullptr if the queue is
+ * empty (or if a producer is halfway through a push). Only to be called by a
+ * single consumer.
+ */
+static LogNode*
+queue_pop()
+{
+  LogNode* tail = state.tail;
+  LogNode* next = tail->next.load( std::memory_order_acquire );
+  if( tail == &state.stub ){
+    if( next == nullptr ){ return nullptr; }
+    state.tail = next;
+    tail       = next;
+    next       = next->next.load( std::memory_order_acquire );
+  }
+  if( next != nullptr ){
+    state.tail = next;
+    return tail;
+  }
+  if( tail != state.head.load( std::memory_order_acquire ) ){
+    return nullptr;
+  }
+  queue_push( &state.stub );
+  next = tail->next.load( std::memory_order_acquire );
+  if( next != nullptr ){
+    state.tail = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+
+/**
+ * @brief Getting the cached python logger handle of a device. Requires the GIL.
+ */
+static PyObject*
+logger_handle( const std::string& device )
+{
+  auto it = state.handles.find( device );
+  if( it != state.handles.end() ){
+    return it->second;
+  }
+  PyObject* handle = PyObject_CallMethod( state.logging_lib, "getLogger", "s",
+                                          ( std::string( logger_prefix )+"."
+                                            +device ).c_str() );
+  state.handles[device] = handle;
+  return handle;
+}
+
+
+/**
+ * @brief Refreshing the C++ side filtering level as the lowest effective level
+ * of all loggers under the `SiPMCalibCMD` logger. Requires the GIL.
+ */
+static void
+refresh_threshold()
+{
+  PyObject* root = PyObject_CallMethod( state.logging_lib, "getLogger", "s",
+                                        logger_prefix );
+  PyObject* level = root ? PyObject_CallMethod( root, "getEffectiveLevel",
+                                                nullptr ) : nullptr;
+  int ans = level ? PyLong_AsLong( level ) : 0;
+  Py_XDECREF( level );
+
+  // Loggers of individual devices can have lower levels than the parent.
+  PyObject* manager = root ? PyObject_GetAttrString( root, "manager" ) : nullptr;
+  PyObject* dict    = manager ? PyObject_GetAttrString( manager, "loggerDict" ) :
+                      nullptr;
+  const std::string prefix = std::string( logger_prefix )+".";
+  PyObject*         key, * value;
+  Py_ssize_t        pos = 0;
+  while( dict && PyDict_Check( dict ) && PyDict_Next( dict, &pos, &key, &value ) ){
+    const char* name = PyUnicode_Check( key ) ? PyUnicode_AsUTF8( key ) : nullptr;
+    if( name == nullptr ||
+        std::string( name ).compare( 0, prefix.size(), prefix ) != 0 ||
+        !PyObject_HasAttrString( value, "getEffectiveLevel" ) ){
+      continue;
+    }
+    PyObject* dev_level = PyObject_CallMethod( value, "getEffectiveLevel",
+                                               nullptr );
+    if( dev_level ){
+      ans = std::min( ans, (int)PyLong_AsLong( dev_level ) );
+    }
+    Py_XDECREF( dev_level );
+  }
+  Py_XDECREF( dict );
+  Py_XDECREF( manager );
+  Py_XDECREF( root );
+  PyErr_Clear();
+  state.threshold = ans;
+}
+
+
+/**
+ * @brief Forwarding all messages currently in the queue to python. Requires the
+ * GIL.
+ */
+static void
+drain_queue()
+{
+  size_t n = 0;
+  while( LogNode* node = queue_pop() ){
+    PyObject* handle = logger_handle( node->device );
+    PyObject* ret    = handle ? PyObject_CallMethod( handle, "log", "is",
+                                                     node->level,
+                                                     node->message.c_str() ) :
+                       nullptr;
+    Py_XDECREF( ret );
+    delete node;
+    ++n;
+  }
+  state.pending -= n;
+
+  const size_t dropped = state.dropped.exchange( 0 );
+  if( dropped > 0 ){
+    PyObject* handle = logger_handle( "Logger" );
+    PyObject* ret    = handle ? PyObject_CallMethod(
+      handle, "log", "is", 30,
+      ( "Logging queue full, "+std::to_string( dropped )
+        +" messages dropped" ).c_str() ) : nullptr;
+    Py_XDECREF( ret );
+  }
+  PyErr_Clear();
+}
+
+
+/**
+ * @brief Exit handler registered to the python `atexit` module, stopping the
+ * drain thread and flushing the remaining messages while python is still
+ * available.
+ */
+static PyObject*
+logger_atexit( PyObject*, PyObject* )
+{
+  state.closed = true;
+  if( state.running.exchange( false ) ){
+    Py_BEGIN_ALLOW_THREADS
+    state.drain_thread.join();
+    Py_END_ALLOW_THREADS
+  }
+  drain_queue();
+  Py_RETURN_NONE;
+}
+
+
+static PyMethodDef logger_atexit_def = {
+  "flush_cpp_logger", logger_atexit, METH_NOARGS, nullptr
+};
+
+
+/**
+ * @brief Initializing the python side objects in the drain thread. Requires the
+ * GIL.
+ */
+static void
+init_python()
+{
+  state.logging_lib = PyImport_ImportModule( "logging" );
+  PyObject* atexit = PyImport_ImportModule( "atexit" );
+  PyObject* func   = PyCFunction_New( &logger_atexit_def, nullptr );
+  PyObject* ret    = ( atexit && func ) ?
+                     PyObject_CallMethod( atexit, "register", "O", func ) :
+                     nullptr;
+  Py_XDECREF( ret );
+  Py_XDECREF( func );
+  Py_XDECREF( atexit );
+  PyErr_Clear();
+}
 
-// Static objects used for logging.
-static PyObject* logging_lib = PyImport_ImportModuleNoBlock( "logging" );
 
 /**
- * @brief Wrapping the python.logging modules call into a C function.
+ * @brief Main loop of the drain thread.
  *
- * Function modified from here: https://kalebporter.medium.com/logging-extending-python-with-c-or-c-fa746466b602
+ * The thread polls the queue at a fixed interval, and only takes the GIL if
+ * there are messages to forward, or if the filtering level needs to be
+ * refreshed. If the python interpreter is not available (standalone binaries),
+ * messages are printed to stderr instead, with the filtering level taken from
+ * the `SIPM_LOG_LEVEL` environment variable (info level by default).
+ */
+static void
+drain_loop()
+{
+  auto last_refresh = std::chrono::steady_clock::now()-refresh_interval;
+  bool initialized  = false;
+  while( state.running ){
+    const auto now         = std::chrono::steady_clock::now();
+    const bool need_refresh = now-last_refresh >= refresh_interval;
+    if( state.pending == 0 && !need_refresh ){
+      std::this_thread::sleep_for( poll_interval );
+      continue;
+    }
+
+    if( !Py_IsInitialized() ){
+      if( need_refresh ){
+        const char* env = getenv( standalone_level_env );
+        state.threshold = env ? atoi( env ) : 20;
+      }
+      size_t n = 0;
+      while( LogNode* node = queue_pop() ){
+        fprintf( stderr, "[%s] %s\n", node->device.c_str(),
+                 node->message.c_str() );
+        delete node;
+        ++n;
+      }
+      state.pending -= n;
+      last_refresh   = now;
+      std::this_thread::sleep_for( poll_interval );
+      continue;
+    }
+
+    PyGILState_STATE gil = PyGILState_Ensure();
+    if( !initialized ){
+      init_python();
+      initialized = true;
+    }
+    if( state.logging_lib != nullptr ){
+      if( need_refresh ){
+        refresh_threshold();
+        last_refresh = now;
+      }
+      drain_queue();
+    }
+    PyGILState_Release( gil );
+    std::this_thread::sleep_for( poll_interval );
+  }
+}
+
+
+static void
+start_drain_thread()
+{
+  state.running      = true;
+  state.drain_thread = std::thread( drain_loop );
+}
+
+
+/**
+ * @brief Pushing a message into the logging queue.
  *
- * @param name The name of the logger
- * @param level The info level
- * @param message The message string
+ * This is the only function in the logging chain called by the user
+ * threads. The message is dropped before being copied if it is below the
+ * filtering level, or if the queue is full.
  */
 static void
 logger_wrapped( const std::string& device,
                 int                level,
                 const std::string& message )
 {
-  PyObject* logging_name = Py_BuildValue( "s",
-                                          ( "SiPMCalibCMD."+device ).c_str()  );
-  PyObject* logging_args = Py_BuildValue( "(is)", level, message.c_str() );
-  PyObject* logging_obj  = PyObject_CallMethod( logging_lib,
-                                                "getLogger",
-                                                "O",
-                                                logging_name );
-  PyObject_CallMethod( logging_obj, "log", "O", logging_args );
-  Py_DECREF( logging_name );
-  Py_DECREF( logging_args );
+  if( level < state.threshold.load( std::memory_order_relaxed ) ||
+      state.closed.load( std::memory_order_relaxed ) ){
+    return;
+  }
+  std::call_once( state.start_flag, start_drain_thread );
+  if( state.pending.fetch_add( 1, std::memory_order_relaxed ) >= max_pending ){
+    state.pending.fetch_sub( 1, std::memory_order_relaxed );
+    state.dropped.fetch_add( 1, std::memory_order_relaxed );
+    return;
+  }
+  queue_push( new LogNode { {nullptr}, level, device, message } );
+}
+
+
+/**
+ * @brief Whether messages of a given level will be forwarded to python. This
+ * can be used to skip the formatting of expensive messages at the call site.
+ */
+bool
+log_enabled( const int level )
+{
+  return level >= state.threshold.load( std::memory_order_relaxed ) &&
+         !state.closed.load( std::memory_order_relaxed );
 }
 
 
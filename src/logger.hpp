@@ -20,6 +20,7 @@ extern void printmsg( const std::string& device,
                       const std::string& x );
 extern void printwarn( const std::string& device,
                        const std::string& x );
+extern bool log_enabled( const int level );
 extern std::runtime_error device_exception( const std::string& device,
                                             const std::string& x  );
 
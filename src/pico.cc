@@ -24,6 +24,7 @@
  * [pico-github]: https://github.com/picotech/picosdk-c-examples
  */
 
+#include "latency.hpp"
 #include "logger.hpp"
 #include "pico.hpp"
 #include <fmt/printf.h>
@@ -54,10 +55,13 @@ static const float inputRanges[PS5000_MAX_RANGES] = {
 void
 PicoUnit::Init()
 {
+  CheckIdle();
   if( device ){
     ps5000CloseUnit( device );
   }
   const auto status = ps5000OpenUnit( &device );
+  ncaptures        = 0;// Forcing the block layout to be set on the new handle
+  bufferregistered = false;
   if( status != PICO_OK ){
     throw device_exception( DeviceName,
                             fmt::sprintf(
@@ -99,6 +103,7 @@ PicoUnit::VoltageRangeMax() const
 void
 PicoUnit::SetVoltageRange( const int16_t channel, const int newrange )
 {
+  CheckIdle();
   const static int16_t enable     = 1;
   const static int16_t dc_coupled = 1;
 
@@ -149,6 +154,7 @@ PicoUnit::SetTrigger( const int16_t  channel,
                       const unsigned newdelay,
                       const int16_t  maxwait )
 {
+  CheckIdle();
   static const int16_t enable = 1;
 
   const int16_t leveladc = channel ==
@@ -184,11 +190,30 @@ PicoUnit::SetTrigger( const int16_t  channel,
  * as well as the number of samples to collected before and after the trigger
  * instance.
  *
- * Also resizes the arrays used for receive the block results.
+ * Also resizes the arrays used for receive the block results. Changing the
+ * layout discards the blocks still held by a stopped acquisition loop.
  */
 void
 PicoUnit::SetBlockNums( unsigned ncaps, unsigned post, unsigned pre )
 {
+  CheckIdle();
+  if( post+pre > (unsigned)maxsamples ){
+    printwarn( DeviceName,
+               fmt::sprintf(
+                 R"(requested samples [%u+%u]greater than maximum allowed samples[%d],
+                 truncating to maximum)",
+                 pre,
+                 post,
+                 maxsamples ));
+    post = maxsamples-pre;
+  }
+
+  // Nothing to do if the layout is unchanged, keeping the buffers and their
+  // driver registration intact.
+  if( ncaps == ncaptures && pre == presamples && post == postsamples ){
+    return;
+  }
+
   int  maxcapture;
   auto status = ps5000MemorySegments( device,
                                       ncaps,// Number of captures per rapid
@@ -201,52 +226,30 @@ PicoUnit::SetBlockNums( unsigned ncaps, unsigned post, unsigned pre )
                               "Error setting rapid block capture (Error code%d)",
                               status ) );
   }
-  if( post+pre > (unsigned)maxsamples ){
-    printwarn( DeviceName,
-               fmt::sprintf(
-                 R"(requested samples [%u+%u]greater than maximum allowed samples[%d],
-                 truncating to maximum)",
-                 pre,
-                 post,
-                 maxsamples ));
-    post = maxsamples-pre;
-  }
 
-  // Resizing capture buffer only if needed (reqesting more stuff)
-  if( ncaptures < ncaps ){
-    bufferA.resize( ncaps );
-    bufferB.resize( ncaps );
-    for( unsigned i = ncaptures; i < ncaps; ++i ){
-      bufferA[i].reset( new int16_t[presamples+postsamples] );
-      bufferB[i].reset( new int16_t[presamples+postsamples] );
-      if( bufferA[i] == nullptr || bufferB[i] == nullptr ){
-        throw device_exception( DeviceName,
-                                fmt::sprintf(
-                                  R"(Failed to initialize block memory buffer (%d/%d).
-                                  Maybe try smaller number of captures)",
-                                  i,
-                                  ncaptures ) );
-      }
-    }
-    overflowbuffer.reset( new int16_t[ncaps] );
-  }
-  ncaptures = ncaps;
-  if( presamples+postsamples < pre+post ){
-    for( unsigned i = 0; i < ncaptures; ++i ){
-      bufferA[i].reset( new int16_t[ pre+post ] );
-      bufferB[i].reset( new int16_t[ pre+post ] );
-      if( bufferA[i] == nullptr || bufferB[i] == nullptr ){
-        throw device_exception( DeviceName,
-                                fmt::sprintf(
-                                  R"(Failed to initialize block memory buffer (%d/%d).
-                                  Maybe try smaller number of captures)",
-                                  i,
-                                  ncaptures ) );
-      }
-    }
+  // Single contiguous [channel][capture][sample] arena for all captures. A new
+  // arena is allocated rather than resizing the existing one, such that views
+  // of the old arena (see BlockArena) never point to freed memory.
+  try {
+    buffer = std::make_shared<std::vector<int16_t> >(
+      2 * (size_t)ncaps * ( pre+post ), 0 );
+    overflowbuffer.resize( ncaps );
+  } catch( std::bad_alloc& e ){
+    throw device_exception( DeviceName,
+                            fmt::sprintf(
+                              R"(Failed to initialize block memory buffer (%u captures).
+                              Maybe try smaller number of captures)",
+                              ncaps ) );
   }
-  presamples  = pre;
-  postsamples = post;
+  ncaptures        = ncaps;
+  presamples       = pre;
+  postsamples      = post;
+  bufferregistered = false;
+
+  // Blocks left over from a stopped acquisition loop have the old layout, and
+  // cannot be popped into the new buffers.
+  StopAcquisition();
+  blockbuffer.Reset( 0 );
 }
 
 
@@ -259,6 +262,17 @@ PicoUnit::SetBlockNums( unsigned ncaps, unsigned post, unsigned pre )
  */
 void
 PicoUnit::StartRapidBlock()
+{
+  CheckIdle();
+  RunBlock();
+}
+
+
+/**
+ * @brief Arming the rapid block acquisition on the device.
+ */
+void
+PicoUnit::RunBlock()
 {
   auto status = ps5000RunBlock( device,
                                 presamples,
@@ -303,19 +317,36 @@ PicoUnit::IsReady()
 void
 PicoUnit::FlushToBuffer()
 {
-  uint32_t actualsamples = presamples+postsamples;
-  int      status        = 0;
-  for( unsigned block = 0; block < ncaptures; ++block ){
-    status = ps5000SetDataBufferBulk( device,
-                                      PS5000_CHANNEL_A,
-                                      bufferA[block].get(),
-                                      actualsamples,
-                                      block );
+  CheckIdle();
+
+  // Registering the capture buffers with the driver only once per layout.
+  if( !bufferregistered ){
+    RegisterBuffers( buffer->data() );
+    bufferregistered = true;
+  }
+  GetValues();
+}
+
+
+/**
+ * @brief Registering a [channel][capture][sample] block with the current
+ * layout as the driver's bulk transfer target.
+ */
+void
+PicoUnit::RegisterBuffers( int16_t* block )
+{
+  const unsigned length = presamples+postsamples;
+  for( unsigned cap = 0; cap < ncaptures; ++cap ){
+    auto status = ps5000SetDataBufferBulk( device,
+                                           PS5000_CHANNEL_A,
+                                           block+(size_t)cap * length,
+                                           length,
+                                           cap );
     status = ps5000SetDataBufferBulk( device,
                                       PS5000_CHANNEL_B,
-                                      bufferB[block].get(),
-                                      actualsamples,
-                                      block );
+                                      block+( (size_t)ncaptures+cap ) * length,
+                                      length,
+                                      cap );
     if( status != PICO_OK ){
       throw device_exception( DeviceName,
                               fmt::sprintf(
@@ -323,11 +354,23 @@ PicoUnit::FlushToBuffer()
                                 status ) );
     }
   }
+}
+
+
+/**
+ * @brief Transferring all captures of the completed rapid block into the
+ * registered buffers, recorded in the `pico.transfer` latency section.
+ */
+void
+PicoUnit::GetValues()
+{
+  LATENCY_SCOPE( "pico.transfer" );
+  uint32_t actualsamples = presamples+postsamples;
   ps5000GetValuesBulk( device,
                        &actualsamples,
                        0,
                        ncaptures-1,// flush range
-                       overflowbuffer.get()// overflow buffer
+                       overflowbuffer.data()// overflow buffer
                        );
 }
 
@@ -335,11 +378,13 @@ PicoUnit::FlushToBuffer()
 /**
  * @brief Suspending the main thread indefinitely until the rapid block
  * collection is complete. Notice that this flush the data to buffer when the
- * function exits.
+ * function exits. The full wait (including the transfer) is recorded in the
+ * `pico.wait_ready` latency section.
  */
 void
 PicoUnit::WaitTillReady()
 {
+  LATENCY_SCOPE( "pico.wait_ready" );
   while( !IsReady() ){
     std::this_thread::sleep_for( std::chrono::microseconds( 5 ) );
   }
@@ -355,7 +400,7 @@ PicoUnit::GetBuffer( const int      channel,
                      const unsigned cap,
                      const unsigned sample ) const
 {
-  return channel == 0 ? bufferA[cap][sample] : bufferB[cap][sample];
+  return CaptureBuffer( channel, cap )[sample];
 }
 
 
@@ -437,7 +482,12 @@ PicoUnit::WaveformString( const int16_t channel, const unsigned capture ) const
 
 
 /**
- * @brief Summing the waveform over the entire sample range.
+ * @brief Summing the waveform over the integration window, with a pedestal
+ * subtraction if needed.
+ *
+ * The raw 16 bit values are summed exactly and scaled afterwards. As the last
+ * 8 bits of the ADC values are always 0, this is equivalent to summing the
+ * effective 8 bit values.
  */
 float
 PicoUnit::WaveformSum( const int16_t  channel,
@@ -447,53 +497,443 @@ PicoUnit::WaveformSum( const int16_t  channel,
                        const unsigned _pedstart,
                        const unsigned _pedstop ) const
 {
-  const unsigned length   = presamples+postsamples;
-  double         pedvalue = 0;
+  const unsigned       length = presamples+postsamples;
+  const WaveformWindow window = { _intstart, _intstop, _pedstart, _pedstop };
+  const int16_t*       wave   = CaptureBuffer( channel, capture );
+  const WaveformReduction<int16_t> red = WaveformKernelReduce( wave,
+                                                               length,
+                                                               window );
 
-  // Getting the pedestal value if required
-  if( _pedstart != _pedstop ){
-    const unsigned pedstart = std::max( unsigned(0), _pedstart );
-    const unsigned pedstop  = std::min( length, _pedstop );
-    for( unsigned i = pedstart; i < pedstop; ++i ){
-      pedvalue += GetBuffer( channel, capture, i ) / 256;
-    }
-    pedvalue *= adc2mv( channel, 256 ) / (double)( pedstop-pedstart );
+  // We will always be using 2ns time slices, inverting for positive number
+  return -2 * red.integral * adc2mv( channel, 256 ) / 256;
+}
+
+
+/**
+ * @brief Getting the maximum absolute value (in effective 8 bit ADC units) over
+ * all captures of the rapid block.
+ */
+int
+PicoUnit::WaveformAbsMax( const int16_t channel ) const
+{
+  const unsigned       length = presamples+postsamples;
+  const WaveformWindow window = { 0, length, 0, 0 };
+
+  std::vector<const int16_t*>              waves( ncaptures );
+  std::vector<WaveformReduction<int16_t> > red( ncaptures );
+  for( unsigned cap = 0; cap < ncaptures; ++cap ){
+    waves[cap] = CaptureBuffer( channel, cap );
   }
-  float ans = 0;
+  WaveformKernelReduceBlock( waves.data(), ncaptures, length, window,
+                             red.data() );
 
-  // Running the additional parsing.
-  const unsigned intstart = std::max( unsigned(0), _intstart );
-  const unsigned intstop  = std::min( length, _intstop );
-  for( unsigned i = intstart; i < intstop; ++i ){
-    ans += GetBuffer( channel, capture, i ) / 256;
+  int ans = -256;
+  for( unsigned cap = 0; cap < ncaptures; ++cap ){
+    ans = std::max( ans, abs( red[cap].minimum / 256 ) );
+    ans = std::max( ans, abs( red[cap].maximum / 256 ) );
   }
-  ans *= adc2mv( channel, 256 );
-  ans -= pedvalue * ( intstop-intstart );
-  ans *= -2;
+  return ans;
+}
 
-  // We will always be using 2ns time slices, inverting for positive number
+
+/**
+ * @brief Computing the waveform sums of all captures in the flushed rapid block
+ * in a single call.
+ *
+ * The results are identical to calling WaveformSum for each capture, but the
+ * window clamping and ADC conversion factor are only evaluated once. The
+ * captures can optionally be split across multiple threads, which is only
+ * worth it for long waveforms or large blocks.
+ */
+std::vector<float>
+PicoUnit::BlockSums( const int16_t  channel,
+                     const unsigned intstart,
+                     const unsigned intstop,
+                     const unsigned pedstart,
+                     const unsigned pedstop,
+                     const unsigned nthreads ) const
+{
+  const WaveformWindow window = { intstart, intstop, pedstart, pedstop };
+  std::vector<float>   ans( ncaptures );
+  SumCaptures( buffer->data(), channel, window, ans.data(), nthreads );
   return ans;
 }
 
 
 /**
- * @brief Getting the maximum value of the value.
+ * @brief Computing the waveform sums of all captures of a channel in a
+ * [channel][capture][sample] block with the current layout.
  */
-int
-PicoUnit::WaveformAbsMax( const int16_t channel ) const
+void
+PicoUnit::SumCaptures( const int16_t*        block,
+                       const int16_t         channel,
+                       const WaveformWindow& window,
+                       float*                out,
+                       const unsigned        nthreads ) const
 {
+  LATENCY_SCOPE( "pico.sums" );
   const unsigned length = presamples+postsamples;
-  int            ans    = -256;
+  const double   scale  = -2 * adc2mv( channel, 256 ) / 256;
+  const int16_t* base   = block+(size_t)channel * ncaptures * length;
+
+  auto reduce = [&]( const unsigned begin, const unsigned end ){
+                  for( unsigned cap = begin; cap < end; ++cap ){
+                    out[cap] = scale * WaveformKernelReduce(
+                      base+(size_t)cap * length, length, window ).integral;
+                  }
+                };
+
+  const unsigned nt = std::max( 1u, std::min( nthreads, ncaptures ) );
+  if( nt == 1 ){
+    reduce( 0, ncaptures );
+    return;
+  }
+  std::vector<std::thread> threads;
+  for( unsigned t = 0; t < nt; ++t ){
+    threads.emplace_back( reduce,
+                          (unsigned)( (uint64_t)ncaptures * t / nt ),
+                          (unsigned)( (uint64_t)ncaptures * ( t+1 ) / nt ) );
+  }
+  for( auto& thread : threads ){
+    thread.join();
+  }
+}
+
+
+/**
+ * @brief Histogramming the waveform sums of all captures in the flushed rapid
+ * block, with nbins uniform bins in the range [binmin, binmax). Sums outside
+ * the range are discarded, so the counts can be directly added over multiple
+ * blocks.
+ */
+std::vector<unsigned>
+PicoUnit::BlockHistogram( const int16_t  channel,
+                          const unsigned intstart,
+                          const unsigned intstop,
+                          const unsigned pedstart,
+                          const unsigned pedstop,
+                          const float    binmin,
+                          const float    binmax,
+                          const unsigned nbins,
+                          const unsigned nthreads ) const
+{
+  if( nbins == 0 || !( binmax > binmin ) ){
+    throw device_exception( DeviceName, "Invalid histogram binning" );
+  }
+  const std::vector<float> sums = BlockSums( channel,
+                                             intstart, intstop,
+                                             pedstart, pedstop,
+                                             nthreads );
+  const double          invwidth = nbins / (double)( binmax-binmin );
+  std::vector<unsigned> ans( nbins, 0 );
+  for( const float x : sums ){
+    if( !( x >= binmin && x < binmax ) ){ continue; }
+    const unsigned bin = std::min( nbins-1, (unsigned)( ( x-binmin ) * invwidth ) );
+    ++ans[bin];
+  }
+  return ans;
+}
+
+
+/**
+ * @brief Filling the waveform sums of all captures in the flushed rapid block
+ * into a readout accumulator, without keeping the sums beyond the block. See
+ * BlockSums for the window definitions.
+ */
+void
+PicoUnit::BlockStats( ReadoutStats&  stats,
+                      const int16_t  channel,
+                      const unsigned intstart,
+                      const unsigned intstop,
+                      const unsigned pedstart,
+                      const unsigned pedstop,
+                      const unsigned nthreads ) const
+{
+  const std::vector<float> sums = BlockSums( channel,
+                                             intstart, intstop,
+                                             pedstart, pedstop,
+                                             nthreads );
+  stats.Fill( sums.data(), sums.size() );
+}
+
+
+/**
+ * @brief Opening a binary waveform file for storing all captures of a given
+ * channel.
+ *
+ * The raw 16 bit ADC values are stored as is, the frame length is fixed to the
+ * current pre+post sample settings, and the conversion factor is fixed to the
+ * current voltage range of the channel, so neither should be changed while the
+ * file is opened. See the @ref wavefile group for the file format.
+ */
+void
+PicoUnit::OpenWaveFile( const std::string& path, const int16_t channel )
+{
+  wavefile.Open( path,
+                 channel,
+                 presamples+postsamples,
+                 timeinterval,
+                 inputRanges[range[channel]] / PS5000_MAX_VALUE );
+  wavechannel = channel;
+  waverange   = range[channel];
+}
+
+
+/**
+ * @brief Flushing and closing the binary waveform file.
+ */
+void
+PicoUnit::CloseWaveFile()
+{
+  wavefile.Close();
+}
+
+
+/**
+ * @brief Writing all captures of the latest rapid block to the binary waveform
+ * file.
+ *
+ * The captures are written in a single vectored write directly from the
+ * rapid-block buffers.
+ */
+void
+PicoUnit::WriteBlock()
+{
+  if( presamples+postsamples != wavefile.Samples() ||
+      range[wavechannel] != waverange ){
+    throw device_exception( DeviceName,
+                            "Block settings changed since opening waveform file" );
+  }
+  std::vector<const int16_t*> frames( ncaptures );
   for( unsigned cap = 0; cap < ncaptures; ++cap ){
-    for( unsigned i = 0; i < length; ++i ){
-      const int16_t raw = GetBuffer( channel, cap, i ) / 256;
-      ans = std::max( ans, abs( raw ) );
+    frames[cap] = CaptureBuffer( wavechannel, cap );
+  }
+  wavefile.WriteFrames( frames.data(), ncaptures );
+}
+
+
+/**
+ * @brief Starting the pipelined rapid block acquisition on a background
+ * thread.
+ *
+ * The thread keeps a ring of capacity preallocated blocks (each with the
+ * current [channel][capture][sample] layout). Whenever a rapid block
+ * completes, the captures are transferred directly into the next free ring
+ * slot, and the device is re-armed before the block is handed over to the
+ * consumer, so that the capture of the next block overlaps with the
+ * processing of the previous one. Blocks completed while the ring is full are
+ * discarded and counted as dropped. The trigger is not fired by this thread,
+ * and the block settings cannot be changed while the acquisition is running.
+ */
+void
+PicoUnit::StartAcquisition( const unsigned capacity )
+{
+  CheckIdle();
+  StopAcquisition();// The thread of a loop stopped by an error is still joinable
+  blockbuffer.Reset( std::max( 1u, capacity ),
+                     PicoBlock { 0, std::vector<int16_t>( buffer->size(), 0 ) } );
+  bufferregistered = false;// Driver buffers are rotated by the thread.
+  blockid          = 0;
+  droppedblocks    = 0;
+  acqerror         = "";
+  runacq           = true;
+  acqthread        = std::thread( [this]{
+    this->RunAcquisitionLoop( std::ref( runacq ) );
+  } );
+}
+
+
+/**
+ * @brief Stopping the background acquisition thread. Blocks already in the
+ * ring buffer can still be drained after the loop has stopped.
+ */
+void
+PicoUnit::StopAcquisition()
+{
+  runacq = false;
+  if( acqthread.joinable() ){
+    acqthread.join();
+  }
+}
+
+
+/**
+ * @brief The main loop of the background acquisition thread.
+ *
+ * As the logging facilities cannot be used outside of the main thread, errors
+ * raised in the loop are stored and stop the loop. The stored error is raised
+ * when the user attempts to drain the buffer.
+ */
+void
+PicoUnit::RunAcquisitionLoop( std::atomic<bool>& run )
+{
+  try {
+    RunBlock();
+    while( run == true ){
+      int16_t ready = 0;
+      ps5000IsReady( device, &ready );
+      if( !ready ){
+        std::this_thread::sleep_for( std::chrono::microseconds( 5 ) );
+        continue;
+      }
+      ++blockid;
+
+      PicoBlock* block = blockbuffer.BeginWrite();
+      if( block == nullptr ){
+        ++droppedblocks;
+        RunBlock();
+        continue;
+      }
+      RegisterBuffers( block->data.data() );
+      GetValues();
+      RunBlock();
+      block->id = blockid;
+      blockbuffer.EndWrite();
     }
+    ps5000Stop( device );
+  } catch( std::exception& e ){
+    acqerror = e.what();
+    ps5000Stop( device );
+    run = false;
+  }
+}
+
+
+/** @brief Whether the background acquisition loop is running. */
+bool
+PicoUnit::IsAcquiring() const
+{
+  return runacq;
+}
+
+
+/** @brief Number of completed blocks in the ring waiting to be drained. */
+unsigned
+PicoUnit::BufferedBlocks() const
+{
+  return blockbuffer.Size();
+}
+
+
+/**
+ * @brief Number of blocks dropped since the acquisition started due to the
+ * ring buffer being full.
+ */
+uint64_t
+PicoUnit::DroppedBlocks() const
+{
+  return droppedblocks;
+}
+
+
+/**
+ * @brief Moving the oldest completed block from the acquisition ring into the
+ * main block buffer, such that all the single block methods (GetBuffer,
+ * WaveformSum, BlockSums, WriteBlock... ) can be used on it. Returns the ID of
+ * the block (the running count of completed rapid blocks), or 0 if no block
+ * is available.
+ */
+uint64_t
+PicoUnit::PopBlock()
+{
+  const PicoBlock* block = blockbuffer.BeginRead();
+  if( block == nullptr ){
+    CheckAcqError();
+    return 0;
+  }
+  std::copy( block->data.begin(), block->data.end(), buffer->begin() );
+  const uint64_t id = block->id;
+  blockbuffer.EndRead();
+  return id;
+}
+
+
+/**
+ * @brief Draining up to maxblocks blocks from the acquisition ring, returning
+ * the waveform sums of all captures of a channel concatenated in block order.
+ * See BlockSums for the window definitions.
+ */
+std::vector<float>
+PicoUnit::PopBlockSums( const int16_t  channel,
+                        const unsigned intstart,
+                        const unsigned intstop,
+                        const unsigned pedstart,
+                        const unsigned pedstop,
+                        const unsigned maxblocks,
+                        const unsigned nthreads )
+{
+  const WaveformWindow window = { intstart, intstop, pedstart, pedstop };
+  std::vector<float>   ans;
+  ans.reserve( (size_t)std::min( maxblocks, BufferedBlocks() ) * ncaptures );
+  for( unsigned n = 0; n < maxblocks; ++n ){
+    const PicoBlock* block = blockbuffer.BeginRead();
+    if( block == nullptr ){ break; }
+    ans.resize( ans.size()+ncaptures );
+    SumCaptures( block->data.data(),
+                 channel,
+                 window,
+                 ans.data()+ans.size()-ncaptures,
+                 nthreads );
+    blockbuffer.EndRead();
+  }
+  if( ans.empty() ){
+    CheckAcqError();
   }
   return ans;
 }
 
 
+/**
+ * @brief Draining up to maxblocks blocks from the acquisition ring into a
+ * readout accumulator, returning the number of blocks drained. Only a single
+ * block worth of waveform sums is held at any time.
+ */
+unsigned
+PicoUnit::PopBlockStats( ReadoutStats&  stats,
+                         const int16_t  channel,
+                         const unsigned intstart,
+                         const unsigned intstop,
+                         const unsigned pedstart,
+                         const unsigned pedstop,
+                         const unsigned maxblocks,
+                         const unsigned nthreads )
+{
+  const WaveformWindow window = { intstart, intstop, pedstart, pedstop };
+  std::vector<float>   sums( ncaptures );
+  unsigned             n = 0;
+  for( ; n < maxblocks; ++n ){
+    const PicoBlock* block = blockbuffer.BeginRead();
+    if( block == nullptr ){ break; }
+    SumCaptures( block->data.data(), channel, window, sums.data(), nthreads );
+    blockbuffer.EndRead();
+    stats.Fill( sums.data(), sums.size() );
+  }
+  if( n == 0 ){
+    CheckAcqError();
+  }
+  return n;
+}
+
+
+void
+PicoUnit::CheckIdle() const
+{
+  if( runacq ){
+    throw device_exception( DeviceName,
+                            "Picoscope is in use by the acquisition loop" );
+  }
+}
+
+
+void
+PicoUnit::CheckAcqError() const
+{
+  if( !runacq && !acqerror.empty() ){
+    throw device_exception( DeviceName, acqerror );
+  }
+}
+
+
 /**
  * @brief Dumping the current picoscope configuration on the screen for
  * inspection.
@@ -608,7 +1048,14 @@ PicoUnit::PicoUnit() : device ( 0 ),
   triggerdelay                ( 0 ),
   presamples                  ( 0 ),
   postsamples                 ( 0 ),
-  ncaptures                   ( 0 )
+  ncaptures                   ( 0 ),
+  buffer                      ( std::make_shared<std::vector<int16_t> >() ),
+  bufferregistered            ( false ),
+  blockid                     ( 0 ),
+  runacq                      ( false ),
+  droppedblocks               ( 0 ),
+  wavechannel                 ( 0 ),
+  waverange                   ( 0 )
 {
   range[0] = 6;
   range[1] = 7;
@@ -617,6 +1064,7 @@ PicoUnit::PicoUnit() : device ( 0 ),
 
 PicoUnit::~PicoUnit()
 {
+  StopAcquisition();
   printdebug( DeviceName, "Closing the PICOSCOPE interface" );
   ps5000CloseUnit( device );
   printdebug( DeviceName, "PICOSCOPE interface closed" );
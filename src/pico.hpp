@@ -1,8 +1,16 @@
 #ifndef PICO_HPP
 #define PICO_HPP
 
+#include "readoutstats.hpp"
+#include "ringbuffer.hpp"
 #include "singleton.hpp"
+#include "wavefile.hpp"
+#include "waveformkernel.hpp"
+
+#include <atomic>
 #include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 class PicoUnit
@@ -45,6 +53,58 @@ public:
                      const unsigned pedstop  = -1 ) const;
   int WaveformAbsMax( const int16_t channel ) const;
 
+  // Whole-block reductions
+  std::vector<float> BlockSums( const int16_t  channel,
+                                const unsigned intstart,
+                                const unsigned intstop,
+                                const unsigned pedstart,
+                                const unsigned pedstop,
+                                const unsigned nthreads = 1 ) const;
+  std::vector<unsigned> BlockHistogram( const int16_t  channel,
+                                        const unsigned intstart,
+                                        const unsigned intstop,
+                                        const unsigned pedstart,
+                                        const unsigned pedstop,
+                                        const float    binmin,
+                                        const float    binmax,
+                                        const unsigned nbins,
+                                        const unsigned nthreads = 1 ) const;
+  void BlockStats( ReadoutStats&  stats,
+                   const int16_t  channel,
+                   const unsigned intstart,
+                   const unsigned intstop,
+                   const unsigned pedstart,
+                   const unsigned pedstop,
+                   const unsigned nthreads = 1 ) const;
+
+  // Pipelined rapid block acquisition on a background thread
+  void               StartAcquisition( const unsigned capacity = 4 );
+  void               StopAcquisition();
+  bool               IsAcquiring() const;
+  unsigned           BufferedBlocks() const;
+  uint64_t           DroppedBlocks() const;
+  uint64_t           PopBlock();
+  std::vector<float> PopBlockSums( const int16_t  channel,
+                                   const unsigned intstart,
+                                   const unsigned intstop,
+                                   const unsigned pedstart,
+                                   const unsigned pedstop,
+                                   const unsigned maxblocks = -1,
+                                   const unsigned nthreads  = 1 );
+  unsigned PopBlockStats( ReadoutStats&  stats,
+                          const int16_t  channel,
+                          const unsigned intstart,
+                          const unsigned intstop,
+                          const unsigned pedstart,
+                          const unsigned pedstop,
+                          const unsigned maxblocks = -1,
+                          const unsigned nthreads  = 1 );
+
+  // Binary waveform file output
+  void OpenWaveFile( const std::string& path, const int16_t channel );
+  void CloseWaveFile();
+  void WriteBlock();
+
 public:
   int16_t  device;// integer representing device in driver API
   int      range[2];
@@ -66,10 +126,55 @@ public:
   inline int
   rangeB() const { return range[1]; }
 
+  // Raw access to the rapid-block arena, laid out as [channel][capture][sample]
+  // with pre+post samples per capture. SetBlockNums swaps in a new arena when
+  // the layout changes, so holding the shared pointer keeps the memory of the
+  // old layout valid.
+  inline std::shared_ptr<const std::vector<int16_t> >
+  BlockArena() const { return buffer; }
+  inline const int16_t*
+  BlockBuffer() const { return buffer->data(); }
+  inline const int16_t*
+  CaptureBuffer( const int channel, const unsigned cap ) const
+  {
+    return buffer->data()
+           +( (size_t)channel * ncaptures+cap ) * ( presamples+postsamples );
+  }
+
 private:
-  std::vector<std::unique_ptr<int16_t[]> > bufferA;
-  std::vector<std::unique_ptr<int16_t[]> > bufferB;
-  std::unique_ptr<int16_t[]>               overflowbuffer;
+  std::shared_ptr<std::vector<int16_t> > buffer;
+  std::vector<int16_t>                   overflowbuffer;
+  bool                 bufferregistered;// Buffers registered with the driver
+
+  // Background acquisition
+  struct PicoBlock
+  {
+    uint64_t             id;
+    std::vector<int16_t> data;// Same layout as the main block buffer
+  };
+  RingBuffer<PicoBlock> blockbuffer;
+  std::thread           acqthread;
+  std::atomic<uint64_t> blockid;
+  std::atomic<bool>     runacq;
+  std::atomic<uint64_t> droppedblocks;
+  std::string           acqerror;
+
+  void RunBlock();
+  void RegisterBuffers( int16_t* block );
+  void GetValues();
+  void SumCaptures( const int16_t*        block,
+                    const int16_t         channel,
+                    const WaveformWindow& window,
+                    float*                out,
+                    const unsigned        nthreads ) const;
+  void RunAcquisitionLoop( std::atomic<bool>& );
+  void CheckIdle() const;
+  void CheckAcqError() const;
+
+  // Binary output file
+  WaveFileWriter wavefile;
+  int16_t        wavechannel;
+  int            waverange;
 
   // Helper functions for sanity check
   void FindTimeInterval();// Running once and not changing;
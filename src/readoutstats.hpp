@@ -0,0 +1,471 @@
+#ifndef READOUTSTATS_HPP
+#define READOUTSTATS_HPP
+
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * @defgroup readoutstats Streaming readout statistics
+ * @ingroup hardware
+ * @brief Header-only accumulators for summarizing readout values on the fly.
+ *
+ * The readout methods of the scope-like devices produce one value per event
+ * (the waveform sums, see @ref waveformkernel), and a typical dark count run
+ * collects millions of events. Rather than storing the values, the device
+ * classes can fill a ReadoutStats object directly from the reduction results,
+ * which keeps the summary statistics and histograms of the values in a memory
+ * footprint that does not depend on the number of events.
+ *
+ * All accumulators can be merged, such that separate accumulators can be
+ * filled by separate threads, channels or data blocks and combined afterwards.
+ * Merging is exact: the merged accumulator is identical (up to floating point
+ * rounding of the moments) to an accumulator filled with all the values.
+ * Accumulators are not thread safe, each thread should fill its own instance.
+ * @{
+ */
+
+/**
+ * @brief Running mean and variance using Welford's algorithm, with the
+ * pairwise update of Chan et al. for merging.
+ */
+class RunningStats
+{
+public:
+  RunningStats(){ Reset(); }
+
+  void
+  Reset()
+  {
+    n    = 0;
+    mean = 0;
+    m2   = 0;
+    min  = std::numeric_limits<double>::infinity();
+    max  = -std::numeric_limits<double>::infinity();
+  }
+
+  void
+  Fill( const double x )
+  {
+    ++n;
+    const double delta = x-mean;
+    mean += delta / n;
+    m2   += delta * ( x-mean );
+    min   = std::min( min, x );
+    max   = std::max( max, x );
+  }
+
+  void
+  Merge( const RunningStats& other )
+  {
+    if( other.n == 0 ){ return; }
+    if( n == 0 ){
+      *this = other;
+      return;
+    }
+    const double total = n+other.n;
+    const double delta = other.mean-mean;
+    mean += delta * other.n / total;
+    m2   += other.m2+delta * delta * ( (double)n * other.n / total );
+    n    += other.n;
+    min   = std::min( min, other.min );
+    max   = std::max( max, other.max );
+  }
+
+  uint64_t
+  Count() const { return n; }
+
+  double
+  Mean() const { return n > 0 ? mean : std::nan( "" ); }
+
+  double
+  Min() const { return n > 0 ? min : std::nan( "" ); }
+
+  double
+  Max() const { return n > 0 ? max : std::nan( "" ); }
+
+  /** @brief Population variance, matching numpy.var. */
+  double
+  Variance() const { return n > 0 ? m2 / n : std::nan( "" ); }
+
+  double
+  StdDev() const { return std::sqrt( Variance() ); }
+
+  /** @brief Standard error of the mean, matching numpy.std/sqrt(N). */
+  double
+  StdError() const { return StdDev() / std::sqrt( (double)n ); }
+
+private:
+  uint64_t n;
+  double   mean;
+  double   m2;
+  double   min;
+  double   max;
+};
+
+
+/**
+ * @brief Histogram with a fixed uniform binning over [min, max), values outside
+ * the range are counted in the underflow and overflow counters. A histogram
+ * with no bins is considered disabled and ignores all values.
+ */
+class Histogram
+{
+public:
+  static constexpr const char* DeviceName = "ReadoutStats";
+
+  Histogram() : lower( 0 ), upper( 0 ), invwidth( 0 ){ Reset(); }
+  Histogram( const double min, const double max, const unsigned nbins ) :
+    lower( min ),
+    upper( max ),
+    invwidth( nbins / ( max-min ) ),
+    counts( nbins )
+  {
+    if( nbins == 0 || !( max > min ) ){
+      throw device_exception( DeviceName, "Invalid histogram binning" );
+    }
+    Reset();
+  }
+
+  /**
+   * @brief Binning for low light spectra: the range starts half a gain below
+   * the pedestal and covers maxpe photoelectron peaks, with binsperpe bins per
+   * photoelectron, such that the peaks at pedestal+k*gain are centered in
+   * a group of bins (for an odd binsperpe, in the center of a single bin), and
+   * the counts of each group add up to the number of events of the
+   * corresponding photoelectron count.
+   */
+  static Histogram
+  Photoelectron( const double   pedestal,
+                 const double   gain,
+                 const unsigned maxpe,
+                 const unsigned binsperpe )
+  {
+    if( !( gain > 0 ) || binsperpe == 0 ){
+      throw device_exception( DeviceName, "Invalid photoelectron binning" );
+    }
+    return Histogram( pedestal-gain / 2,
+                      pedestal+( maxpe+0.5 ) * gain,
+                      ( maxpe+1 ) * binsperpe );
+  }
+
+  void
+  Reset()
+  {
+    std::fill( counts.begin(), counts.end(), 0 );
+    underflow = 0;
+    overflow  = 0;
+  }
+
+  void
+  Fill( const double x )
+  {
+    if( counts.empty() ){
+      return;
+    } else if( x < lower ){
+      ++underflow;
+    } else if( x >= upper ){
+      ++overflow;
+    } else if( x == x ){
+      // Clamping in case of rounding at the upper edge
+      ++counts[std::min( counts.size()-1, (size_t)( ( x-lower ) * invwidth ) )];
+    }
+  }
+
+  void
+  Merge( const Histogram& other )
+  {
+    if( other.counts.empty() ){ return; }
+    if( other.lower != lower || other.upper != upper ||
+        other.counts.size() != counts.size() ){
+      throw device_exception( DeviceName,
+                              "Cannot merge histograms with different binning" );
+    }
+    for( size_t i = 0; i < counts.size(); ++i ){
+      counts[i] += other.counts[i];
+    }
+    underflow += other.underflow;
+    overflow  += other.overflow;
+  }
+
+  unsigned
+  Bins() const { return counts.size(); }
+
+  double
+  Min() const { return lower; }
+
+  double
+  Max() const { return upper; }
+
+  uint64_t
+  Underflow() const { return underflow; }
+
+  uint64_t
+  Overflow() const { return overflow; }
+
+  const std::vector<uint64_t>&
+  Counts() const { return counts; }
+
+private:
+  double                lower;
+  double                upper;
+  double                invwidth;
+  std::vector<uint64_t> counts;
+  uint64_t              underflow;
+  uint64_t              overflow;
+};
+
+
+/**
+ * @brief Histogram with a fixed number of bins whose range follows the data.
+ *
+ * The bin width is always the base width times a power of 2, and the bin
+ * edges are always integer multiples of the bin width, so bins never
+ * straddle the edges of a coarser binning. When a value falls outside the
+ * current range, the range is moved to recenter the filled bins, and the
+ * width is doubled (merging pairs of adjacent bins) until all values fit. As
+ * rebinning only ever adds up whole bins, the counts are exact, and two
+ * histograms with the same number of bins and base width can be merged
+ * regardless of the ranges they ended up with.
+ */
+class AdaptiveHistogram
+{
+public:
+  static constexpr const char* DeviceName = "ReadoutStats";
+
+  AdaptiveHistogram( const unsigned nbins     = 1024,
+                     const double   basewidth = 1e-3 ) :
+    basewidth( basewidth ),
+    counts( std::max( 2u, nbins ) )
+  {
+    if( !( basewidth > 0 ) ){
+      throw device_exception( DeviceName, "Invalid histogram bin width" );
+    }
+    Reset();
+  }
+
+  void
+  Reset()
+  {
+    std::fill( counts.begin(), counts.end(), 0 );
+    level  = 0;
+    origin = 0;
+    total  = 0;
+  }
+
+  void
+  Fill( const double x )
+  {
+    if( !std::isfinite( x ) ){ return; }
+    int64_t g = Index( x );
+    if( total == 0 ){
+      origin = g-(int64_t)counts.size() / 2;
+    } else if( g < origin || g >= origin+(int64_t)counts.size() ){
+      int64_t first, last;
+      Occupied( first, last );
+      Fit( level, std::min( first, g ), std::max( last, g ) );
+      g = Index( x );
+    }
+    ++counts[Clamp( g-origin )];
+    ++total;
+  }
+
+  void
+  Merge( const AdaptiveHistogram& other )
+  {
+    if( other.counts.size() != counts.size() ||
+        other.basewidth != basewidth ){
+      throw device_exception( DeviceName,
+                              "Cannot merge histograms with different binning" );
+    }
+    if( other.total == 0 ){ return; }
+    if( total == 0 ){
+      *this = other;
+      return;
+    }
+
+    // Bringing this histogram to a range covering both histograms
+    const unsigned common = std::max( level, other.level );
+    int64_t        first, last, ofirst, olast;
+    Occupied( first, last );
+    other.Occupied( ofirst, olast );
+    Fit( common,
+         std::min( Scale( first, common-level ),
+                   Scale( ofirst, common-other.level ) ),
+         std::max( Scale( last, common-level ),
+                   Scale( olast, common-other.level ) ) );
+
+    const unsigned shift = level-other.level;
+    for( size_t i = 0; i < other.counts.size(); ++i ){
+      if( other.counts[i] == 0 ){ continue; }
+      counts[Scale( other.origin+i, shift )-origin] += other.counts[i];
+    }
+    total += other.total;
+  }
+
+  unsigned
+  Bins() const { return counts.size(); }
+
+  double
+  Width() const { return std::ldexp( basewidth, level ); }
+
+  /** @brief Lower edge of the first bin. */
+  double
+  Min() const { return origin * Width(); }
+
+  double
+  Max() const { return ( origin+(int64_t)counts.size() ) * Width(); }
+
+  uint64_t
+  Entries() const { return total; }
+
+  const std::vector<uint64_t>&
+  Counts() const { return counts; }
+
+private:
+  double                basewidth;
+  std::vector<uint64_t> counts;
+  unsigned              level;// Bin width is basewidth * 2^level
+  int64_t               origin;// Index of the first bin in units of the width
+  uint64_t              total;
+
+  /** @brief Global bin index of a value at the current width. */
+  int64_t
+  Index( const double x ) const
+  {
+    const double limit = 4e18;
+    return std::max( -limit, std::min( limit, std::floor( x / Width() ) ) );
+  }
+
+  size_t
+  Clamp( const int64_t i ) const
+  {
+    return std::max( (int64_t)0, std::min( (int64_t)counts.size()-1, i ) );
+  }
+
+  /** @brief Global bin index after doubling the width shift times. */
+  static int64_t
+  Scale( const int64_t g, const unsigned shift )
+  {
+    if( shift >= 63 ){ return g < 0 ? -1 : 0; }
+    const int64_t d = (int64_t)1 << shift;
+    return g >= 0 ? g / d : -( ( -g+d-1 ) / d );
+  }
+
+  /** @brief Global indices of the first and last non-empty bins. */
+  void
+  Occupied( int64_t& first, int64_t& last ) const
+  {
+    size_t i = 0, j = counts.size()-1;
+    while( i < j && counts[i] == 0 ){ ++i; }
+    while( j > i && counts[j] == 0 ){ --j; }
+    first = origin+i;
+    last  = origin+j;
+  }
+
+  /**
+   * @brief Rebinning to the finest width at or above the given level where the
+   * global bin range [lo, hi] (in units of that level) fits, with the filled
+   * range centered.
+   */
+  void
+  Fit( unsigned newlevel, int64_t lo, int64_t hi )
+  {
+    const int64_t n = counts.size();
+    while( hi-lo >= n ){
+      ++newlevel;
+      lo = Scale( lo, 1 );
+      hi = Scale( hi, 1 );
+    }
+    const int64_t         neworigin = lo-( n-1-( hi-lo ) ) / 2;
+    const unsigned        shift     = newlevel-level;
+    std::vector<uint64_t> rebinned( n, 0 );
+    for( int64_t i = 0; i < n; ++i ){
+      if( counts[i] == 0 ){ continue; }
+      rebinned[Clamp( Scale( origin+i, shift )-neworigin )] += counts[i];
+    }
+    counts.swap( rebinned );
+    level  = newlevel;
+    origin = neworigin;
+  }
+};
+
+
+/**
+ * @brief Accumulator for the per-event values of a readout: the running
+ * moments, an adaptive histogram that is always filled, and an optional fixed
+ * binning histogram (disabled by default, see SetBinning).
+ */
+class ReadoutStats
+{
+public:
+  ReadoutStats( const unsigned nbins = 1024, const double basewidth = 1e-3 ) :
+    adaptive( nbins, basewidth ){}
+
+  void
+  Reset()
+  {
+    stats.Reset();
+    adaptive.Reset();
+    fixed.Reset();
+  }
+
+  /** @brief Enabling the fixed histogram, discarding its current counts. */
+  void
+  SetBinning( const Histogram& h )
+  {
+    fixed = h;
+    fixed.Reset();
+  }
+
+  void
+  Fill( const double x )
+  {
+    stats.Fill( x );
+    adaptive.Fill( x );
+    fixed.Fill( x );
+  }
+
+  template<typename T>
+  void
+  Fill( const T* x, const size_t n )
+  {
+    for( size_t i = 0; i < n; ++i ){
+      Fill( x[i] );
+    }
+  }
+
+  void
+  Merge( const ReadoutStats& other )
+  {
+    stats.Merge( other.stats );
+    adaptive.Merge( other.adaptive );
+    if( fixed.Bins() == 0 ){
+      fixed = other.fixed;
+    } else {
+      fixed.Merge( other.fixed );
+    }
+  }
+
+  const RunningStats&
+  Stats() const { return stats; }
+
+  const AdaptiveHistogram&
+  Adaptive() const { return adaptive; }
+
+  const Histogram&
+  Fixed() const { return fixed; }
+
+private:
+  RunningStats      stats;
+  AdaptiveHistogram adaptive;
+  Histogram         fixed;
+};
+
+/** @} */
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef RINGBUFFER_HPP
+#define RINGBUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Lock-free single-producer/single-consumer ring buffer of preallocated
+ * slots.
+ *
+ * The producer thread requests the next free slot with BeginWrite, fills it in
+ * place, then publishes it with EndWrite. The consumer thread gets the oldest
+ * published slot with BeginRead, and releases it back to the producer with
+ * EndRead. Slots are allocated once on construction (or Reset), so large
+ * objects such as waveform buffers can be filled without any allocation or
+ * copying on the acquisition path. Only one thread may write and only one
+ * thread may read at any given time. Reset is not thread safe, and should only
+ * be called when neither the producer nor the consumer is running.
+ */
+template<typename T>
+class RingBuffer
+{
+public:
+  RingBuffer( const size_t n = 0 ) : slots( n+1 ), head( 0 ), tail( 0 ){}
+
+  void
+  Reset( const size_t n, const T& init = T() )
+  {
+    slots.assign( n+1, init );
+    head = 0;
+    tail = 0;
+  }
+
+  /** @brief Getting the next free slot, nullptr if the buffer is full. */
+  T*
+  BeginWrite()
+  {
+    const size_t h = head.load( std::memory_order_relaxed );
+    if( Next( h ) == tail.load( std::memory_order_acquire ) ){
+      return nullptr;
+    }
+    return &slots[h];
+  }
+
+  /** @brief Publishing the slot returned by BeginWrite. */
+  void
+  EndWrite()
+  {
+    const size_t h = head.load( std::memory_order_relaxed );
+    head.store( Next( h ), std::memory_order_release );
+  }
+
+  /** @brief Getting the oldest published slot, nullptr if buffer is empty. */
+  T*
+  BeginRead()
+  {
+    const size_t t = tail.load( std::memory_order_relaxed );
+    if( t == head.load( std::memory_order_acquire ) ){
+      return nullptr;
+    }
+    return &slots[t];
+  }
+
+  /** @brief Releasing the slot returned by BeginRead. */
+  void
+  EndRead()
+  {
+    const size_t t = tail.load( std::memory_order_relaxed );
+    tail.store( Next( t ), std::memory_order_release );
+  }
+
+  /** @brief Number of published slots not yet released by the consumer. */
+  size_t
+  Size() const
+  {
+    const size_t h = head.load( std::memory_order_acquire );
+    const size_t t = tail.load( std::memory_order_acquire );
+    return h >= t ? h-t : h+slots.size()-t;
+  }
+
+  size_t
+  Capacity() const { return slots.size()-1; }
+
+private:
+  inline size_t
+  Next( const size_t x ) const { return x+1 == slots.size() ? 0 : x+1; }
+
+  std::vector<T> slots;
+
+  // Padding the two indices onto separate cache lines to avoid false sharing
+  // between the producer and consumer threads. (Explicit padding rather than
+  // alignas, as over-aligned allocation is not available in C++14.)
+  char                pad0[64];
+  std::atomic<size_t> head;
+  char                pad1[64-sizeof( std::atomic<size_t> )];
+  std::atomic<size_t> tail;
+};
+
+#endif
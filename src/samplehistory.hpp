@@ -0,0 +1,101 @@
+#ifndef SAMPLEHISTORY_HPP
+#define SAMPLEHISTORY_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief Lock-free single-writer/multiple-reader history of timestamped
+ * samples.
+ *
+ * Unlike the RingBuffer, readers do not consume the samples: the writer
+ * always overwrites the oldest sample, and any number of reader threads can
+ * copy out the latest samples at any time without blocking the writer. A
+ * reader copy that overlaps with the writer overwriting the same slots is
+ * detected with a claim counter (updated before a slot is overwritten) and
+ * the affected samples are dropped from the returned copy, so readers only
+ * ever see complete samples. Sample fields are stored as relaxed atomics such
+ * that the concurrent access is well defined. Reset is not thread safe.
+ */
+class SampleHistory
+{
+public:
+  struct Sample
+  {
+    double time;
+    float  value;
+  };
+
+  SampleHistory( const size_t n = 0 ){ Reset( n ); }
+
+  void
+  Reset( const size_t n )
+  {
+    capacity = std::max( size_t(1), n );
+    slots.reset( new Slot[capacity] );
+    claimed = 0;
+    written = 0;
+  }
+
+  /** @brief Adding a new sample, overwriting the oldest sample if full. */
+  void
+  Push( const double time, const float value )
+  {
+    const uint64_t w = written.load( std::memory_order_relaxed );
+    claimed.store( w+1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    Slot& slot = slots[w % capacity];
+    slot.time.store( time, std::memory_order_relaxed );
+    slot.value.store( value, std::memory_order_relaxed );
+    written.store( w+1, std::memory_order_release );
+  }
+
+  /** @brief Total number of samples pushed since the last reset. */
+  uint64_t
+  Count() const { return written.load( std::memory_order_acquire ); }
+
+  size_t
+  Capacity() const { return capacity; }
+
+  /** @brief Copying the latest (at most) n samples, oldest sample first. */
+  std::vector<Sample>
+  Latest( const size_t n ) const
+  {
+    const uint64_t end   = written.load( std::memory_order_acquire );
+    const uint64_t begin = end-std::min( (uint64_t)std::min( n, capacity ),
+                                         end );
+    std::vector<Sample> ans( end-begin );
+    for( uint64_t i = begin; i < end; ++i ){
+      const Slot& slot = slots[i % capacity];
+      ans[i-begin].time  = slot.time.load( std::memory_order_relaxed );
+      ans[i-begin].value = slot.value.load( std::memory_order_relaxed );
+    }
+    std::atomic_thread_fence( std::memory_order_acquire );
+
+    // Samples older than this may have been overwritten during the copy.
+    const uint64_t c     = claimed.load( std::memory_order_relaxed );
+    const uint64_t valid = c > capacity ? c-capacity : 0;
+    if( valid > begin ){
+      ans.erase( ans.begin(),
+                 ans.begin()+std::min( valid-begin, (uint64_t)ans.size() ) );
+    }
+    return ans;
+  }
+
+private:
+  struct Slot
+  {
+    std::atomic<double> time;
+    std::atomic<float>  value;
+  };
+
+  size_t                  capacity;
+  std::unique_ptr<Slot[]> slots;
+  std::atomic<uint64_t>   claimed;
+  std::atomic<uint64_t>   written;
+};
+
+#endif
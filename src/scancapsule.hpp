@@ -0,0 +1,36 @@
+#ifndef SCANCAPSULE_HPP
+#define SCANCAPSULE_HPP
+
+#include "scanreadout.hpp"
+#include <pybind11/pybind11.h>
+
+/**
+ * @brief Helper functions for passing the scan routines defined in
+ * scanreadout.hpp between the python modules as named capsules. Only to be
+ * used by the python bindings.
+ * @{
+ */
+template<typename T>
+inline pybind11::object
+MakeScanCapsule( T* routine )
+{
+  return pybind11::reinterpret_steal<pybind11::object>(
+    PyCapsule_New( routine, T::CapsuleName, []( PyObject* capsule ){
+    delete static_cast<T*>( PyCapsule_GetPointer( capsule, T::CapsuleName ) );
+  } ) );
+}
+
+
+/** @brief Nullptr if the object is not a capsule of the requested routine. */
+template<typename T>
+inline const T*
+GetScanCapsule( const pybind11::object& obj )
+{
+  if( !PyCapsule_IsValid( obj.ptr(), T::CapsuleName ) ){ return nullptr; }
+  return static_cast<const T*>( PyCapsule_GetPointer( obj.ptr(),
+                                                      T::CapsuleName ) );
+}
+
+/** @} */
+
+#endif
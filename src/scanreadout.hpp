@@ -0,0 +1,88 @@
+#ifndef SCANREADOUT_HPP
+#define SCANREADOUT_HPP
+
+#include "readoutstats.hpp"
+
+#include <functional>
+#include <vector>
+
+/**
+ * @brief Readout routine to be performed by the C++ scan executor at each
+ * settled point of a scan (see GCoder::RunScan).
+ *
+ * As the various readout devices are exposed as separate python modules, the
+ * readout routines are passed between modules as python capsules with the name
+ * ScanReadout::CapsuleName holding a pointer to this object, such that the scan
+ * executor can call into the readout devices without passing through python.
+ * The read function writes exactly `nvalues` values into the output pointer,
+ * and must not call into python, as it will be called without holding the
+ * python GIL (the logging facilities do not require the GIL).
+ */
+struct ScanReadout
+{
+  static constexpr const char* CapsuleName = "ScanReadout";
+
+  std::function<void( double* )> read;
+  unsigned                       nvalues;
+
+  // Optional split of the read function for the pipelined scan (see
+  // GCoder::RunScan): acquire collects the raw data of a point on the readout
+  // device (including any triggering), and reduce computes the nvalues values
+  // from the raw data without accessing the device, such that the reduction
+  // can overlap with the motion to the next point.
+  std::function<void( std::vector<double>& )>                 acquire;
+  std::function<void( const std::vector<double>&, double* )> reduce;
+
+  /** @brief Setting the acquire and reduce split, with read running both. */
+  void
+  SetStages( const std::function<void( std::vector<double>& )>&                 a,
+             const std::function<void( const std::vector<double>&, double* )>& r )
+  {
+    acquire = a;
+    reduce  = r;
+    read    = [a, r]( double* out ){
+      std::vector<double> raw;
+      a( raw );
+      r( raw, out );
+    };
+  }
+
+  /**
+   * @brief Helper for summarizing the readout values as the mean and the
+   * spread, following the same convention as the python readout method: the
+   * standard deviation for continuous readouts, and the standard error of the
+   * mean for counting (event based) readouts.
+   */
+  static void
+  Summarize( const RunningStats& stats, const bool counting, double* out )
+  {
+    out[0] = stats.Mean();
+    out[1] = counting ? stats.StdError() : stats.StdDev();
+  }
+
+  static void
+  Summarize( const std::vector<double>& values,
+             const bool                 counting,
+             double*                    out )
+  {
+    RunningStats stats;
+    for( const double x : values ){
+      stats.Fill( x );
+    }
+    Summarize( stats, counting, out );
+  }
+};
+
+/**
+ * @brief Trigger routine to be used by the readout routines of scope-like
+ * readouts in a scan, passed between modules as a python capsule with the name
+ * ScanTrigger::CapsuleName. The same restrictions as ScanReadout apply.
+ */
+struct ScanTrigger
+{
+  static constexpr const char* CapsuleName = "ScanTrigger";
+
+  std::function<void()> fire;
+};
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef SCANSCHEDULER_HPP
+#define SCANSCHEDULER_HPP
+
+#include "logger.hpp"
+#include "readoutstats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Pipelined execution of the operations of a scan as a dependency graph.
+ *
+ * Each scan point runs the same list of stages (ex: move, settle, acquire,
+ * reduce, write). Every stage is assigned to a named worker thread, typically
+ * one per device, and each worker runs its stages point by point in the order
+ * the stages were added. A stage of point N can depend on any earlier stage of
+ * point N, or on any stage (including later stages) of point N-lag for lag > 0. A stage starts as soon
+ * as its worker is free and its dependencies are done, so stages on different
+ * workers overlap whenever the graph allows it. For example, the reduction of
+ * point N can overlap with the motion to point N+1 if the motion only depends
+ * on the acquisition of the previous point.
+ *
+ * As the stages of every worker run in the (point, stage) order, and every
+ * dependency points to an earlier (point, stage) pair, the execution can never
+ * deadlock. If a stage throws, the remaining stages are abandoned and the
+ * exception is raised by Run once all workers have stopped. Stages that wait
+ * for a long time should poll Stopped to return early.
+ *
+ * The run time of each stage, and the time its worker spent waiting for the
+ * dependencies of the stage, are kept for reporting after the run.
+ */
+class ScanScheduler
+{
+public:
+  static constexpr const char* DeviceName = "ScanScheduler";
+
+  typedef std::function<void( const size_t point )> StageFunction;
+
+  ScanScheduler() : stop( false ), finished( 0 ), walltime( 0 ){}
+
+  /** @brief Dependency on a stage of the point lag points before. */
+  struct Dependency
+  {
+    unsigned stage;
+    unsigned lag;
+  };
+
+  struct StageTiming
+  {
+    std::string  name;
+    std::string  worker;
+    RunningStats run;// In seconds
+    double       wait;// Total time spent waiting for dependencies in seconds
+  };
+
+  /** @brief Adding a stage, returning the stage index used for dependencies. */
+  unsigned
+  AddStage( const std::string&             name,
+            const std::string&             worker,
+            const StageFunction&           f,
+            const std::vector<Dependency>& deps = {} )
+  {
+    for( const auto& d : deps ){
+      if( d.lag == 0 && d.stage >= stages.size() ){
+        throw device_exception( DeviceName,
+                                "Scan stage [" + name
+                                +"] depends on a later stage of the same point" );
+      }
+    }
+    Stage s;
+    s.name   = name;
+    s.worker = worker;
+    s.f      = f;
+    s.deps   = deps;
+    stages.push_back( s );
+    return stages.size()-1;
+  }
+
+  /**
+   * @brief Running all stages for npoints points. The calling thread only
+   * waits for the workers, calling the interrupt function every 0.1 seconds,
+   * which is expected to throw to stop the scan.
+   */
+  void
+  Run( const size_t npoints, const std::function<void()>& interrupt = nullptr )
+  {
+    for( const auto& s : stages ){
+      for( const auto& d : s.deps ){
+        if( d.stage >= stages.size() ){
+          throw device_exception( DeviceName,
+                                  "Scan stage [" + s.name
+                                  +"] depends on an unknown stage" );
+        }
+      }
+    }
+    std::vector<std::string> workers;
+    for( const auto& s : stages ){
+      if( std::find( workers.begin(), workers.end(), s.worker ) == workers.end() ){
+        workers.push_back( s.worker );
+      }
+    }
+
+    done.reset( new std::atomic<size_t>[stages.size()] );
+    for( size_t i = 0; i < stages.size(); ++i ){
+      done[i] = 0;
+    }
+    timing.assign( stages.size(), StageTiming() );
+    for( size_t i = 0; i < stages.size(); ++i ){
+      timing[i].name   = stages[i].name;
+      timing[i].worker = stages[i].worker;
+      timing[i].wait   = 0;
+    }
+    error    = nullptr;
+    stop     = false;
+    finished = 0;
+
+    const auto               start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for( const auto& w : workers ){
+      threads.emplace_back( &ScanScheduler::RunWorker, this, w, npoints );
+    }
+    try {
+      std::unique_lock<std::mutex> lock( mutex );
+      while( finished < workers.size() ){
+        cv.wait_for( lock, std::chrono::milliseconds( 100 ) );
+        if( interrupt && !stop ){
+          lock.unlock();
+          interrupt();
+          lock.lock();
+        }
+      }
+    } catch( ... ){
+      Abort( std::current_exception() );
+    }
+    for( auto& t : threads ){
+      t.join();
+    }
+    walltime = std::chrono::duration<double>(
+      std::chrono::steady_clock::now()-start ).count();
+    if( error ){
+      std::rethrow_exception( error );
+    }
+  }
+
+  /** @brief Whether the scan is being stopped by an error or an interrupt. */
+  bool
+  Stopped() const { return stop; }
+
+  /** @brief Timing of each stage of the last run, in the order of AddStage. */
+  const std::vector<StageTiming>&
+  Timing() const { return timing; }
+
+  /** @brief Total duration of the last run in seconds. */
+  double
+  WallTime() const { return walltime; }
+
+private:
+  struct Stage
+  {
+    std::string             name;
+    std::string             worker;
+    StageFunction           f;
+    std::vector<Dependency> deps;
+  };
+
+  std::vector<Stage>                     stages;
+  std::unique_ptr<std::atomic<size_t>[]> done;// Points completed per stage
+  std::vector<StageTiming>               timing;
+  std::mutex                             mutex;
+  std::condition_variable                cv;
+  std::atomic<bool>                      stop;
+  std::exception_ptr                     error;
+  unsigned                               finished;
+  double                                 walltime;
+
+  bool
+  Ready( const Stage& s, const size_t point ) const
+  {
+    for( const auto& d : s.deps ){
+      if( point >= d.lag && done[d.stage] <= point-d.lag ){ return false; }
+    }
+    return true;
+  }
+
+  void
+  RunWorker( const std::string& worker, const size_t npoints )
+  {
+    typedef std::chrono::steady_clock clock;
+    try {
+      for( size_t p = 0; p < npoints && !stop; ++p ){
+        for( size_t i = 0; i < stages.size() && !stop; ++i ){
+          if( stages[i].worker != worker ){ continue; }
+          const auto t0 = clock::now();
+          {
+            std::unique_lock<std::mutex> lock( mutex );
+            cv.wait( lock, [&](){ return stop || Ready( stages[i], p ); } );
+          }
+          if( stop ){ break; }
+          const auto t1 = clock::now();
+          stages[i].f( p );
+          const auto t2 = clock::now();
+          timing[i].wait += std::chrono::duration<double>( t1-t0 ).count();
+          timing[i].run.Fill( std::chrono::duration<double>( t2-t1 ).count() );
+          {
+            std::lock_guard<std::mutex> lock( mutex );
+            ++done[i];
+          }
+          cv.notify_all();
+        }
+      }
+    } catch( ... ){
+      Abort( std::current_exception() );
+    }
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      ++finished;
+    }
+    cv.notify_all();
+  }
+
+  void
+  Abort( const std::exception_ptr e )
+  {
+    {
+      std::lock_guard<std::mutex> lock( mutex );
+      if( !error ){ error = e; }
+      stop = true;
+    }
+    cv.notify_all();
+  }
+};
+
+#endif
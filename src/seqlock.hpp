@@ -0,0 +1,69 @@
+#ifndef SEQLOCK_HPP
+#define SEQLOCK_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * @brief Single-writer sequence lock for publishing small plain-data
+ * snapshots.
+ *
+ * The writer never blocks, and readers never block the writer: a reader
+ * retries the copy if the writer was updating the data at the same time, so a
+ * reader always obtains a complete and consistent snapshot. The data is stored
+ * as relaxed atomic words such that the concurrent access is well defined.
+ * Only one thread may call Store at any given time.
+ */
+template<typename T>
+class SeqLock
+{
+  static_assert( std::is_trivially_copyable<T>::value,
+                 "SeqLock requires trivially copyable data" );
+
+public:
+  SeqLock( const T& init = T() ) : seq( 0 ){ Store( init ); }
+
+  void
+  Store( const T& value )
+  {
+    uint64_t buffer[nwords] = {0};
+    memcpy( buffer, &value, sizeof( T ) );
+
+    const uint64_t s = seq.load( std::memory_order_relaxed );
+    seq.store( s+1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    for( unsigned i = 0; i < nwords; ++i ){
+      words[i].store( buffer[i], std::memory_order_relaxed );
+    }
+    seq.store( s+2, std::memory_order_release );
+  }
+
+  T
+  Load() const
+  {
+    uint64_t buffer[nwords];
+    uint64_t s0, s1;
+    do {
+      s0 = seq.load( std::memory_order_acquire );
+      for( unsigned i = 0; i < nwords; ++i ){
+        buffer[i] = words[i].load( std::memory_order_relaxed );
+      }
+      std::atomic_thread_fence( std::memory_order_acquire );
+      s1 = seq.load( std::memory_order_relaxed );
+    } while( s0 != s1 || ( s0 & 1 ) );
+
+    T ans;
+    memcpy( &ans, buffer, sizeof( T ) );
+    return ans;
+  }
+
+private:
+  static constexpr unsigned nwords = ( sizeof( T )+7 ) / 8;
+
+  std::atomic<uint64_t> seq;
+  std::atomic<uint64_t> words[nwords];
+};
+
+#endif
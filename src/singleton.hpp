@@ -2,18 +2,40 @@
 #define SINGLETON_HPP
 
 #include <memory>
+#include <mutex>
 
-#define DECLARE_SINGLETON( MYCLASS )                            \
-private:                                                        \
-  static std::unique_ptr<MYCLASS> _instance;                    \
-  MYCLASS();                                                    \
-  MYCLASS( const MYCLASS& )   = delete;                         \
-  MYCLASS( const MYCLASS && ) = delete;                         \
-public:                                                         \
-  ~MYCLASS();                                                   \
-  inline static MYCLASS&       instance(){ return *_instance; } \
-  static constexpr const char* DeviceName = # MYCLASS;          \
-  static int make_instance();                                   \
+/**
+ * @brief Declaring a class as a singleton device.
+ *
+ * In addition to the singleton instance handling, each singleton has an access
+ * mutex, which is held by the python bindings for the duration of each device
+ * call (see devicecall.hpp), such that the device can be safely accessed from
+ * multiple python threads while the GIL is released. The mutex is recursive,
+ * such that device calls nested in python callbacks of the same thread do not
+ * deadlock.
+ *
+ * The DeviceMock<MYCLASS> template is granted access to the device internals,
+ * such that the mock backends of the hardware-free benchmarks (see bench/) can
+ * substitute the hardware handles. It is never specialized in the device
+ * modules themselves.
+ */
+template<typename T>
+struct DeviceMock;
+
+#define DECLARE_SINGLETON( MYCLASS )                                  \
+private:                                                              \
+  friend struct DeviceMock<MYCLASS>;                                  \
+  static std::unique_ptr<MYCLASS> _instance;                          \
+  mutable std::recursive_mutex    _access_mutex;                      \
+  MYCLASS();                                                          \
+  MYCLASS( const MYCLASS& )   = delete;                               \
+  MYCLASS( const MYCLASS && ) = delete;                               \
+public:                                                               \
+  ~MYCLASS();                                                         \
+  inline static MYCLASS&       instance(){ return *_instance; }       \
+  inline std::recursive_mutex& access_mutex() const { return _access_mutex; } \
+  static constexpr const char* DeviceName = # MYCLASS;                \
+  static int make_instance();                                         \
   static void close_instance();
 
 #define IMPLEMENT_SINGLETON( MYCLASS )                   \
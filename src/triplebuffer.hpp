@@ -0,0 +1,63 @@
+#ifndef TRIPLEBUFFER_HPP
+#define TRIPLEBUFFER_HPP
+
+#include <atomic>
+
+/**
+ * @brief Lock-free single-producer/single-consumer triple buffer.
+ *
+ * The producer always has a slot to write into (Back), and publishes it with
+ * Publish, swapping it with the shared middle slot. The consumer takes the
+ * most recently published slot with Update, and reads it in place (Front).
+ * Neither side ever waits for the other: the producer overwrites a published
+ * slot that has not yet been taken by the consumer, so the consumer always
+ * gets the latest slot and intermediate slots are dropped. Only one thread may
+ * produce and only one thread may consume at any given time.
+ */
+template<typename T>
+class TripleBuffer
+{
+public:
+  TripleBuffer() : middle( 1 ), back( 0 ), front( 2 ){}
+
+  /** @brief Slot owned by the producer. */
+  T&
+  Back(){ return slots[back]; }
+
+  /** @brief Publishing the producer slot, getting a new slot to write into. */
+  void
+  Publish()
+  {
+    back = middle.exchange( back | fresh, std::memory_order_acq_rel ) & index;
+  }
+
+  /**
+   * @brief Taking the latest published slot if a new one is available,
+   * returns false if nothing has been published since the last update.
+   */
+  bool
+  Update()
+  {
+    if( !( middle.load( std::memory_order_relaxed ) & fresh ) ){
+      return false;
+    }
+    front = middle.exchange( front, std::memory_order_acq_rel ) & index;
+    return true;
+  }
+
+  /** @brief Slot owned by the consumer. */
+  T&
+  Front(){ return slots[front]; }
+
+private:
+  static constexpr unsigned fresh = 4;
+  static constexpr unsigned index = 3;
+
+  T                     slots[3];
+  std::atomic<unsigned> middle;
+  unsigned              back;
+  char                  pad[64];// Keeping the producer and consumer indices apart
+  unsigned              front;
+};
+
+#endif
@@ -7,16 +7,15 @@
  * @ingroup hardware
  * @brief Visual system interface class
  *
- * As the visual process has a long startup time, a thread will be started
+ * As the visual process has a long startup time, threads will be started
  * whenever a visual system is declared, which will constantly flush the
  * contents of the camera interface to a buffer, process the standardized image
- * processing routine, and store the processed image and extracted variables,
- * and repeat until some termination code is received. This looped thread will
- * be briefly paused when the user request the image, to ensure the integrity
- * of the transferred data. The core of the image processing functions is
- * photo-detector finding: finding the optimal "dark rectangle" within the
- * image, and calculated in the center of this rectangle in terms of pixel
- * coordinates.
+ * processing routine, and publish the processed image and extracted variables,
+ * and repeat until some termination code is received. Requests for the results
+ * or the images never wait on the camera or on the processing routine. The
+ * core of the image processing functions is photo-detector finding: finding
+ * the optimal "dark rectangle" within the image, and calculated in the center
+ * of this rectangle in terms of pixel coordinates.
  *
  * This will be the one interface functions that does not start use a singleton
  * notation, as the system can potentially have more than 1 camera running
@@ -24,24 +23,23 @@
  *
  * ## Visual processing thread management.
  *
- * There are 3 data members in the Visual class used for managing the thread.
- * - std::thread loop_thead: the thread object for handling the loop function
- * - std::atomic<bool> run_loop: the thread-safe flag variable to indicate
- *   whether the loop should continue.
- * - std::mutex loop_mutex: Mutex lock required for data manipulation of the
- *   image containers.
- *
- * The main loop will basically loop over the following:
- * - Check if run_loop is true. Exit the loop if not.
- * - Wait to lock the mutex.
- * - Extract image and perform image processes
- * - unlock the mutex.
- * - Wait a fixed pause period.
- *
- * Under this model, the image extraction functions has windows in which it can
- * choose to lock the mutex while it perform data extraction. The starting and
- * stopping of the loop is also a simple check on the value of the `run_loop`
- * variable.
+ * The camera handling is split into a two-stage pipeline:
+ * - The grabber thread constantly reads frames from the camera into the
+ *   producer slot of a lock-free triple buffer, tagging each frame with a
+ *   sequence number and a capture timestamp.
+ * - The processing thread takes the latest frame from the triple buffer, runs
+ *   the detector finding algorithm, and publishes the results, the raw image,
+ *   and the display image together as a single immutable object via an atomic
+ *   shared pointer swap.
+ *
+ * Frames arriving while the processing thread is busy are dropped, so the
+ * results always reflect the latest frame available. As each result carries
+ * the sequence number and timestamp of its source frame, the user can request
+ * results from a frame captured after some given time (GetVisResultAfter),
+ * rather than pausing for some fixed amount of time to be safe. Both threads
+ * are stopped via the thread-safe `run_loop` flag. The mutex and condition
+ * variable pairs in the class are only used for waking up waiting threads, and
+ * are never held while reading from the camera or processing the image.
  *
  * ## Visual processing algorithm for finding a photo detecting element
  *
@@ -73,12 +71,30 @@
  *
  * Functions should beable to receive a cv::Mat object as the input, to allow
  * for arbitrary levels of debugging and feature demonstration.
+ *
+ * ## Detector tracking
+ *
+ * As the detector typically only moves slightly between frames, when the
+ * `tracking` flag is set the algorithm above is only performed within a region
+ * of interest (ROI) around the detector found in the previous frame (`roi_margin`
+ * times the size of the previous detector). If the detector is not found, the
+ * same frame is searched again with an ROI twice as wide, and if that still
+ * fails, a coarse-to-fine pyramid search is performed: candidates are searched
+ * for in an image down-sampled `pyramid_levels` times, and the full algorithm
+ * is performed on the full resolution image only within the ROIs around the
+ * candidates. If none of the candidates contains a detector, the full frame is
+ * searched, such that tracking never finds fewer detectors than the full
+ * search. The ROIs that have been searched are shown in blue in the display
+ * image. Tracking is off by default.
  */
+#include "latency.hpp"
 #include "logger.hpp"
 #include "visual.hpp"
 #include <fmt/printf.h>
 #include <opencv2/core/utils/logger.hpp>
 
+#include <climits>
+
 // Helper objects for consistant display (format BGR)
 static const cv::Scalar red( 100, 100, 255 );
 static const cv::Scalar cyan( 255, 255, 100 );
@@ -187,78 +203,190 @@ Visual::FrameHeight() const
 
 
 /**
- * @brief The method used for running the loop.
+ * @brief Helper function for the wall-clock time in seconds, matching the
+ * python `time.time()` convention.
+ */
+static double
+timestamp()
+{
+  return std::chrono::duration<double>(
+    std::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+
+/**
+ * @brief The method used for running the frame grabbing loop.
  *
- * The atomic object needs to be passed in as a argument to function properly.
- * In between loop iterations, a fixed 5 millisecond paused is used to ensure
- * that other processes has a chance to extract image and processing results
- * when requested. This pause must be faster than the camera
- * refresh rate to have a real-time like iamge presentation in the GUI program.
+ * Frames are read into the producer slot of the triple buffer and published
+ * as soon as they are available. As the camera buffer holds one frame, a frame
+ * returned by a read may have been exposed before the read call started, so
+ * the capture time of a frame is taken as the time the previous read returned,
+ * which is no later than the actual capture time. If the memory of the
+ * producer slot is still shared with a published result, the slot is released
+ * first such that the camera writes into newly allocated memory instead of
+ * overwriting the published image. If the camera is not available, empty
+ * frames are published at a fixed 5 millisecond interval to keep the
+ * processing results (and their timestamps) updating.
  */
 void
-Visual::RunMainLoop( std::atomic<bool>& run_loop )
+Visual::RunGrabLoop()
 {
-  namespace st = std::chrono;
-  auto get_time = []( void )->size_t {
-                    return st::duration_cast<st::microseconds>(
-                      st::high_resolution_clock::now().time_since_epoch()).count();
-                  };
+  uint64_t seq      = 0;
+  double   previous = timestamp();
   while( run_loop == true ){
-    const size_t time_start = get_time();
-    size_t       time_end   = get_time();
-    loop_mutex.lock();
+    Frame& frame = frames.Back();
+    if( frame.image.u != nullptr && frame.image.u->refcount > 1 ){
+      frame.image.release();
+    }
 
-    do{
-      cam >> image;
-    } while( ( image.empty() || image.cols == 0 ) && cam.isOpened() );
+    if( cam.isOpened() ){
+      LATENCY_SCOPE( "visual.grab" );
+      cam >> frame.image;
+    } else {
+      frame.image.release();
+      std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+    }
+    const double now = timestamp();
+    if( cam.isOpened() && ( frame.image.empty() || frame.image.cols == 0 ) ){
+      previous = now;
+      continue;
+    }
+
+    frame.seq  = ++seq;
+    frame.time = previous;
+    previous   = now;
+    frames.Publish();
+    { std::lock_guard<std::mutex> lock( frame_mutex ); }
+    frame_cv.notify_one();
+  }
+}
 
-    latest = FindDetector( image );
-    loop_mutex.unlock();
 
-    while( time_end-time_start < 5e3 ){
-      std::this_thread::sleep_for( st::milliseconds( 1 ) );
-      time_end = get_time();
+/**
+ * @brief The method used for running the image processing loop.
+ *
+ * The loop waits for a new frame to be published by the grabber thread, runs
+ * the detector finding algorithm on the latest frame (frames that arrive while
+ * processing is on-going are dropped), and publishes the result as a new
+ * immutable object. The publication is a single atomic pointer swap, so
+ * readers never wait on either the camera or the processing routine. The
+ * display image is not rendered here, but only when requested (see
+ * GetDisplay).
+ */
+void
+Visual::RunProcessLoop()
+{
+  while( run_loop == true ){
+    {
+      std::unique_lock<std::mutex> lock( frame_mutex );
+      if( !frame_cv.wait_for( lock, std::chrono::milliseconds( 100 ), [this]{
+          return frames.Update() || run_loop == false;
+        } ) ){
+        continue;
+      }
     }
+    if( run_loop == false ){ break; }
+
+    const Frame& frame = frames.Front();
+    auto         ans   = std::make_shared<Processed>();
+    ans->image = frame.image;
+    {
+      LATENCY_SCOPE( "visual.process" );
+      ans->result = FindDetector( frame.image, track_roi,
+                                  ans->contours, ans->rois );
+    }
+    ans->result.frame_seq  = frame.seq;
+    ans->result.frame_time = frame.time;
+    std::atomic_store( &latest, std::shared_ptr<const Processed>( ans ) );
+
+    { std::lock_guard<std::mutex> lock( result_mutex ); }
+    result_cv.notify_all();
   }
 }
 
 
 /**
- * @brief Starting the loop thread.
+ * @brief Starting the grabber and processing threads.
  */
 void
 Visual::StartLoopThread()
 {
-  run_loop    = true;
-  loop_thread = std::thread( [this]{
-    this->RunMainLoop( std::ref( run_loop ) );
-  } );
+  if( run_loop == true ){ return; }
+  run_loop       = true;
+  grab_thread    = std::thread( [this]{ this->RunGrabLoop(); } );
+  process_thread = std::thread( [this]{ this->RunProcessLoop(); } );
 }
 
 
 /**
- * @brief Setting the loop to stop and waiting for the thread to terminate.
+ * @brief Setting the loops to stop and waiting for the threads to terminate.
  */
 void
 Visual::EndLoopThread()
 {
   if( run_loop == true ){
     run_loop = false;
-    loop_thread.join();
+    { std::lock_guard<std::mutex> lock( frame_mutex ); }
+    frame_cv.notify_all();
+    grab_thread.join();
+    process_thread.join();
   }
 }
 
 
 /**
- * @brief Extraction of the visual processing results.
+ * @brief Atomic copy of the pointer to the latest processing results, nullptr
+ * if no frame has been processed yet.
+ */
+std::shared_ptr<const Visual::Processed>
+Visual::LatestProcessed() const
+{
+  return std::atomic_load( &latest );
+}
+
+
+/**
+ * @brief Extraction of the latest visual processing results.
  */
 Visual::VisResult
 Visual::GetVisResult()
 {
-  loop_mutex.lock();
-  VisResult ans = latest;
-  loop_mutex.unlock();
-  return ans;
+  static const VisResult empty_return =
+    VisResult { -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  const auto ptr = LatestProcessed();
+  return ptr ? ptr->result : empty_return;
+}
+
+
+/**
+ * @brief Extraction of the visual processing results of a frame captured after
+ * the time `t` (in seconds since epoch, as python's `time.time()`).
+ *
+ * This waits for the processing thread to publish such a result, which allows
+ * the caller to request results that are guaranteed to reflect the state of
+ * the system after some action (ex: the gantry settling) instead of pausing for
+ * some fixed amount of time. An exception is raised if no such result is
+ * available within `timeout` seconds.
+ */
+Visual::VisResult
+Visual::GetVisResultAfter( const double t, const double timeout )
+{
+  std::shared_ptr<const Processed> ptr;
+  auto                             fresh = [this, t, &ptr]{
+                                             ptr = LatestProcessed();
+                                             return ptr &&
+                                                    ptr->result.frame_time >= t;
+                                           };
+
+  std::unique_lock<std::mutex> lock( result_mutex );
+  if( !result_cv.wait_for( lock,
+                           std::chrono::duration<double>( timeout ),
+                           fresh ) ){
+    throw device_exception( DeviceName(), fmt::sprintf(
+                              "No frame captured after requested time within %.2lf seconds",
+                              timeout ) );
+  }
+  return ptr->result;
 }
 
 
@@ -266,23 +394,48 @@ Visual::GetVisResult()
  * @brief Extraction of the image, either the raw unprocessed image, or the
  * descriptive image which includes the processed contours.
  *
- * In the rare event that the frame is empty (either because the camera was
- * never properly initialized, or that there was an issue with the image
- * transfer process), a blank (all 0 value image) with the correct dimensions
- * will be returned to ensure that all subsequent functions will function
- * nominally.
+ * The image is taken from the latest published processing results, which are
+ * never modified after being published, so no copy is required. The returned
+ * matrix shares its memory with the published results, and should be treated
+ * as read-only. In the rare
+ * event that the frame is empty (either because the camera was never properly
+ * initialized, or that there was an issue with the image transfer process), a
+ * blank (all 0 value image) with the correct dimensions will be returned to
+ * ensure that all subsequent functions will function nominally.
  */
 cv::Mat
 Visual::GetImage( const bool raw )
 {
   static const cv::Mat blank_frame( cv::Size( FrameWidth(), FrameHeight() ),
                                     CV_8UC3, cv::Scalar( 0, 0, 0 ) );
-  loop_mutex.lock();
-  cv::Mat ans_mat =
-    ( display.empty() ||
-      display.cols == 0 ) ? blank_frame : raw ? image : display;
-  loop_mutex.unlock();
-  return ans_mat;
+  const auto ptr = LatestProcessed();
+  if( !ptr || ptr->image.empty() || ptr->image.cols == 0 ){
+    return blank_frame;
+  }
+  return raw ? ptr->image : GetDisplay( *ptr );
+}
+
+
+/**
+ * @brief Rendering the display image of some processing results on the first
+ * request.
+ *
+ * The display image is only required by the GUI and the monitoring windows,
+ * so rather than rendering it for every frame processed, it is rendered (at
+ * most once per frame) when requested. Concurrent requests for the same frame
+ * wait for the one rendering.
+ */
+const cv::Mat&
+Visual::GetDisplay( const Processed& proc ) const
+{
+  std::call_once( proc.display_flag, [this, &proc]{
+    LATENCY_SCOPE( "visual.render" );
+    proc.display = MakeDisplay( proc.image, proc.contours, proc.result );
+    for( const auto& roi : proc.rois ){
+      cv::rectangle( proc.display, roi, blue, 1 );
+    }
+  } );
+  return proc.display;
 }
 
 
@@ -302,17 +455,30 @@ Visual::SaveImage( const std::string& path, bool raw )
  * @brief Returning the image as a JPEG encoded string.
  *
  * This method is required by the GUI interface to allow for streaming of data
- * via HTTP image requests.
+ * via HTTP image requests. The encoded image is cached with the processing
+ * results, such that multiple clients requesting the same frame share a single
+ * encoding. The returned pointer shares the ownership of the processing results,
+ * so the encoded image can be passed on without being copied.
  */
-std::vector<uchar>
+Visual::ImageBytes
 Visual::GetImageBytes()
 {
-  std::vector<uchar> buf;// Storage required by opencv.
-  const auto         img = GetImage( false );
+  const auto ptr = LatestProcessed();
+  if( ptr && !ptr->image.empty() && ptr->image.cols != 0 ){
+    std::call_once( ptr->jpeg_flag, [this, &ptr]{
+      const cv::Mat& display = GetDisplay( *ptr );
+      LATENCY_SCOPE( "visual.encode" );
+      cv::imencode( ".jpg", display, ptr->jpeg );
+    } );
+    return ImageBytes( ptr, &ptr->jpeg );
+  }
+
+  auto       buf = std::make_shared<std::vector<uchar> >();
+  const auto img = GetImage( false );
   if( img.empty() ){
     throw device_exception( DeviceName(), "Image empty" );
   }
-  cv::imencode( ".jpg", img, buf );
+  cv::imencode( ".jpg", img, *buf );
   return buf;
 }
 
@@ -337,34 +503,117 @@ Visual::InitVarDefault()
   size_cutoff  = 50;
   ratio_cutoff = 1.4;
   poly_range   = 0.08;
+
+  tracking       = false;
+  roi_margin     = 2.0;
+  pyramid_levels = 2;
+  track_roi      = cv::Rect();
 }
 
 
 /**
- * @brief Given image in cv::Mat format. Compute the visual algorithm results
- * and stored in a processed version of the image in the internal buffer.
+ * @brief Helper function for expanding a region of interest about its center
+ * by some factor, clipped to the frame boundaries.
+ */
+static cv::Rect
+expand_roi( const cv::Rect& roi, const double factor, const cv::Size& frame )
+{
+  const double w = roi.width * factor;
+  const double h = roi.height * factor;
+  const cv::Rect ans( roi.x+roi.width / 2.0-w / 2, roi.y+roi.height / 2.0-h / 2,
+                      w, h );
+  return ans & cv::Rect( 0, 0, frame.width, frame.height );
+}
+
+
+/**
+ * @brief Helper function for merging overlapping regions of interest, such that
+ * no part of the image is processed twice.
+ */
+static std::vector<cv::Rect>
+merge_roi( std::vector<cv::Rect> rois )
+{
+  for( unsigned i = 0; i < rois.size(); ++i ){
+    for( unsigned j = i+1; j < rois.size(); ++j ){
+      if( ( rois[i] & rois[j] ).area() > 0 ){
+        rois[i] = rois[i] | rois[j];
+        rois.erase( rois.begin()+j );
+        j = i;// Merged region may overlap with previously checked regions.
+      }
+    }
+  }
+  return rois;
+}
+
+
+/**
+ * @brief Given image in cv::Mat format. Compute the visual algorithm results,
+ * and keep the contours found and the regions searched for rendering the
+ * display image.
  *
  * This handles the main control flow of:
  * - Extracting the image.
+ * - Determining the regions of interest to run the contouring algorithm in (see
+ *   the detector tracking section in the class documentation).
  * - Running the contouring algorithm
  * - Morphing the results into the standard VisResult format.
+ *
+ * The region of interest of the detector found in the previous frame is passed
+ * in as `tracked`, and is updated with the detector found in this frame, such
+ * that the tracking state is owned by the caller (the processing thread for
+ * the live camera).
  */
 Visual::VisResult
-Visual::FindDetector( const cv::Mat& img )
+Visual::FindDetector( const cv::Mat&            img,
+                      cv::Rect&                 tracked,
+                      std::vector<ContourList>& contours,
+                      std::vector<cv::Rect>&    rois ) const
 {
   static const VisResult empty_return =
-    VisResult { -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    VisResult { -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+  contours.clear();
+  rois.clear();
 
   // Early exits if image is not found.
   if( img.empty() || img.cols == 0 ){
+    tracked = cv::Rect();
     return empty_return;
   }
-  const auto  contours = FindContours( img );
-  const auto& hulls    = contours.at( 0 );
-  const auto  ans      = hulls.empty() ? empty_return : MakeResult( img, hulls.at(
-                                                                      0 ) );
-  display = MakeDisplay( img, contours );
-  return ans;
+
+  if( tracking && tracked.area() > 0 ){
+    rois     = { expand_roi( tracked, roi_margin, img.size() ) };
+    contours = FindContours( img, rois );
+    if( contours.at( 0 ).empty() ){// Widening the search if lost.
+      rois     = { expand_roi( tracked, 2 * roi_margin, img.size() ) };
+      contours = FindContours( img, rois );
+    }
+  }
+  if( contours.empty() || contours.at( 0 ).empty() ){
+    rois.clear();
+    if( tracking && pyramid_levels > 0 ){
+      for( const auto& cand : GetPyramidCandidates( img ) ){
+        rois.push_back( expand_roi( cand, roi_margin, img.size() ) );
+      }
+      rois = merge_roi( rois );
+    }
+    if( !rois.empty() ){
+      contours = FindContours( img, rois );
+    }
+    // The coarse candidates are only loosely selected, and the real detector
+    // may be missed, so the full frame is searched if they did not pan out.
+    if( rois.empty() || contours.at( 0 ).empty() ){
+      rois     = { cv::Rect( 0, 0, img.cols, img.rows ) };
+      contours = FindContours( img );
+    }
+  }
+  if( !tracking ){
+    rois.clear();// Only displaying the search regions if tracking
+  }
+
+  const auto& hulls = contours.at( 0 );
+  tracked = hulls.empty() ? cv::Rect() : cv::boundingRect( hulls.at( 0 ) );
+  return hulls.empty() ? empty_return : MakeResult( img, hulls.at( 0 ) );
 }
 
 
@@ -385,7 +634,24 @@ Visual::FindDetector( const cv::Mat& img )
 std::vector<Visual::ContourList>
 Visual::FindContours( const cv::Mat& img ) const
 {
-  const ContourList contours = GetRawContours( img );
+  return FindContours( img, { cv::Rect( 0, 0, img.cols, img.rows ) } );
+}
+
+
+/**
+ * @brief Same as the full-image contour finding, except that the raw contours
+ * are only extracted within the given list of regions of interest. The
+ * returned contours are in the coordinates of the full image.
+ */
+std::vector<Visual::ContourList>
+Visual::FindContours( const cv::Mat&               img,
+                      const std::vector<cv::Rect>& rois ) const
+{
+  ContourList contours;
+  for( const auto& roi : rois ){
+    const ContourList roi_contours = GetRawContours( img, roi );
+    contours.insert( contours.end(), roi_contours.begin(), roi_contours.end() );
+  }
   ContourList       failed_ratio;
   ContourList       failed_lumi;
   ContourList       failed_rect;
@@ -452,7 +718,7 @@ Visual::MakeResult( const cv::Mat& img, const Visual::Contour_t& hull ) const
                     distmax, poly.at( 0 ).x, poly.at( 1 ).x, poly.at( 2 ).x,
                     poly.at( 3 ).x,
                     poly.at( 0 ).y, poly.at( 1 ).y, poly.at( 2 ).y,
-                    poly.at( 3 ).y, };
+                    poly.at( 3 ).y, 0, 0 };
 }
 
 
@@ -467,6 +733,24 @@ Visual::MakeResult( const cv::Mat& img, const Visual::Contour_t& hull ) const
 cv::Mat
 Visual::MakeDisplay( const cv::Mat&                          img,
                      const std::vector<Visual::ContourList>& contlist ) const
+{
+  static const VisResult empty_return =
+    VisResult { -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  return MakeDisplay( img, contlist,
+                      contlist.at( 0 ).empty() ? empty_return :
+                      MakeResult( img, contlist.at( 0 ).at( 0 ) ) );
+}
+
+
+/**
+ * @brief Generating the processed image with the results of the visual
+ * algorithm already computed, such that the measures are not recomputed when
+ * rendering.
+ */
+cv::Mat
+Visual::MakeDisplay( const cv::Mat&                          img,
+                     const std::vector<Visual::ContourList>& contlist,
+                     const VisResult&                        res ) const
 {
   // Drawing variables
   char    msg[1024];
@@ -493,7 +777,6 @@ Visual::MakeDisplay( const cv::Mat&                          img,
   if( contlist.at( 0 ).empty() ){
     PlotText( "NOT FOUND", cv::Point( 20, 20 ), red );
   } else {
-    const auto   res = MakeResult( img, contlist.at( 0 ).at( 0 ) );
     const double x   = res.x;
     const double y   = res.y;
     const double s2  = res.sharpness_m2;
@@ -514,21 +797,93 @@ Visual::MakeDisplay( const cv::Mat&                          img,
  */
 std::vector<Visual::Contour_t>
 Visual::GetRawContours( const cv::Mat& img ) const
+{
+  return GetRawContours( img, cv::Rect( 0, 0, img.cols, img.rows ) );
+}
+
+
+/**
+ * @brief The threshold-and-contour algorithm restricted to a region of interest
+ * of the image.
+ *
+ * Only the region of interest is converted and processed (the crop is a view of
+ * the original image, so no copy is made), and the resulting contours are
+ * shifted back to the coordinates of the full image.
+ */
+std::vector<Visual::Contour_t>
+Visual::GetRawContours( const cv::Mat& img, const cv::Rect& roi ) const
 {
   cv::Mat                gray_img;
   std::vector<cv::Vec4i> hierarchy;
   std::vector<Contour_t> contours;
 
   // Standard image processing.
-  cv::cvtColor( img, gray_img, cv::COLOR_BGR2GRAY );
+  cv::cvtColor( img( roi ), gray_img, cv::COLOR_BGR2GRAY );
   cv::blur( gray_img, gray_img, cv::Size( blur_range, blur_range ) );
   cv::threshold( gray_img, gray_img, threshold, 255, cv::THRESH_BINARY );
   cv::findContours( gray_img, contours, hierarchy, cv::RETR_TREE,
-                    cv::CHAIN_APPROX_SIMPLE, cv::Point( 0, 0 ) );
+                    cv::CHAIN_APPROX_SIMPLE, roi.tl() );
   return contours;
 }
 
 
+/**
+ * @brief Coarse search for detector candidates on a down-sampled image.
+ *
+ * The image is down-sampled `pyramid_levels` times by a factor of 2, and the
+ * threshold-and-contour algorithm is run with the blur range scaled to the
+ * coarse resolution. Only the cheap selection criteria (the size and the ratio
+ * of the bounding box, in full resolution pixels) are applied to the coarse
+ * contours, and the bounding boxes of the largest few candidates are returned
+ * in the coordinates of the full image, for the full selection to be performed
+ * on the full resolution image.
+ */
+std::vector<cv::Rect>
+Visual::GetPyramidCandidates( const cv::Mat& img ) const
+{
+  static constexpr unsigned max_candidates = 4;
+
+  const int scale  = 1 << std::max( pyramid_levels, 0 );
+  cv::Mat   coarse = img;
+  for( int i = 0; i < pyramid_levels; ++i ){
+    cv::Mat next;
+    cv::pyrDown( coarse, next );
+    coarse = next;
+  }
+
+  cv::Mat                gray_img;
+  std::vector<cv::Vec4i> hierarchy;
+  std::vector<Contour_t> contours;
+  const int              coarse_blur = std::max( 1, blur_range / scale );
+  cv::cvtColor( coarse, gray_img, cv::COLOR_BGR2GRAY );
+  cv::blur( gray_img, gray_img, cv::Size( coarse_blur, coarse_blur ) );
+  cv::threshold( gray_img, gray_img, threshold, 255, cv::THRESH_BINARY );
+  cv::findContours( gray_img, contours, hierarchy, cv::RETR_TREE,
+                    cv::CHAIN_APPROX_SIMPLE, cv::Point( 0, 0 ) );
+
+  std::vector<cv::Rect> ans;
+  for( const auto& cont : contours ){
+    if( GetContourSize( cont ) * scale < size_cutoff ){
+      continue;
+    }
+    const cv::Rect bound = cv::boundingRect( cont );
+    const double   ratio = (double)bound.height / (double)bound.width;
+    if( ratio > ratio_cutoff || ratio < 1. / ratio_cutoff ){
+      continue;
+    }
+    ans.push_back( cv::Rect( bound.x * scale, bound.y * scale,
+                             bound.width * scale, bound.height * scale ) );
+  }
+  std::sort( ans.begin(), ans.end(), []( const cv::Rect& x, const cv::Rect& y ){
+    return x.area() > y.area();
+  } );
+  if( ans.size() > max_candidates ){
+    ans.resize( max_candidates );
+  }
+  return ans;
+}
+
+
 /**
  * @brief Given the the original image and a contour of interest, computed the
  * luminosity of the internal area.
@@ -539,11 +894,26 @@ Visual::GetRawContours( const cv::Mat& img ) const
 double
 Visual::GetImageLumi( const cv::Mat& img, const Contour_t& cont ) const
 {
-  // Expecting the internals of the photosensor to be dark.
+  // Expecting the internals of the photosensor to be dark. Only the bounding
+  // rectangle of the contour is masked and averaged over, with the storage of
+  // the mask being reused across calls.
+  thread_local cv::Mat scratch;
+  const cv::Rect       br = cv::boundingRect( cont )
+                            & cv::Rect( 0, 0, img.cols, img.rows );
+  if( br.area() <= 0 ){
+    return 0;
+  }
+  if( scratch.cols < br.width || scratch.rows < br.height ){
+    scratch.create( std::max( scratch.rows, br.height ),
+                    std::max( scratch.cols, br.width ), CV_8UC1 );
+  }
+  cv::Mat mask = scratch( cv::Rect( 0, 0, br.width, br.height ) );
+  mask = 0;
+
   const std::vector<Contour_t> v_cont = { cont };
-  cv::Mat                      mask   = cv::Mat::zeros( img.size(), CV_8UC1 );
-  cv::drawContours( mask, v_cont, 0, 255, cv::FILLED );
-  const cv::Scalar meancol = cv::mean( img, mask );
+  cv::drawContours( mask, v_cont, 0, 255, cv::FILLED, cv::LINE_8,
+                    cv::noArray(), INT_MAX, cv::Point( -br.x, -br.y ) );
+  const cv::Scalar meancol = cv::mean( img( br ), mask );
   return 0.2126 * meancol[0]+0.7152 * meancol[1]+0.0722 * meancol[2];
 }
 
@@ -599,18 +969,42 @@ Visual::GetContourSize( const Contour_t& x ) const
 
 /**
  * @brief Getting the maximum distance of two points within a contour.
+ *
+ * The maximum distance is always found between two vertices of the convex hull
+ * of the contour, so this is computed with the rotating calipers method on the
+ * convex hull: for each edge of the hull, the vertex furthest from the edge is
+ * tracked by advancing a second pointer around the hull, so only the O(n)
+ * antipodal pairs are checked instead of all pairs of points.
  */
 double
 Visual::GetContourMaxMeasure( const Contour_t& x ) const
 {
-  // Maximum distance in contour
-  double ans = 0;
-  for( const auto& p1 : x ){
-    for( const auto& p2 : x ){
-      ans = std::max( ans, cv::norm( p2-p1 ) );
+  const Contour_t hull = GetConvexHull( x );
+  const size_t    n    = hull.size();
+  auto            dist2 = [&hull]( const size_t i, const size_t j )->int64_t {
+                            const int64_t dx = hull[i].x-hull[j].x;
+                            const int64_t dy = hull[i].y-hull[j].y;
+                            return dx * dx+dy * dy;
+                          };
+  auto area = [&hull]( const size_t i, const size_t j, const size_t k )->int64_t {
+                const int64_t a = (int64_t)( hull[j].x-hull[i].x ) * ( hull[k].y-hull[i].y )
+                                  -(int64_t)( hull[j].y-hull[i].y ) * ( hull[k].x-hull[i].x );
+                return a < 0 ? -a : a;
+              };
+
+  if( n < 2 ){ return 0; }
+  if( n == 2 ){ return std::sqrt( (double)dist2( 0, 1 ) ); }
+
+  int64_t ans = 0;
+  size_t  j   = 1;
+  for( size_t i = 0; i < n; ++i ){
+    const size_t ni = ( i+1 ) % n;
+    while( area( i, ni, ( j+1 ) % n ) > area( i, ni, j ) ){
+      j = ( j+1 ) % n;
     }
+    ans = std::max( ans, std::max( dist2( i, j ), dist2( ni, j ) ) );
   }
-  return ans;
+  return std::sqrt( (double)ans );
 }
 
 
@@ -622,49 +1016,53 @@ Visual::GetContourMaxMeasure( const Contour_t& x ) const
  * small blur, then compute the laplace transformed image. Then taking the
  * standard deviation (2nd order variance) and Kurtosis measure (4th order
  * variance) of the transformed image.
+ *
+ * Only the region of interest is converted to gray scale. As the Laplacian of
+ * an 8-bit image with integer kernel coefficients is always an integer well
+ * within the exact range of single precision floats, the Laplacian is
+ * computed as a float image with no loss of precision, and the moments are
+ * computed from the raw sums (accumulated in double precision) in a single
+ * pass over the image.
  */
 std::pair<double, double>
 Visual::sharpness( const cv::Mat& img, const cv::Rect& crop ) const
 {
   // Image containers
-  cv::Mat cimg[3], bimg, fimg, lap;
-
-  // Variable containers
-  cv::Scalar mu, sigma;
+  cv::Mat bimg, lap;
 
-  // Convert original image to gray scale
-  cv::cvtColor( img, bimg, cv::COLOR_BGR2GRAY );
-
-  // Getting green channel image image converting to gray scale
-  // cv::split( img, // cimg );
-  // cimg[1].convertTo( fimg, CV_32FC1 );
-  // Creating the crops
   if( crop.width == 0 || crop.height == 0 ){
     return std::pair<double, double>( 0, 0 );
   }
 
-  // Cropping to range sometimes is bad... not sure why just yet
-  try {bimg = bimg( crop ).clone();
-  } catch( cv::Exception& e ){
+  // Regions of interest extending beyond the image are rejected
+  if( ( crop & cv::Rect( 0, 0, img.cols, img.rows ) ) != crop ){
     return std::pair<double, double>( 0, 0 );
   }
+
+  // Converting the cropped image to gray scale
+  cv::cvtColor( img( crop ), bimg, cv::COLOR_BGR2GRAY );
   cv::blur( bimg, bimg, cv::Size( 2, 2 ) );
 
   // Calculating lagrangian
-  cv::Laplacian( bimg, lap, CV_64F, 5 );
+  cv::Laplacian( bimg, lap, CV_32F, 5 );
 
-  // Calculating the 2nd and 4th moment
-  mu = cv::mean( lap );
-  double mo2 = 0, mo4 = 0;
+  // Calculating the 2nd and 4th moment from the raw sums
+  double s1 = 0, s2 = 0, s3 = 0, s4 = 0;
   for( int r = 0; r < lap.rows; ++r ){
+    const float* row = lap.ptr<float>( r );
     for( int c = 0; c < lap.cols; ++c ){
-      const double val  = lap.at<double>( r, c );
-      const double diff = val-mu.val[0];
-      mo2 += diff * diff;
-      mo4 += diff * diff * diff * diff;
+      const double val  = row[c];
+      const double val2 = val * val;
+      s1 += val;
+      s2 += val2;
+      s3 += val2 * val;
+      s4 += val2 * val2;
     }
   }
-  mo2 /= lap.rows * lap.cols;
-  mo4 /= lap.rows * lap.cols;
+  const double n   = lap.rows * lap.cols;
+  const double mu  = s1 / n;
+  const double mo2 = s2 / n-mu * mu;
+  const double mo4 = s4 / n-4 * mu * s3 / n+6 * mu * mu * s2 / n
+                     -3 * mu * mu * mu * mu;
   return std::pair<double, double>( mo4 / ( mo2 * mo2 ), mo2 );
 }
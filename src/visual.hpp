@@ -5,8 +5,12 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
 
+#include "triplebuffer.hpp"
+
 #include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <thread>
 
 class Visual
@@ -36,14 +40,19 @@ public:
                      int poly_y2;
                      int poly_y3;
                      int poly_y4;
+                     uint64_t frame_seq;// Sequence number of the source frame
+                     double frame_time;// Capture time of the source frame
   };
 
-  unsigned           FrameWidth() const;
-  unsigned           FrameHeight() const;
-  VisResult          GetVisResult();
-  cv::Mat            GetImage( const bool );
-  bool               SaveImage( const std::string&, const bool raw );
-  std::vector<uchar> GetImageBytes();
+  typedef std::shared_ptr<const std::vector<uchar> > ImageBytes;
+
+  unsigned   FrameWidth() const;
+  unsigned   FrameHeight() const;
+  VisResult  GetVisResult();
+  VisResult  GetVisResultAfter( const double, const double );
+  cv::Mat    GetImage( const bool );
+  bool       SaveImage( const std::string&, const bool raw );
+  ImageBytes GetImageBytes();
 
   // Imaging finding parameters
   int    blur_range;
@@ -53,39 +62,87 @@ public:
   double ratio_cutoff;
   double poly_range;
 
+  // Detector tracking parameters
+  bool   tracking;
+  double roi_margin;
+  int    pyramid_levels;
+
   // Making the image processing function public to allow for debugging images
   // to be passed through
   std::vector<ContourList> FindContours( const cv::Mat& ) const;
+  std::vector<ContourList> FindContours( const cv::Mat&,
+                                         const std::vector<cv::Rect>& ) const;
   VisResult                MakeResult( const cv::Mat&, const Contour_t& ) const;
   cv::Mat                  MakeDisplay( const cv::Mat&,
                                         const std::vector<ContourList>& ) const;
+  cv::Mat                  MakeDisplay( const cv::Mat&,
+                                        const std::vector<ContourList>&,
+                                        const VisResult& ) const;
+  VisResult                FindDetector( const cv::Mat&,
+                                         cv::Rect&,
+                                         std::vector<ContourList>&,
+                                         std::vector<cv::Rect>& ) const;
 
   std::string DeviceName() const;
 
 private:
   cv::VideoCapture cam;
-  cv::Mat          image;
-  cv::Mat          display;
-  VisResult        latest;
+
+  // Raw frame as passed from the grabber thread to the processing thread.
+  struct Frame
+  {
+    cv::Mat  image;
+    uint64_t seq;
+    double   time;
+  };
+
+  // Processing results, published as a whole and never modified afterwards,
+  // except for the display image and its JPEG encoding, which are rendered
+  // once on the first request.
+  struct Processed
+  {
+    VisResult                  result;
+    cv::Mat                    image;
+    std::vector<ContourList>   contours;
+    std::vector<cv::Rect>      rois;
+    mutable std::once_flag     display_flag;
+    mutable cv::Mat            display;
+    mutable std::once_flag     jpeg_flag;
+    mutable std::vector<uchar> jpeg;
+  };
+
+  TripleBuffer<Frame>              frames;
+  std::shared_ptr<const Processed> latest;
 
   // Variables for storing the thread handling
-  std::thread       loop_thread;
-  std::atomic<bool> run_loop;
-  std::mutex        loop_mutex;
+  std::thread             grab_thread;
+  std::thread             process_thread;
+  std::atomic<bool>       run_loop;
+  std::mutex              frame_mutex;// Only used for waking up the threads
+  std::condition_variable frame_cv;
+  std::mutex              result_mutex;
+  std::condition_variable result_cv;
 
   // Function for thread handling;
   void StartLoopThread();
   void EndLoopThread();
-  void RunMainLoop( std::atomic<bool>& );
+  void RunGrabLoop();
+  void RunProcessLoop();
+
+  std::shared_ptr<const Processed> LatestProcessed() const;
+  const cv::Mat&                   GetDisplay( const Processed& ) const;
 
   // Helper function for
   void InitVarDefault();
 
-  // Image processing function
-  VisResult FindDetector( const cv::Mat& );
+  // Region of interest of the latest detector found, only to be used by the
+  // processing thread.
+  cv::Rect track_roi;
 
 public:
   ContourList GetRawContours( const cv::Mat& ) const;
+  ContourList GetRawContours( const cv::Mat&, const cv::Rect& ) const;
+  std::vector<cv::Rect> GetPyramidCandidates( const cv::Mat& ) const;
   Contour_t   GetConvexHull( const Contour_t& ) const;
   Contour_t   GetPolyApprox( const Contour_t& ) const;
   double      GetImageLumi( const cv::Mat&,
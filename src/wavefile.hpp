@@ -0,0 +1,241 @@
+#ifndef WAVEFILE_HPP
+#define WAVEFILE_HPP
+
+#include "logger.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * @defgroup wavefile Binary waveform files
+ * @ingroup hardware
+ * @brief Compact binary storage for raw waveforms of the scope-like readouts.
+ *
+ * A file consists of a single fixed-size 64 byte header, followed by an
+ * arbitrary number of fixed-size frames, each frame being `nsamples` signed 16
+ * bit integers (native byte order, little-endian on all systems used by the
+ * calibration stand). The voltage in mV of an ADC value is `adc * adcscale`,
+ * and the spacing between samples in nanoseconds is `timeinterval`. As the
+ * frames are fixed size, the number of frames can be deduced from the file
+ * size, which allows the python reader (cmod/wavefile.py) to memory map the
+ * file directly as a 2D array.
+ *
+ * The writer keeps a single preallocated frame buffer, frames are either
+ * converted directly into this buffer (NextFrame/CommitFrame), or written in a
+ * single `writev` call directly from the acquisition buffers (WriteFrames).
+ * @{
+ */
+struct WaveFileHeader
+{
+  char     magic[8];// Always "SIPMWAVE"
+  uint32_t version;
+  uint32_t channel;
+  uint32_t nsamples;// Number of int16 samples per frame
+  uint32_t reserved;
+  double   timeinterval;// In units of ns
+  double   adcscale;// In units of mV per ADC count
+  char     padding[24];
+};
+
+static_assert( sizeof( WaveFileHeader ) == 64,
+               "Binary waveform header must be 64 bytes" );
+
+class WaveFileWriter
+{
+public:
+  WaveFileWriter() : fd( -1 ), nsamples( 0 ), fill( 0 ), nframes( 0 ){}
+  ~WaveFileWriter()
+  {
+    try {
+      Close();
+    } catch( std::exception& e ){}
+  }
+
+  /**
+   * @brief Opening a file for writing. If the file already contains data,
+   * new frames will be appended, provided that the existing header is identical
+   * and the file holds a whole number of frames.
+   */
+  void
+  Open( const std::string& path,
+        const unsigned     channel,
+        const unsigned     samples,
+        const double       timeinterval,
+        const double       adcscale,
+        const unsigned     bufferframes = 256 )
+  {
+    Close();
+    WaveFileHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, "SIPMWAVE", 8 );
+    header.version      = 1;
+    header.channel      = channel;
+    header.nsamples     = samples;
+    header.timeinterval = timeinterval;
+    header.adcscale     = adcscale;
+
+    fd = open( path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644 );
+    if( fd < 0 ){
+      throw device_exception( DeviceName,
+                              "Failed to open waveform file ["+path+"]" );
+    }
+    struct stat st;
+    fstat( fd, &st );
+    if( st.st_size == 0 ){
+      if( write( fd, &header, sizeof( header ) ) != sizeof( header ) ){
+        Close();
+        throw device_exception( DeviceName, "Failed to write waveform header" );
+      }
+    } else {
+      // Appending is only allowed to a file with the identical header (version,
+      // channel and scales included) and a whole number of frames, otherwise
+      // the frames would be misread.
+      const off_t    framesize = (off_t)samples * sizeof( int16_t );
+      const off_t    data      = st.st_size-(off_t)sizeof( header );
+      WaveFileHeader existing;
+      if( pread( fd, &existing, sizeof( existing ), 0 ) != sizeof( existing )
+          || memcmp( &existing, &header, sizeof( header ) ) != 0
+          || ( framesize > 0 ? data % framesize != 0 : data != 0 ) ){
+        Close();
+        throw device_exception( DeviceName,
+                                "Existing file ["+path+
+                                "] is not a compatible waveform file" );
+      }
+    }
+    nsamples = samples;
+    fill     = 0;
+    nframes  = 0;
+    buffer.assign( (size_t)nsamples * std::max( 1u, bufferframes ), 0 );
+  }
+
+  /** @brief Flushing the remaining frames and closing the file. */
+  void
+  Close()
+  {
+    if( fd >= 0 ){
+      const int f = fd;
+      try {
+        Flush();
+      } catch( std::exception& e ){
+        close( f );
+        fd = -1;
+        throw;
+      }
+      close( f );
+      fd = -1;
+    }
+  }
+
+  bool
+  IsOpen() const { return fd >= 0; }
+
+  uint64_t
+  Frames() const { return nframes; }
+
+  unsigned
+  Samples() const { return nsamples; }
+
+  /**
+   * @brief Getting the next frame in the internal buffer to fill in place.
+   * The frame is only stored once CommitFrame is called.
+   */
+  int16_t*
+  NextFrame()
+  {
+    CheckOpen();
+    if( fill+nsamples > buffer.size() ){
+      Flush();
+    }
+    return buffer.data()+fill;
+  }
+
+  void
+  CommitFrame()
+  {
+    fill += nsamples;
+    ++nframes;
+  }
+
+  /**
+   * @brief Writing n frames directly from external buffers, one iovec per
+   * frame, without copying into the internal buffer.
+   */
+  void
+  WriteFrames( const int16_t* const* frames, const unsigned n )
+  {
+    CheckOpen();
+    Flush();
+    std::vector<struct iovec> iov( std::min( n, (unsigned)IOV_MAX ) );
+    for( unsigned start = 0; start < n; start += iov.size() ){
+      const unsigned count = std::min( (unsigned)iov.size(), n-start );
+      for( unsigned i = 0; i < count; ++i ){
+        iov[i].iov_base = const_cast<int16_t*>( frames[start+i] );
+        iov[i].iov_len  = nsamples * sizeof( int16_t );
+      }
+      WriteAll( iov.data(), count );
+    }
+    nframes += n;
+  }
+
+  /** @brief Writing the buffered frames to disk. */
+  void
+  Flush()
+  {
+    if( fd < 0 || fill == 0 ){ return; }
+    struct iovec iov = { buffer.data(), fill * sizeof( int16_t ) };
+    fill = 0;
+    WriteAll( &iov, 1 );
+  }
+
+private:
+  static constexpr const char* DeviceName = "WaveFile";
+
+  int                  fd;
+  unsigned             nsamples;
+  size_t               fill;
+  uint64_t             nframes;
+  std::vector<int16_t> buffer;
+
+  void
+  CheckOpen() const
+  {
+    if( fd < 0 ){
+      throw device_exception( DeviceName, "Waveform file is not opened" );
+    }
+  }
+
+  // Handling partial writes of writev.
+  void
+  WriteAll( struct iovec* iov, int count )
+  {
+    while( count > 0 ){
+      ssize_t written = writev( fd, iov, count );
+      if( written < 0 ){
+        throw device_exception( DeviceName, "Failed to write waveform frames" );
+      }
+      while( count > 0 && (size_t)written >= iov->iov_len ){
+        written -= iov->iov_len;
+        ++iov;
+        --count;
+      }
+      if( count > 0 ){
+        iov->iov_base = (char*)iov->iov_base+written;
+        iov->iov_len -= written;
+      }
+    }
+  }
+};
+
+/** @} */
+
+#endif
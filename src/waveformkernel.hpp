@@ -0,0 +1,252 @@
+#ifndef WAVEFORMKERNEL_HPP
+#define WAVEFORMKERNEL_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+/**
+ * @defgroup waveformkernel Waveform reduction kernels
+ * @ingroup hardware
+ * @brief Header-only reduction kernels shared by the DRS4 and picoscope
+ * readout.
+ *
+ * The kernels are templated over the sample type (float for the DRS4 calibrated
+ * waveforms, int16_t for the raw picoscope ADC values), and compute the
+ * pedestal mean, the pedestal subtracted window integral, and the peak values
+ * and positions in the integration window in a single pass over the samples.
+ *
+ * The inner loops are written over a fixed number of independent accumulator
+ * lanes with branch-free updates, so that the compiler can map each lane onto a
+ * SIMD register element without requiring non-standard floating point
+ * reassociation flags (which would otherwise block the vectorization of a
+ * simple running sum). Sums of int16_t samples are accumulated exactly in 64
+ * bit integers, sums of float samples are accumulated in double, matching the
+ * precision of the original scalar loops.
+ *
+ * All results are in the raw units of the sample, conversion to physical units
+ * is left to the device classes.
+ * @{
+ */
+
+/** @brief Accumulator type used for summing samples of type T. */
+template<typename T>
+struct WaveformAccumulator { typedef double type; };
+
+template<>
+struct WaveformAccumulator<int16_t> { typedef int64_t type; };
+
+/**
+ * @brief Sample index windows for a waveform reduction, the stop indices are
+ * exclusive. Setting the pedestal start and stop to the same value disables
+ * the pedestal subtraction. Windows are clipped to the waveform length.
+ */
+struct WaveformWindow
+{
+  unsigned intstart;
+  unsigned intstop;
+  unsigned pedstart;
+  unsigned pedstop;
+};
+
+/**
+ * @brief Results of a single waveform reduction. Peak values and positions are
+ * only evaluated in the integration window, with the positions being sample
+ * indices relative to the start of the waveform (first occurrence for ties).
+ */
+template<typename T>
+struct WaveformReduction
+{
+  double   pedestal;// Mean sample value in the pedestal window
+  double   integral;// Sum of pedestal subtracted samples in the window
+  T        minimum;
+  T        maximum;
+  unsigned minindex;
+  unsigned maxindex;
+};
+
+static constexpr unsigned waveform_lanes = 8;
+
+/** @brief Plain sum of samples in [start, stop). */
+template<typename T>
+inline typename WaveformAccumulator<T>::type
+WaveformKernelSum( const T* w, const unsigned start, const unsigned stop )
+{
+  typedef typename WaveformAccumulator<T>::type acc_t;
+  acc_t    acc[waveform_lanes] = {0};
+  unsigned i                   = start;
+  for( ; i+waveform_lanes <= stop; i += waveform_lanes ){
+    for( unsigned j = 0; j < waveform_lanes; ++j ){
+      acc[j] += w[i+j];
+    }
+  }
+  acc_t ans = 0;
+  for( unsigned j = 0; j < waveform_lanes; ++j ){
+    ans += acc[j];
+  }
+  for( ; i < stop; ++i ){
+    ans += w[i];
+  }
+  return ans;
+}
+
+
+/**
+ * @brief Sum of (w[i]-offset) * weight[(i+rotation) % nweights] over [start,
+ * stop), splitting the rotated weight array into contiguous segments so that
+ * the inner loop has no modulo operation. Used for the DRS4 time weighted
+ * integration where the weight is the width of the domino cell.
+ */
+template<typename T>
+inline double
+WaveformKernelWeightedSum( const T*       w,
+                           const float*   weight,
+                           const unsigned nweights,
+                           const unsigned rotation,
+                           const double   offset,
+                           const unsigned start,
+                           const unsigned stop )
+{
+  double   ans = 0;
+  unsigned i   = start;
+  while( i < stop ){
+    const unsigned cell   = ( i+rotation ) % nweights;
+    const unsigned seglen = std::min( stop-i, nweights-cell );
+    const T*       wseg   = w+i;
+    const float*   weg    = weight+cell;
+    double         acc[waveform_lanes] = {0};
+    unsigned       k                   = 0;
+    for( ; k+waveform_lanes <= seglen; k += waveform_lanes ){
+      for( unsigned j = 0; j < waveform_lanes; ++j ){
+        acc[j] += ( wseg[k+j]-offset ) * weg[k+j];
+      }
+    }
+    for( ; k < seglen; ++k ){
+      ans += ( wseg[k]-offset ) * weg[k];
+    }
+    for( unsigned j = 0; j < waveform_lanes; ++j ){
+      ans += acc[j];
+    }
+    i += seglen;
+  }
+  return ans;
+}
+
+
+/** @brief Mean sample value in [start, stop), 0 for an empty window. */
+template<typename T>
+inline double
+WaveformKernelPedestal( const T* w, const unsigned start, const unsigned stop )
+{
+  return stop > start ?
+         (double)WaveformKernelSum( w, start, stop ) / ( stop-start ) :
+         0.0;
+}
+
+
+/**
+ * @brief Single pass reduction of a waveform of a given length: the pedestal
+ * mean, the pedestal subtracted integral, and the peak values and positions in
+ * the integration window.
+ */
+template<typename T>
+inline WaveformReduction<T>
+WaveformKernelReduce( const T*              w,
+                      const unsigned        length,
+                      const WaveformWindow& window )
+{
+  typedef typename WaveformAccumulator<T>::type acc_t;
+  WaveformReduction<T>                          ans;
+
+  ans.pedestal = 0;
+  if( window.pedstart != window.pedstop ){
+    ans.pedestal = WaveformKernelPedestal( w,
+                                           window.pedstart,
+                                           std::min( length, window.pedstop ) );
+  }
+
+  const unsigned start = std::min( length, window.intstart );
+  const unsigned stop  = std::max( start, std::min( length, window.intstop ) );
+
+  acc_t    acc[waveform_lanes] = {0};
+  T        mn[waveform_lanes];
+  T        mx[waveform_lanes];
+  unsigned mnidx[waveform_lanes];
+  unsigned mxidx[waveform_lanes];
+  for( unsigned j = 0; j < waveform_lanes; ++j ){
+    mn[j]    = std::numeric_limits<T>::max();
+    mx[j]    = std::numeric_limits<T>::lowest();
+    mnidx[j] = start;
+    mxidx[j] = start;
+  }
+
+  unsigned i = start;
+  for( ; i+waveform_lanes <= stop; i += waveform_lanes ){
+    for( unsigned j = 0; j < waveform_lanes; ++j ){
+      const T x = w[i+j];
+      acc[j]  += x;
+      mnidx[j] = x < mn[j] ? i+j : mnidx[j];
+      mn[j]    = x < mn[j] ? x : mn[j];
+      mxidx[j] = x > mx[j] ? i+j : mxidx[j];
+      mx[j]    = x > mx[j] ? x : mx[j];
+    }
+  }
+
+  // Merging the lanes, keeping the earliest index for tied values.
+  acc_t sum = 0;
+  ans.minimum  = std::numeric_limits<T>::max();
+  ans.maximum  = std::numeric_limits<T>::lowest();
+  ans.minindex = start;
+  ans.maxindex = start;
+  for( unsigned j = 0; j < waveform_lanes; ++j ){
+    sum += acc[j];
+    if( mn[j] < ans.minimum
+        || ( mn[j] == ans.minimum && mnidx[j] < ans.minindex ) ){
+      ans.minimum  = mn[j];
+      ans.minindex = mnidx[j];
+    }
+    if( mx[j] > ans.maximum
+        || ( mx[j] == ans.maximum && mxidx[j] < ans.maxindex ) ){
+      ans.maximum  = mx[j];
+      ans.maxindex = mxidx[j];
+    }
+  }
+  for( ; i < stop; ++i ){
+    const T x = w[i];
+    sum += x;
+    if( x < ans.minimum ){
+      ans.minimum  = x;
+      ans.minindex = i;
+    }
+    if( x > ans.maximum ){
+      ans.maximum  = x;
+      ans.maxindex = i;
+    }
+  }
+
+  ans.integral = (double)sum-ans.pedestal * ( stop-start );
+  return ans;
+}
+
+
+/**
+ * @brief Batched reduction over n waveforms of the same length (such as all
+ * captures of a picoscope rapid block), with the same windows applied to all
+ * waveforms. The results are written to the n-element output array.
+ */
+template<typename T>
+inline void
+WaveformKernelReduceBlock( const T* const*       waveforms,
+                           const unsigned        n,
+                           const unsigned        length,
+                           const WaveformWindow& window,
+                           WaveformReduction<T>* out )
+{
+  for( unsigned k = 0; k < n; ++k ){
+    out[k] = WaveformKernelReduce( waveforms[k], length, window );
+  }
+}
+
+/** @} */
+
+#endif